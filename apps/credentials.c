@@ -43,6 +43,19 @@
 #define OPT_STR_TLSCABUNDLE "tlsCaBundle"
 #define OPT_STR_TLSCAKEYCHAIN "tlsCaMacOSKeyChainRef"
 #define OPT_STR_TOTPSEEDFILE "totpSeedFile"
+#define OPT_STR_THREADSTESTID "threadsTestSessions"
+#define OPT_STR_THREADSVSID "threadsVectorSets"
+#define OPT_STR_HTTPACCEPTCOMPRESSION "httpAcceptCompression"
+#define OPT_STR_HTTPCOMPRESSREQUESTS "httpCompressRequests"
+#define OPT_STR_DATASTORECOMPRESSION "datastoreCompression"
+#define OPT_STR_DATASTORELOG "datastoreLog"
+#define OPT_STR_DATASTORESYNC "datastoreSync"
+#define OPT_STR_DATASTORESYNCINTERVAL "datastoreSyncInterval"
+#define OPT_STR_HTTPVERSION2 "httpVersion2"
+#define OPT_STR_HTTPRATELIMIT "httpRateLimit"
+#define OPT_STR_HTTPRATESTART "httpRateStart"
+#define OPT_STR_HTTPRATEMIN "httpRateMin"
+#define OPT_STR_HTTPRATEMAX "httpRateMax"
 
 /*
  * Pointer to parsed options. This pointer is only to be used by the async
@@ -94,6 +107,22 @@ static int json_get_uint64(struct json_object *obj, const char *name,
 	return 0;
 }
 
+static int json_get_bool(struct json_object *obj, const char *name, bool *val)
+{
+	struct json_object *o = NULL;
+	int ret = json_find_key(obj, name, &o, json_type_boolean);
+
+	if (ret)
+		return ret;
+
+	*val = !!json_object_get_boolean(o);
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY, "Found boolean %s with value %u\n",
+	       name, *val);
+
+	return 0;
+}
+
 static int json_get_string(struct json_object *obj, const char *name,
 			   const char **outbuf, bool nodebug)
 {
@@ -138,6 +167,7 @@ static int read_complete(int fd, char *buf, uint32_t buflen)
 int load_config(struct opt_cred *cred)
 {
 	struct flock lock;
+	uint64_t val;
 	int ret;
 	int fd;
 
@@ -213,6 +243,49 @@ int load_config(struct opt_cred *cred)
 	CKINT(json_get_string(cred->config, OPT_STR_TOTPSEEDFILE,
 			      &cred->seedfile, false));
 
+	/* Allow the thread limits to be absent */
+	cred->threads_testid = 0;
+	if (!json_get_uint64(cred->config, OPT_STR_THREADSTESTID, &val))
+		cred->threads_testid = (uint32_t)val;
+	cred->threads_vsid = 0;
+	if (!json_get_uint64(cred->config, OPT_STR_THREADSVSID, &val))
+		cred->threads_vsid = (uint32_t)val;
+
+	/* Compressed responses are accepted unless disabled */
+	cred->http_accept_compression = true;
+	json_get_bool(cred->config, OPT_STR_HTTPACCEPTCOMPRESSION,
+		      &cred->http_accept_compression);
+	cred->http_compress_requests = false;
+	json_get_bool(cred->config, OPT_STR_HTTPCOMPRESSREQUESTS,
+		      &cred->http_compress_requests);
+	cred->http_version2 = false;
+	json_get_bool(cred->config, OPT_STR_HTTPVERSION2, &cred->http_version2);
+
+	/* The request rate is limited with the default rates unless changed */
+	cred->http_rate_limit = true;
+	json_get_bool(cred->config, OPT_STR_HTTPRATELIMIT,
+		      &cred->http_rate_limit);
+	cred->http_rate_start = ACVP_NET_RATE_START;
+	if (!json_get_uint64(cred->config, OPT_STR_HTTPRATESTART, &val))
+		cred->http_rate_start = (uint32_t)val;
+	cred->http_rate_min = ACVP_NET_RATE_MIN;
+	if (!json_get_uint64(cred->config, OPT_STR_HTTPRATEMIN, &val))
+		cred->http_rate_min = (uint32_t)val;
+	cred->http_rate_max = ACVP_NET_RATE_MAX;
+	if (!json_get_uint64(cred->config, OPT_STR_HTTPRATEMAX, &val))
+		cred->http_rate_max = (uint32_t)val;
+
+	cred->datastore_compression = false;
+	json_get_bool(cred->config, OPT_STR_DATASTORECOMPRESSION,
+		      &cred->datastore_compression);
+	cred->datastore_log = false;
+	json_get_bool(cred->config, OPT_STR_DATASTORELOG, &cred->datastore_log);
+	cred->datastore_sync = true;
+	json_get_bool(cred->config, OPT_STR_DATASTORESYNC, &cred->datastore_sync);
+	cred->datastore_sync_interval = ACVP_DATASTORE_SYNC_INTERVAL;
+	if (!json_get_uint64(cred->config, OPT_STR_DATASTORESYNCINTERVAL, &val))
+		cred->datastore_sync_interval = (uint32_t)val;
+
 out:
 	if (fd >= 0)
 		close(fd);
@@ -37,6 +37,21 @@ struct opt_cred {
 	const char *tlscabundle;
 	const char *tlscakeychainref;
 	const char *seedfile;
+
+	uint32_t threads_testid;
+	uint32_t threads_vsid;
+
+	bool http_accept_compression;
+	bool http_compress_requests;
+	bool http_version2;
+	bool http_rate_limit;
+	uint32_t http_rate_start;
+	uint32_t http_rate_min;
+	uint32_t http_rate_max;
+	bool datastore_compression;
+	bool datastore_log;
+	bool datastore_sync;
+	uint32_t datastore_sync_interval;
 };
 
 int set_totp_seed(struct opt_cred *cred, const bool official_testing,
@@ -39,6 +39,7 @@
 #include "macos.h"
 
 #define OPT_CIPHER_OPTIONS_MAX 512
+#define OPT_DEFINITIONS_MAX 64
 
 struct opt_data {
 	struct acvp_search_ctx search;
@@ -59,6 +60,8 @@ struct opt_data {
 	char *basedir;
 	char *secure_basedir;
 	char *definition_basedir;
+	char *definitions[OPT_DEFINITIONS_MAX];
+	size_t definitions_idx;
 	char *cipher_options_file;
 	char *cipher_options_algo[OPT_CIPHER_OPTIONS_MAX];
 	size_t cipher_options_algo_idx;
@@ -83,6 +86,11 @@ struct opt_data {
 	bool list_available_purchase_opts;
 	bool fetch_verdicts;
 	bool esvp_proxy;
+	bool datastore_import;
+	bool datastore_export;
+
+	uint32_t threads_testid;
+	uint32_t threads_vsid;
 };
 
 static void usage(void)
@@ -324,6 +332,18 @@ static void usage(void)
 	fprintf(stderr,
 		"\t   --upload-only\t\tOnly upload test responses without\n");
 	fprintf(stderr, "\t\t\t\t\tdownloading test verdicts\n");
+	fprintf(stderr,
+		"\t   --threads-testid <NUM>\tMaximum number of test sessions\n");
+	fprintf(stderr, "\t\t\t\t\tprocessed concurrently\n");
+	fprintf(stderr,
+		"\t   --threads-vsid <NUM>\t\tMaximum number of vsIDs processed\n");
+	fprintf(stderr, "\t\t\t\t\tconcurrently\n");
+	fprintf(stderr,
+		"\t   --datastore-import\t\tConvert test session directories into\n");
+	fprintf(stderr, "\t\t\t\t\tlogs of the log data store\n");
+	fprintf(stderr,
+		"\t   --datastore-export\t\tConvert logs of the log data store into\n");
+	fprintf(stderr, "\t\t\t\t\ttest session directories\n");
 	fprintf(stderr,
 		"\t-v --verbose\t\t\tVerbose logging, multiple options\n");
 	fprintf(stderr, "\t\t\t\t\tincrease verbosity\n");
@@ -333,6 +353,8 @@ static void usage(void)
 		"\t   --logger-class <NUM>\t\tLimit logging to given class\n");
 	fprintf(stderr, "\t\t\t\t\t(-1 lists all logging classes)\n");
 	fprintf(stderr, "\t   --logfile <FILE>\t\tFile to write logs to\n");
+	fprintf(stderr,
+		"\t   --logger-async\t\tWrite logs from a separate thread\n");
 	fprintf(stderr, "\t-q --quiet\t\t\tNo output - quiet operation\n");
 	fprintf(stderr, "\t   --version\t\t\tVersion of ACVP proxy\n");
 	fprintf(stderr,
@@ -365,6 +387,8 @@ static void free_opts(struct opt_data *opts)
 		free(opts->secure_basedir);
 	if (opts->definition_basedir)
 		free(opts->definition_basedir);
+	for (i = 0; i < opts->definitions_idx; i++)
+		free(opts->definitions[i]);
 	if (opts->cipher_options_file)
 		free(opts->cipher_options_file);
 	for (i = 0; i < opts->cipher_options_algo_idx; i++)
@@ -495,6 +519,21 @@ out:
 	return ret;
 }
 
+static int add_definitions(struct opt_data *opts, const char *directory)
+{
+	int ret;
+
+	if (opts->definitions_idx >= OPT_DEFINITIONS_MAX)
+		return -EOVERFLOW;
+
+	CKINT(duplicate_string(&opts->definitions[opts->definitions_idx],
+			       directory));
+	opts->definitions_idx++;
+
+out:
+	return ret;
+}
+
 static int parse_opts(int argc, char *argv[], struct opt_data *opts)
 {
 	struct acvp_search_ctx *search = &opts->search;
@@ -504,7 +543,8 @@ static int parse_opts(int argc, char *argv[], struct opt_data *opts)
 	char version[200] = { 0 };
 	unsigned long val = 0;
 	long lval;
-	unsigned int dolist = 0, listunregistered = 0, modconf_loaded = 0;
+	unsigned int dolist = 0, listunregistered = 0;
+	size_t i;
 	bool logger_force_threading = false;
 
 	while (1) {
@@ -588,6 +628,14 @@ static int parse_opts(int argc, char *argv[], struct opt_data *opts)
 
 			{ "fetch-verdicts", no_argument, 0, 0 },
 
+			{ "threads-testid", required_argument, 0, 0 },
+			{ "threads-vsid", required_argument, 0, 0 },
+
+			{ "datastore-import", no_argument, 0, 0 },
+			{ "datastore-export", no_argument, 0, 0 },
+
+			{ "logger-async", no_argument, 0, 0 },
+
 			{ 0, 0, 0, 0 }
 		};
 		c = getopt_long(argc, argv, "m:n:e:r:p:fluc:d:ob:s:vqh",
@@ -711,8 +759,7 @@ static int parse_opts(int argc, char *argv[], struct opt_data *opts)
 				break;
 			case 15:
 				/* definitions */
-				CKINT(acvp_def_config(optarg));
-				modconf_loaded = 1;
+				CKINT(add_definitions(opts, optarg));
 				break;
 
 			case 16:
@@ -1057,6 +1104,45 @@ static int parse_opts(int argc, char *argv[], struct opt_data *opts)
 				opts->fetch_verdicts = true;
 				break;
 
+			case 65:
+				/* threads-testid */
+				lval = strtol(optarg, NULL, 10);
+				if (lval <= 0 || lval > UINT16_MAX) {
+					logger(LOGGER_ERR, LOGGER_C_ANY,
+					       "undefined number of test session threads\n");
+					usage();
+					ret = -EINVAL;
+					goto out;
+				}
+				opts->threads_testid = (uint32_t)lval;
+				break;
+			case 66:
+				/* threads-vsid */
+				lval = strtol(optarg, NULL, 10);
+				if (lval <= 0 || lval > UINT16_MAX) {
+					logger(LOGGER_ERR, LOGGER_C_ANY,
+					       "undefined number of vsID threads\n");
+					usage();
+					ret = -EINVAL;
+					goto out;
+				}
+				opts->threads_vsid = (uint32_t)lval;
+				break;
+
+			case 67:
+				/* datastore-import */
+				opts->datastore_import = true;
+				break;
+			case 68:
+				/* datastore-export */
+				opts->datastore_export = true;
+				break;
+
+			case 69:
+				/* logger-async */
+				CKINT(logger_set_async(true));
+				break;
+
 			default:
 				usage();
 				ret = -EINVAL;
@@ -1098,8 +1184,7 @@ static int parse_opts(int argc, char *argv[], struct opt_data *opts)
 			CKINT(duplicate_string(&cred->configfile, optarg));
 			break;
 		case 'd':
-			CKINT(acvp_def_config(optarg));
-			modconf_loaded = 1;
+			CKINT(add_definitions(opts, optarg));
 			break;
 
 		case 'v':
@@ -1176,7 +1261,15 @@ static int parse_opts(int argc, char *argv[], struct opt_data *opts)
 		}
 	}
 
-	if (!modconf_loaded)
+	/*
+	 * The definitions are loaded once the secure data store holding their
+	 * snapshots is known.
+	 */
+	if (opts->secure_basedir)
+		CKINT(acvp_def_set_snapshot_dir(opts->secure_basedir));
+	for (i = 0; i < opts->definitions_idx; i++)
+		CKINT(acvp_def_config(opts->definitions[i]));
+	if (!opts->definitions_idx)
 		CKINT(acvp_def_default_config(opts->definition_basedir));
 
 	if (listunregistered) {
@@ -1243,6 +1336,16 @@ static int initialize_ctx(struct acvp_ctx **ctx, struct opt_data *opts,
 	CKINT(acvp_ctx_init(ctx, opts->basedir, opts->secure_basedir));
 
 	cred = &opts->cred;
+
+	/* Command line options take precedence over the configuration file */
+	if (opts->threads_testid || opts->threads_vsid ||
+	    cred->threads_testid || cred->threads_vsid) {
+		CKINT(acvp_set_threading_limits(
+			opts->threads_testid ? opts->threads_testid :
+					       cred->threads_testid,
+			opts->threads_vsid ? opts->threads_vsid :
+					     cred->threads_vsid));
+	}
 	/* Official testing */
 	if (opts->official_testing) {
 		CKINT(acvp_req_production(*ctx));
@@ -1259,6 +1362,23 @@ static int initialize_ctx(struct acvp_ctx **ctx, struct opt_data *opts,
 				   cred->tlspasscode));
 	}
 
+	/* Each configuration file defines the compression for its server */
+	if (enable_net) {
+		CKINT(acvp_set_net_compression(cred->http_accept_compression,
+					       cred->http_compress_requests));
+		CKINT(acvp_set_net_http2(cred->http_version2));
+		CKINT(acvp_set_net_rate_limit(cred->http_rate_limit,
+					      cred->http_rate_start,
+					      cred->http_rate_min,
+					      cred->http_rate_max));
+	}
+
+	opts->acvp_ctx_options.compress_datastore =
+		cred->datastore_compression;
+	CKINT(acvp_set_datastore_log(cred->datastore_log));
+	acvp_set_datastore_sync(cred->datastore_sync,
+				cred->datastore_sync_interval);
+
 	/* Submit requests and retrieve test vectors */
 	CKINT(acvp_set_module(*ctx, &opts->search, opts->specific_modversion));
 
@@ -1636,6 +1756,34 @@ out:
 	return ret;
 }
 
+static int do_datastore_import(struct opt_data *opts)
+{
+	struct acvp_ctx *ctx = NULL;
+	int ret;
+
+	CKINT(initialize_ctx(&ctx, opts, false));
+
+	CKINT(acvp_datastore_log_import(ctx));
+
+out:
+	acvp_ctx_release(ctx);
+	return ret;
+}
+
+static int do_datastore_export(struct opt_data *opts)
+{
+	struct acvp_ctx *ctx = NULL;
+	int ret;
+
+	CKINT(initialize_ctx(&ctx, opts, false));
+
+	CKINT(acvp_datastore_log_export(ctx));
+
+out:
+	acvp_ctx_release(ctx);
+	return ret;
+}
+
 static int esvp_proxy_handling(struct opt_data *opts)
 {
 	struct acvp_ctx *ctx = NULL;
@@ -1687,7 +1835,11 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
-	if (opts.fetch_verdicts) {
+	if (opts.datastore_import) {
+		CKINT(do_datastore_import(&opts));
+	} else if (opts.datastore_export) {
+		CKINT(do_datastore_export(&opts));
+	} else if (opts.fetch_verdicts) {
 		CKINT(do_fetch_verdicts(&opts));
 	} else if (opts.list_purchased_vs) {
 		CKINT(do_list_purchased_vsids(&opts));
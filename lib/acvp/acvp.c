@@ -37,6 +37,7 @@
 #include "json_wrapper.h"
 #include "definition.h"
 #include "logger.h"
+#include "datastore_sync.h"
 #include "hash/memset_secure.h"
 #include "request_helper.h"
 #include "threading_support.h"
@@ -49,6 +50,9 @@
 const struct acvp_datastore_be *ds = NULL;
 const struct acvp_netaccess_be *na = NULL;
 
+static const struct acvp_datastore_be *ds_default = NULL;
+static const struct acvp_datastore_be *ds_log = NULL;
+
 static struct acvp_net_ctx net_global;
 
 static atomic_t acvp_lib_init = ATOMIC_INIT(0);
@@ -75,6 +79,9 @@ static void acvp_release_net(struct acvp_net_ctx *net)
 	ACVP_PTR_FREE_NULL(net->certs_clnt_passcode);
 	ACVP_PTR_FREE_NULL(net->certs_ca_macos_keychain_ref);
 	ACVP_PTR_FREE_NULL(net->certs_clnt_macos_keychain_ref);
+	net->accept_compression = false;
+	net->compress_request = false;
+	net->http2 = false;
 }
 
 static void acvp_release_modinfo(struct acvp_modinfo_ctx *modinfo)
@@ -182,6 +189,51 @@ void acvp_register_ds(const struct acvp_datastore_be *datastore)
 		return;
 	}
 	ds = datastore;
+	ds_default = datastore;
+}
+
+void acvp_register_ds_log(const struct acvp_datastore_be *datastore)
+{
+	if (ds_log) {
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "Re-registering log datastore callback!\n");
+		return;
+	}
+	ds_log = datastore;
+}
+
+DSO_PUBLIC
+void acvp_set_datastore_sync(bool enable, unsigned int interval_ms)
+{
+	acvp_ds_sync_enable(enable);
+	acvp_ds_sync_set_interval(interval_ms);
+}
+
+DSO_PUBLIC
+int acvp_set_net_rate_limit(bool enable, unsigned int rate_start,
+			    unsigned int rate_min, unsigned int rate_max)
+{
+	return acvp_net_rate_limit(enable, rate_start, rate_min, rate_max);
+}
+
+DSO_PUBLIC
+int acvp_set_datastore_log(bool enable)
+{
+	if (!enable) {
+		ds = ds_default;
+		return 0;
+	}
+
+	if (!ds_log) {
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "Log datastore backend not available\n");
+		return -EOPNOTSUPP;
+	}
+
+	ds = ds_log;
+	logger(LOGGER_VERBOSE, LOGGER_C_ANY, "Log datastore backend enabled\n");
+
+	return 0;
 }
 
 void acvp_register_na(const struct acvp_netaccess_be *netaccess)
@@ -400,6 +452,47 @@ out:
 	return ret;
 }
 
+DSO_PUBLIC
+int acvp_set_net_compression(bool accept_compression, bool compress_request)
+{
+	struct acvp_net_ctx *net = &net_global;
+
+	if (!net->server_name) {
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "ACVP server information not yet set\n");
+		return -EOPNOTSUPP;
+	}
+
+	net->accept_compression = accept_compression;
+	net->compress_request = compress_request;
+
+	logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+	       "ACVP request compression: responses (%s), requests (%s)\n",
+	       accept_compression ? "accepted" : "disabled",
+	       compress_request ? "enabled" : "disabled");
+
+	return 0;
+}
+
+DSO_PUBLIC
+int acvp_set_net_http2(bool enable)
+{
+	struct acvp_net_ctx *net = &net_global;
+
+	if (!net->server_name) {
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "ACVP server information not yet set\n");
+		return -EOPNOTSUPP;
+	}
+
+	net->http2 = enable;
+
+	logger(LOGGER_VERBOSE, LOGGER_C_ANY, "HTTP/2 multiplexing %s\n",
+	       enable ? "enabled" : "disabled");
+
+	return 0;
+}
+
 DSO_PUBLIC
 int acvp_set_module(struct acvp_ctx *ctx,
 		    const struct acvp_search_ctx *caller_search,
@@ -591,6 +684,16 @@ void acvp_ctx_release(struct acvp_ctx *ctx)
 	datastore = &ctx->datastore;
 	search = &datastore->search;
 
+	acvp_testids_index_release(ctx);
+	acvp_req_algo_cache_release();
+
+	/* The operation is complete, persist the updated definitions */
+	ret = acvp_def_flush();
+	if (ret)
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "Writing the updated module definitions failed: %d\n",
+		       ret);
+
 	acvp_release_modinfo(&ctx->modinfo);
 	acvp_release_datastore(&ctx->datastore);
 	acvp_release_search(search);
@@ -615,6 +718,21 @@ out:
 	return ret;
 }
 
+DSO_PUBLIC
+int acvp_set_threading_limits(uint32_t testid_limit, uint32_t vsid_limit)
+{
+	/* Thread group 0 processes the testIDs, group 1 the vsIDs */
+	const uint32_t limits[] = { testid_limit, vsid_limit };
+
+	if (!acvp_library_initialized()) {
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "ACVP library was not yet initialized\n");
+		return -EOPNOTSUPP;
+	}
+
+	return thread_set_limits(limits, ARRAY_SIZE(limits));
+}
+
 DSO_PUBLIC
 int acvp_ctx_init(struct acvp_ctx **ctx, const char *datastore_basedir,
 		  const char *secure_basedir)
@@ -703,6 +821,12 @@ void acvp_release(void)
 	/* We are not waiting for the server threads */
 	thread_release(false, false);
 
+	/* Stop the JWT refresh, it writes to the data store */
+	acvp_auth_refresh_release();
+
+	/* Commit the pending writes of the data store */
+	acvp_ds_sync_release();
+
 	/* Server threads should be shut down by now, kill them if needed */
 	thread_release(true, true);
 }
@@ -222,7 +222,7 @@ static void acvp_list_cert_unique_free(void)
 }
 
 static int acvp_get_cert_detail_vsid(const struct acvp_vsid_ctx *vsid_ctx,
-				     const struct acvp_buf *buf)
+				     const struct acvp_ext_buf *buf)
 {
 	struct acvp_vsid_ctx tmp_ctx;
 	int ret;
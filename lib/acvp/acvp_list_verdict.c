@@ -89,7 +89,7 @@ acvp_list_verdict_print(const struct acvp_test_verdict_status *verdict,
 }
 
 static int acvp_list_verdicts_vsid(const struct acvp_vsid_ctx *vsid_ctx,
-				   const struct acvp_buf *buf)
+				   const struct acvp_ext_buf *buf)
 {
 	struct acvp_vsid_ctx tmp_ctx;
 	int ret;
@@ -330,6 +330,8 @@ static int acvp_rename_module_cb(const struct acvp_ctx *ctx,
 	CKINT(acvp_rename_procfamily(&testid_ctx, rename_ctx->proc_family_new));
 
 out:
+	/* The search strings of the definition may have changed */
+	acvp_def_reindex();
 	return ret;
 }
 
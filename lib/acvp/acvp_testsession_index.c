@@ -0,0 +1,335 @@
+/* Index of the test sessions found in the data store
+ *
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "acvpproxy.h"
+#include "definition_internal.h"
+#include "internal.h"
+#include "logger.h"
+#include "mutex_w.h"
+#include "ret_checkers.h"
+#include "threading_support.h"
+
+/*
+ * The index maps a module definition to the testIDs of its test sessions.
+ * The entries are sorted by the address of the definition. An entry is never
+ * modified once it is part of the index, thus the testID array of an entry can
+ * be used without holding the lock until the index is released.
+ */
+struct acvp_testids_index_entry {
+	const struct definition *def;
+	uint32_t *testids;
+	unsigned int testid_count;
+};
+
+static DEFINE_MUTEX_W_UNLOCKED(acvp_testids_index_lock);
+static const struct acvp_ctx *acvp_testids_index_ctx = NULL;
+static struct acvp_testids_index_entry **acvp_testids_index = NULL;
+static unsigned int acvp_testids_index_nr = 0;
+
+static void acvp_testids_index_free(struct acvp_testids_index_entry **index,
+				    unsigned int nr)
+{
+	unsigned int i;
+
+	if (!index)
+		return;
+
+	for (i = 0; i < nr; i++) {
+		if (!index[i])
+			continue;
+		if (index[i]->testids)
+			free(index[i]->testids);
+		free(index[i]);
+	}
+	free(index);
+}
+
+static int acvp_testids_index_cmp_def(const void *a, const void *b)
+{
+	const struct acvp_testids_index_entry *ea =
+		*(const struct acvp_testids_index_entry * const *)a;
+	const struct acvp_testids_index_entry *eb =
+		*(const struct acvp_testids_index_entry * const *)b;
+
+	if ((uintptr_t)ea->def < (uintptr_t)eb->def)
+		return -1;
+	if ((uintptr_t)ea->def > (uintptr_t)eb->def)
+		return 1;
+	return 0;
+}
+
+static int acvp_testids_index_cmp_testid(const void *a, const void *b)
+{
+	uint32_t ta = *(const uint32_t *)a, tb = *(const uint32_t *)b;
+
+	if (ta < tb)
+		return -1;
+	if (ta > tb)
+		return 1;
+	return 0;
+}
+
+/* Find the position of the definition in the index - caller holds the lock */
+static unsigned int acvp_testids_index_pos(const struct definition *def)
+{
+	unsigned int low = 0, high = acvp_testids_index_nr;
+
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
+
+		if ((uintptr_t)acvp_testids_index[mid]->def < (uintptr_t)def)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static struct acvp_testids_index_entry *
+acvp_testids_index_find(const struct definition *def)
+{
+	unsigned int pos = acvp_testids_index_pos(def);
+
+	if (pos < acvp_testids_index_nr && acvp_testids_index[pos]->def == def)
+		return acvp_testids_index[pos];
+	return NULL;
+}
+
+/* Collect the testIDs of one definition from the data store */
+static int acvp_testids_index_crawl(const struct acvp_ctx *ctx,
+				    struct acvp_testids_index_entry *entry)
+{
+	int ret;
+
+	CKINT(ds->acvp_datastore_find_testsession(
+		entry->def, ctx, &entry->testids, &entry->testid_count));
+
+	/* Process the test sessions in the order of their creation */
+	if (entry->testid_count > 1) {
+		qsort(entry->testids, entry->testid_count,
+		      sizeof(*entry->testids), acvp_testids_index_cmp_testid);
+	}
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY,
+	       "Found %u test sessions for module %s\n", entry->testid_count,
+	       entry->def->info->module_name);
+
+out:
+	return ret;
+}
+
+#ifdef ACVP_USE_PTHREAD
+struct acvp_testids_index_thread_ctx {
+	const struct acvp_ctx *ctx;
+	struct acvp_testids_index_entry *entry;
+};
+
+static int acvp_testids_index_crawl_thread(void *arg)
+{
+	struct acvp_testids_index_thread_ctx *tdata = arg;
+	const struct acvp_ctx *ctx = tdata->ctx;
+	struct acvp_testids_index_entry *entry = tdata->entry;
+
+	free(tdata);
+
+	return acvp_testids_index_crawl(ctx, entry);
+}
+#endif
+
+/*
+ * Crawl the test session directories of all definitions matching the search
+ * criteria in parallel - each thread fills its own entry.
+ */
+static int acvp_testids_index_build(const struct acvp_ctx *ctx,
+				    struct acvp_testids_index_entry ***index,
+				    unsigned int *nr)
+{
+	const struct acvp_search_ctx *search = &ctx->datastore.search;
+	const struct definition *def;
+	struct acvp_testids_index_entry **entries = NULL;
+	unsigned int nr_entries = 0, i = 0;
+	int ret = 0;
+
+	for (def = acvp_find_def(search, NULL); def;
+	     def = acvp_find_def(search, def))
+		nr_entries++;
+
+	if (!nr_entries)
+		goto out;
+
+	entries = calloc(nr_entries, sizeof(*entries));
+	CKNULL(entries, -ENOMEM);
+
+	for (def = acvp_find_def(search, NULL); def && i < nr_entries;
+	     def = acvp_find_def(search, def), i++) {
+		entries[i] = calloc(1, sizeof(*entries[i]));
+		CKNULL(entries[i], -ENOMEM);
+		entries[i]->def = def;
+
+#ifdef ACVP_USE_PTHREAD
+		/* Disable threading in DEBUG mode */
+		if (ctx->options.threading_disabled) {
+			CKINT(acvp_testids_index_crawl(ctx, entries[i]));
+		} else {
+			struct acvp_testids_index_thread_ctx *tdata;
+			int ret_ancestor;
+
+			tdata = calloc(1, sizeof(*tdata));
+			CKNULL(tdata, -ENOMEM);
+			tdata->ctx = ctx;
+			tdata->entry = entries[i];
+			CKINT(thread_start(acvp_testids_index_crawl_thread,
+					   tdata, 0, &ret_ancestor));
+			ret |= ret_ancestor;
+		}
+#else
+		CKINT(acvp_testids_index_crawl(ctx, entries[i]));
+#endif
+	}
+
+out:
+#ifdef ACVP_USE_PTHREAD
+	ret |= thread_wait();
+#endif
+
+	if (ret) {
+		acvp_testids_index_free(entries, nr_entries);
+		return ret;
+	}
+
+	if (nr_entries > 1) {
+		qsort(entries, nr_entries, sizeof(*entries),
+		      acvp_testids_index_cmp_def);
+	}
+
+	*index = entries;
+	*nr = nr_entries;
+
+	return 0;
+}
+
+/* Add an entry for a definition outside the search criteria */
+static int acvp_testids_index_insert(struct acvp_testids_index_entry *entry)
+{
+	struct acvp_testids_index_entry **tmp;
+	unsigned int pos = acvp_testids_index_pos(entry->def), i;
+
+	tmp = realloc(acvp_testids_index,
+		      (acvp_testids_index_nr + 1) * sizeof(*tmp));
+	if (!tmp)
+		return -ENOMEM;
+	acvp_testids_index = tmp;
+
+	for (i = acvp_testids_index_nr; i > pos; i--)
+		acvp_testids_index[i] = acvp_testids_index[i - 1];
+	acvp_testids_index[pos] = entry;
+	acvp_testids_index_nr++;
+
+	return 0;
+}
+
+int acvp_testids_index_get(const struct acvp_ctx *ctx,
+			   const struct definition *def,
+			   const uint32_t **testids,
+			   unsigned int *testid_count)
+{
+	struct acvp_testids_index_entry *entry, *new = NULL;
+	int ret = 0;
+
+	CKNULL_LOG(ctx, -EINVAL, "ACVP request context missing\n");
+	CKNULL_LOG(def, -EINVAL, "Module definition missing\n");
+
+	mutex_w_lock(&acvp_testids_index_lock);
+	if (acvp_testids_index_ctx != ctx) {
+		struct acvp_testids_index_entry **index = NULL;
+		unsigned int nr = 0;
+
+		mutex_w_unlock(&acvp_testids_index_lock);
+
+		CKINT(acvp_testids_index_build(ctx, &index, &nr));
+
+		mutex_w_lock(&acvp_testids_index_lock);
+		if (acvp_testids_index_ctx != ctx) {
+			acvp_testids_index_free(acvp_testids_index,
+						acvp_testids_index_nr);
+			acvp_testids_index = index;
+			acvp_testids_index_nr = nr;
+			acvp_testids_index_ctx = ctx;
+		} else {
+			/* Another thread built the index in the meantime */
+			acvp_testids_index_free(index, nr);
+		}
+	}
+	entry = acvp_testids_index_find(def);
+	mutex_w_unlock(&acvp_testids_index_lock);
+
+	/*
+	 * Definitions outside the search criteria (e.g. dependencies) are
+	 * crawled on first use.
+	 */
+	if (!entry) {
+		new = calloc(1, sizeof(*new));
+		CKNULL(new, -ENOMEM);
+		new->def = def;
+		CKINT(acvp_testids_index_crawl(ctx, new));
+
+		mutex_w_lock(&acvp_testids_index_lock);
+		entry = acvp_testids_index_find(def);
+		if (!entry) {
+			ret = acvp_testids_index_insert(new);
+			if (!ret) {
+				entry = new;
+				new = NULL;
+			}
+		}
+		mutex_w_unlock(&acvp_testids_index_lock);
+		if (ret)
+			goto out;
+	}
+
+	*testids = entry->testids;
+	*testid_count = entry->testid_count;
+
+out:
+	if (new) {
+		if (new->testids)
+			free(new->testids);
+		free(new);
+	}
+	return ret;
+}
+
+void acvp_testids_index_release(const struct acvp_ctx *ctx)
+{
+	mutex_w_lock(&acvp_testids_index_lock);
+	if (acvp_testids_index_ctx == ctx) {
+		acvp_testids_index_free(acvp_testids_index,
+					acvp_testids_index_nr);
+		acvp_testids_index = NULL;
+		acvp_testids_index_nr = 0;
+		acvp_testids_index_ctx = NULL;
+	}
+	mutex_w_unlock(&acvp_testids_index_lock);
+}
@@ -483,8 +483,8 @@ static int acvp_test_add_deps(struct acvp_testid_ctx *testid_ctx)
 	const struct def_deps *def_deps;
 	struct acvp_test_deps *test_deps;
 	struct acvp_testid_ctx tmp_testid_ctx;
-	uint32_t testids[ACVP_REQ_MAX_FAILED_TESTID];
-	unsigned int i, testid_count = ACVP_REQ_MAX_FAILED_TESTID;
+	const uint32_t *testids;
+	unsigned int i, testid_count;
 	int ret = 0;
 
 	if (!testid_ctx)
@@ -550,8 +550,8 @@ static int acvp_test_add_deps(struct acvp_testid_ctx *testid_ctx)
 		 * requests the processing of a given set of test sessions or
 		 * vector set IDs.
 		 */
-		CKINT(ds->acvp_datastore_find_testsession(
-			def_deps->dependency, ctx, testids, &testid_count));
+		CKINT(acvp_testids_index_get(ctx, def_deps->dependency,
+					     &testids, &testid_count));
 
 		/*
 		 * Iterate through all testids returned by the search and
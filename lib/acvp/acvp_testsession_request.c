@@ -19,6 +19,7 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -26,21 +27,17 @@
 
 #include "acvp_error_handler.h"
 #include "atomic_bool.h"
+#include "hash/sha256.h"
 #include "logger.h"
 #include "acvpproxy.h"
 #include "internal.h"
+#include "json_stream.h"
 #include "json_wrapper.h"
+#include "mutex_w.h"
 #include "request_helper.h"
 #include "sleep.h"
 #include "threading_support.h"
 
-/*
- * Structure for one thread
- */
-struct acvp_thread_ctx {
-	struct acvp_vsid_ctx *vsid_ctx;
-};
-
 /*
  * Shall the ACVP operation be shut down?
  */
@@ -347,6 +344,184 @@ out:
 	return ret;
 }
 
+/*
+ * Cache of the serialized algorithms array of a capability set.
+ *
+ * The same implementation is commonly registered for many OEs, i.e. the
+ * definitions share one def_algo array. The def_algo arrays and all data they
+ * reference are static data of the module implementations which is never
+ * modified. Thus, the array is looked up by its address. The serialized
+ * algorithms array is keyed by its hash, so that different def_algo arrays
+ * with equal capabilities share one cached string.
+ */
+struct acvp_req_algo_cache {
+	struct acvp_req_algo_cache *next;
+	const struct def_algo *algos;
+	unsigned int num_algos;
+	uint8_t digest[SHA256_SIZE_DIGEST];
+	char *algorithms;
+	bool alias; /* algorithms is owned by another entry */
+};
+
+static DEFINE_MUTEX_W_UNLOCKED(acvp_req_algo_cache_lock);
+static struct acvp_req_algo_cache *acvp_req_algo_cache_head = NULL;
+
+/* Caller must hold the cache lock */
+static struct acvp_req_algo_cache *
+acvp_req_algo_cache_find(const struct definition *def)
+{
+	struct acvp_req_algo_cache *entry;
+
+	for (entry = acvp_req_algo_cache_head; entry; entry = entry->next) {
+		if (entry->algos == def->algos &&
+		    entry->num_algos == def->num_algos)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* Caller must hold the cache lock */
+static struct acvp_req_algo_cache *
+acvp_req_algo_cache_find_digest(const uint8_t *digest)
+{
+	struct acvp_req_algo_cache *entry;
+
+	for (entry = acvp_req_algo_cache_head; entry; entry = entry->next) {
+		if (!memcmp(entry->digest, digest, sizeof(entry->digest)))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static int acvp_req_algo_cache_add(const struct definition *def,
+				   struct json_object *algorithms)
+{
+	struct acvp_req_algo_cache *entry = NULL, *content;
+	const char *str;
+	int ret = 0;
+	HASH_CTX_ON_STACK(ctx);
+
+	str = json_object_to_json_string_ext(algorithms,
+					     JSON_C_TO_STRING_PLAIN |
+						     JSON_C_TO_STRING_NOSLASHESCAPE);
+	CKNULL_LOG(str, -ENOMEM,
+		   "JSON object conversion into string failed\n");
+
+	entry = calloc(1, sizeof(*entry));
+	CKNULL(entry, -ENOMEM);
+	entry->algos = def->algos;
+	entry->num_algos = def->num_algos;
+
+	sha256->init(ctx);
+	sha256->update(ctx, (const uint8_t *)str, strlen(str));
+	sha256->final(ctx, entry->digest);
+
+	mutex_w_lock(&acvp_req_algo_cache_lock);
+
+	if (acvp_req_algo_cache_find(def)) {
+		/* Another thread was faster */
+		mutex_w_unlock(&acvp_req_algo_cache_lock);
+		goto out;
+	}
+
+	content = acvp_req_algo_cache_find_digest(entry->digest);
+	if (content) {
+		entry->algorithms = content->algorithms;
+		entry->alias = true;
+	} else {
+		ret = acvp_duplicate(&entry->algorithms, str);
+		if (ret) {
+			mutex_w_unlock(&acvp_req_algo_cache_lock);
+			goto out;
+		}
+	}
+
+	entry->next = acvp_req_algo_cache_head;
+	acvp_req_algo_cache_head = entry;
+	entry = NULL;
+
+	mutex_w_unlock(&acvp_req_algo_cache_lock);
+
+out:
+	if (entry)
+		free(entry);
+	return ret;
+}
+
+/* Obtain a private copy of the algorithms array from the cache */
+static int acvp_req_algo_cache_get(const struct definition *def,
+				   struct json_object **algorithms)
+{
+	struct acvp_req_algo_cache *entry;
+	int ret = 0;
+
+	/* Entries are never modified or removed while the context exists */
+	mutex_w_lock(&acvp_req_algo_cache_lock);
+	entry = acvp_req_algo_cache_find(def);
+	mutex_w_unlock(&acvp_req_algo_cache_lock);
+
+	if (!entry)
+		return 0;
+
+	*algorithms = json_tokener_parse(entry->algorithms);
+	CKNULL_LOG(*algorithms, -ENOMEM,
+		   "Cannot parse cached algorithms JSON\n");
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY,
+	       "Using cached algorithms array\n");
+
+out:
+	return ret;
+}
+
+void acvp_req_algo_cache_release(void)
+{
+	struct acvp_req_algo_cache *entry, *tmp;
+
+	mutex_w_lock(&acvp_req_algo_cache_lock);
+	entry = acvp_req_algo_cache_head;
+	acvp_req_algo_cache_head = NULL;
+	mutex_w_unlock(&acvp_req_algo_cache_lock);
+
+	while (entry) {
+		tmp = entry->next;
+		if (!entry->alias)
+			free(entry->algorithms);
+		free(entry);
+		entry = tmp;
+	}
+}
+
+static int acvp_req_build_algos(const struct definition *def,
+				struct json_object **algorithms_out)
+{
+	struct json_object *algorithms = NULL;
+	unsigned int i;
+	int ret;
+
+	CKINT(acvp_req_algo_cache_get(def, &algorithms));
+	if (algorithms)
+		goto out;
+
+	algorithms = json_object_new_array();
+	CKNULL(algorithms, -ENOMEM);
+	logger(LOGGER_DEBUG, LOGGER_C_ANY, "New algorithms array\n");
+	for (i = 0; i < def->num_algos; i++)
+		CKINT(acvp_req_set_algo(algorithms, def->algos + i));
+
+	CKINT(acvp_req_algo_cache_add(def, algorithms));
+
+out:
+	if (ret) {
+		ACVP_JSON_PUT_NULL(algorithms);
+	} else {
+		*algorithms_out = algorithms;
+	}
+	return ret;
+}
+
 static int acvp_req_build(const struct acvp_testid_ctx *testid_ctx,
 			  struct json_object *request)
 {
@@ -354,7 +529,6 @@ static int acvp_req_build(const struct acvp_testid_ctx *testid_ctx,
 	const struct acvp_req_ctx *req_details = &ctx->req_details;
 	const struct definition *def = testid_ctx->def;
 	struct json_object *entry = NULL, *tmp = NULL, *algorithms = NULL;
-	unsigned int i;
 	int ret = 0;
 
 	/* Array entry for version */
@@ -387,12 +561,7 @@ static int acvp_req_build(const struct acvp_testid_ctx *testid_ctx,
 		json_object_new_string(req_details->encryptAtRest ? "yes" :
 									  "no")));
 
-	algorithms = json_object_new_array();
-	CKNULL(algorithms, -ENOMEM);
-	logger(LOGGER_DEBUG, LOGGER_C_ANY, "New algorithms array\n");
-	for (i = 0; i < def->num_algos; i++)
-		CKINT(acvp_req_set_algo(algorithms, def->algos + i));
-
+	CKINT(acvp_req_build_algos(def, &algorithms));
 	CKINT(json_object_object_add(entry, "algorithms", algorithms));
 
 	CKINT(json_object_array_add(request, entry));
@@ -421,96 +590,327 @@ out:
 	return ret;
 }
 
-/*
- * Fetch data and process potential retry responses
- */
-int acvp_process_retry(const struct acvp_vsid_ctx *vsid_ctx,
-		       struct acvp_buf *result_data, const char *url,
-		       int (*debug_logger)(const struct acvp_vsid_ctx *vsid_ctx,
-					   const struct acvp_buf *buf, int err))
+static void acvp_process_retry_error(const struct acvp_vsid_ctx *vsid_ctx,
+				     const int ret)
 {
 	const struct acvp_testid_ctx *testid_ctx = vsid_ctx->testid_ctx;
 	const struct definition *def = testid_ctx->def;
 	const struct def_info *info = def ? def->info : NULL;
+
+	if (!ret)
+		return;
+
+	if (ret == -EINTR || ret == -ESHUTDOWN) {
+		logger_status(
+			LOGGER_C_ANY,
+			"Interrupted processing testID %u with vsID %u (%d)\n",
+			testid_ctx->testid, vsid_ctx->vsid, ret);
+	} else {
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "Failure in processing testID %u with vsID %u (%d) for module %s (%s)\n",
+		       testid_ctx->testid, vsid_ctx->vsid, ret,
+		       (info && info->module_name) ? info->module_name :
+						       "<undefined>",
+		       (info && info->impl_name) ? info->impl_name :
+						     "<undefined>");
+	}
+}
+
+static void acvp_process_retry_status(const struct acvp_vsid_ctx *vsid_ctx)
+{
+	const struct acvp_testid_ctx *testid_ctx = vsid_ctx->testid_ctx;
+
+	if (vsid_ctx->vsid) {
+		logger_status(LOGGER_C_ANY,
+			      "(Re)Try testID %u / vsID %u (%u / %u done)\n",
+			      testid_ctx->testid, vsid_ctx->vsid,
+			      atomic_read(&glob_vsids_processed),
+			      atomic_read(&glob_vsids_to_process));
+	} else {
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY, "(Re)Try testID %u\n",
+		       testid_ctx->testid);
+	}
+}
+
+/* Log the retry request of the server and enforce a minimum wait time */
+static void acvp_process_retry_log(const struct acvp_vsid_ctx *vsid_ctx,
+				   uint32_t *sleep_time)
+{
+	const struct acvp_testid_ctx *testid_ctx = vsid_ctx->testid_ctx;
+
+	/* Retry at least after one second to not hammer the server */
+	if (!*sleep_time)
+		*sleep_time = 1;
+
+	acvp_net_rate_retry_hint(*sleep_time);
+
+	if (vsid_ctx->vsid) {
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+		       "ACVP server requested retry - sleeping for %u seconds for vsID %u again\n",
+		       *sleep_time, vsid_ctx->vsid);
+	} else {
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+		       "ACVP server requested retry - sleeping for %u seconds for testID %u again\n",
+		       *sleep_time, testid_ctx->testid);
+	}
+}
+
+/*
+ * Check the server response for a retry statement. Returns true and sets
+ * sleep_time to the number of seconds to wait if the server asks for a
+ * retry. Otherwise, sleep_time is set to zero.
+ */
+static bool acvp_process_retry_hint(const struct acvp_vsid_ctx *vsid_ctx,
+				    struct json_object *data,
+				    uint32_t *sleep_time)
+{
+	/* The server did not return a retry statement - we are done. */
+	if (json_get_uint(data, "retry", sleep_time)) {
+		*sleep_time = 0;
+		return false;
+	}
+
+	acvp_process_retry_log(vsid_ctx, sleep_time);
+
+	return true;
+}
+
+/*
+ * Fetch data once - if the server requests a retry, the result buffer is
+ * cleared and sleep_time is set to the number of seconds the server asks us
+ * to wait before trying again. Otherwise sleep_time is set to zero.
+ */
+static int
+acvp_process_retry_once(const struct acvp_vsid_ctx *vsid_ctx,
+			struct acvp_buf *result_data, const char *url,
+			int (*debug_logger)(const struct acvp_vsid_ctx *vsid_ctx,
+					    const struct acvp_buf *buf, int err),
+			uint32_t *sleep_time)
+{
+	const struct acvp_testid_ctx *testid_ctx = vsid_ctx->testid_ctx;
 	struct json_object *resp = NULL, *data = NULL;
-	uint32_t sleep_time = 0;
 	int ret, ret2;
 
-	while (1) {
-		if (vsid_ctx->vsid) {
-			logger_status(
-				LOGGER_C_ANY,
-				"(Re)Try testID %u / vsID %u (%u / %u done)\n",
-				testid_ctx->testid, vsid_ctx->vsid,
-				atomic_read(&glob_vsids_processed),
-				atomic_read(&glob_vsids_to_process));
-		} else {
-			logger(LOGGER_VERBOSE, LOGGER_C_ANY,
-			       "(Re)Try testID %u\n", testid_ctx->testid);
-		}
+	*sleep_time = 0;
 
-		ret2 = acvp_net_op(testid_ctx, url, NULL, result_data,
-				   acvp_http_get);
+	acvp_process_retry_status(vsid_ctx);
 
-		/* Store the debug version of the result unconditionally. */
-		if (debug_logger) {
-			CKINT(debug_logger(vsid_ctx, result_data, ret2));
-		}
+	ret2 = acvp_net_op(testid_ctx, url, NULL, result_data, acvp_http_get);
+
+	/* Store the debug version of the result unconditionally. */
+	if (debug_logger) {
+		CKINT(debug_logger(vsid_ctx, result_data, ret2));
+	}
+
+	if (ret2 < 0) {
+		ret = ret2;
+		goto out;
+	}
+
+	/* Strip the version array entry and get the data. */
+	CKINT(acvp_req_strip_version(result_data, &resp, &data));
+
+	/* Clear the buffer for the next attempt if the server asks for it. */
+	if (acvp_process_retry_hint(vsid_ctx, data, sleep_time))
+		acvp_free_buf(result_data);
+
+out:
+	ACVP_JSON_PUT_NULL(resp);
+	return ret;
+}
+
+/*****************************************************************************
+ * Streamed vsID download
+ *
+ * The vector set is written to the data store while it is received and
+ * processed by the JSON stream processor to validate its structure and to
+ * detect a retry request of the server. Thus, neither the raw vector set nor
+ * a JSON object tree of it is held in memory. When debugging is enabled, the
+ * buffered download is used as it stores the raw server response for
+ * debugging purposes.
+ *****************************************************************************/
+struct acvp_vsid_stream {
+	struct acvp_buf_sink file;
+	struct acvp_buf_sink sink;
+	struct json_stream js;
+	const char *version_keyword;
+};
 
-		if (ret2 < 0) {
-			ret = ret2;
+static bool acvp_vsid_stream_enabled(void)
+{
+	return (ds->acvp_datastore_open_vsid &&
+		logger_get_verbosity(LOGGER_C_ANY) < LOGGER_DEBUG);
+}
+
+static int acvp_vsid_stream_write(void *ctx, const uint8_t *data, uint32_t len)
+{
+	struct acvp_vsid_stream *stream = (struct acvp_vsid_stream *)ctx;
+	int ret;
+
+	CKINT(stream->file.write(stream->file.ctx, data, len));
+	CKINT_LOG(json_stream_update(&stream->js, data, len),
+		  "Cannot parse ACVP server response\n");
+
+out:
+	return ret;
+}
+
+static void acvp_vsid_stream_js_init(struct acvp_vsid_stream *stream)
+{
+	json_stream_init(&stream->js);
+	stream->js.version_keyword = stream->version_keyword;
+	stream->js.capture_key = "retry";
+}
+
+static int acvp_vsid_stream_reset(void *ctx)
+{
+	struct acvp_vsid_stream *stream = (struct acvp_vsid_stream *)ctx;
+
+	acvp_vsid_stream_js_init(stream);
+
+	return stream->file.reset(stream->file.ctx);
+}
+
+static int acvp_vsid_stream_init(const struct acvp_vsid_ctx *vsid_ctx,
+				 struct acvp_vsid_stream *stream)
+{
+	const struct acvp_testid_ctx *testid_ctx = vsid_ctx->testid_ctx;
+	const struct acvp_ctx *ctx = testid_ctx->ctx;
+	const struct acvp_datastore_ctx *datastore = &ctx->datastore;
+	const struct acvp_net_proto *proto;
+	int ret;
+
+	memset(&stream->file, 0, sizeof(stream->file));
+
+	CKINT(acvp_get_proto(&proto));
+	stream->version_keyword = proto->proto_version_keyword;
+	acvp_vsid_stream_js_init(stream);
+
+	CKINT(ds->acvp_datastore_open_vsid(vsid_ctx, datastore->vectorfile,
+					   false, &stream->file));
+
+	stream->sink.write = acvp_vsid_stream_write;
+	stream->sink.reset = acvp_vsid_stream_reset;
+	stream->sink.ctx = stream;
+
+out:
+	return ret;
+}
+
+/*
+ * Streamed counterpart of acvp_process_retry_once. If the server does not
+ * ask for a retry, the received vector set is committed to the data store.
+ */
+static int
+acvp_process_retry_once_stream(const struct acvp_vsid_ctx *vsid_ctx,
+			       const char *url, uint32_t *sleep_time)
+{
+	const struct acvp_testid_ctx *testid_ctx = vsid_ctx->testid_ctx;
+	struct acvp_vsid_stream stream;
+	ACVP_BUFFER_INIT(buf);
+	unsigned long val;
+	char *endptr;
+	bool commit = false;
+	int ret, ret2;
+
+	*sleep_time = 0;
+
+	CKINT(acvp_vsid_stream_init(vsid_ctx, &stream));
+
+	acvp_process_retry_status(vsid_ctx);
+
+	ret2 = acvp_net_op_sink(testid_ctx, url, &stream.sink, &buf);
+
+	/* Store the debug version of an error response. */
+	if (ret2) {
+		CKINT(acvp_store_vector_debug(vsid_ctx, &buf, ret2));
+	}
+
+	if (ret2 < 0) {
+		ret = ret2;
+		goto out;
+	}
+
+	/* ACVP error response is stored like a vector set */
+	if (buf.buf && buf.len) {
+		CKINT(stream.sink.write(stream.sink.ctx, buf.buf, buf.len));
+	}
+
+	/* An empty response is stored like with the buffered download */
+	if (stream.js.depth || stream.js.done) {
+		CKINT_LOG(json_stream_final(&stream.js),
+			  "Incomplete ACVP server response\n");
+		if (!stream.js.data_elements) {
+			logger(LOGGER_WARN, LOGGER_C_ANY,
+			       "No data found in ACVP server response\n");
+			ret = -EINVAL;
 			goto out;
 		}
+	}
 
-		/* Strip the version array entry and get the data. */
-		CKINT(acvp_req_strip_version(result_data, &resp, &data));
+	commit = true;
 
-		/*
-		 * Terminate the loop when the server did not return a
-		 * retry statement.
-		 */
-		if (json_get_uint(data, "retry", &sleep_time))
-			break;
+	/* The server did not return a retry statement - we are done. */
+	if (!stream.js.captured)
+		goto out;
+	val = strtoul(stream.js.capture, &endptr, 10);
+	if (*endptr || val > UINT32_MAX)
+		goto out;
 
-		/* Server asked us to retry in given number of seconds */
+	/* Discard the data as the server asks for a retry. */
+	*sleep_time = (uint32_t)val;
+	acvp_process_retry_log(vsid_ctx, sleep_time);
+	commit = false;
 
-		/* Clear the buffers for the next loop iteration. */
-		ACVP_JSON_PUT_NULL(resp);
-		acvp_free_buf(result_data);
+out:
+	ret2 = ds->acvp_datastore_close_vsid(&stream.file, commit && !ret);
+	if (!ret)
+		ret = ret2;
+	acvp_free_buf(&buf);
+	return ret;
+}
 
-		if (vsid_ctx->vsid) {
-			logger(LOGGER_VERBOSE, LOGGER_C_ANY,
-			       "ACVP server requested retry - sleeping for %u seconds for vsID %u again\n",
-			       sleep_time, vsid_ctx->vsid);
-		} else {
-			logger(LOGGER_VERBOSE, LOGGER_C_ANY,
-			       "ACVP server requested retry - sleeping for %u seconds for testID %u again\n",
-			       sleep_time, testid_ctx->testid);
-		}
+/*
+ * One download attempt of a vector set. If the download is streamed, the
+ * data is already stored in the data store and buf is left empty.
+ */
+static int acvp_get_testvectors_once(const struct acvp_vsid_ctx *vsid_ctx,
+				     struct acvp_buf *buf, const char *url,
+				     uint32_t *sleep_time, bool *streamed)
+{
+	*streamed = acvp_vsid_stream_enabled();
+	if (*streamed)
+		return acvp_process_retry_once_stream(vsid_ctx, url,
+						      sleep_time);
+
+	return acvp_process_retry_once(vsid_ctx, buf, url,
+				       acvp_store_vector_debug, sleep_time);
+}
+
+/*
+ * Fetch data and process potential retry responses
+ */
+int acvp_process_retry(const struct acvp_vsid_ctx *vsid_ctx,
+		       struct acvp_buf *result_data, const char *url,
+		       int (*debug_logger)(const struct acvp_vsid_ctx *vsid_ctx,
+					   const struct acvp_buf *buf, int err))
+{
+	uint32_t sleep_time;
+	int ret;
+
+	while (1) {
+		CKINT(acvp_process_retry_once(vsid_ctx, result_data, url,
+					      debug_logger, &sleep_time));
+
+		if (!sleep_time)
+			break;
 
 		/* Wait the requested amount of seconds */
 		CKINT(sleep_interruptible(sleep_time, &acvp_op_interrupted));
 	}
 
 out:
-	if (ret) {
-		if (ret == -EINTR || ret == -ESHUTDOWN) {
-			logger_status(
-				LOGGER_C_ANY,
-				"Interrupted processing testID %u with vsID %u (%d)\n",
-				testid_ctx->testid, vsid_ctx->vsid, ret);
-		} else {
-			logger(LOGGER_ERR, LOGGER_C_ANY,
-			       "Failure in processing testID %u with vsID %u (%d) for module %s (%s)\n",
-			       testid_ctx->testid, vsid_ctx->vsid, ret,
-			       (info && info->module_name) ? info->module_name :
-								   "<undefined>",
-			       (info && info->impl_name) ? info->impl_name :
-								 "<undefined>");
-		}
-	}
-
-	ACVP_JSON_PUT_NULL(resp);
+	acvp_process_retry_error(vsid_ctx, ret);
 	return ret;
 }
 
@@ -577,23 +977,20 @@ void acvp_record_vsid_duration(const struct acvp_vsid_ctx *vsid_ctx,
 	ds->acvp_datastore_write_vsid(vsid_ctx, pathname, false, &buf);
 }
 
-/* GET /testSessions/<testSessionId>/vectorSets/<vectorSetId> */
-int acvp_get_testvectors(const struct acvp_vsid_ctx *vsid_ctx)
+/*
+ * Store the downloaded vsID data with the result of the download operation
+ * provided with ret2. The buffer is NULL if the data was streamed into the
+ * data store.
+ */
+static int acvp_get_testvectors_store(const struct acvp_vsid_ctx *vsid_ctx,
+				      const struct acvp_buf *buf, int ret2)
 {
 	const struct acvp_testid_ctx *testid_ctx = vsid_ctx->testid_ctx;
 	const struct acvp_ctx *ctx = testid_ctx->ctx;
 	const struct acvp_datastore_ctx *datastore = &ctx->datastore;
 	const struct acvp_net_ctx *net;
-	ACVP_BUFFER_INIT(buf);
 	ACVP_BUFFER_INIT(tmp);
-	char url[ACVP_NET_URL_MAXLEN];
-	int ret, ret2;
-
-	/* Prepare the URL to be used for downloading the vsID */
-	CKINT(acvp_vsid_url(vsid_ctx, url, sizeof(url), false));
-
-	/* Do the actual download of the vsID */
-	ret2 = acvp_process_retry(vsid_ctx, &buf, url, acvp_store_vector_debug);
+	int ret;
 
 	/* Initialize the vsID directory for later potential re-load. */
 	CKINT(acvp_store_vector_status(
@@ -606,9 +1003,11 @@ int acvp_get_testvectors(const struct acvp_vsid_ctx *vsid_ctx)
 		goto out;
 	}
 
-	/* Store the vsID data in data store */
-	CKINT(ds->acvp_datastore_write_vsid(vsid_ctx, datastore->vectorfile,
-					    false, &buf));
+	/* Store the vsID data in data store unless it was streamed there */
+	if (buf) {
+		CKINT(ds->acvp_datastore_write_vsid(
+			vsid_ctx, datastore->vectorfile, false, buf));
+	}
 
 	CKINT(acvp_get_net(&net));
 	tmp.buf = (uint8_t *)net->server_name;
@@ -634,26 +1033,322 @@ int acvp_get_testvectors(const struct acvp_vsid_ctx *vsid_ctx)
 	/* Store the time the download took */
 	acvp_record_vsid_duration(vsid_ctx, ACVP_DS_DOWNLOADDURATION);
 
+out:
+	return ret;
+}
+
+/* GET /testSessions/<testSessionId>/vectorSets/<vectorSetId> */
+int acvp_get_testvectors(const struct acvp_vsid_ctx *vsid_ctx)
+{
+	ACVP_BUFFER_INIT(buf);
+	char url[ACVP_NET_URL_MAXLEN];
+	uint32_t sleep_time;
+	bool streamed;
+	int ret, ret2;
+
+	/* Prepare the URL to be used for downloading the vsID */
+	CKINT(acvp_vsid_url(vsid_ctx, url, sizeof(url), false));
+
+	/* Do the actual download of the vsID */
+	while (1) {
+		ret2 = acvp_get_testvectors_once(vsid_ctx, &buf, url,
+						 &sleep_time, &streamed);
+		if (ret2 || !sleep_time)
+			break;
+
+		/* Wait the requested amount of seconds */
+		ret2 = sleep_interruptible(sleep_time, &acvp_op_interrupted);
+		if (ret2)
+			break;
+	}
+	acvp_process_retry_error(vsid_ctx, ret2);
+
+	CKINT(acvp_get_testvectors_store(vsid_ctx, streamed ? NULL : &buf,
+					 ret2));
+
 out:
 	acvp_free_buf(&buf);
 	return ret;
 }
 
 #ifdef ACVP_USE_PTHREAD
-static int acvp_process_req_thread(void *arg)
+/*****************************************************************************
+ * vsID download scheduler
+ *
+ * Instead of parking one thread per vsID which sleeps for the time the ACVP
+ * server asks us to retry, all pending vsID downloads of one test session
+ * are held in one queue ordered by the time the next attempt is due. A small
+ * set of workers picks the entries when they become due, performs one
+ * download attempt and either stores the data or re-queues the entry with
+ * the retry hint of the server. Thus, the number of threads is independent
+ * of the number of vsIDs in flight. The number of workers of one test session
+ * is bounded by ACVP_VSID_SCHED_WORKERS and the limit of the vsID thread group
+ * (--threads-vsid).
+ *****************************************************************************/
+
+/* Maximum number of workers of one test session including the caller */
+#define ACVP_VSID_SCHED_WORKERS 4
+
+/*
+ * Maximum time in seconds a worker waits before re-checking the queue and
+ * whether the operation was interrupted.
+ */
+#define ACVP_VSID_SCHED_MAXWAIT 1
+
+struct acvp_vsid_sched_entry {
+	struct acvp_vsid_sched_entry *next;
+	struct acvp_vsid_ctx *vsid_ctx;
+	time_t due;
+	char url[ACVP_NET_URL_MAXLEN];
+};
+
+struct acvp_vsid_sched {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct acvp_vsid_sched_entry *queue;
+	unsigned int pending;
+	int ret;
+};
+
+/* Insert entry into the queue sorted by due time - caller holds the lock */
+static void acvp_vsid_sched_enqueue(struct acvp_vsid_sched *sched,
+				    struct acvp_vsid_sched_entry *entry)
+{
+	struct acvp_vsid_sched_entry **pos = &sched->queue;
+
+	while (*pos && (*pos)->due <= entry->due)
+		pos = &(*pos)->next;
+
+	entry->next = *pos;
+	*pos = entry;
+
+	pthread_cond_signal(&sched->cond);
+}
+
+static void acvp_vsid_sched_release_entry(struct acvp_vsid_sched_entry *entry)
+{
+	acvp_release_vsid_ctx(entry->vsid_ctx);
+	free(entry);
+}
+
+/* Mark one entry as completed - caller holds the lock */
+static void acvp_vsid_sched_complete(struct acvp_vsid_sched *sched,
+				     struct acvp_vsid_sched_entry *entry,
+				     const int ret)
+{
+	acvp_vsid_sched_release_entry(entry);
+	sched->ret |= ret;
+	sched->pending--;
+	pthread_cond_broadcast(&sched->cond);
+}
+
+/* Perform one download attempt for the entry */
+static int acvp_vsid_sched_fetch(struct acvp_vsid_sched_entry *entry,
+				 uint32_t *sleep_time)
 {
-	struct acvp_thread_ctx *tdata = (struct acvp_thread_ctx *)arg;
-	struct acvp_vsid_ctx *vsid_ctx = tdata->vsid_ctx;
+	const struct acvp_vsid_ctx *vsid_ctx = entry->vsid_ctx;
+	ACVP_BUFFER_INIT(buf);
+	bool streamed;
+	int ret, ret2;
+
+	ret2 = acvp_get_testvectors_once(vsid_ctx, &buf, entry->url,
+					 sleep_time, &streamed);
+	acvp_process_retry_error(vsid_ctx, ret2);
+
+	/* Server asks for a retry - nothing to store yet */
+	if (!ret2 && *sleep_time) {
+		ret = 0;
+		goto out;
+	}
+
+	*sleep_time = 0;
+	ret = acvp_get_testvectors_store(vsid_ctx, streamed ? NULL : &buf,
+					 ret2);
+
+out:
+	acvp_free_buf(&buf);
+	return ret;
+}
+
+static int acvp_vsid_sched_worker(void *arg)
+{
+	struct acvp_vsid_sched *sched = (struct acvp_vsid_sched *)arg;
+	struct acvp_vsid_sched_entry *entry;
+	struct timespec wait;
+	uint32_t sleep_time;
+	time_t now;
 	int ret;
 
-	free(tdata);
+	pthread_mutex_lock(&sched->lock);
+
+	while (sched->pending) {
+		/* Drop all queued entries when we are interrupted */
+		if (acvp_op_get_interrupted()) {
+			while (sched->queue) {
+				entry = sched->queue;
+				sched->queue = entry->next;
+				acvp_vsid_sched_complete(sched, entry, -EINTR);
+			}
+		}
+
+		now = time(NULL);
+		entry = sched->queue;
+
+		/*
+		 * Either all remaining entries are processed by other
+		 * workers or the next entry is not yet due.
+		 */
+		if (!entry || entry->due > now) {
+			wait.tv_sec = now + ACVP_VSID_SCHED_MAXWAIT;
+			if (entry && entry->due < wait.tv_sec)
+				wait.tv_sec = entry->due;
+			wait.tv_nsec = 0;
+			pthread_cond_timedwait(&sched->cond, &sched->lock,
+					       &wait);
+			continue;
+		}
+
+		sched->queue = entry->next;
+		entry->next = NULL;
+
+		pthread_mutex_unlock(&sched->lock);
+		thread_set_name(acvp_vsid, entry->vsid_ctx->vsid);
+		ret = acvp_vsid_sched_fetch(entry, &sleep_time);
+		pthread_mutex_lock(&sched->lock);
+
+		if (!ret && sleep_time) {
+			entry->due = time(NULL) + (time_t)sleep_time;
+			acvp_vsid_sched_enqueue(sched, entry);
+		} else {
+			acvp_vsid_sched_complete(sched, entry, ret);
+		}
+	}
+
+	pthread_mutex_unlock(&sched->lock);
+
+	return 0;
+}
+
+/*
+ * Download all vsIDs in the array with the scheduler. The calling thread
+ * services the queue as well, additional workers are started in the vsID
+ * thread group.
+ */
+static int acvp_vsid_sched_run(const struct acvp_testid_ctx *testid_ctx,
+			       const uint32_t *vsids, const uint32_t entries)
+{
+	const struct acvp_ctx *ctx = testid_ctx->ctx;
+	const struct acvp_opts_ctx *opts = &ctx->options;
+	struct acvp_vsid_sched sched;
+	unsigned int i, workers = 0, max_workers;
+	int ret = 0;
+
+	memset(&sched, 0, sizeof(sched));
+	if (pthread_mutex_init(&sched.lock, NULL))
+		return -EFAULT;
+	if (pthread_cond_init(&sched.cond, NULL)) {
+		pthread_mutex_destroy(&sched.lock);
+		return -EFAULT;
+	}
+
+	for (i = 0; i < entries; i++) {
+		struct acvp_vsid_sched_entry *entry;
+		struct acvp_vsid_ctx *vsid_ctx;
+
+		vsid_ctx = calloc(1, sizeof(*vsid_ctx));
+		CKNULL(vsid_ctx, -ENOMEM);
+		vsid_ctx->testid_ctx = testid_ctx;
+		vsid_ctx->vsid = vsids[i];
+		if (clock_gettime(CLOCK_REALTIME, &vsid_ctx->start)) {
+			ret = -errno;
+			acvp_release_vsid_ctx(vsid_ctx);
+			goto out;
+		}
 
-	thread_set_name(acvp_vsid, vsid_ctx->vsid);
+		entry = calloc(1, sizeof(*entry));
+		if (!entry) {
+			acvp_release_vsid_ctx(vsid_ctx);
+			ret = -ENOMEM;
+			goto out;
+		}
+		entry->vsid_ctx = vsid_ctx;
+
+		ret = acvp_vsid_url(vsid_ctx, entry->url, sizeof(entry->url),
+				    false);
+		if (ret) {
+			acvp_vsid_sched_release_entry(entry);
+			goto out;
+		}
 
-	ret = acvp_get_testvectors(vsid_ctx);
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+		       "Fetching data for vsID %u\n", vsid_ctx->vsid);
 
-	acvp_release_vsid_ctx(vsid_ctx);
+		/* Queue is not yet serviced, no locking needed */
+		entry->due = time(NULL);
+		acvp_vsid_sched_enqueue(&sched, entry);
+		sched.pending++;
+	}
 
+	/* Disable threading in DEBUG mode */
+	if (opts->threading_disabled) {
+		logger(LOGGER_DEBUG, LOGGER_C_ANY,
+		       "Disable threading support\n");
+	} else {
+		/*
+		 * The calling thread is one worker itself. A handful of
+		 * workers suffices as they only wait for the server, but the
+		 * test session never uses more workers than configured for
+		 * the vsID thread group or vsIDs are pending.
+		 */
+		max_workers = thread_get_limit(1);
+		if (max_workers > ACVP_VSID_SCHED_WORKERS)
+			max_workers = ACVP_VSID_SCHED_WORKERS;
+		if (max_workers > entries)
+			max_workers = entries;
+		if (max_workers)
+			max_workers--;
+
+		while (workers < max_workers) {
+			int ret_ancestor;
+
+			/*
+			 * thread_start waits until the vsID thread group has
+			 * a free slot - the workers started so far service
+			 * the queue meanwhile. If a worker cannot be started
+			 * at all (e.g. during shutdown), the workers started
+			 * so far and the calling thread service the queue.
+			 */
+			if (thread_start(acvp_vsid_sched_worker, &sched, 1,
+					 &ret_ancestor))
+				break;
+			ret |= ret_ancestor;
+			workers++;
+		}
+	}
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY,
+	       "Servicing %u vsIDs of testID %u with %u workers\n", entries,
+	       testid_ctx->testid, workers + 1);
+
+	acvp_vsid_sched_worker(&sched);
+	thread_set_name(acvp_testid, testid_ctx->testid);
+
+	/* All entries are processed, wait for the workers to leave */
+	if (workers)
+		ret |= thread_wait();
+
+	ret |= sched.ret;
+
+out:
+	/* Release entries that were never serviced due to an error */
+	while (sched.queue) {
+		struct acvp_vsid_sched_entry *entry = sched.queue;
+
+		sched.queue = entry->next;
+		acvp_vsid_sched_release_entry(entry);
+	}
+	pthread_cond_destroy(&sched.cond);
+	pthread_mutex_destroy(&sched.lock);
 	return ret;
 }
 #endif
@@ -766,6 +1461,11 @@ static int acvp_process_vectors(const struct acvp_testid_ctx *testid_ctx,
 		goto out;
 	}
 
+#ifdef ACVP_USE_PTHREAD
+	/* Download all vsIDs with the scheduler */
+	CKINT(acvp_vsid_sched_run(testid_ctx, vsid_array.vsids,
+				  vsid_array.entries));
+#else
 	/* Iterate over all vsID and download each */
 	for (i = 0; i < vsid_array.entries; i++) {
 		struct acvp_vsid_ctx *vsid_ctx;
@@ -783,37 +1483,12 @@ static int acvp_process_vectors(const struct acvp_testid_ctx *testid_ctx,
 		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
 		       "Fetching data for vsID %u\n", vsid_ctx->vsid);
 
-#ifdef ACVP_USE_PTHREAD
-		/* Disable threading in DEBUG mode */
-		if (opts->threading_disabled) {
-			logger(LOGGER_DEBUG, LOGGER_C_ANY,
-			       "Disable threading support\n");
-			ret = acvp_get_testvectors(vsid_ctx);
-			acvp_release_vsid_ctx(vsid_ctx);
-			if (ret)
-				goto out;
-		} else {
-			struct acvp_thread_ctx *tdata;
-			int ret_ancestor;
-
-			tdata = calloc(1, sizeof(*tdata));
-			if (!tdata) {
-				acvp_release_vsid_ctx(vsid_ctx);
-				ret = -ENOMEM;
-				goto out;
-			}
-			tdata->vsid_ctx = vsid_ctx;
-			CKINT(thread_start(acvp_process_req_thread, tdata, 1,
-					   &ret_ancestor));
-			ret |= ret_ancestor;
-		}
-#else
 		ret = acvp_get_testvectors(vsid_ctx);
 		acvp_release_vsid_ctx(vsid_ctx);
 		if (ret)
 			goto out;
-#endif
 	}
+#endif
 
 out:
 	if (vsid_array.vsids)
@@ -821,10 +1496,6 @@ out:
 	if (vsid_array.urls)
 		free(vsid_array.urls);
 
-#ifdef ACVP_USE_PTHREAD
-	ret |= thread_wait();
-#endif
-
 	return ret;
 }
 
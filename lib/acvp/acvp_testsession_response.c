@@ -27,6 +27,7 @@
 #include "acvp_error_handler.h"
 #include "logger.h"
 #include "acvpproxy.h"
+#include "json_stream.h"
 #include "json_wrapper.h"
 #include "internal.h"
 #include "request_helper.h"
@@ -471,32 +472,83 @@ out:
 	return ret;
 }
 
+static int acvp_request_sample_write(void *ctx, const uint8_t *data,
+				     uint32_t len)
+{
+	FILE *out = (FILE *)ctx;
+
+	if (fwrite(data, 1, len, out) != len)
+		return -EIO;
+
+	return 0;
+}
+
+/*
+ * Add the showExpected keyword to the response without parsing the entire
+ * response into a JSON object tree. The modified response is streamed into an
+ * unlinked temporary file which is uploaded from its mapping just like the
+ * original response file. Thus, the response is never held in the heap.
+ */
 static int acvp_request_sample_vsid(const struct acvp_vsid_ctx *vsid_ctx,
 				    const struct acvp_ext_buf *buf)
 {
-	struct json_object *full = NULL, *response;
-	const char *new_str;
-	ACVP_BUFFER_INIT(tmp_buf);
+	const struct acvp_net_proto *proto;
+	struct acvp_buf_sink sink = { .write = acvp_request_sample_write };
+	struct json_stream *js = NULL;
 	ACVP_EXT_BUFFER_INIT(new_buf);
+	FILE *out = NULL;
 	int ret;
 
-	tmp_buf.buf = buf->buf;
-	tmp_buf.len = buf->len;
-	CKINT_LOG(acvp_req_strip_version(&tmp_buf, &full, &response),
-		  "Cannot parse response data %s\n", buf->buf);
-	CKINT(json_object_object_add(response, "showExpected",
-				     json_object_new_boolean(true)));
+	CKINT(acvp_get_proto(&proto));
+
+	js = calloc(1, sizeof(*js));
+	CKNULL(js, -ENOMEM);
+	json_stream_init(js);
+	js->version_keyword = proto->proto_version_keyword;
+	js->inject = "\"showExpected\": true";
+	js->out = &sink;
+
+	out = tmpfile();
+	if (!out) {
+		ret = -errno;
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "Cannot create temporary file for the response (%d)\n",
+		       ret);
+		goto out;
+	}
+	sink.ctx = out;
+
+	ret = json_stream_update(js, buf->buf, buf->len);
+	if (!ret)
+		ret = json_stream_final(js);
+	if (ret) {
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "Cannot parse response data %.*s\n", (int)buf->len,
+		       buf->buf);
+		goto out;
+	}
+
+	if (js->inject_replaced) {
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+		       "Response for vsID %u already contains showExpected which is set to true\n",
+		       vsid_ctx->vsid);
+	}
+
+	if (fflush(out)) {
+		ret = -errno;
+		goto out;
+	}
 
-	new_str = json_object_to_json_string_ext(
-		full, JSON_C_TO_STRING_PRETTY | JSON_C_TO_STRING_NOSLASHESCAPE);
-	CKNULL(new_str, -EFAULT);
-	new_buf.buf = (uint8_t *)new_str;
-	new_buf.len = (uint32_t)strlen(new_str);
+	CKINT(acvp_ext_buf_map_fd(fileno(out), "response sample", &new_buf));
 
 	CKINT(acvp_check_large_endpoint(vsid_ctx, &new_buf));
 
 out:
-	ACVP_JSON_PUT_NULL(full);
+	acvp_ext_buf_unmap(&new_buf);
+	if (out)
+		fclose(out);
+	if (js)
+		free(js);
 	return ret;
 }
 
@@ -592,13 +644,12 @@ out:
 }
 
 static int acvp_process_one_vsid(const struct acvp_vsid_ctx *vsid_ctx,
-				 const struct acvp_buf *buf)
+				 const struct acvp_ext_buf *buf)
 {
 	const struct acvp_testid_ctx *testid_ctx;
 	const struct acvp_ctx *ctx;
 	const struct acvp_req_ctx *req;
 	const struct acvp_opts_ctx *opts;
-	ACVP_EXT_BUFFER_INIT(tmp_buf);
 	int ret;
 
 	CKNULL_LOG(vsid_ctx, -EINVAL, "ACVP vsID request context missing\n");
@@ -675,9 +726,7 @@ static int acvp_process_one_vsid(const struct acvp_vsid_ctx *vsid_ctx,
 	atomic_inc((atomic_t *)&testid_ctx->vsids_to_process);
 	atomic_inc(&glob_vsids_to_process);
 
-	tmp_buf.buf = buf->buf;
-	tmp_buf.len = buf->len;
-	ret = acvp_response_submit_one(vsid_ctx, &tmp_buf);
+	ret = acvp_response_submit_one(vsid_ctx, buf);
 
 	/* Store the time the upload took */
 	acvp_record_vsid_duration(vsid_ctx, ACVP_DS_UPLOADDURATION);
@@ -894,7 +943,6 @@ int acvp_process_testids(const struct acvp_ctx *ctx,
 	const struct acvp_search_ctx *search;
 	const struct acvp_opts_ctx *opts;
 	const struct definition *def;
-	uint32_t testids[ACVP_REQ_MAX_FAILED_TESTID];
 	int ret = 0;
 
 	CKNULL_LOG(ctx, -EINVAL, "ACVP request context missing\n");
@@ -935,12 +983,12 @@ int acvp_process_testids(const struct acvp_ctx *ctx,
 
 	/* Iterate through all modules */
 	while (def) {
-		unsigned int testid_count = ACVP_REQ_MAX_FAILED_TESTID;
-		unsigned int i;
+		const uint32_t *testids;
+		unsigned int testid_count, i;
 
 		/* Search for all testids for a given module */
-		CKINT(ds->acvp_datastore_find_testsession(def, ctx, testids,
-							  &testid_count));
+		CKINT(acvp_testids_index_get(ctx, def, &testids,
+					     &testid_count));
 
 		/* Iterate through all testids */
 		for (i = 0; i < testid_count; i++) {
@@ -979,6 +1027,9 @@ out:
 	ret |= thread_wait();
 #endif
 
+	/* The operation may have changed the data store */
+	acvp_testids_index_release(ctx);
+
 	return ret;
 }
 
@@ -988,7 +1039,6 @@ int acvp_testids_refresh(const struct acvp_ctx *ctx)
 	const struct acvp_search_ctx *search;
 	const struct definition *def;
 	struct acvp_testid_ctx *testid_ctx_head = NULL;
-	uint32_t testids[ACVP_REQ_MAX_FAILED_TESTID];
 	int ret = 0;
 
 	CKNULL_LOG(ctx, -EINVAL, "ACVP request context missing\n");
@@ -1016,12 +1066,12 @@ int acvp_testids_refresh(const struct acvp_ctx *ctx)
 	 * members of that linked list are in need to get their JWT refreshed.
 	 */
 	while (def) {
-		unsigned int testid_count = ACVP_REQ_MAX_FAILED_TESTID;
-		unsigned int i;
+		const uint32_t *testids;
+		unsigned int testid_count, i;
 
 		/* Search for all testids for a given module */
-		CKINT(ds->acvp_datastore_find_testsession(def, ctx, testids,
-							  &testid_count));
+		CKINT(acvp_testids_index_get(ctx, def, &testids,
+					     &testid_count));
 
 		/* Iterate through all testids */
 		for (i = 0; i < testid_count; i++) {
@@ -1090,7 +1140,7 @@ out:
 }
 
 static int acvp_fetch_one_verdict_vsid(const struct acvp_vsid_ctx *vsid_ctx,
-				       const struct acvp_buf *buf)
+				       const struct acvp_ext_buf *buf)
 {
 	const struct acvp_testid_ctx *testid_ctx;
 	int ret;
@@ -282,6 +282,13 @@ struct acvp_opts_ctx {
 	 */
 	bool upload_only;
 
+	/*
+	 * Store the downloaded test vectors compressed with gzip in the data
+	 * store. Compressed test vectors and test responses are always read
+	 * transparently.
+	 */
+	bool compress_datastore;
+
 	/*
 	 * Delete an entry in the ACVP database. The ID is taken from the
 	 * module's JSON configuration file.
@@ -466,6 +473,133 @@ int acvp_set_net(const char *server_name, unsigned int port, const char *ca,
 		 const char *client_cert_keychain_ref, const char *client_key,
 		 const char *passcode);
 
+/**
+ * @brief Configure the compression of the HTTP communication with the
+ *	  ACVP server
+ *
+ * NOTE: This call must be made after acvp_set_net.
+ *
+ * @param accept_compression [in] Offer the server to send gzip or deflate
+ *				  compressed response bodies
+ * @param compress_request [in] Send the request bodies of PUT and POST
+ *				operations gzip compressed - this option must
+ *				only be enabled if the server supports it
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_set_net_compression(bool accept_compression, bool compress_request);
+
+/**
+ * @brief Use HTTP/2 for the communication with the ACVP server
+ *
+ * When enabled, HTTP/2 is negotiated during the TLS handshake and the
+ * concurrent requests of all threads are multiplexed as HTTP/2 streams over
+ * a small number of shared connections. If the server does not support
+ * HTTP/2, HTTP/1.1 is used.
+ *
+ * NOTE: This call must be made after acvp_set_net.
+ *
+ * @param enable [in] Use HTTP/2 if the server supports it
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_set_net_http2(bool enable);
+
+/**
+ * @brief Configure the limiter of the request rate to the ACVP server
+ *
+ * All requests obtain a token from a token bucket that is refilled with the
+ * current request rate. The rate starts with rate_start requests per second.
+ * It grows by one request per second after every round of successful
+ * requests up to rate_max and it is halved down to rate_min when the server
+ * throttles the requests (HTTP 429, 502, 503, 504).
+ *
+ * By default, the limiter is enabled with a start rate of ACVP_NET_RATE_START,
+ * a minimum rate of ACVP_NET_RATE_MIN and a maximum rate of ACVP_NET_RATE_MAX
+ * requests per second.
+ *
+ * @param enable [in] Limit the request rate - if false, the requests are sent
+ *		      without delay, only throttled requests pause all requests
+ *		      for a backoff time
+ * @param rate_start [in] Initial request rate per second
+ * @param rate_min [in] Minimum request rate per second (at least 1)
+ * @param rate_max [in] Maximum request rate per second
+ *
+ * @return 0 on success, -EINVAL if rate_min <= rate_start <= rate_max does not
+ *	   hold
+ */
+#define ACVP_NET_RATE_START 16
+#define ACVP_NET_RATE_MIN 1
+#define ACVP_NET_RATE_MAX 64
+int acvp_set_net_rate_limit(bool enable, unsigned int rate_start,
+			    unsigned int rate_min, unsigned int rate_max);
+
+/**
+ * @brief Configure the syncing of data store writes to disk
+ *
+ * All files of the data store are written to a temporary file that is synced
+ * to disk and renamed to its final name. Thus, a crash never leaves a
+ * truncated file behind. To avoid one sync per file, a background thread
+ * collects the sync requests of all threads for the given interval and
+ * commits them together with one syncfs per file system or one fdatasync
+ * per file. A writer returns once its file is committed.
+ *
+ * By default, syncing is enabled with an interval of
+ * ACVP_DATASTORE_SYNC_INTERVAL milliseconds.
+ *
+ * @param enable [in] Sync the written files to disk - if false, the files are
+ *		      still written atomically, but a crash may lose them
+ * @param interval_ms [in] Interval in milliseconds collecting the sync
+ *			   requests of one batch - 0 syncs each file
+ *			   immediately in the writing thread
+ */
+#define ACVP_DATASTORE_SYNC_INTERVAL 10
+void acvp_set_datastore_sync(bool enable, unsigned int interval_ms);
+
+/**
+ * @brief Store the test session data in log files
+ *
+ * When enabled, all artifacts of a test session are kept in one append-only,
+ * checksummed log file <testID>.acvplog in the module directory of the data
+ * store (and of the secure data store for the sensitive data) instead of one
+ * file per artifact. The log backend does not compress the stored data.
+ *
+ * NOTE: The setting applies process-wide and must be made before the first
+ * test session is accessed.
+ *
+ * @param enable [in] Use the log backend if true, the file backend otherwise
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_set_datastore_log(bool enable);
+
+/**
+ * @brief Convert the test session directories found in the data store into
+ *	  the log files used by the log backend
+ *
+ * The files of all test session directories are appended to the log of the
+ * respective test session unless the log holds identical data already. Thus,
+ * the import can be repeated. The test session directories are not modified.
+ *
+ * @param ctx [in] ACVP Proxy library context
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_datastore_log_import(const struct acvp_ctx *ctx);
+
+/**
+ * @brief Convert the log files of the log backend found in the data store into
+ *	  the test session directories used by the file backend
+ *
+ * Files in the test session directories which are newer than the record of
+ * the log are left untouched. The log files are not modified.
+ *
+ * @param ctx [in] ACVP Proxy library context
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_datastore_log_export(const struct acvp_ctx *ctx);
+
 /**
  * @brief Define the module specification for which test vectors are to be
  *	  obtained or for which test results are to be submitted. The search
@@ -690,6 +824,36 @@ int acvp_list_unregistered_definitions(void);
  */
 int acvp_def_config(const char *directory);
 
+/**
+ * @brief Enable or disable the snapshot of the module definitions.
+ *
+ * When loading a module definition directory, the loaded definitions are
+ * stored in a binary snapshot file in the snapshot directory (see
+ * acvp_def_set_snapshot_dir). The file name is derived from the path name of
+ * the module definition directory. As long as the configuration files and the
+ * compiled algorithm definitions are unchanged, subsequent loads of the
+ * directory use the snapshot instead of parsing the configuration files. If
+ * the snapshot cannot be written, the configuration files are parsed every
+ * time. The snapshot is enabled by default.
+ *
+ * @param enable [in] Use and generate the snapshot
+ */
+void acvp_def_set_snapshot(bool enable);
+
+/**
+ * @brief Set the directory holding the snapshots of the module definitions.
+ *
+ * This function must be called before acvp_def_config to take effect. By
+ * default, the snapshots are stored in the default secure data store
+ * directory.
+ *
+ * @param directory [in] Directory for the snapshots, usually the secure data
+ *			 store base directory - NULL restores the default
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_def_set_snapshot_dir(const char *directory);
+
 /**
  * @brief Load all module definition configurations from the default
  *	  configuration directory.
@@ -713,6 +877,26 @@ int acvp_def_default_config(const char *config_basedir);
  */
 int acvp_set_options(struct acvp_ctx *ctx, const struct acvp_opts_ctx *options);
 
+/**
+ * @brief Limit the number of concurrently processed test sessions and vsIDs.
+ *
+ * The test sessions and the vsIDs are processed by separate sets of threads.
+ * By default, each set may use half of all available threads. With this
+ * call, the concurrency can be sized to what the ACVP server accepts. Idle
+ * test session threads help processing pending vsIDs.
+ *
+ * NOTE: This call must be made after acvp_init and before any operation
+ *	 is performed.
+ *
+ * @param testid_limit [in] Maximum number of test sessions processed
+ *			    concurrently (0 uses the remaining threads)
+ * @param vsid_limit [in] Maximum number of vsIDs processed concurrently
+ *			  (0 uses the remaining threads)
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_set_threading_limits(uint32_t testid_limit, uint32_t vsid_limit);
+
 /**
  * @brief List all testIDs where the download of vectors failed
  *
@@ -20,28 +20,112 @@
 
 #include <sys/types.h>
 #include <dirent.h>
+#include <limits.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 #include "acvpproxy.h"
+#include "datastore_sync.h"
 #include "definition.h"
 #include "internal.h"
 #include "json_wrapper.h"
 #include "logger.h"
 #include "mutex.h"
 #include "request_helper.h"
+#include "threading_support.h"
 
-/* List of instantiated module definitions */
+/*
+ * Registry of the instantiated module definitions
+ *
+ * The definitions are kept in registration order in def_vec. The position of
+ * a definition in def_vec is stored in the definition and serves as cursor for
+ * acvp_find_def. For the module name, vendor name, execution environment and
+ * processor search criteria, an index maps each string found in the
+ * definitions to the ascending positions of the definitions carrying it.
+ * Definitions without such a string match any search string and are kept in
+ * the wildcard list of the index.
+ */
 static DEFINE_MUTEX_UNLOCKED(def_mutex);
-static struct definition *def_head = NULL;
+static struct definition **def_vec = NULL;
+static unsigned int def_nr = 0, def_alloc = 0;
+
+#define ACVP_DEF_INDEX_BITS 8
+#define ACVP_DEF_INDEX_SIZE (1 << ACVP_DEF_INDEX_BITS)
+#define ACVP_DEF_INDEX_END UINT_MAX
+
+struct acvp_def_index_list {
+	unsigned int *pos;
+	unsigned int nr;
+	unsigned int alloc;
+};
+
+struct acvp_def_index_key {
+	struct acvp_def_index_key *next;
+	char *key;
+	struct acvp_def_index_list list;
+};
+
+struct acvp_def_index {
+	struct acvp_def_index_key *table[ACVP_DEF_INDEX_SIZE];
+	struct acvp_def_index_list wildcard;
+};
+
+enum acvp_def_index_type {
+	acvp_def_index_module,
+	acvp_def_index_vendor,
+	acvp_def_index_execenv,
+	acvp_def_index_processor,
+
+	acvp_def_index_last,
+};
+
+static struct acvp_def_index def_index[acvp_def_index_last];
 
 /* List of uninstantiated module definitions */
 static DEFINE_MUTEX_UNLOCKED(def_uninstantiated_mutex);
 static struct def_algo_map *def_uninstantiated_head = NULL;
 
-static DEFINE_MUTEX_UNLOCKED(def_file_access_mutex);
+/*
+ * Write-behind cache of updated configuration files
+ *
+ * Updates of a configuration file are applied to its cached JSON document
+ * which is written back once with acvp_def_flush. Readers of the file are
+ * served from the cache. Each file has its own lock, the list lock is taken
+ * for writing only to add entries and to flush the cache.
+ */
+struct acvp_def_pending {
+	struct acvp_def_pending *next;
+	struct json_object *config;
+	char *pathname;
+	mutex_t lock;
+	bool dirty;
+};
+
+static DEFINE_MUTEX_UNLOCKED(def_pending_mutex);
+static struct acvp_def_pending *def_pending_head = NULL;
+
+/*
+ * Parsed configuration files
+ *
+ * Each configuration file is parsed once and shared by all combinations of
+ * vendor, module, OE and implementation files it is part of. An entry is
+ * reused as long as the file's inode, size and modification time are
+ * unchanged.
+ */
+struct acvp_def_cache_entry {
+	struct acvp_def_cache_entry *next;
+	struct json_object *config;
+	char *pathname;
+	struct timespec mtime;
+	off_t size;
+	ino_t ino;
+	int ret;
+};
+
+static DEFINE_MUTEX_UNLOCKED(def_cache_mutex);
+static struct acvp_def_cache_entry *def_cache_head = NULL;
 
 /*****************************************************************************
  * Conversions
@@ -157,6 +241,228 @@ static void acvp_def_dealloc_unused_lock(struct def_lock *lock)
  * Runtime registering code for cipher definitions
  *****************************************************************************/
 
+static unsigned int acvp_def_index_hash(const char *str)
+{
+	uint32_t hash = 2166136261U;
+
+	/* FNV-1a */
+	while (*str) {
+		hash ^= (uint8_t)*str++;
+		hash *= 16777619U;
+	}
+
+	return hash & (ACVP_DEF_INDEX_SIZE - 1);
+}
+
+static int acvp_def_index_list_add(struct acvp_def_index_list *list,
+				   unsigned int pos)
+{
+	/* A definition may carry the same string multiple times */
+	if (list->nr && list->pos[list->nr - 1] == pos)
+		return 0;
+
+	if (list->nr >= list->alloc) {
+		unsigned int *tmp;
+		unsigned int alloc = list->alloc ? list->alloc * 2 : 8;
+
+		tmp = realloc(list->pos, alloc * sizeof(*tmp));
+		if (!tmp)
+			return -ENOMEM;
+		list->pos = tmp;
+		list->alloc = alloc;
+	}
+
+	list->pos[list->nr++] = pos;
+	return 0;
+}
+
+/* Return the first position in the list that is not smaller than pos */
+static unsigned int acvp_def_index_list_next(
+	const struct acvp_def_index_list *list, unsigned int pos)
+{
+	unsigned int low = 0, high = list->nr;
+
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
+
+		if (list->pos[mid] < pos)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return (low < list->nr) ? list->pos[low] : ACVP_DEF_INDEX_END;
+}
+
+static struct acvp_def_index_key *
+acvp_def_index_find(const struct acvp_def_index *index, const char *key)
+{
+	struct acvp_def_index_key *entry;
+
+	for (entry = index->table[acvp_def_index_hash(key)]; entry;
+	     entry = entry->next) {
+		if (!strcmp(entry->key, key))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static int acvp_def_index_add(struct acvp_def_index *index, const char *key,
+			      unsigned int pos)
+{
+	struct acvp_def_index_key *entry;
+	int ret;
+
+	if (!key)
+		return acvp_def_index_list_add(&index->wildcard, pos);
+
+	entry = acvp_def_index_find(index, key);
+	if (!entry) {
+		unsigned int hash = acvp_def_index_hash(key);
+
+		entry = calloc(1, sizeof(*entry));
+		CKNULL(entry, -ENOMEM);
+
+		/* The definition strings may be changed with a rename */
+		ret = acvp_duplicate(&entry->key, key);
+		if (ret) {
+			free(entry);
+			goto out;
+		}
+
+		entry->next = index->table[hash];
+		index->table[hash] = entry;
+	}
+
+	CKINT(acvp_def_index_list_add(&entry->list, pos));
+
+out:
+	return ret;
+}
+
+static void acvp_def_index_free(struct acvp_def_index *index)
+{
+	unsigned int i;
+
+	for (i = 0; i < ACVP_DEF_INDEX_SIZE; i++) {
+		struct acvp_def_index_key *entry = index->table[i];
+
+		while (entry) {
+			struct acvp_def_index_key *curr = entry;
+
+			entry = entry->next;
+			if (curr->list.pos)
+				free(curr->list.pos);
+			free(curr->key);
+			free(curr);
+		}
+	}
+
+	if (index->wildcard.pos)
+		free(index->wildcard.pos);
+	memset(index, 0, sizeof(*index));
+}
+
+/* Add the search strings of the definition to the indexes - def_mutex held */
+static int acvp_def_index_def(const struct definition *def, unsigned int pos)
+{
+	const struct def_dependency *def_dep;
+	bool execenv_found = false, processor_found = false;
+	int ret;
+
+	CKINT(acvp_def_index_add(&def_index[acvp_def_index_module],
+				 def->info ? def->info->module_name : NULL,
+				 pos));
+	CKINT(acvp_def_index_add(&def_index[acvp_def_index_vendor],
+				 def->vendor ? def->vendor->vendor_name : NULL,
+				 pos));
+
+	for (def_dep = def->oe ? def->oe->def_dep : NULL; def_dep;
+	     def_dep = def_dep->next) {
+		switch (def_dep->def_dependency_type) {
+		case def_dependency_firmware:
+		case def_dependency_os:
+		case def_dependency_software:
+			CKINT(acvp_def_index_add(
+				&def_index[acvp_def_index_execenv],
+				def_dep->name, pos));
+			execenv_found = true;
+			break;
+		case def_dependency_hardware:
+			CKINT(acvp_def_index_add(
+				&def_index[acvp_def_index_processor],
+				def_dep->proc_name, pos));
+			processor_found = true;
+			break;
+		default:
+			break;
+		}
+	}
+
+	/* Without a dependency of the type, any search string matches */
+	if (!execenv_found) {
+		CKINT(acvp_def_index_add(&def_index[acvp_def_index_execenv],
+					 NULL, pos));
+	}
+	if (!processor_found) {
+		CKINT(acvp_def_index_add(&def_index[acvp_def_index_processor],
+					 NULL, pos));
+	}
+
+out:
+	return ret;
+}
+
+/*
+ * Return the first position not smaller than pos of a definition that may
+ * match the search string and the number of candidates - def_mutex held.
+ */
+static unsigned int acvp_def_index_next(const struct acvp_def_index *index,
+					const char *searchstr, bool fuzzy,
+					unsigned int pos, unsigned int *count)
+{
+	unsigned int next, i;
+
+	next = acvp_def_index_list_next(&index->wildcard, pos);
+	*count = index->wildcard.nr;
+
+	if (!fuzzy) {
+		const struct acvp_def_index_key *entry =
+			acvp_def_index_find(index, searchstr);
+
+		if (entry) {
+			unsigned int cand =
+				acvp_def_index_list_next(&entry->list, pos);
+
+			if (cand < next)
+				next = cand;
+			*count += entry->list.nr;
+		}
+
+		return next;
+	}
+
+	/* A fuzzy search is a substring search over the distinct strings */
+	for (i = 0; i < ACVP_DEF_INDEX_SIZE; i++) {
+		const struct acvp_def_index_key *entry;
+
+		for (entry = index->table[i]; entry; entry = entry->next) {
+			unsigned int cand;
+
+			if (!strstr(entry->key, searchstr))
+				continue;
+
+			cand = acvp_def_index_list_next(&entry->list, pos);
+			if (cand < next)
+				next = cand;
+			*count += entry->list.nr;
+		}
+	}
+
+	return next;
+}
+
 /**
  * @brief Register one cipher module implementation with the library. This
  *	  function is intended to be invoked in the constructor of the library,
@@ -166,36 +472,46 @@ static void acvp_def_dealloc_unused_lock(struct def_lock *lock)
  *
  * @param curr_def Pointer to the definition to be registered.
  */
-static void acvp_register_def(struct definition *curr_def)
+static int acvp_register_def(struct definition *curr_def)
 {
-	struct definition *tmp_def;
+	int ret = 0;
 
 	/* Safety-measure to prevent programming bugs to affect us. */
 	curr_def->next = NULL;
 
 	mutex_lock(&def_mutex);
-	if (!def_head) {
-		def_head = curr_def;
+
+	/* do not re-register */
+	if (curr_def->registry_idx < def_nr &&
+	    def_vec[curr_def->registry_idx] == curr_def) {
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "Programming bug: re-registering definition!\n");
 		goto out;
 	}
 
-	for (tmp_def = def_head; tmp_def != NULL; tmp_def = tmp_def->next) {
-		/* do not re-register */
-		if (curr_def == tmp_def) {
-			logger(LOGGER_ERR, LOGGER_C_ANY,
-			       "Programming bug: re-registering definition!\n");
-			goto out;
-		}
+	if (def_nr >= def_alloc) {
+		struct definition **tmp;
+		unsigned int alloc = def_alloc ? def_alloc * 2 : 64;
 
-		if (!tmp_def->next) {
-			tmp_def->next = curr_def;
-			goto out;
-		}
+		tmp = realloc(def_vec, alloc * sizeof(*tmp));
+		CKNULL(tmp, -ENOMEM);
+		def_vec = tmp;
+		def_alloc = alloc;
 	}
 
+	/*
+	 * The definition only becomes visible once it is fully indexed. A
+	 * failure leaves at most stale positions beyond def_nr in the index
+	 * which are harmless as every candidate is matched in full.
+	 */
+	CKINT(acvp_def_index_def(curr_def, def_nr));
+	curr_def->registry_idx = def_nr;
+	def_vec[def_nr] = curr_def;
+	def_nr++;
+
 out:
 	mutex_unlock(&def_mutex);
-	return;
+	return ret;
 }
 
 static int acvp_match_def_search(const struct acvp_search_ctx *search,
@@ -257,10 +573,73 @@ static int acvp_match_def_search(const struct acvp_search_ctx *search,
 	return 0;
 }
 
+/*
+ * Find the position of the next definition starting at pos which matches the
+ * search criteria. The candidates are taken from the index of the most
+ * selective search criterion - def_mutex held.
+ */
+static unsigned int acvp_def_find_pos(const struct acvp_search_ctx *search,
+				      unsigned int pos)
+{
+	const struct acvp_def_index *index = NULL;
+	const char *searchstr[acvp_def_index_last], *indexstr = NULL;
+	bool fuzzy[acvp_def_index_last], indexfuzzy = false;
+	unsigned int i, best = ACVP_DEF_INDEX_END;
+
+	searchstr[acvp_def_index_module] = search->modulename;
+	fuzzy[acvp_def_index_module] = search->modulename_fuzzy_search;
+	searchstr[acvp_def_index_vendor] = search->vendorname;
+	fuzzy[acvp_def_index_vendor] = search->vendorname_fuzzy_search;
+	searchstr[acvp_def_index_execenv] = search->execenv;
+	fuzzy[acvp_def_index_execenv] = search->execenv_fuzzy_search;
+	searchstr[acvp_def_index_processor] = search->processor;
+	fuzzy[acvp_def_index_processor] = search->processor_fuzzy_search;
+
+	for (i = 0; i < acvp_def_index_last; i++) {
+		unsigned int count;
+
+		if (!searchstr[i])
+			continue;
+
+		acvp_def_index_next(&def_index[i], searchstr[i], fuzzy[i], pos,
+				    &count);
+		if (count < best) {
+			best = count;
+			index = &def_index[i];
+			indexstr = searchstr[i];
+			indexfuzzy = fuzzy[i];
+		}
+	}
+
+	while (pos < def_nr) {
+		const struct definition *def;
+		unsigned int count;
+
+		/* Without a search string, every definition is a candidate */
+		if (index) {
+			pos = acvp_def_index_next(index, indexstr, indexfuzzy,
+						  pos, &count);
+			if (pos >= def_nr)
+				break;
+		}
+
+		def = def_vec[pos];
+
+		if (!acvp_match_def_search(search, def) &&
+		    (!search->with_es_def || def->es))
+			return pos;
+
+		pos++;
+	}
+
+	return ACVP_DEF_INDEX_END;
+}
+
 const struct definition *acvp_find_def(const struct acvp_search_ctx *search,
 				       const struct definition *processed_ptr)
 {
 	const struct definition *tmp_def = NULL;
+	unsigned int pos = 0;
 
 	mutex_reader_lock(&def_mutex);
 
@@ -269,39 +648,20 @@ const struct definition *acvp_find_def(const struct acvp_search_ctx *search,
 		 * Guarantee that the pointer is valid as we unlock the mutex
 		 * when returning.
 		 */
-		for (tmp_def = def_head; tmp_def != NULL;
-		     tmp_def = tmp_def->next) {
-			if (tmp_def == processed_ptr)
-				break;
-		}
-
-		if (!tmp_def) {
+		pos = processed_ptr->registry_idx;
+		if (pos >= def_nr || def_vec[pos] != processed_ptr) {
 			logger(LOGGER_WARN, LOGGER_C_ANY,
 			       "Processed pointer is not known to definition list! - Programming Bug at file %s line %d\n",
 			       __FILE__, __LINE__);
 			goto out;
 		}
 
-		tmp_def = processed_ptr->next;
-	} else {
-		tmp_def = def_head;
+		pos++;
 	}
 
-	for (; tmp_def != NULL; tmp_def = tmp_def->next) {
-		int ret = acvp_match_def_search(search, tmp_def);
-
-		if (ret == -ENOENT)
-			continue;
-		else if (ret) {
-			tmp_def = NULL;
-			goto out;
-		}
-
-		if (search->with_es_def && !tmp_def->es)
-			continue;
-
-		break;
-	}
+	pos = acvp_def_find_pos(search, pos);
+	if (pos < def_nr)
+		tmp_def = def_vec[pos];
 
 out:
 	mutex_reader_unlock(&def_mutex);
@@ -1093,15 +1453,14 @@ out:
  */
 static int acvp_def_wire_deps(void)
 {
-	struct definition *curr_def;
+	unsigned int curr_pos;
 	int ret = 0;
 
 	mutex_lock(&def_mutex);
-	if (!def_head)
-		goto out;
 
-	/* Iterate through the linked list of the registered definitions. */
-	for (curr_def = def_head; curr_def != NULL; curr_def = curr_def->next) {
+	/* Iterate through the registered definitions. */
+	for (curr_pos = 0; curr_pos < def_nr; curr_pos++) {
+		struct definition *curr_def = def_vec[curr_pos];
 		const struct def_vendor *vendor;
 		const struct def_oe *oe;
 		const struct def_info *curr_info;
@@ -1138,7 +1497,7 @@ static int acvp_def_wire_deps(void)
 
 		/* Iterate through the dependencies */
 		for (deps = curr_def->deps; deps != NULL; deps = deps->next) {
-			struct definition *s_def;
+			unsigned int pos;
 
 			/*
 			 * We have an external certificate reference. The user
@@ -1149,11 +1508,12 @@ static int acvp_def_wire_deps(void)
 				continue;
 
 			/*
-			 * Search through all definitions for a match of the
-			 * impl_name.
+			 * Search through all definitions applying to our
+			 * environment for a match of the impl_name.
 			 */
-			for (s_def = def_head; s_def != NULL;
-			     s_def = s_def->next) {
+			for (pos = acvp_def_find_pos(&search, 0); pos < def_nr;
+			     pos = acvp_def_find_pos(&search, pos + 1)) {
+				struct definition *s_def = def_vec[pos];
 				struct def_info *info = s_def->info;
 
 				CKNULL(info, -EFAULT);
@@ -1175,13 +1535,6 @@ static int acvp_def_wire_deps(void)
 				if (s_def == curr_def)
 					continue;
 
-				/*
-				 * Make sure that the dependency applies to our
-				 * environment.
-				 */
-				if (acvp_match_def_search(&search, s_def))
-					continue;
-
 				/* We found a match, wire it up */
 				deps->dependency = s_def;
 				logger(LOGGER_DEBUG, LOGGER_C_ANY,
@@ -1251,58 +1604,91 @@ static void acvp_def_release(struct definition *def)
 	free(def);
 }
 
-void acvp_def_release_all(void)
+static void acvp_def_cache_free(struct acvp_def_cache_entry *entry)
 {
-	struct definition *def = NULL;
+	if (!entry)
+		return;
 
-	mutex_lock(&def_mutex);
-	if (!def_head)
-		goto out;
+	ACVP_JSON_PUT_NULL(entry->config);
+	if (entry->pathname)
+		free(entry->pathname);
+	free(entry);
+}
 
-	def = def_head;
+static void acvp_def_cache_release(void)
+{
+	struct acvp_def_cache_entry *entry;
 
-	while (def) {
-		struct definition *curr = def;
+	mutex_lock(&def_cache_mutex);
+	entry = def_cache_head;
+	while (entry) {
+		struct acvp_def_cache_entry *curr = entry;
 
-		def = def->next;
-		acvp_def_release(curr);
+		entry = entry->next;
+		acvp_def_cache_free(curr);
 	}
+	def_cache_head = NULL;
+	mutex_unlock(&def_cache_mutex);
+}
+
+void acvp_def_release_all(void)
+{
+	unsigned int i;
 
-	def_head = NULL;
+	/* Write the pending updates before the definitions are gone */
+	acvp_def_flush();
+
+	mutex_lock(&def_mutex);
+
+	for (i = 0; i < def_nr; i++)
+		acvp_def_release(def_vec[i]);
+
+	if (def_vec)
+		free(def_vec);
+	def_vec = NULL;
+	def_nr = 0;
+	def_alloc = 0;
+
+	for (i = 0; i < acvp_def_index_last; i++)
+		acvp_def_index_free(&def_index[i]);
 
-out:
 	mutex_unlock(&def_mutex);
+	acvp_def_cache_release();
 	return;
 }
 
-static int acvp_def_write_json(struct json_object *config, const char *pathname)
+void acvp_def_reindex(void)
 {
-	int ret, fd;
-
-	mutex_lock(&def_file_access_mutex);
+	unsigned int i;
+	int ret = 0;
 
-	fd = open(pathname, O_WRONLY | O_TRUNC);
-	if (fd < 0)
-		return -errno;
+	mutex_lock(&def_mutex);
 
-	ret = json_object_to_fd(fd, config,
-				JSON_C_TO_STRING_PRETTY |
-					JSON_C_TO_STRING_NOSLASHESCAPE);
+	for (i = 0; i < acvp_def_index_last; i++)
+		acvp_def_index_free(&def_index[i]);
 
-	close(fd);
+	for (i = 0; i < def_nr; i++) {
+		ret = acvp_def_index_def(def_vec[i], i);
+		if (ret)
+			break;
+	}
 
-	mutex_unlock(&def_file_access_mutex);
+	/* Without an index, no search would find a definition any more */
+	if (ret) {
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "Rebuilding definition index failed: %d\n", ret);
+	}
 
-	return ret;
+	mutex_unlock(&def_mutex);
 }
 
-static int acvp_def_read_json(struct json_object **config, const char *pathname)
+static int acvp_def_read_file(struct json_object **config,
+			      const char *pathname)
 {
 	struct json_object *filecontent;
 	int ret = 0, fd;
 
-	mutex_reader_lock(&def_file_access_mutex);
-
+	/* Files are replaced atomically, thus no lock is needed */
 	fd = open(pathname, O_RDONLY);
 	if (fd < 0)
 		return -errno;
@@ -1315,7 +1701,179 @@ static int acvp_def_read_json(struct json_object **config, const char *pathname)
 	*config = filecontent;
 
 out:
-	mutex_reader_unlock(&def_file_access_mutex);
+	return ret;
+}
+
+/* Caller holds def_pending_mutex */
+static struct acvp_def_pending *acvp_def_pending_find(const char *pathname)
+{
+	struct acvp_def_pending *pending;
+
+	for (pending = def_pending_head; pending; pending = pending->next) {
+		if (!strcmp(pending->pathname, pathname))
+			return pending;
+	}
+
+	return NULL;
+}
+
+static void acvp_def_pending_put(struct acvp_def_pending *pending)
+{
+	mutex_unlock(&pending->lock);
+	mutex_reader_unlock(&def_pending_mutex);
+}
+
+/*
+ * Get the cache entry of the file with its lock taken - the caller must
+ * release it with acvp_def_pending_put. If load is true, the document is read
+ * from the file if it is not yet cached.
+ */
+static int acvp_def_pending_get(const char *pathname, bool load,
+				struct acvp_def_pending **pending_out)
+{
+	struct acvp_def_pending *pending;
+	int ret;
+
+	for (;;) {
+		mutex_reader_lock(&def_pending_mutex);
+		pending = acvp_def_pending_find(pathname);
+		if (pending)
+			break;
+		mutex_reader_unlock(&def_pending_mutex);
+
+		mutex_lock(&def_pending_mutex);
+		if (!acvp_def_pending_find(pathname)) {
+			pending = calloc(1, sizeof(*pending));
+			if (!pending) {
+				mutex_unlock(&def_pending_mutex);
+				return -ENOMEM;
+			}
+			ret = acvp_duplicate(&pending->pathname, pathname);
+			if (ret) {
+				free(pending);
+				mutex_unlock(&def_pending_mutex);
+				return ret;
+			}
+			mutex_init(&pending->lock, 0);
+			pending->next = def_pending_head;
+			def_pending_head = pending;
+		}
+		mutex_unlock(&def_pending_mutex);
+	}
+
+	mutex_lock(&pending->lock);
+
+	if (load && !pending->config) {
+		ret = acvp_def_read_file(&pending->config, pathname);
+		if (ret) {
+			acvp_def_pending_put(pending);
+			return ret;
+		}
+	}
+
+	*pending_out = pending;
+
+	return 0;
+}
+
+static int acvp_def_write_json(struct json_object *config, const char *pathname)
+{
+	struct acvp_def_pending *pending;
+	int ret;
+
+	CKINT(acvp_def_pending_get(pathname, false, &pending));
+
+	/* The caller does not modify the document after handing it over */
+	ACVP_JSON_PUT_NULL(pending->config);
+	pending->config = json_object_get(config);
+	pending->dirty = true;
+
+	acvp_def_pending_put(pending);
+
+out:
+	return ret;
+}
+
+static int acvp_def_read_json(struct json_object **config, const char *pathname)
+{
+	struct acvp_def_pending *pending;
+	int ret = 1;
+
+	mutex_reader_lock(&def_pending_mutex);
+	pending = acvp_def_pending_find(pathname);
+	if (pending) {
+		mutex_lock(&pending->lock);
+		if (pending->config) {
+			*config = NULL;
+			ret = json_object_deep_copy(pending->config, config,
+						    NULL) ? -ENOMEM : 0;
+		}
+		mutex_unlock(&pending->lock);
+	}
+	mutex_reader_unlock(&def_pending_mutex);
+
+	/* The file is not updated by this process */
+	if (ret > 0)
+		ret = acvp_def_read_file(config, pathname);
+
+	return ret;
+}
+
+static int acvp_def_flush_file(const struct acvp_def_pending *pending)
+{
+	struct stat statbuf;
+	const char *str;
+	mode_t mode = 0644;
+	int ret;
+
+	str = json_object_to_json_string_ext(
+		pending->config,
+		JSON_C_TO_STRING_PRETTY | JSON_C_TO_STRING_NOSLASHESCAPE);
+	CKNULL(str, -ENOMEM);
+
+	if (!stat(pending->pathname, &statbuf))
+		mode = statbuf.st_mode & 07777;
+
+	CKINT_LOG(acvp_ds_sync_write(pending->pathname, (const uint8_t *)str,
+				     strlen(str), mode),
+		  "Cannot write configuration file %s\n", pending->pathname);
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY, "Configuration file %s written\n",
+	       pending->pathname);
+
+out:
+	return ret;
+}
+
+int acvp_def_flush(void)
+{
+	struct acvp_def_pending *pending;
+	int ret = 0, ret2;
+
+	/* Readers must not see the file before it is written */
+	mutex_lock(&def_pending_mutex);
+
+	pending = def_pending_head;
+	def_pending_head = NULL;
+
+	while (pending) {
+		struct acvp_def_pending *curr = pending;
+
+		pending = pending->next;
+
+		if (curr->dirty && curr->config) {
+			ret2 = acvp_def_flush_file(curr);
+			if (!ret)
+				ret = ret2;
+		}
+
+		ACVP_JSON_PUT_NULL(curr->config);
+		free(curr->pathname);
+		free(curr);
+	}
+
+	mutex_unlock(&def_pending_mutex);
+
 	return ret;
 }
 
@@ -1367,14 +1925,14 @@ static int acvp_def_update_id(const char *pathname,
 			      const struct acvp_def_update_id_entry *list,
 			      const uint32_t list_entries)
 {
-	struct json_object *config = NULL;
+	struct acvp_def_pending *pending;
 	unsigned int i;
 	int ret = 0;
 	bool updated = false;
 
 	CKNULL(pathname, -EINVAL);
 
-	CKINT_LOG(acvp_def_read_json(&config, pathname),
+	CKINT_LOG(acvp_def_pending_get(pathname, true, &pending),
 		  "Cannot parse config file %s\n", pathname);
 
 	for (i = 0; i < list_entries; i++) {
@@ -1383,15 +1941,19 @@ static int acvp_def_update_id(const char *pathname,
 
 		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
 		       "Updating entry %s with %u\n", list[i].name, list[i].id);
-		CKINT(acvp_def_set_value(config, list[i].name, list[i].id,
-					 &updated));
+		ret = acvp_def_set_value(pending->config, list[i].name,
+					 list[i].id, &updated);
+		if (ret)
+			break;
 	}
 
+	/* The file is written with the next flush */
 	if (updated)
-		CKINT(acvp_def_write_json(config, pathname));
+		pending->dirty = true;
+
+	acvp_def_pending_put(pending);
 
 out:
-	ACVP_JSON_PUT_NULL(config);
 	return ret;
 }
 
@@ -1450,14 +2012,14 @@ static int acvp_def_update_str(const char *pathname,
 			       const struct acvp_def_update_string_entry *list,
 			       const uint32_t list_entries)
 {
-	struct json_object *config = NULL;
+	struct acvp_def_pending *pending;
 	unsigned int i;
 	int ret = 0;
 	bool updated = false;
 
 	CKNULL(pathname, -EINVAL);
 
-	CKINT_LOG(acvp_def_read_json(&config, pathname),
+	CKINT_LOG(acvp_def_pending_get(pathname, true, &pending),
 		  "Cannot parse config file %s\n", pathname);
 
 	for (i = 0; i < list_entries; i++) {
@@ -1467,12 +2029,17 @@ static int acvp_def_update_str(const char *pathname,
 		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
 		       "Updating entry %s with %s\n", list[i].name,
 		       list[i].str);
-		CKINT(acvp_def_set_str(config, list[i].name, list[i].str,
-				       &updated));
+		ret = acvp_def_set_str(pending->config, list[i].name,
+				       list[i].str, &updated);
+		if (ret)
+			break;
 	}
 
+	/* The file is written with the next flush */
 	if (updated)
-		CKINT(acvp_def_write_json(config, pathname));
+		pending->dirty = true;
+
+	acvp_def_pending_put(pending);
 
 out:
 	return ret;
@@ -2437,19 +3004,26 @@ out:
 	return ret;
 }
 
-static int acvp_def_load_config(const char *basedir, const char *oe_file,
-				const char *vendor_file, const char *info_file,
-				const char *impl_file)
-{
-	struct json_object *oe_config = NULL, *vendor_config = NULL,
-			   *info_config = NULL, *impl_config = NULL,
-			   *impl_array = NULL;
+/*
+ * Instantiate the definitions of one combination of configuration files. The
+ * definitions are not registered, but returned as a linked list in defs to
+ * allow the caller to register them in a deterministic order.
+ */
+static int acvp_def_load_config(const char *basedir,
+				const struct acvp_def_cache_entry *oe_entry,
+				const struct acvp_def_cache_entry *vendor_entry,
+				const struct acvp_def_cache_entry *info_entry,
+				const struct acvp_def_cache_entry *impl_entry,
+				struct definition **defs)
+{
+	struct json_object *oe_config, *vendor_config, *info_config,
+		*impl_config = NULL, *impl_array = NULL;
 	struct def_algo_map *map = NULL;
-	struct definition *def = NULL;
+	struct definition *def = NULL, **defs_tail = defs;
 	struct def_oe oe;
 	struct def_info info;
 	struct def_vendor vendor;
-
+	const char *oe_file, *vendor_file, *info_file, *impl_file = NULL;
 	const char *local_module_name, *local_proc_family = NULL;
 	int ret;
 	bool registered = false;
@@ -2459,14 +3033,26 @@ static int acvp_def_load_config(const char *basedir, const char *oe_file,
 	memset(&vendor, 0, sizeof(vendor));
 
 	CKNULL_LOG(
-		oe_file, -EINVAL,
+		oe_entry, -EINVAL,
 		"No operational environment file name given for definition config\n");
-	CKNULL_LOG(vendor_file, -EINVAL,
+	CKNULL_LOG(vendor_entry, -EINVAL,
 		   "No vendor file name given for definition config\n");
 	CKNULL_LOG(
-		info_file, -EINVAL,
+		info_entry, -EINVAL,
 		"No module information file name given for definition config\n");
+
+	oe_file = oe_entry->pathname;
+	oe_config = oe_entry->config;
+	vendor_file = vendor_entry->pathname;
+	vendor_config = vendor_entry->config;
+	info_file = info_entry->pathname;
+	info_config = info_entry->config;
+
 	/* It is permissible to have a NULL impl_file */
+	if (impl_entry) {
+		impl_file = impl_entry->pathname;
+		impl_config = impl_entry->config;
+	}
 
 	logger(LOGGER_DEBUG, LOGGER_C_ANY,
 	       "Reading module definitions from %s, %s, %s, %s\n", oe_file,
@@ -2474,7 +3060,7 @@ static int acvp_def_load_config(const char *basedir, const char *oe_file,
 				"Implementation definition not provided");
 
 	/* Load OE configuration */
-	CKINT_LOG(acvp_def_read_json(&oe_config, oe_file),
+	CKINT_LOG(oe_entry->ret,
 		  "Cannot parse operational environment config file %s\n",
 		  oe_file);
 	CKINT_LOG(acvp_def_load_config_oe(oe_config, &oe, &local_proc_family),
@@ -2485,7 +3071,7 @@ static int acvp_def_load_config(const char *basedir, const char *oe_file,
 	oe.def_oe_file = (char *)oe_file;
 
 	/* Load module configuration */
-	CKINT_LOG(acvp_def_read_json(&info_config, info_file),
+	CKINT_LOG(info_entry->ret,
 		  "Cannot parse module information config file %s\n",
 		  info_file);
 	CKINT_LOG(acvp_def_load_config_module(info_config, &info,
@@ -2496,7 +3082,7 @@ static int acvp_def_load_config(const char *basedir, const char *oe_file,
 	info.def_module_file = (char *)info_file;
 
 	/* Load vendor configuration */
-	CKINT_LOG(acvp_def_read_json(&vendor_config, vendor_file),
+	CKINT_LOG(vendor_entry->ret,
 		  "Cannot parse vendor information config file %s\n",
 		  vendor_file);
 	CKINT_LOG(acvp_def_load_config_vendor(vendor_config, &vendor),
@@ -2506,15 +3092,15 @@ static int acvp_def_load_config(const char *basedir, const char *oe_file,
 	vendor.def_vendor_file = (char *)vendor_file;
 
 	/* Allow an empty impl file, for example when we simply sync-meta */
-	if (impl_file) {
-		CKINT_LOG(acvp_def_read_json(&impl_config, impl_file),
+	if (impl_entry) {
+		CKINT_LOG(impl_entry->ret,
 			  "Cannot parse cipher implementations config file %s\n",
 			  impl_file);
 		CKINT(json_find_key(impl_config, "implementations", &impl_array,
 				    json_type_array));
 	}
 
-	mutex_lock(&def_uninstantiated_mutex);
+	mutex_reader_lock(&def_uninstantiated_mutex);
 
 	for (map = def_uninstantiated_head; map != NULL; map = map->next) {
 		size_t i, found = 0;
@@ -2546,7 +3132,10 @@ static int acvp_def_load_config(const char *basedir, const char *oe_file,
 			 */
 			registered = true;
 
-			CKNULL(impl, EINVAL);
+			if (!impl) {
+				ret = -EINVAL;
+				goto unlock;
+			}
 
 			string = json_object_get_string(impl);
 
@@ -2579,7 +3168,9 @@ static int acvp_def_load_config(const char *basedir, const char *oe_file,
 
 		def->uninstantiated_def = map;
 
-		acvp_register_def(def);
+		*defs_tail = def;
+		defs_tail = &def->next;
+		def = NULL;
 
 		registered = true;
 	}
@@ -2600,16 +3191,13 @@ static int acvp_def_load_config(const char *basedir, const char *oe_file,
 		CKINT_ULCK(acvp_def_load_deps(vendor_config, def));
 		CKINT_ULCK(acvp_def_load_deps(info_config, def));
 
-		acvp_register_def(def);
+		*defs_tail = def;
+		def = NULL;
 	}
 
 unlock:
-	mutex_unlock(&def_uninstantiated_mutex);
+	mutex_reader_unlock(&def_uninstantiated_mutex);
 out:
-	ACVP_JSON_PUT_NULL(oe_config);
-	ACVP_JSON_PUT_NULL(vendor_config);
-	ACVP_JSON_PUT_NULL(info_config);
-	ACVP_JSON_PUT_NULL(impl_config);
 	acvp_def_free_dep(&oe);
 
 	/*
@@ -2631,109 +3219,437 @@ static int acvp_def_usable_dirent(const struct dirent *dirent)
 	return acvp_usable_dirent(dirent, ACVP_DEF_CONFIG_FILE_EXTENSION);
 }
 
-DSO_PUBLIC
-int acvp_def_config(const char *directory)
+/* Configuration files of one directory of a definition */
+struct acvp_def_dir {
+	struct acvp_def_cache_entry **entries;
+	unsigned int nr_entries;
+};
+
+static void acvp_def_dir_free(struct acvp_def_dir *dir)
 {
-	struct dirent *oe_dirent, *vendor_dirent, *info_dirent, *impl_dirent;
-	DIR *oe_dir = NULL, *vendor_dir = NULL, *info_dir = NULL,
-	    *impl_dir = NULL;
-	char oe_pathname[FILENAME_MAX - 257],
-		vendor_pathname[FILENAME_MAX - 257],
-		info_pathname[FILENAME_MAX - 257],
-		impl_pathname[FILENAME_MAX - 257];
-	char oe[FILENAME_MAX], vendor[FILENAME_MAX], info[FILENAME_MAX],
-		impl[FILENAME_MAX];
-	int ret = 0;
+	if (dir->entries)
+		free(dir->entries);
+	dir->entries = NULL;
+	dir->nr_entries = 0;
+}
 
-	CKNULL_LOG(directory, -EINVAL, "Configuration directory missing\n");
+/* Report a configuration file which cannot be parsed only once */
+static int acvp_def_dir_check(const struct acvp_def_dir *dir)
+{
+	unsigned int i;
 
-	snprintf(oe_pathname, sizeof(oe_pathname) - 256, "%s/%s", directory,
-		 ACVP_DEF_DIR_OE);
-	oe_dir = opendir(oe_pathname);
-	CKNULL_LOG(oe_dir, -errno, "Failed to open directory %s\n",
-		   oe_pathname);
+	for (i = 0; i < dir->nr_entries; i++) {
+		if (dir->entries[i]->ret) {
+			logger(LOGGER_ERR, LOGGER_C_ANY,
+			       "Cannot parse config file %s\n",
+			       dir->entries[i]->pathname);
+			return dir->entries[i]->ret;
+		}
+	}
 
-	snprintf(vendor_pathname, sizeof(vendor_pathname) - 256, "%s/%s",
-		 directory, ACVP_DEF_DIR_VENDOR);
-	vendor_dir = opendir(vendor_pathname);
-	CKNULL_LOG(vendor_dir, -errno, "Failed to open directory %s\n",
-		   vendor_pathname);
+	return 0;
+}
 
-	snprintf(info_pathname, sizeof(info_pathname) - 256, "%s/%s", directory,
-		 ACVP_DEF_DIR_MODINFO);
-	info_dir = opendir(info_pathname);
-	CKNULL_LOG(info_dir, -errno, "Failed to open directory %s\n",
-		   info_pathname);
+static int acvp_def_cache_parse(void *arg)
+{
+	struct acvp_def_cache_entry *entry = arg;
 
-	snprintf(impl_pathname, sizeof(impl_pathname) - 256, "%s/%s", directory,
-		 ACVP_DEF_DIR_IMPLEMENTATIONS);
-	impl_dir = opendir(impl_pathname);
-	/* we allow implementation to be non-existant */
-	if (!impl_dir) {
-		logger(LOGGER_WARN, LOGGER_C_ANY,
-		       "No implementation directory found - only meta data synchronization possible!\n");
+	logger(LOGGER_DEBUG, LOGGER_C_ANY, "Parsing configuration file %s\n",
+	       entry->pathname);
+
+	/* A parsing error is reported when the file is used */
+	entry->ret = acvp_def_read_json(&entry->config, entry->pathname);
+
+	return 0;
+}
+
+/*
+ * Get the cache entry for the file - a new or stale entry is parsed in the
+ * background. Caller must hold def_cache_mutex.
+ */
+static int acvp_def_cache_get(const char *pathname,
+			      struct acvp_def_cache_entry **entry_out)
+{
+	struct acvp_def_cache_entry *entry, **prev;
+	struct stat statbuf;
+	int ret;
+
+	if (stat(pathname, &statbuf))
+		return -errno;
+
+	for (prev = &def_cache_head; *prev; prev = &(*prev)->next) {
+		entry = *prev;
+
+		if (strcmp(entry->pathname, pathname))
+			continue;
+
+		if (entry->ino == statbuf.st_ino &&
+		    entry->size == statbuf.st_size &&
+		    entry->mtime.tv_sec == statbuf.st_mtim.tv_sec &&
+		    entry->mtime.tv_nsec == statbuf.st_mtim.tv_nsec) {
+			*entry_out = entry;
+			return 0;
+		}
+
+		/* The file changed since it was parsed */
+		*prev = entry->next;
+		acvp_def_cache_free(entry);
+		break;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	CKNULL(entry, -ENOMEM);
+	ret = acvp_duplicate(&entry->pathname, pathname);
+	if (ret) {
+		free(entry);
+		goto out;
 	}
+	entry->ino = statbuf.st_ino;
+	entry->size = statbuf.st_size;
+	entry->mtime = statbuf.st_mtim;
 
-	/* Process all permutations of configuration files. */
-	while ((vendor_dirent = readdir(vendor_dir)) != NULL) {
-		if (!acvp_def_usable_dirent(vendor_dirent))
+	entry->next = def_cache_head;
+	def_cache_head = entry;
+	*entry_out = entry;
+
+#ifdef ACVP_USE_PTHREAD
+	CKINT(thread_start(acvp_def_cache_parse, entry, 0, NULL));
+#else
+	acvp_def_cache_parse(entry);
+#endif
+
+out:
+	return ret;
+}
+
+static int acvp_def_cache_cmp_name(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * Collect the configuration files of the directory in name order. If an
+ * optional directory cannot be opened, 1 is returned.
+ */
+static int acvp_def_cache_dir(const char *dirname, struct acvp_def_dir *dir,
+			      bool optional)
+{
+	struct dirent *dirent;
+	DIR *d;
+	char **names = NULL, **tmp;
+	char pathname[FILENAME_MAX];
+	unsigned int nr_names = 0, i;
+	int ret = 0;
+
+	d = opendir(dirname);
+	if (!d) {
+		ret = -errno;
+		if (optional)
+			return 1;
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "Failed to open directory %s\n", dirname);
+		return ret;
+	}
+
+	while ((dirent = readdir(d)) != NULL) {
+		if (!acvp_def_usable_dirent(dirent))
 			continue;
 
-		snprintf(vendor, sizeof(vendor), "%s/%s", vendor_pathname,
-			 vendor_dirent->d_name);
+		tmp = realloc(names, (nr_names + 1) * sizeof(*names));
+		CKNULL(tmp, -ENOMEM);
+		names = tmp;
+		names[nr_names] = NULL;
+		CKINT(acvp_duplicate(&names[nr_names], dirent->d_name));
+		nr_names++;
+	}
 
-		while ((info_dirent = readdir(info_dir)) != NULL) {
-			if (!acvp_def_usable_dirent(info_dirent))
-				continue;
+	if (!nr_names)
+		goto out;
 
-			snprintf(info, sizeof(info), "%s/%s", info_pathname,
-				 info_dirent->d_name);
+	qsort(names, nr_names, sizeof(*names), acvp_def_cache_cmp_name);
 
-			while ((oe_dirent = readdir(oe_dir)) != NULL) {
-				bool impl_found = false;
+	dir->entries = calloc(nr_names, sizeof(*dir->entries));
+	CKNULL(dir->entries, -ENOMEM);
 
-				if (!acvp_def_usable_dirent(oe_dirent))
-					continue;
+	for (i = 0; i < nr_names; i++) {
+		snprintf(pathname, sizeof(pathname), "%s/%s", dirname,
+			 names[i]);
+		CKINT(acvp_def_cache_get(pathname, &dir->entries[i]));
+		dir->nr_entries++;
+	}
 
-				snprintf(oe, sizeof(oe), "%s/%s", oe_pathname,
-					 oe_dirent->d_name);
+out:
+	for (i = 0; i < nr_names; i++) {
+		if (names[i])
+			free(names[i]);
+	}
+	if (names)
+		free(names);
+	closedir(d);
+	return ret;
+}
 
-				if (!impl_dir) {
-					CKINT(acvp_def_load_config(directory,
-								   oe, vendor,
-								   info, NULL));
-					continue;
-				}
+/* One combination of vendor, module, OE and implementation file */
+struct acvp_def_load_job {
+	const char *basedir;
+	const struct acvp_def_cache_entry *oe;
+	const struct acvp_def_cache_entry *vendor;
+	const struct acvp_def_cache_entry *info;
+	const struct acvp_def_cache_entry *impl;
+	struct definition *defs;
+	int ret;
+};
 
-				while ((impl_dirent = readdir(impl_dir)) !=
-				       NULL) {
-					if (!acvp_def_usable_dirent(
-						    impl_dirent))
-						continue;
+static int acvp_def_load_job(void *arg)
+{
+	struct acvp_def_load_job *job = arg;
 
-					impl_found = true;
+	job->ret = acvp_def_load_config(job->basedir, job->oe, job->vendor,
+					job->info, job->impl, &job->defs);
 
-					snprintf(impl, sizeof(impl), "%s/%s",
-						 impl_pathname,
-						 impl_dirent->d_name);
-					CKINT(acvp_def_load_config(directory,
-								   oe, vendor,
-								   info, impl));
-				}
+	return job->ret;
+}
 
-				if (!impl_found) {
-					CKINT(acvp_def_load_config(directory,
-								   oe, vendor,
-								   info, NULL));
-				}
+void acvp_def_release_list(struct definition *def)
+{
+	while (def) {
+		struct definition *curr = def;
+
+		def = def->next;
+		acvp_def_release(curr);
+	}
+}
 
-				rewinddir(impl_dir);
+/*
+ * Register the linked definitions - in error case, the definition causing the
+ * error and all following definitions are released.
+ */
+static int acvp_def_register_list(struct definition *def,
+				  struct definition ***registered,
+				  unsigned int *nr_registered)
+{
+	int ret = 0;
+
+	while (def) {
+		struct definition *next = def->next;
+
+		ret = acvp_register_def(def);
+		if (ret) {
+			acvp_def_release_list(def);
+			break;
+		}
+		(*registered)[(*nr_registered)++] = def;
+		def = next;
+	}
+
+	return ret;
+}
+
+static unsigned int acvp_def_count_list(const struct definition *def)
+{
+	unsigned int nr = 0;
+
+	for (; def; def = def->next)
+		nr++;
+
+	return nr;
+}
+
+/* Generate the snapshot from the configuration files loaded into the cache */
+static void acvp_def_write_snapshot(const char *directory,
+				    const struct acvp_def_dir **dirs,
+				    unsigned int nr_dirs,
+				    struct definition *const *defs,
+				    unsigned int nr_defs)
+{
+	struct acvp_def_snapshot_src *src;
+	unsigned int nr_src = 0, i, j;
+
+	for (i = 0; i < nr_dirs; i++)
+		nr_src += dirs[i]->nr_entries;
+
+	src = calloc(nr_src ? nr_src : 1, sizeof(*src));
+	if (!src)
+		return;
+
+	for (i = 0, nr_src = 0; i < nr_dirs; i++) {
+		for (j = 0; j < dirs[i]->nr_entries; j++, nr_src++) {
+			const struct acvp_def_cache_entry *entry =
+				dirs[i]->entries[j];
+
+			src[nr_src].pathname = entry->pathname;
+			src[nr_src].size = entry->size;
+			src[nr_src].mtime = entry->mtime;
+		}
+	}
+
+	if (acvp_def_snapshot_write(directory, src, nr_src, defs, nr_defs)) {
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+		       "Generating definition snapshot for %s failed\n",
+		       directory);
+	}
+
+	free(src);
+}
+
+DSO_PUBLIC
+int acvp_def_config(const char *directory)
+{
+	struct acvp_def_dir oe_dir, vendor_dir, info_dir, impl_dir;
+	const struct acvp_def_dir *dirs[] = { &oe_dir, &vendor_dir, &info_dir,
+					      &impl_dir };
+	struct acvp_def_load_job *jobs = NULL;
+	struct definition *defs = NULL, **registered = NULL;
+	char pathname[FILENAME_MAX - 257];
+	unsigned int nr_jobs = 0, nr_impl, nr_defs = 0, nr_registered = 0,
+		     i = 0, v, m, o, n;
+	int ret = 0, ret_wait;
+	bool from_snapshot = false;
+
+	memset(&oe_dir, 0, sizeof(oe_dir));
+	memset(&vendor_dir, 0, sizeof(vendor_dir));
+	memset(&info_dir, 0, sizeof(info_dir));
+	memset(&impl_dir, 0, sizeof(impl_dir));
+
+	CKNULL_LOG(directory, -EINVAL, "Configuration directory missing\n");
+
+#ifdef ACVP_USE_PTHREAD
+	/* Definitions are loaded before the library is initialized */
+	CKINT(thread_init(2));
+#endif
+
+	mutex_lock(&def_cache_mutex);
+
+	/* Use the snapshot of the definitions if it matches the config files */
+	CKINT_ULCK(acvp_def_snapshot_load(directory, &defs));
+	if (!ret) {
+		from_snapshot = true;
+		nr_defs = acvp_def_count_list(defs);
+		if (nr_defs) {
+			registered = calloc(nr_defs, sizeof(*registered));
+			if (!registered) {
+				acvp_def_release_list(defs);
+				ret = -ENOMEM;
+				goto unlock;
 			}
-			rewinddir(oe_dir);
 		}
-		rewinddir(info_dir);
+		CKINT_ULCK(acvp_def_register_list(defs, &registered,
+						  &nr_registered));
+		goto wire;
 	}
+	ret = 0;
 
+	/*
+	 * Parse every configuration file once - the files are parsed in
+	 * parallel while the directories are read.
+	 */
+	snprintf(pathname, sizeof(pathname), "%s/%s", directory,
+		 ACVP_DEF_DIR_OE);
+	CKINT_ULCK(acvp_def_cache_dir(pathname, &oe_dir, false));
+
+	snprintf(pathname, sizeof(pathname), "%s/%s", directory,
+		 ACVP_DEF_DIR_VENDOR);
+	CKINT_ULCK(acvp_def_cache_dir(pathname, &vendor_dir, false));
+
+	snprintf(pathname, sizeof(pathname), "%s/%s", directory,
+		 ACVP_DEF_DIR_MODINFO);
+	CKINT_ULCK(acvp_def_cache_dir(pathname, &info_dir, false));
+
+	snprintf(pathname, sizeof(pathname), "%s/%s", directory,
+		 ACVP_DEF_DIR_IMPLEMENTATIONS);
+	CKINT_ULCK(acvp_def_cache_dir(pathname, &impl_dir, true));
+	/* we allow implementation to be non-existant */
+	if (ret) {
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "No implementation directory found - only meta data synchronization possible!\n");
+		ret = 0;
+	}
+
+#ifdef ACVP_USE_PTHREAD
+	CKINT_ULCK(thread_wait());
+#endif
+
+	CKINT_ULCK(acvp_def_dir_check(&oe_dir));
+	CKINT_ULCK(acvp_def_dir_check(&vendor_dir));
+	CKINT_ULCK(acvp_def_dir_check(&info_dir));
+	CKINT_ULCK(acvp_def_dir_check(&impl_dir));
+
+	/* Process all permutations of configuration files in parallel. */
+	nr_impl = impl_dir.nr_entries ? impl_dir.nr_entries : 1;
+	nr_jobs = vendor_dir.nr_entries * info_dir.nr_entries *
+		  oe_dir.nr_entries * nr_impl;
+	if (!nr_jobs)
+		goto wire;
+
+	jobs = calloc(nr_jobs, sizeof(*jobs));
+	if (!jobs) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	for (v = 0; v < vendor_dir.nr_entries; v++) {
+		for (m = 0; m < info_dir.nr_entries; m++) {
+			for (o = 0; o < oe_dir.nr_entries; o++) {
+				for (n = 0; n < nr_impl; n++, i++) {
+					struct acvp_def_load_job *job =
+						&jobs[i];
+
+					job->basedir = directory;
+					job->vendor = vendor_dir.entries[v];
+					job->info = info_dir.entries[m];
+					job->oe = oe_dir.entries[o];
+					job->impl = impl_dir.nr_entries ?
+						impl_dir.entries[n] : NULL;
+#ifdef ACVP_USE_PTHREAD
+					ret = thread_start(acvp_def_load_job,
+							   job, 0, NULL);
+#else
+					ret = acvp_def_load_job(job);
+#endif
+					if (ret)
+						goto wait;
+				}
+			}
+		}
+	}
+
+wait:
+#ifdef ACVP_USE_PTHREAD
+	ret_wait = thread_wait();
+#else
+	ret_wait = 0;
+#endif
+
+	for (n = 0; n < nr_jobs; n++)
+		nr_defs += acvp_def_count_list(jobs[n].defs);
+	if (nr_defs && !ret) {
+		registered = calloc(nr_defs, sizeof(*registered));
+		if (!registered)
+			ret = -ENOMEM;
+	}
+
+	/*
+	 * Register the definitions in the order of the combinations. As with
+	 * a sequential load, the definitions of all combinations before a
+	 * failing one are registered.
+	 */
+	for (n = 0; n < nr_jobs; n++) {
+		if (ret || jobs[n].ret) {
+			if (!ret)
+				ret = jobs[n].ret;
+			acvp_def_release_list(jobs[n].defs);
+			continue;
+		}
+
+		ret = acvp_def_register_list(jobs[n].defs, &registered,
+					     &nr_registered);
+	}
+	if (!ret)
+		ret = ret_wait;
+	if (ret)
+		goto unlock;
+
+wire:
 	/*
 	 * Resolving the dependencies at this point implies that the
 	 * dependency resolution is confined to an IUT. For example, if OpenSSL
@@ -2744,17 +3660,29 @@ int acvp_def_config(const char *directory)
 	 * This is due to the fact that our current function only operates
 	 * on one given module definition directory.
 	 */
-	CKINT(acvp_def_wire_deps());
+	CKINT_ULCK(acvp_def_wire_deps());
+
+	if (!from_snapshot) {
+		acvp_def_write_snapshot(directory, dirs, ARRAY_SIZE(dirs),
+					registered, nr_registered);
+	}
 
+unlock:
+#ifdef ACVP_USE_PTHREAD
+	/* Do not release entries which are still being parsed */
+	if (ret)
+		thread_wait();
+#endif
+	mutex_unlock(&def_cache_mutex);
 out:
-	if (oe_dir)
-		closedir(oe_dir);
-	if (vendor_dir)
-		closedir(vendor_dir);
-	if (info_dir)
-		closedir(info_dir);
-	if (impl_dir)
-		closedir(impl_dir);
+	if (jobs)
+		free(jobs);
+	if (registered)
+		free(registered);
+	acvp_def_dir_free(&oe_dir);
+	acvp_def_dir_free(&vendor_dir);
+	acvp_def_dir_free(&info_dir);
+	acvp_def_dir_free(&impl_dir);
 	return ret;
 }
 
@@ -2808,6 +3736,17 @@ out:
 	return ret;
 }
 
+struct def_algo_map *acvp_def_maps_get(void)
+{
+	mutex_reader_lock(&def_uninstantiated_mutex);
+	return def_uninstantiated_head;
+}
+
+void acvp_def_maps_put(void)
+{
+	mutex_reader_unlock(&def_uninstantiated_mutex);
+}
+
 void acvp_register_algo_map(struct def_algo_map *curr_map,
 			    const unsigned int nrmaps)
 {
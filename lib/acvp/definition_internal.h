@@ -22,6 +22,8 @@
 
 #include <limits.h>
 #include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
 
 #include <json-c/json.h>
 
@@ -358,6 +360,8 @@ struct def_deps {
  * @var uninstantiated_def Reference to uninstantiated algorithm definition
  * @var deps Dependencies - if NULL then no dependencies
  * @var next This pointer is internal to the library and MUST NOT be used.
+ * @var registry_idx This value is internal to the library and MUST NOT be
+ *		     used.
  */
 struct definition {
 	struct def_info *info;
@@ -369,18 +373,22 @@ struct definition {
 	struct def_algo_map *uninstantiated_def;
 	struct def_deps *deps;
 	struct definition *next;
+	unsigned int registry_idx;
 };
 
 /**
  * @brief Iterate over all definitions and return when one match is found.
- *	  The processed_ptr can be used to indicate the entry in the linked list
+ *	  The processed_ptr can be used to indicate the entry in the registry
  *	  that is used as a start point but what was already processed. I.e. the
  *	  search will continue with the entry following the processed_ptr.
+ *	  A returned definition stays a valid cursor until all definitions are
+ *	  released. The candidates are looked up in the registry index, thus
+ *	  resuming a search does not walk the already processed entries.
  *
- *	  If processed_ptr is NULL, the head of the list is used.
+ *	  If processed_ptr is NULL, the first registered entry is used.
  *
  * @param search Search definition
- * @param processed_ptr Starting point in linked list
+ * @param processed_ptr Starting point in registry
  *
  * @return Found definition or NULL if no entry found.
  */
@@ -453,11 +461,82 @@ int acvp_def_get_module_id(struct def_info *def_info);
 int acvp_def_put_module_id(struct def_info *def_info);
 
 void acvp_def_release_all(void);
+
+/**
+ * @brief Write the pending updates of the configuration files.
+ *
+ * The updates of the IDs and strings of a configuration file are collected in
+ * memory and readers of the file are served with the updated content. This
+ * call writes each updated file once by atomically replacing it. It is
+ * invoked at the end of an operation and when the definitions are released.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_def_flush(void);
+
+/**
+ * @brief Rebuild the search index of the registered definitions after the
+ *	  search strings of a definition were changed.
+ */
+void acvp_def_reindex(void);
 void acvp_def_free_info(struct def_info *info);
 void acvp_def_free_vendor(struct def_vendor *vendor);
 void acvp_def_free_oe(struct def_oe *oe);
 int acvp_def_alloc_lock(struct def_lock **lock);
 
+/**
+ * @brief Release the definitions linked with their next pointer.
+ */
+void acvp_def_release_list(struct definition *def);
+
+/**
+ * @brief Get the registered algorithm maps. The maps cannot be modified until
+ *	  they are put again.
+ */
+struct def_algo_map *acvp_def_maps_get(void);
+void acvp_def_maps_put(void);
+
+/**
+ * @brief Configuration file a definition snapshot is generated from with its
+ *	  state at the time it was loaded.
+ */
+struct acvp_def_snapshot_src {
+	const char *pathname;
+	off_t size;
+	struct timespec mtime;
+};
+
+/**
+ * @brief Load the definitions of the definition directory from its snapshot.
+ *	  The definitions are linked with their next pointer and are neither
+ *	  registered nor are their dependencies wired.
+ *
+ * @param directory [in] Definition directory
+ * @param defs [out] Loaded definitions
+ *
+ * @return 0 on success, 1 if no matching snapshot is present, < 0 on error
+ */
+int acvp_def_snapshot_load(const char *directory, struct definition **defs);
+
+/**
+ * @brief Write the snapshot of the definitions loaded from the definition
+ *	  directory. If a configuration file changed since it was loaded, no
+ *	  snapshot is written.
+ *
+ * @param directory [in] Definition directory
+ * @param src [in] Configuration files the definitions are loaded from
+ * @param nr_src [in] Number of configuration files
+ * @param defs [in] Definitions loaded from the directory
+ * @param nr_defs [in] Number of definitions
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_def_snapshot_write(const char *directory,
+			    const struct acvp_def_snapshot_src *src,
+			    unsigned int nr_src,
+			    struct definition *const *defs,
+			    unsigned int nr_defs);
+
 /**
  * @brief write any updates of the definitions to the corresponding JSON
  * configuration files
@@ -0,0 +1,1487 @@
+/* Binary snapshot of the module definitions of a definition directory
+ *
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "acvpproxy.h"
+#include "binhexbin.h"
+#include "datastore_sync.h"
+#include "definition_internal.h"
+#include "esvp_definition.h"
+#include "hash/sha256.h"
+#include "internal.h"
+#include "logger.h"
+#include "request_helper.h"
+#include "ret_checkers.h"
+
+/*
+ * The snapshot holds the loaded definitions of one definition directory. It
+ * is only used when it still matches its sources:
+ *
+ * - the configuration directories must hold the same file names,
+ * - size and modification time of each file must be unchanged - if only the
+ *   modification time differs (e.g. after a copy), the SHA-256 digest of the
+ *   file content must match and the snapshot is refreshed,
+ * - the digest over the library version and the registered algorithm maps
+ *   must be unchanged.
+ *
+ * The file is mapped into memory and used in place: all integers are stored
+ * in host byte order, strings are referenced by their offset into the string
+ * table at the end of the file and algorithm maps by their position in the
+ * list of registered maps. The dependencies between definitions are wired
+ * after loading as they may refer to definitions of other directories.
+ */
+
+#define ACVP_DEF_SNAPSHOT_MAGIC "ACVPDEFS"
+#define ACVP_DEF_SNAPSHOT_VERSION 1
+#define ACVP_DEF_SNAPSHOT_ENDIAN 0x01020304
+/* Reference to no string, map or dependency */
+#define ACVP_DEF_SNAPSHOT_NONE 0xffffffff
+#define ACVP_DEF_SNAPSHOT_STR_BUCKETS 1024
+
+struct acvp_def_snapshot_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint64_t len;
+	uint8_t maps_digest[SHA256_SIZE_DIGEST];
+	uint8_t body_digest[SHA256_SIZE_DIGEST];
+	uint32_t nr_files;
+	uint32_t nr_defs;
+	uint32_t nr_oe_deps;
+	uint32_t nr_deps;
+	uint32_t strtab_len;
+	uint32_t reserved;
+};
+
+/* Configuration file the snapshot was generated from */
+struct acvp_def_snapshot_file {
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint32_t dir;
+	uint32_t name;
+	uint8_t digest[SHA256_SIZE_DIGEST];
+};
+
+/* struct def_dependency */
+struct acvp_def_snapshot_oe_dep {
+	uint64_t features;
+	uint32_t acvp_dep_id;
+	uint32_t type;
+	uint32_t name;
+	uint32_t description;
+	uint32_t cpe;
+	uint32_t swid;
+	uint32_t manufacturer;
+	uint32_t proc_family;
+	uint32_t proc_family_internal;
+	uint32_t proc_name;
+	uint32_t proc_series;
+	uint32_t reserved;
+};
+
+/* struct def_deps */
+struct acvp_def_snapshot_deps {
+	uint32_t dep_cipher;
+	uint32_t dep_name;
+	uint32_t deps_type;
+	uint32_t reserved;
+};
+
+/*
+ * struct definition - the lock references group the definitions sharing one
+ * lock as the definitions loaded from one combination of configuration files
+ * do.
+ */
+struct acvp_def_snapshot_def {
+	uint32_t map;
+	uint32_t info_file;
+	uint32_t vendor_file;
+	uint32_t oe_file;
+	uint32_t info_lock;
+	uint32_t vendor_lock;
+	uint32_t oe_lock;
+
+	uint32_t module_name;
+	uint32_t impl_name;
+	uint32_t impl_description;
+	uint32_t orig_module_name;
+	uint32_t module_name_filesafe;
+	uint32_t module_name_internal;
+	uint32_t module_type;
+	uint32_t module_version;
+	uint32_t module_version_filesafe;
+	uint32_t module_description;
+
+	uint32_t vendor_name;
+	uint32_t vendor_name_filesafe;
+	uint32_t vendor_url;
+	uint32_t contact_name;
+	uint32_t contact_email;
+	uint32_t contact_phone;
+	uint32_t addr_street;
+	uint32_t addr_locality;
+	uint32_t addr_region;
+	uint32_t addr_country;
+	uint32_t addr_zipcode;
+
+	uint32_t acvp_oe_id;
+	uint32_t config_file_version;
+	uint32_t oe_dep_first;
+	uint32_t oe_dep_count;
+
+	uint32_t deps_first;
+	uint32_t deps_count;
+};
+
+static const char *acvp_def_snapshot_dirs[] = {
+	ACVP_DEF_DIR_OE,
+	ACVP_DEF_DIR_VENDOR,
+	ACVP_DEF_DIR_MODINFO,
+	ACVP_DEF_DIR_IMPLEMENTATIONS,
+};
+
+static bool acvp_def_snapshot_enabled = true;
+/* Directory holding the snapshots - empty for the default */
+static char acvp_def_snapshot_basedir[FILENAME_MAX / 2];
+
+DSO_PUBLIC
+void acvp_def_set_snapshot(bool enable)
+{
+	acvp_def_snapshot_enabled = enable;
+}
+
+DSO_PUBLIC
+int acvp_def_set_snapshot_dir(const char *directory)
+{
+	int ret;
+
+	if (!directory) {
+		acvp_def_snapshot_basedir[0] = '\0';
+		return 0;
+	}
+
+	ret = snprintf(acvp_def_snapshot_basedir,
+		       sizeof(acvp_def_snapshot_basedir), "%s", directory);
+	if (ret < 0 || (size_t)ret >= sizeof(acvp_def_snapshot_basedir)) {
+		acvp_def_snapshot_basedir[0] = '\0';
+		return -ENAMETOOLONG;
+	}
+
+	return 0;
+}
+
+/*****************************************************************************
+ * Sources of the snapshot
+ *****************************************************************************/
+
+/* Configuration files of a definition directory in directory and name order */
+struct acvp_def_snapshot_list {
+	char **names;
+	uint32_t *dirs;
+	unsigned int nr;
+};
+
+static void acvp_def_snapshot_list_free(struct acvp_def_snapshot_list *list)
+{
+	unsigned int i;
+
+	for (i = 0; i < list->nr; i++) {
+		if (list->names[i])
+			free(list->names[i]);
+	}
+	if (list->names)
+		free(list->names);
+	if (list->dirs)
+		free(list->dirs);
+	memset(list, 0, sizeof(*list));
+}
+
+static int acvp_def_snapshot_cmp_name(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* A missing directory is treated as empty */
+static int acvp_def_snapshot_list_dir(const char *directory, uint32_t dir,
+				      struct acvp_def_snapshot_list *list)
+{
+	struct dirent *dirent;
+	DIR *d;
+	char pathname[FILENAME_MAX];
+	unsigned int first = list->nr;
+	int ret = 0;
+
+	snprintf(pathname, sizeof(pathname), "%s/%s", directory,
+		 acvp_def_snapshot_dirs[dir]);
+	d = opendir(pathname);
+	if (!d)
+		return 0;
+
+	while ((dirent = readdir(d)) != NULL) {
+		char **names;
+		uint32_t *dirs;
+
+		if (!acvp_usable_dirent(dirent, ACVP_DEF_CONFIG_FILE_EXTENSION))
+			continue;
+
+		names = realloc(list->names, (list->nr + 1) * sizeof(*names));
+		CKNULL(names, -ENOMEM);
+		list->names = names;
+		dirs = realloc(list->dirs, (list->nr + 1) * sizeof(*dirs));
+		CKNULL(dirs, -ENOMEM);
+		list->dirs = dirs;
+
+		list->names[list->nr] = NULL;
+		list->dirs[list->nr] = dir;
+		list->nr++;
+		CKINT(acvp_duplicate(&list->names[list->nr - 1],
+				     dirent->d_name));
+	}
+
+	if (list->nr - first > 1) {
+		qsort(list->names + first, list->nr - first,
+		      sizeof(*list->names), acvp_def_snapshot_cmp_name);
+	}
+
+out:
+	closedir(d);
+	return ret;
+}
+
+static int acvp_def_snapshot_list(const char *directory,
+				  struct acvp_def_snapshot_list *list)
+{
+	uint32_t dir;
+	int ret = 0;
+
+	memset(list, 0, sizeof(*list));
+
+	for (dir = 0; dir < ARRAY_SIZE(acvp_def_snapshot_dirs); dir++)
+		CKINT(acvp_def_snapshot_list_dir(directory, dir, list));
+
+out:
+	if (ret)
+		acvp_def_snapshot_list_free(list);
+	return ret;
+}
+
+/* Path of a configuration file as used by the definitions */
+static void acvp_def_snapshot_pathname(const char *directory, uint32_t dir,
+				       const char *name, char *pathname,
+				       size_t pathnamelen)
+{
+	snprintf(pathname, pathnamelen, "%s/%s/%s", directory,
+		 acvp_def_snapshot_dirs[dir], name);
+}
+
+static int acvp_def_snapshot_hash_file(const char *pathname, uint8_t *digest)
+{
+	ACVP_BUFFER_INIT(md);
+	int ret;
+
+	CKINT(acvp_hash_file(pathname, sha256, &md));
+	if (md.len != SHA256_SIZE_DIGEST) {
+		ret = -EFAULT;
+		goto out;
+	}
+	memcpy(digest, md.buf, md.len);
+
+out:
+	acvp_free_buf(&md);
+	return ret;
+}
+
+static void acvp_def_snapshot_hash_str(struct sha_ctx *ctx, const char *str)
+{
+	static const uint8_t none = 0xff;
+
+	if (str)
+		sha256->update(ctx, (const uint8_t *)str, strlen(str) + 1);
+	else
+		sha256->update(ctx, &none, sizeof(none));
+}
+
+/*
+ * Collect the registered algorithm maps and the digest over them. Caller
+ * holds the maps with acvp_def_maps_get.
+ */
+static int acvp_def_snapshot_maps(struct def_algo_map *head,
+				  struct def_algo_map ***maps_out,
+				  unsigned int *nr_maps, uint8_t *digest)
+{
+	struct def_algo_map *map, **maps = NULL;
+	char version[32];
+	unsigned int nr = 0;
+	int ret = 0;
+	HASH_CTX_ON_STACK(ctx);
+
+	snprintf(version, sizeof(version), "%d.%d.%d", MAJVERSION, MINVERSION,
+		 PATCHLEVEL);
+
+	sha256->init(ctx);
+	acvp_def_snapshot_hash_str(ctx, version);
+
+	for (map = head; map; map = map->next) {
+		acvp_def_snapshot_hash_str(ctx, map->algo_name);
+		acvp_def_snapshot_hash_str(ctx, map->processor);
+		acvp_def_snapshot_hash_str(ctx, map->impl_name);
+		acvp_def_snapshot_hash_str(ctx, map->impl_description);
+		nr++;
+	}
+	sha256->final(ctx, digest);
+
+	if (nr) {
+		maps = calloc(nr, sizeof(*maps));
+		CKNULL(maps, -ENOMEM);
+		for (map = head, nr = 0; map; map = map->next)
+			maps[nr++] = map;
+	}
+
+	*maps_out = maps;
+	*nr_maps = nr;
+
+out:
+	return ret;
+}
+
+static void acvp_def_snapshot_body_digest(const uint8_t *data, size_t len,
+					  uint8_t *digest)
+{
+	const struct acvp_def_snapshot_hdr *hdr =
+		(const struct acvp_def_snapshot_hdr *)data;
+	HASH_CTX_ON_STACK(ctx);
+
+	sha256->init(ctx);
+	sha256->update(ctx, (const uint8_t *)&hdr->nr_files,
+		       sizeof(*hdr) - offsetof(struct acvp_def_snapshot_hdr,
+					       nr_files));
+	sha256->update(ctx, data + sizeof(*hdr), len - sizeof(*hdr));
+	sha256->final(ctx, digest);
+}
+
+static const char *acvp_def_snapshot_dir(void)
+{
+	return acvp_def_snapshot_basedir[0] ? acvp_def_snapshot_basedir :
+					      ACVP_DS_CREDENTIALDIR;
+}
+
+/*
+ * The snapshot of a definition directory is stored in the snapshot directory
+ * under the SHA-256 digest of the resolved path name of the definition
+ * directory.
+ */
+static int acvp_def_snapshot_filename(const char *directory, char *pathname,
+				      size_t pathnamelen)
+{
+	char *resolved;
+	char hex[2 * SHA256_SIZE_DIGEST + 1] = { 0 };
+	uint8_t digest[SHA256_SIZE_DIGEST];
+	int ret;
+	HASH_CTX_ON_STACK(ctx);
+
+	resolved = realpath(directory, NULL);
+	if (!resolved)
+		return -errno;
+
+	sha256->init(ctx);
+	sha256->update(ctx, (const uint8_t *)resolved, strlen(resolved));
+	sha256->final(ctx, digest);
+	free(resolved);
+
+	bin2hex(digest, sizeof(digest), hex, sizeof(hex), 0);
+
+	ret = snprintf(pathname, pathnamelen, "%s/%s%s%s",
+		       acvp_def_snapshot_dir(),
+		       ACVP_DEF_SNAPSHOT_PREFIX, hex, ACVP_DEF_SNAPSHOT_SUFFIX);
+	if (ret < 0 || (size_t)ret >= pathnamelen)
+		return -ENAMETOOLONG;
+
+	return 0;
+}
+
+/*****************************************************************************
+ * Generation of the snapshot
+ *****************************************************************************/
+
+struct acvp_def_snapshot_str {
+	struct acvp_def_snapshot_str *next;
+	uint32_t off;
+};
+
+struct acvp_def_snapshot_builder {
+	char *strtab;
+	uint32_t strtab_len;
+	uint32_t strtab_alloc;
+	struct acvp_def_snapshot_str *buckets[ACVP_DEF_SNAPSHOT_STR_BUCKETS];
+
+	const struct def_lock **locks;
+	uint32_t nr_locks;
+};
+
+static void
+acvp_def_snapshot_builder_free(struct acvp_def_snapshot_builder *builder)
+{
+	unsigned int i;
+
+	for (i = 0; i < ACVP_DEF_SNAPSHOT_STR_BUCKETS; i++) {
+		struct acvp_def_snapshot_str *str = builder->buckets[i];
+
+		while (str) {
+			struct acvp_def_snapshot_str *next = str->next;
+
+			free(str);
+			str = next;
+		}
+	}
+	if (builder->strtab)
+		free(builder->strtab);
+	if (builder->locks)
+		free(builder->locks);
+}
+
+/* Add a string to the string table - identical strings are stored once */
+static int acvp_def_snapshot_add_str(struct acvp_def_snapshot_builder *builder,
+				     const char *str, uint32_t *off)
+{
+	struct acvp_def_snapshot_str *ent;
+	uint32_t hash = 2166136261U;
+	size_t len;
+	const char *p;
+
+	if (!str) {
+		*off = ACVP_DEF_SNAPSHOT_NONE;
+		return 0;
+	}
+
+	for (p = str; *p; p++) {
+		hash ^= (uint8_t)*p;
+		hash *= 16777619U;
+	}
+	hash %= ACVP_DEF_SNAPSHOT_STR_BUCKETS;
+
+	for (ent = builder->buckets[hash]; ent; ent = ent->next) {
+		if (!strcmp(builder->strtab + ent->off, str)) {
+			*off = ent->off;
+			return 0;
+		}
+	}
+
+	len = strlen(str) + 1;
+	if (len > UINT32_MAX - builder->strtab_len - 1)
+		return -EOVERFLOW;
+
+	if (builder->strtab_len + len > builder->strtab_alloc) {
+		uint32_t alloc = builder->strtab_alloc ?
+					 builder->strtab_alloc : 4096;
+		char *tmp;
+
+		while (alloc < builder->strtab_len + len &&
+		       alloc < UINT32_MAX / 2)
+			alloc *= 2;
+		if (alloc < builder->strtab_len + len)
+			alloc = UINT32_MAX;
+
+		tmp = realloc(builder->strtab, alloc);
+		if (!tmp)
+			return -ENOMEM;
+		builder->strtab = tmp;
+		builder->strtab_alloc = alloc;
+	}
+
+	ent = calloc(1, sizeof(*ent));
+	if (!ent)
+		return -ENOMEM;
+	ent->off = builder->strtab_len;
+	ent->next = builder->buckets[hash];
+	builder->buckets[hash] = ent;
+
+	memcpy(builder->strtab + builder->strtab_len, str, len);
+	builder->strtab_len += (uint32_t)len;
+	*off = ent->off;
+
+	return 0;
+}
+
+/* Reference of the lock - definitions sharing a lock share the reference */
+static uint32_t
+acvp_def_snapshot_add_lock(struct acvp_def_snapshot_builder *builder,
+			   const struct def_lock *lock)
+{
+	uint32_t i;
+
+	for (i = builder->nr_locks; i > 0; i--) {
+		if (builder->locks[i - 1] == lock)
+			return i - 1;
+	}
+
+	builder->locks[builder->nr_locks] = lock;
+	return builder->nr_locks++;
+}
+
+static uint32_t acvp_def_snapshot_file_ref(const char *pathname,
+					   char *const *pathnames,
+					   unsigned int nr_files)
+{
+	unsigned int i;
+
+	if (!pathname)
+		return ACVP_DEF_SNAPSHOT_NONE;
+
+	for (i = 0; i < nr_files; i++) {
+		if (!strcmp(pathnames[i], pathname))
+			return i;
+	}
+
+	return ACVP_DEF_SNAPSHOT_NONE;
+}
+
+static int acvp_def_snapshot_add_oe_dep(
+	struct acvp_def_snapshot_builder *builder,
+	const struct def_dependency *def_dep,
+	struct acvp_def_snapshot_oe_dep *rec)
+{
+	int ret;
+
+	rec->features = def_dep->features;
+	rec->acvp_dep_id = def_dep->acvp_dep_id;
+	rec->type = (uint32_t)def_dep->def_dependency_type;
+	CKINT(acvp_def_snapshot_add_str(builder, def_dep->name, &rec->name));
+	CKINT(acvp_def_snapshot_add_str(builder, def_dep->description,
+					&rec->description));
+	CKINT(acvp_def_snapshot_add_str(builder, def_dep->cpe, &rec->cpe));
+	CKINT(acvp_def_snapshot_add_str(builder, def_dep->swid, &rec->swid));
+	CKINT(acvp_def_snapshot_add_str(builder, def_dep->manufacturer,
+					&rec->manufacturer));
+	CKINT(acvp_def_snapshot_add_str(builder, def_dep->proc_family,
+					&rec->proc_family));
+	CKINT(acvp_def_snapshot_add_str(builder, def_dep->proc_family_internal,
+					&rec->proc_family_internal));
+	CKINT(acvp_def_snapshot_add_str(builder, def_dep->proc_name,
+					&rec->proc_name));
+	CKINT(acvp_def_snapshot_add_str(builder, def_dep->proc_series,
+					&rec->proc_series));
+
+out:
+	return ret;
+}
+
+static int acvp_def_snapshot_add_info(struct acvp_def_snapshot_builder *builder,
+				      const struct def_info *info,
+				      struct acvp_def_snapshot_def *rec)
+{
+	int ret;
+
+	CKINT(acvp_def_snapshot_add_str(builder, info->module_name,
+					&rec->module_name));
+	CKINT(acvp_def_snapshot_add_str(builder, info->impl_name,
+					&rec->impl_name));
+	CKINT(acvp_def_snapshot_add_str(builder, info->impl_description,
+					&rec->impl_description));
+	CKINT(acvp_def_snapshot_add_str(builder, info->orig_module_name,
+					&rec->orig_module_name));
+	CKINT(acvp_def_snapshot_add_str(builder, info->module_name_filesafe,
+					&rec->module_name_filesafe));
+	CKINT(acvp_def_snapshot_add_str(builder, info->module_name_internal,
+					&rec->module_name_internal));
+	rec->module_type = (uint32_t)info->module_type;
+	CKINT(acvp_def_snapshot_add_str(builder, info->module_version,
+					&rec->module_version));
+	CKINT(acvp_def_snapshot_add_str(builder, info->module_version_filesafe,
+					&rec->module_version_filesafe));
+	CKINT(acvp_def_snapshot_add_str(builder, info->module_description,
+					&rec->module_description));
+
+out:
+	return ret;
+}
+
+static int
+acvp_def_snapshot_add_vendor(struct acvp_def_snapshot_builder *builder,
+			     const struct def_vendor *vendor,
+			     struct acvp_def_snapshot_def *rec)
+{
+	int ret;
+
+	CKINT(acvp_def_snapshot_add_str(builder, vendor->vendor_name,
+					&rec->vendor_name));
+	CKINT(acvp_def_snapshot_add_str(builder, vendor->vendor_name_filesafe,
+					&rec->vendor_name_filesafe));
+	CKINT(acvp_def_snapshot_add_str(builder, vendor->vendor_url,
+					&rec->vendor_url));
+	CKINT(acvp_def_snapshot_add_str(builder, vendor->contact_name,
+					&rec->contact_name));
+	CKINT(acvp_def_snapshot_add_str(builder, vendor->contact_email,
+					&rec->contact_email));
+	CKINT(acvp_def_snapshot_add_str(builder, vendor->contact_phone,
+					&rec->contact_phone));
+	CKINT(acvp_def_snapshot_add_str(builder, vendor->addr_street,
+					&rec->addr_street));
+	CKINT(acvp_def_snapshot_add_str(builder, vendor->addr_locality,
+					&rec->addr_locality));
+	CKINT(acvp_def_snapshot_add_str(builder, vendor->addr_region,
+					&rec->addr_region));
+	CKINT(acvp_def_snapshot_add_str(builder, vendor->addr_country,
+					&rec->addr_country));
+	CKINT(acvp_def_snapshot_add_str(builder, vendor->addr_zipcode,
+					&rec->addr_zipcode));
+
+out:
+	return ret;
+}
+
+int acvp_def_snapshot_write(const char *directory,
+			    const struct acvp_def_snapshot_src *src,
+			    unsigned int nr_src,
+			    struct definition *const *defs,
+			    unsigned int nr_defs)
+{
+	struct acvp_def_snapshot_builder builder;
+	struct acvp_def_snapshot_list list;
+	struct acvp_def_snapshot_hdr *hdr;
+	struct acvp_def_snapshot_file *files = NULL;
+	struct acvp_def_snapshot_def *def_recs = NULL;
+	struct acvp_def_snapshot_oe_dep *oe_dep_recs = NULL;
+	struct acvp_def_snapshot_deps *deps_recs = NULL;
+	struct def_algo_map *head, **maps = NULL;
+	char **pathnames = NULL;
+	char pathname[FILENAME_MAX];
+	uint8_t maps_digest[SHA256_SIZE_DIGEST];
+	uint8_t *buf = NULL, *p;
+	uint64_t len;
+	uint32_t empty;
+	unsigned int i, j, nr_maps = 0, nr_oe_deps = 0, nr_deps = 0;
+	int ret = 0;
+
+	if (!acvp_def_snapshot_enabled)
+		return 0;
+
+	memset(&builder, 0, sizeof(builder));
+	CKINT(acvp_def_snapshot_list(directory, &list));
+
+	/* The snapshot is only valid for the files the definitions are from */
+	if (list.nr != nr_src)
+		goto changed;
+
+	if (list.nr) {
+		files = calloc(list.nr, sizeof(*files));
+		CKNULL(files, -ENOMEM);
+		pathnames = calloc(list.nr, sizeof(*pathnames));
+		CKNULL(pathnames, -ENOMEM);
+	}
+
+	for (i = 0; i < list.nr; i++) {
+		struct acvp_def_snapshot_file *file = &files[i];
+		struct stat statbuf;
+
+		acvp_def_snapshot_pathname(directory, list.dirs[i],
+					   list.names[i], pathname,
+					   sizeof(pathname));
+		CKINT(acvp_duplicate(&pathnames[i], pathname));
+
+		for (j = 0; j < nr_src; j++) {
+			if (!strcmp(src[j].pathname, pathname))
+				break;
+		}
+		if (j == nr_src)
+			goto changed;
+
+		CKINT(acvp_def_snapshot_hash_file(pathname, file->digest));
+		if (stat(pathname, &statbuf) ||
+		    statbuf.st_size != src[j].size ||
+		    statbuf.st_mtim.tv_sec != src[j].mtime.tv_sec ||
+		    statbuf.st_mtim.tv_nsec != src[j].mtime.tv_nsec)
+			goto changed;
+
+		file->size = (uint64_t)statbuf.st_size;
+		file->mtime_sec = (int64_t)statbuf.st_mtim.tv_sec;
+		file->mtime_nsec = (int64_t)statbuf.st_mtim.tv_nsec;
+		file->dir = list.dirs[i];
+		CKINT(acvp_def_snapshot_add_str(&builder, list.names[i],
+						&file->name));
+	}
+
+	for (i = 0; i < nr_defs; i++) {
+		const struct def_dependency *def_dep;
+		const struct def_deps *deps;
+
+		for (def_dep = defs[i]->oe->def_dep; def_dep;
+		     def_dep = def_dep->next)
+			nr_oe_deps++;
+		for (deps = defs[i]->deps; deps; deps = deps->next)
+			nr_deps++;
+	}
+
+	if (nr_defs) {
+		def_recs = calloc(nr_defs, sizeof(*def_recs));
+		CKNULL(def_recs, -ENOMEM);
+		builder.locks = calloc(3 * nr_defs, sizeof(*builder.locks));
+		CKNULL(builder.locks, -ENOMEM);
+	}
+	if (nr_oe_deps) {
+		oe_dep_recs = calloc(nr_oe_deps, sizeof(*oe_dep_recs));
+		CKNULL(oe_dep_recs, -ENOMEM);
+	}
+	if (nr_deps) {
+		deps_recs = calloc(nr_deps, sizeof(*deps_recs));
+		CKNULL(deps_recs, -ENOMEM);
+	}
+
+	head = acvp_def_maps_get();
+	ret = acvp_def_snapshot_maps(head, &maps, &nr_maps, maps_digest);
+	if (ret) {
+		acvp_def_maps_put();
+		goto out;
+	}
+
+	for (i = 0, nr_oe_deps = 0, nr_deps = 0; i < nr_defs; i++) {
+		const struct definition *def = defs[i];
+		struct acvp_def_snapshot_def *rec = &def_recs[i];
+		const struct def_dependency *def_dep;
+		const struct def_deps *deps;
+
+		rec->map = ACVP_DEF_SNAPSHOT_NONE;
+		if (def->uninstantiated_def) {
+			for (j = 0; j < nr_maps; j++) {
+				if (maps[j] == def->uninstantiated_def) {
+					rec->map = j;
+					break;
+				}
+			}
+			if (rec->map == ACVP_DEF_SNAPSHOT_NONE)
+				break;
+		}
+
+		rec->info_file = acvp_def_snapshot_file_ref(
+			def->info->def_module_file, pathnames, list.nr);
+		rec->vendor_file = acvp_def_snapshot_file_ref(
+			def->vendor->def_vendor_file, pathnames, list.nr);
+		rec->oe_file = acvp_def_snapshot_file_ref(
+			def->oe->def_oe_file, pathnames, list.nr);
+		if (rec->info_file == ACVP_DEF_SNAPSHOT_NONE ||
+		    rec->vendor_file == ACVP_DEF_SNAPSHOT_NONE ||
+		    rec->oe_file == ACVP_DEF_SNAPSHOT_NONE)
+			break;
+
+		rec->info_lock =
+			acvp_def_snapshot_add_lock(&builder, def->info->def_lock);
+		rec->vendor_lock = acvp_def_snapshot_add_lock(
+			&builder, def->vendor->def_lock);
+		rec->oe_lock =
+			acvp_def_snapshot_add_lock(&builder, def->oe->def_lock);
+
+		ret = acvp_def_snapshot_add_info(&builder, def->info, rec);
+		if (ret)
+			break;
+		ret = acvp_def_snapshot_add_vendor(&builder, def->vendor, rec);
+		if (ret)
+			break;
+
+		rec->acvp_oe_id = def->oe->acvp_oe_id;
+		rec->config_file_version = def->oe->config_file_version;
+		rec->oe_dep_first = nr_oe_deps;
+		for (def_dep = def->oe->def_dep; def_dep;
+		     def_dep = def_dep->next) {
+			ret = acvp_def_snapshot_add_oe_dep(
+				&builder, def_dep, &oe_dep_recs[nr_oe_deps]);
+			if (ret)
+				break;
+			nr_oe_deps++;
+			rec->oe_dep_count++;
+		}
+		if (ret)
+			break;
+
+		rec->deps_first = nr_deps;
+		for (deps = def->deps; deps; deps = deps->next) {
+			struct acvp_def_snapshot_deps *deps_rec =
+				&deps_recs[nr_deps];
+
+			deps_rec->deps_type = (uint32_t)deps->deps_type;
+			ret = acvp_def_snapshot_add_str(&builder,
+							deps->dep_cipher,
+							&deps_rec->dep_cipher);
+			if (ret)
+				break;
+			ret = acvp_def_snapshot_add_str(
+				&builder, deps->dep_name, &deps_rec->dep_name);
+			if (ret)
+				break;
+			nr_deps++;
+			rec->deps_count++;
+		}
+		if (ret)
+			break;
+	}
+	acvp_def_maps_put();
+
+	if (ret)
+		goto out;
+
+	/* A definition refers to a map or file the snapshot cannot hold */
+	if (i < nr_defs) {
+		logger(LOGGER_DEBUG, LOGGER_C_ANY,
+		       "Definitions of %s cannot be stored in a snapshot\n",
+		       directory);
+		goto out;
+	}
+
+	/* The string table is never empty to simplify its validation */
+	if (!builder.strtab_len)
+		CKINT(acvp_def_snapshot_add_str(&builder, "", &empty));
+
+	len = sizeof(*hdr) + (uint64_t)list.nr * sizeof(*files) +
+	      (uint64_t)nr_defs * sizeof(*def_recs) +
+	      (uint64_t)nr_oe_deps * sizeof(*oe_dep_recs) +
+	      (uint64_t)nr_deps * sizeof(*deps_recs) + builder.strtab_len;
+	if (len > SIZE_MAX) {
+		ret = -EOVERFLOW;
+		goto out;
+	}
+
+	buf = calloc(1, (size_t)len);
+	CKNULL(buf, -ENOMEM);
+
+	hdr = (struct acvp_def_snapshot_hdr *)buf;
+	memcpy(hdr->magic, ACVP_DEF_SNAPSHOT_MAGIC, sizeof(hdr->magic));
+	hdr->version = ACVP_DEF_SNAPSHOT_VERSION;
+	hdr->endian = ACVP_DEF_SNAPSHOT_ENDIAN;
+	hdr->len = len;
+	memcpy(hdr->maps_digest, maps_digest, sizeof(hdr->maps_digest));
+	hdr->nr_files = list.nr;
+	hdr->nr_defs = nr_defs;
+	hdr->nr_oe_deps = nr_oe_deps;
+	hdr->nr_deps = nr_deps;
+	hdr->strtab_len = builder.strtab_len;
+
+	p = buf + sizeof(*hdr);
+	if (list.nr) {
+		memcpy(p, files, list.nr * sizeof(*files));
+		p += list.nr * sizeof(*files);
+	}
+	if (nr_defs) {
+		memcpy(p, def_recs, nr_defs * sizeof(*def_recs));
+		p += nr_defs * sizeof(*def_recs);
+	}
+	if (nr_oe_deps) {
+		memcpy(p, oe_dep_recs, nr_oe_deps * sizeof(*oe_dep_recs));
+		p += nr_oe_deps * sizeof(*oe_dep_recs);
+	}
+	if (nr_deps) {
+		memcpy(p, deps_recs, nr_deps * sizeof(*deps_recs));
+		p += nr_deps * sizeof(*deps_recs);
+	}
+	memcpy(p, builder.strtab, builder.strtab_len);
+
+	acvp_def_snapshot_body_digest(buf, (size_t)len, hdr->body_digest);
+
+	CKINT(acvp_def_snapshot_filename(directory, pathname,
+					 sizeof(pathname)));
+
+	/* The snapshot directory is part of the secure data store */
+	if (mkdir(acvp_def_snapshot_dir(), 0700) && errno != EEXIST)
+		ret = -errno;
+	else
+		ret = acvp_ds_sync_write(pathname, buf, (size_t)len, 0600);
+	if (ret) {
+		/* The definitions are usable without a snapshot */
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+		       "Cannot write definition snapshot %s (%d)\n", pathname,
+		       ret);
+		ret = 0;
+		goto out;
+	}
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY,
+	       "Definition snapshot %s written with %u definitions\n",
+	       pathname, nr_defs);
+
+	goto out;
+
+changed:
+	logger(LOGGER_DEBUG, LOGGER_C_ANY,
+	       "Definition files of %s changed during loading, snapshot not written\n",
+	       directory);
+
+out:
+	if (pathnames) {
+		for (i = 0; i < list.nr; i++) {
+			if (pathnames[i])
+				free(pathnames[i]);
+		}
+		free(pathnames);
+	}
+	acvp_def_snapshot_list_free(&list);
+	acvp_def_snapshot_builder_free(&builder);
+	if (files)
+		free(files);
+	if (def_recs)
+		free(def_recs);
+	if (oe_dep_recs)
+		free(oe_dep_recs);
+	if (deps_recs)
+		free(deps_recs);
+	if (maps)
+		free(maps);
+	if (buf)
+		free(buf);
+	return ret;
+}
+
+/*****************************************************************************
+ * Loading of the snapshot
+ *****************************************************************************/
+
+struct acvp_def_snapshot {
+	const uint8_t *data;
+	size_t len;
+	const struct acvp_def_snapshot_hdr *hdr;
+	const struct acvp_def_snapshot_file *files;
+	const struct acvp_def_snapshot_def *defs;
+	const struct acvp_def_snapshot_oe_dep *oe_deps;
+	const struct acvp_def_snapshot_deps *deps;
+	const char *strtab;
+};
+
+/* Check the structure of the snapshot */
+static bool acvp_def_snapshot_parse(struct acvp_def_snapshot *snap)
+{
+	const struct acvp_def_snapshot_hdr *hdr;
+	uint8_t digest[SHA256_SIZE_DIGEST];
+	uint64_t len;
+
+	if (snap->len < sizeof(*hdr))
+		return false;
+
+	hdr = (const struct acvp_def_snapshot_hdr *)snap->data;
+	if (memcmp(hdr->magic, ACVP_DEF_SNAPSHOT_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != ACVP_DEF_SNAPSHOT_VERSION ||
+	    hdr->endian != ACVP_DEF_SNAPSHOT_ENDIAN || hdr->len != snap->len)
+		return false;
+
+	len = sizeof(*hdr) + (uint64_t)hdr->nr_files * sizeof(*snap->files) +
+	      (uint64_t)hdr->nr_defs * sizeof(*snap->defs) +
+	      (uint64_t)hdr->nr_oe_deps * sizeof(*snap->oe_deps) +
+	      (uint64_t)hdr->nr_deps * sizeof(*snap->deps) + hdr->strtab_len;
+	if (len != snap->len || !hdr->strtab_len ||
+	    snap->data[snap->len - 1] != '\0')
+		return false;
+
+	acvp_def_snapshot_body_digest(snap->data, snap->len, digest);
+	if (memcmp(digest, hdr->body_digest, sizeof(digest)))
+		return false;
+
+	snap->hdr = hdr;
+	snap->files = (const struct acvp_def_snapshot_file *)(hdr + 1);
+	snap->defs = (const struct acvp_def_snapshot_def *)(snap->files +
+							     hdr->nr_files);
+	snap->oe_deps = (const struct acvp_def_snapshot_oe_dep *)(snap->defs +
+								  hdr->nr_defs);
+	snap->deps = (const struct acvp_def_snapshot_deps *)(snap->oe_deps +
+							     hdr->nr_oe_deps);
+	snap->strtab = (const char *)(snap->deps + hdr->nr_deps);
+
+	return true;
+}
+
+static int acvp_def_snapshot_str(const struct acvp_def_snapshot *snap,
+				 uint32_t off, const char **str)
+{
+	if (off == ACVP_DEF_SNAPSHOT_NONE) {
+		*str = NULL;
+		return 0;
+	}
+	if (off >= snap->hdr->strtab_len)
+		return -EINVAL;
+
+	*str = snap->strtab + off;
+	return 0;
+}
+
+static int acvp_def_snapshot_dup(const struct acvp_def_snapshot *snap,
+				 uint32_t off, char **dst)
+{
+	const char *str;
+	int ret;
+
+	CKINT(acvp_def_snapshot_str(snap, off, &str));
+	CKINT(acvp_duplicate(dst, str));
+
+out:
+	return ret;
+}
+
+/*
+ * Check that the snapshot was generated from the current configuration files.
+ * If a file is only touched, its record in the copy of the snapshot is
+ * updated.
+ */
+static bool acvp_def_snapshot_check_files(const char *directory,
+					  const struct acvp_def_snapshot *snap,
+					  uint8_t *copy, bool *refresh)
+{
+	struct acvp_def_snapshot_list list;
+	char pathname[FILENAME_MAX];
+	unsigned int i;
+	bool valid = false;
+
+	if (acvp_def_snapshot_list(directory, &list))
+		return false;
+
+	if (list.nr != snap->hdr->nr_files)
+		goto out;
+
+	for (i = 0; i < list.nr; i++) {
+		const struct acvp_def_snapshot_file *file = &snap->files[i];
+		struct acvp_def_snapshot_file *new;
+		uint8_t digest[SHA256_SIZE_DIGEST];
+		struct stat statbuf;
+		const char *name;
+
+		if (file->dir != list.dirs[i] ||
+		    acvp_def_snapshot_str(snap, file->name, &name) || !name ||
+		    strcmp(name, list.names[i]))
+			goto out;
+
+		acvp_def_snapshot_pathname(directory, list.dirs[i],
+					   list.names[i], pathname,
+					   sizeof(pathname));
+		if (stat(pathname, &statbuf) ||
+		    (uint64_t)statbuf.st_size != file->size)
+			goto out;
+
+		if ((int64_t)statbuf.st_mtim.tv_sec == file->mtime_sec &&
+		    (int64_t)statbuf.st_mtim.tv_nsec == file->mtime_nsec)
+			continue;
+
+		if (acvp_def_snapshot_hash_file(pathname, digest) ||
+		    memcmp(digest, file->digest, sizeof(digest)))
+			goto out;
+
+		new = (struct acvp_def_snapshot_file *)(copy +
+							((const uint8_t *)file -
+							 snap->data));
+		new->mtime_sec = (int64_t)statbuf.st_mtim.tv_sec;
+		new->mtime_nsec = (int64_t)statbuf.st_mtim.tv_nsec;
+		*refresh = true;
+	}
+
+	valid = true;
+
+out:
+	acvp_def_snapshot_list_free(&list);
+	return valid;
+}
+
+static int acvp_def_snapshot_lock(struct def_lock **locks, uint32_t nr_locks,
+				  uint32_t ref, struct def_lock **lock)
+{
+	int ret = 0;
+
+	if (ref >= nr_locks) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (!locks[ref])
+		CKINT(acvp_def_alloc_lock(&locks[ref]));
+
+	atomic_inc(&locks[ref]->refcnt);
+	*lock = locks[ref];
+
+out:
+	return ret;
+}
+
+static int acvp_def_snapshot_file_path(const char *directory,
+				       const struct acvp_def_snapshot *snap,
+				       uint32_t ref, char **pathname)
+{
+	const struct acvp_def_snapshot_file *file;
+	char path[FILENAME_MAX];
+	const char *name;
+	int ret;
+
+	if (ref >= snap->hdr->nr_files ||
+	    snap->files[ref].dir >= ARRAY_SIZE(acvp_def_snapshot_dirs)) {
+		ret = -EINVAL;
+		goto out;
+	}
+	file = &snap->files[ref];
+	CKINT(acvp_def_snapshot_str(snap, file->name, &name));
+	CKNULL(name, -EINVAL);
+
+	acvp_def_snapshot_pathname(directory, file->dir, name, path,
+				   sizeof(path));
+	CKINT(acvp_duplicate(pathname, path));
+
+out:
+	return ret;
+}
+
+static int acvp_def_snapshot_load_info(const char *directory,
+				       const struct acvp_def_snapshot *snap,
+				       const struct acvp_def_snapshot_def *rec,
+				       struct def_info *info)
+{
+	int ret;
+
+	CKINT(acvp_def_snapshot_dup(snap, rec->module_name,
+				    &info->module_name));
+	CKINT(acvp_def_snapshot_dup(snap, rec->impl_name, &info->impl_name));
+	CKINT(acvp_def_snapshot_dup(snap, rec->impl_description,
+				    &info->impl_description));
+	CKINT(acvp_def_snapshot_dup(snap, rec->orig_module_name,
+				    &info->orig_module_name));
+	CKINT(acvp_def_snapshot_dup(snap, rec->module_name_filesafe,
+				    &info->module_name_filesafe));
+	CKINT(acvp_def_snapshot_dup(snap, rec->module_name_internal,
+				    &info->module_name_internal));
+	info->module_type = (enum def_mod_type)rec->module_type;
+	CKINT(acvp_def_snapshot_dup(snap, rec->module_version,
+				    &info->module_version));
+	CKINT(acvp_def_snapshot_dup(snap, rec->module_version_filesafe,
+				    &info->module_version_filesafe));
+	CKINT(acvp_def_snapshot_dup(snap, rec->module_description,
+				    &info->module_description));
+	CKINT(acvp_def_snapshot_file_path(directory, snap, rec->info_file,
+					  &info->def_module_file));
+
+out:
+	return ret;
+}
+
+static int acvp_def_snapshot_load_vendor(const char *directory,
+					 const struct acvp_def_snapshot *snap,
+					 const struct acvp_def_snapshot_def *rec,
+					 struct def_vendor *vendor)
+{
+	int ret;
+
+	CKINT(acvp_def_snapshot_dup(snap, rec->vendor_name,
+				    &vendor->vendor_name));
+	CKINT(acvp_def_snapshot_dup(snap, rec->vendor_name_filesafe,
+				    &vendor->vendor_name_filesafe));
+	CKINT(acvp_def_snapshot_dup(snap, rec->vendor_url,
+				    &vendor->vendor_url));
+	CKINT(acvp_def_snapshot_dup(snap, rec->contact_name,
+				    &vendor->contact_name));
+	CKINT(acvp_def_snapshot_dup(snap, rec->contact_email,
+				    &vendor->contact_email));
+	CKINT(acvp_def_snapshot_dup(snap, rec->contact_phone,
+				    &vendor->contact_phone));
+	CKINT(acvp_def_snapshot_dup(snap, rec->addr_street,
+				    &vendor->addr_street));
+	CKINT(acvp_def_snapshot_dup(snap, rec->addr_locality,
+				    &vendor->addr_locality));
+	CKINT(acvp_def_snapshot_dup(snap, rec->addr_region,
+				    &vendor->addr_region));
+	CKINT(acvp_def_snapshot_dup(snap, rec->addr_country,
+				    &vendor->addr_country));
+	CKINT(acvp_def_snapshot_dup(snap, rec->addr_zipcode,
+				    &vendor->addr_zipcode));
+	CKINT(acvp_def_snapshot_file_path(directory, snap, rec->vendor_file,
+					  &vendor->def_vendor_file));
+
+out:
+	return ret;
+}
+
+static int acvp_def_snapshot_load_oe(const char *directory,
+				     const struct acvp_def_snapshot *snap,
+				     const struct acvp_def_snapshot_def *rec,
+				     struct def_oe *oe)
+{
+	struct def_dependency **tail = &oe->def_dep;
+	uint32_t i;
+	int ret;
+
+	oe->acvp_oe_id = rec->acvp_oe_id;
+	oe->config_file_version = rec->config_file_version;
+	CKINT(acvp_def_snapshot_file_path(directory, snap, rec->oe_file,
+					  &oe->def_oe_file));
+
+	if (rec->oe_dep_first > snap->hdr->nr_oe_deps ||
+	    rec->oe_dep_count > snap->hdr->nr_oe_deps - rec->oe_dep_first) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < rec->oe_dep_count; i++) {
+		const struct acvp_def_snapshot_oe_dep *dep_rec =
+			&snap->oe_deps[rec->oe_dep_first + i];
+		struct def_dependency *def_dep;
+
+		def_dep = calloc(1, sizeof(*def_dep));
+		CKNULL(def_dep, -ENOMEM);
+		*tail = def_dep;
+		tail = &def_dep->next;
+
+		def_dep->features = dep_rec->features;
+		def_dep->acvp_dep_id = dep_rec->acvp_dep_id;
+		def_dep->def_dependency_type =
+			(enum def_dependency_type)dep_rec->type;
+		CKINT(acvp_def_snapshot_dup(snap, dep_rec->name,
+					    &def_dep->name));
+		CKINT(acvp_def_snapshot_dup(snap, dep_rec->description,
+					    &def_dep->description));
+		CKINT(acvp_def_snapshot_dup(snap, dep_rec->cpe, &def_dep->cpe));
+		CKINT(acvp_def_snapshot_dup(snap, dep_rec->swid,
+					    &def_dep->swid));
+		CKINT(acvp_def_snapshot_dup(snap, dep_rec->manufacturer,
+					    &def_dep->manufacturer));
+		CKINT(acvp_def_snapshot_dup(snap, dep_rec->proc_family,
+					    &def_dep->proc_family));
+		CKINT(acvp_def_snapshot_dup(snap, dep_rec->proc_family_internal,
+					    &def_dep->proc_family_internal));
+		CKINT(acvp_def_snapshot_dup(snap, dep_rec->proc_name,
+					    &def_dep->proc_name));
+		CKINT(acvp_def_snapshot_dup(snap, dep_rec->proc_series,
+					    &def_dep->proc_series));
+	}
+
+out:
+	return ret;
+}
+
+static int acvp_def_snapshot_load_deps(const struct acvp_def_snapshot *snap,
+				       const struct acvp_def_snapshot_def *rec,
+				       struct definition *def)
+{
+	struct def_deps **tail = &def->deps;
+	uint32_t i;
+	int ret = 0;
+
+	if (rec->deps_first > snap->hdr->nr_deps ||
+	    rec->deps_count > snap->hdr->nr_deps - rec->deps_first) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < rec->deps_count; i++) {
+		const struct acvp_def_snapshot_deps *deps_rec =
+			&snap->deps[rec->deps_first + i];
+		struct def_deps *deps;
+
+		deps = calloc(1, sizeof(*deps));
+		CKNULL(deps, -ENOMEM);
+		*tail = deps;
+		tail = &deps->next;
+
+		deps->deps_type = (enum acvp_deps_type)deps_rec->deps_type;
+		CKINT(acvp_def_snapshot_dup(snap, deps_rec->dep_cipher,
+					    &deps->dep_cipher));
+		CKINT(acvp_def_snapshot_dup(snap, deps_rec->dep_name,
+					    &deps->dep_name));
+	}
+
+out:
+	return ret;
+}
+
+/* Instantiate the definitions of the snapshot - caller holds the maps */
+static int acvp_def_snapshot_defs(const char *directory,
+				  const struct acvp_def_snapshot *snap,
+				  struct def_algo_map **maps,
+				  unsigned int nr_maps,
+				  struct definition **defs)
+{
+	const struct acvp_def_snapshot_hdr *hdr = snap->hdr;
+	struct definition *def, **tail = defs;
+	struct def_lock **locks = NULL;
+	uint32_t i, nr_locks = 3 * hdr->nr_defs;
+	int ret = 0;
+
+	if (nr_locks) {
+		locks = calloc(nr_locks, sizeof(*locks));
+		CKNULL(locks, -ENOMEM);
+	}
+
+	for (i = 0; i < hdr->nr_defs; i++) {
+		const struct acvp_def_snapshot_def *rec = &snap->defs[i];
+
+		def = calloc(1, sizeof(*def));
+		CKNULL(def, -ENOMEM);
+		*tail = def;
+		tail = &def->next;
+
+		if (rec->map != ACVP_DEF_SNAPSHOT_NONE) {
+			struct def_algo_map *map;
+
+			if (rec->map >= nr_maps) {
+				ret = -EINVAL;
+				goto out;
+			}
+			map = maps[rec->map];
+			def->algos = map->algos;
+			def->num_algos = map->num_algos;
+			def->uninstantiated_def = map;
+		}
+
+		def->info = calloc(1, sizeof(*def->info));
+		CKNULL(def->info, -ENOMEM);
+		CKINT(acvp_def_snapshot_lock(locks, nr_locks, rec->info_lock,
+					     &def->info->def_lock));
+		CKINT(acvp_def_snapshot_load_info(directory, snap, rec,
+						  def->info));
+
+		def->vendor = calloc(1, sizeof(*def->vendor));
+		CKNULL(def->vendor, -ENOMEM);
+		CKINT(acvp_def_snapshot_lock(locks, nr_locks, rec->vendor_lock,
+					     &def->vendor->def_lock));
+		CKINT(acvp_def_snapshot_load_vendor(directory, snap, rec,
+						    def->vendor));
+
+		def->oe = calloc(1, sizeof(*def->oe));
+		CKNULL(def->oe, -ENOMEM);
+		CKINT(acvp_def_snapshot_lock(locks, nr_locks, rec->oe_lock,
+					     &def->oe->def_lock));
+		CKINT(acvp_def_snapshot_load_oe(directory, snap, rec,
+						def->oe));
+
+		CKINT(acvp_def_snapshot_load_deps(snap, rec, def));
+
+		/* The entropy source definitions are not part of the snapshot */
+		CKINT(esvp_def_config(directory, &def->es));
+	}
+
+out:
+	if (locks)
+		free(locks);
+	if (ret) {
+		acvp_def_release_list(*defs);
+		*defs = NULL;
+	}
+	return ret;
+}
+
+int acvp_def_snapshot_load(const char *directory, struct definition **defs)
+{
+	struct acvp_def_snapshot snap;
+	struct def_algo_map *head, **maps = NULL;
+	struct stat statbuf;
+	char pathname[FILENAME_MAX];
+	uint8_t maps_digest[SHA256_SIZE_DIGEST];
+	uint8_t *copy = NULL;
+	unsigned int nr_maps = 0;
+	int ret = 1, fd;
+	bool refresh = false;
+
+	*defs = NULL;
+
+	if (!acvp_def_snapshot_enabled)
+		return 1;
+
+	memset(&snap, 0, sizeof(snap));
+
+	if (acvp_def_snapshot_filename(directory, pathname, sizeof(pathname)))
+		return 1;
+	fd = open(pathname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 1;
+
+	if (fstat(fd, &statbuf) || statbuf.st_size <= 0 ||
+	    (uint64_t)statbuf.st_size > SIZE_MAX) {
+		close(fd);
+		return 1;
+	}
+
+	snap.len = (size_t)statbuf.st_size;
+	snap.data = mmap(NULL, snap.len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (snap.data == MAP_FAILED)
+		return 1;
+
+	if (!acvp_def_snapshot_parse(&snap)) {
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+		       "Definition snapshot %s is invalid\n", pathname);
+		goto out;
+	}
+
+	/* Touched files are recorded in a copy to refresh the snapshot */
+	copy = malloc(snap.len);
+	CKNULL(copy, -ENOMEM);
+	memcpy(copy, snap.data, snap.len);
+
+	if (!acvp_def_snapshot_check_files(directory, &snap, copy, &refresh)) {
+		logger(LOGGER_DEBUG, LOGGER_C_ANY,
+		       "Definition snapshot %s is outdated\n", pathname);
+		goto out;
+	}
+
+	head = acvp_def_maps_get();
+	ret = acvp_def_snapshot_maps(head, &maps, &nr_maps, maps_digest);
+	if (!ret) {
+		if (memcmp(maps_digest, snap.hdr->maps_digest,
+			   sizeof(maps_digest))) {
+			logger(LOGGER_DEBUG, LOGGER_C_ANY,
+			       "Definition snapshot %s does not match the algorithm definitions\n",
+			       pathname);
+			ret = 1;
+		} else {
+			ret = acvp_def_snapshot_defs(directory, &snap, maps,
+						     nr_maps, defs);
+		}
+	}
+	acvp_def_maps_put();
+
+	/* Let the configuration files report a problem of the snapshot */
+	if (ret < 0 && ret != -ENOMEM) {
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+		       "Definition snapshot %s unusable (%d)\n", pathname, ret);
+		ret = 1;
+	}
+	if (ret)
+		goto out;
+
+	logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+	       "%u definitions of %s loaded from snapshot\n",
+	       snap.hdr->nr_defs, directory);
+
+	if (refresh) {
+		acvp_def_snapshot_body_digest(
+			copy, snap.len,
+			((struct acvp_def_snapshot_hdr *)copy)->body_digest);
+		if (acvp_ds_sync_write(pathname, copy, snap.len, 0666)) {
+			logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+			       "Cannot refresh definition snapshot %s\n",
+			       pathname);
+		}
+	}
+
+out:
+	if (copy)
+		free(copy);
+	if (maps)
+		free(maps);
+	munmap((void *)snap.data, snap.len);
+	return ret;
+}
@@ -20,13 +20,16 @@
 
 #include <string.h>
 
+#include "authtoken_broker.h"
 #include "buffer.h"
 #include "build_bug_on.h"
 #include "logger.h"
 #include "internal.h"
 #include "json_wrapper.h"
 #include "definition.h"
+#include "mutex_w.h"
 #include "request_helper.h"
+#include "threading_support.h"
 #include "totp.h"
 
 int acvp_init_acvp_auth_ctx(struct acvp_auth_ctx **auth)
@@ -94,6 +97,8 @@ void acvp_release_auth(struct acvp_testid_ctx *testid_ctx)
 	if (!testid_ctx || !testid_ctx->server_auth)
 		return;
 
+	acvp_auth_refresh_untrack(testid_ctx);
+
 	auth = testid_ctx->server_auth;
 
 	acvp_release_acvp_auth_ctx(auth);
@@ -155,6 +160,19 @@ int acvp_set_authtoken(const struct acvp_testid_ctx *testid_ctx,
 	if (def)
 		CKINT(ds->acvp_datastore_write_authtoken(testid_ctx));
 
+	/* Share the token with other ACVP Proxy processes */
+	if (def && testid_ctx->testid) {
+		int rc = acvp_authtoken_broker_put(testid_ctx->ctx,
+						   testid_ctx->testid,
+						   testid_ctx->server_auth);
+
+		if (rc) {
+			logger(LOGGER_DEBUG, LOGGER_C_ANY,
+			       "Cannot publish JWT access token to JWT broker (%d)\n",
+			       rc);
+		}
+	}
+
 out:
 	return ret;
 }
@@ -287,6 +305,15 @@ static int acvp_process_login(const struct acvp_testid_ctx *testid_ctx,
 		       "Initial login received, store it for reuse\n");
 		acvp_release_acvp_auth_ctx(ctx_auth);
 		CKINT(acvp_copy_auth(ctx_auth, testid_ctx->server_auth));
+
+		ret = acvp_authtoken_broker_put(
+			ctx, ACVP_AUTHTOKEN_BROKER_INITIAL, ctx_auth);
+		if (ret) {
+			logger(LOGGER_DEBUG, LOGGER_C_ANY,
+			       "Cannot publish initial login token to JWT broker (%d)\n",
+			       ret);
+			ret = 0;
+		}
 	}
 
 out:
@@ -350,6 +377,36 @@ int acvp_login_need_refresh(const struct acvp_testid_ctx *testid_ctx)
 	return -EAGAIN;
 }
 
+/*
+ * Obtain a token generated by another ACVP Proxy process from the JWT broker.
+ * The caller must hold the broker lock.
+ */
+static int acvp_login_broker_get(const struct acvp_testid_ctx *testid_ctx)
+{
+	const struct acvp_ctx *ctx = testid_ctx->ctx;
+	struct acvp_auth_ctx *auth = testid_ctx->server_auth;
+	int ret = -ENOENT;
+
+	/* A token bound to the test session */
+	if (testid_ctx->testid) {
+		ret = acvp_authtoken_broker_get(ctx, testid_ctx->testid, auth);
+		if (!ret)
+			return 0;
+	}
+
+	/* An existing token can only be refreshed by the server */
+	if (acvp_jwt_exist(auth))
+		return ret;
+
+	/* An initial login token */
+	ret = acvp_authtoken_broker_get(ctx, ACVP_AUTHTOKEN_BROKER_INITIAL,
+					ctx->ctx_auth);
+	if (ret)
+		return ret;
+
+	return acvp_login_need_refresh_nonnull(testid_ctx);
+}
+
 void totp_debug_get_counter(uint64_t *counter, uint64_t *counter_stepped);
 static void acvp_login_debug_print(const char *login_buf)
 {
@@ -396,6 +453,8 @@ static int acvp_login_submit(struct json_object *login, const char *url,
 	netinfo.net = net;
 	netinfo.url = url;
 	netinfo.server_auth = NULL;
+	netinfo.sink = NULL;
+	netinfo.retry_after = NULL;
 	ret = na->acvp_http_post(&netinfo, &login_buf, response_buf);
 
 	/* Dump the password in case of an error for debugging */
@@ -455,6 +514,7 @@ int acvp_login(const struct acvp_testid_ctx *testid_ctx)
 	int ret = 0;
 	char url[ACVP_NET_URL_MAXLEN];
 	bool dump_register = (ctx) ? ctx->req_details.dump_register : false;
+	bool broker_locked = false;
 
 	CKNULL_LOG(auth, -EINVAL, "Authentication context missing\n");
 
@@ -464,6 +524,21 @@ int acvp_login(const struct acvp_testid_ctx *testid_ctx)
 	if (!acvp_login_need_refresh_nonnull(testid_ctx))
 		goto out;
 
+	/*
+	 * Another ACVP Proxy process may hold a valid token. The broker lock
+	 * is kept during the login so that other processes wait for our
+	 * token instead of logging in themselves.
+	 */
+	if (!dump_register && !acvp_authtoken_broker_lock(ctx)) {
+		broker_locked = true;
+
+		if (!acvp_login_broker_get(testid_ctx)) {
+			logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+			       "Using JWT access token obtained from JWT broker\n");
+			goto out;
+		}
+	}
+
 	login = json_object_new_array();
 	CKNULL(login, -ENOMEM);
 
@@ -530,6 +605,8 @@ int acvp_login(const struct acvp_testid_ctx *testid_ctx)
 	CKINT(acvp_process_login(testid_ctx, &response_buf));
 
 out:
+	if (broker_locked)
+		acvp_authtoken_broker_unlock();
 	mutex_unlock(&auth->mutex);
 	mutex_unlock(&ctx_auth->mutex);
 	ACVP_JSON_PUT_NULL(login);
@@ -795,3 +872,577 @@ out:
 
 	return ret;
 }
+
+/*****************************************************************************
+ * Proactive refresh of the JWT auth tokens
+ *****************************************************************************/
+
+#ifdef ACVP_USE_PTHREAD
+
+/*
+ * All test sessions that use a JWT auth token are tracked. Before the first
+ * JWT expires, all JWTs expiring within the refresh horizon are refreshed with
+ * one /login/refresh request. Thus only one TOTP value is needed for all of
+ * them and the worker threads do not have to wait for a TOTP value of their
+ * own during a login. JWTs that expired nevertheless are left to the login
+ * during their next use.
+ */
+#define ACVP_JWT_REFRESH_HORIZON 300
+
+/*
+ * @busy: The test session is part of the batch that is currently refreshed
+ *	  (protected by acvp_auth_refresh_lock)
+ * @retry: Earliest time for the next attempt after a failed refresh
+ */
+struct acvp_auth_refresh {
+	struct acvp_auth_refresh *next;
+	const struct acvp_testid_ctx *testid_ctx;
+	time_t retry;
+	bool busy;
+};
+
+struct acvp_auth_refresh_item {
+	const struct acvp_testid_ctx *testid_ctx;
+	struct acvp_auth_ctx *auth;
+};
+
+static DEFINE_MUTEX_W_UNLOCKED(acvp_auth_refresh_lock);
+static pthread_cond_t acvp_auth_refresh_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t acvp_auth_refresh_done = PTHREAD_COND_INITIALIZER;
+static struct acvp_auth_refresh *acvp_auth_refresh_head = NULL;
+static bool acvp_auth_refresh_running = false;
+static bool acvp_auth_refresh_shutdown = false;
+
+/*
+ * Protects the ESVP SD list of all test sessions as the refresh thread walks
+ * it while the ESVP upload adds new entries.
+ */
+static DEFINE_MUTEX_W_UNLOCKED(acvp_auth_refresh_sd_mutex);
+
+void acvp_auth_refresh_sd_lock(void)
+{
+	mutex_w_lock(&acvp_auth_refresh_sd_mutex);
+}
+
+void acvp_auth_refresh_sd_unlock(void)
+{
+	mutex_w_unlock(&acvp_auth_refresh_sd_mutex);
+}
+
+/* Expiry time of one JWT, 0 if there is none */
+static time_t acvp_auth_refresh_expiry(const struct acvp_auth_ctx *auth)
+{
+	time_t generated;
+
+	if (!auth || !acvp_jwt_exist(auth))
+		return 0;
+
+	/* Updated by the owner with the auth lock held */
+	generated = __atomic_load_n(&auth->jwt_token_generated,
+				    __ATOMIC_RELAXED);
+	if (!generated)
+		return 0;
+
+	return generated + ACVP_JWT_TOKEN_LIFETIME;
+}
+
+/* Earliest expiry time of all JWTs of the test session, 0 if there is none */
+static time_t
+acvp_auth_refresh_session_expiry(const struct acvp_testid_ctx *testid_ctx)
+{
+	const struct esvp_es_def *es = testid_ctx->es_def;
+	const struct esvp_sd_def *sd;
+	time_t expiry = acvp_auth_refresh_expiry(testid_ctx->server_auth), tmp;
+
+	if (!es)
+		return expiry;
+
+	tmp = acvp_auth_refresh_expiry(es->es_auth);
+	if (tmp && (!expiry || tmp < expiry))
+		expiry = tmp;
+
+	acvp_auth_refresh_sd_lock();
+	for (sd = es->sd; sd; sd = sd->next) {
+		tmp = acvp_auth_refresh_expiry(sd->sd_auth);
+		if (tmp && (!expiry || tmp < expiry))
+			expiry = tmp;
+	}
+	acvp_auth_refresh_sd_unlock();
+
+	return expiry;
+}
+
+/*
+ * Time at which the refresh of the test session is due, 0 if no refresh is
+ * possible - caller holds acvp_auth_refresh_lock
+ */
+static time_t acvp_auth_refresh_due(const struct acvp_auth_refresh *session,
+				    const time_t now)
+{
+	time_t expiry = acvp_auth_refresh_session_expiry(session->testid_ctx);
+	time_t due;
+
+	if (!expiry || expiry <= now)
+		return 0;
+
+	due = expiry - ACVP_JWT_REFRESH_HORIZON;
+	if (due < session->retry)
+		due = session->retry;
+	if (due >= expiry)
+		return 0;
+
+	return due;
+}
+
+/* Caller holds acvp_auth_refresh_sd_mutex */
+static unsigned int
+acvp_auth_refresh_nr_auths(const struct acvp_testid_ctx *testid_ctx)
+{
+	const struct esvp_es_def *es = testid_ctx->es_def;
+	const struct esvp_sd_def *sd;
+	unsigned int nr = 1;
+
+	if (!es)
+		return nr;
+
+	if (es->es_auth)
+		nr++;
+	for (sd = es->sd; sd; sd = sd->next) {
+		if (sd->sd_auth)
+			nr++;
+	}
+
+	return nr;
+}
+
+static void acvp_auth_refresh_unlock(struct acvp_auth_refresh_item *items,
+				     unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++)
+		mutex_unlock(&items[i].auth->mutex);
+}
+
+static int acvp_auth_refresh_lock_one(const struct acvp_testid_ctx *testid_ctx,
+				      struct acvp_auth_ctx *auth,
+				      struct acvp_auth_refresh_item *items,
+				      unsigned int *nr)
+{
+	if (mutex_trylock(&auth->mutex))
+		return -EBUSY;
+
+	if (!acvp_jwt_exist(auth)) {
+		mutex_unlock(&auth->mutex);
+		return -EAGAIN;
+	}
+
+	items[*nr].testid_ctx = testid_ctx;
+	items[*nr].auth = auth;
+	(*nr)++;
+
+	return 0;
+}
+
+/*
+ * Lock all auth contexts of one test session. A test session that is currently
+ * used by another thread is skipped for this round. Caller holds
+ * acvp_auth_refresh_sd_mutex.
+ */
+static int
+acvp_auth_refresh_lock_session(const struct acvp_testid_ctx *testid_ctx,
+			       struct acvp_auth_refresh_item *items,
+			       unsigned int *nr)
+{
+	const struct esvp_es_def *es = testid_ctx->es_def;
+	const struct esvp_sd_def *sd;
+	unsigned int locked = 0;
+	int ret;
+
+	CKINT(acvp_auth_refresh_lock_one(testid_ctx, testid_ctx->server_auth,
+					 items + *nr, &locked));
+	if (es && es->es_auth) {
+		CKINT(acvp_auth_refresh_lock_one(testid_ctx, es->es_auth,
+						 items + *nr, &locked));
+	}
+	if (es) {
+		for (sd = es->sd; sd; sd = sd->next) {
+			if (!sd->sd_auth)
+				continue;
+			CKINT(acvp_auth_refresh_lock_one(testid_ctx,
+							 sd->sd_auth,
+							 items + *nr, &locked));
+		}
+	}
+
+	*nr += locked;
+
+out:
+	if (ret)
+		acvp_auth_refresh_unlock(items + *nr, locked);
+	return ret;
+}
+
+static int acvp_auth_refresh_process(struct acvp_auth_refresh_item *items,
+				     const unsigned int nr,
+				     struct acvp_buf *response)
+{
+	struct json_object *req = NULL, *entry = NULL, *jauth_array, *jauth;
+	unsigned int max_reg_msg_size = UINT_MAX, i;
+	int ret;
+	bool largeendpoint;
+
+	if (!response->buf || !response->len) {
+		logger(LOGGER_ERR, LOGGER_C_ANY, "No response data found\n");
+		return -EINVAL;
+	}
+
+	CKINT(acvp_req_strip_version(response, &req, &entry));
+
+	ret = json_get_bool(entry, "largeEndpointRequired", &largeendpoint);
+	if (!ret && largeendpoint) {
+		CKINT(json_get_uint(entry, "sizeConstraint",
+				    &max_reg_msg_size));
+	}
+
+	CKINT(json_find_key(entry, "accessToken", &jauth_array,
+			    json_type_array));
+
+	if (json_object_array_length(jauth_array) != nr) {
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "Number of refreshed auth tokens does not match the request\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		const struct acvp_testid_ctx *testid_ctx = items[i].testid_ctx;
+		struct acvp_auth_ctx *auth = items[i].auth;
+
+		jauth = json_object_array_get_idx(jauth_array, i);
+		if (!json_object_is_type(jauth, json_type_string)) {
+			logger(LOGGER_ERR, LOGGER_C_ANY,
+			       "JSON data type %s does not match expected type %s\n",
+			       json_type_to_name(json_object_get_type(jauth)),
+			       json_type_to_name(json_type_string));
+			ret = -EINVAL;
+			goto out;
+		}
+
+		if (max_reg_msg_size != UINT_MAX)
+			auth->max_reg_msg_size = max_reg_msg_size;
+
+		/*
+		 * testid_ctx auth token is stored permanently, others just
+		 * temporary.
+		 */
+		if (auth == testid_ctx->server_auth) {
+			CKINT(acvp_set_authtoken(testid_ctx,
+					json_object_get_string(jauth)));
+		} else {
+			CKINT(acvp_set_authtoken_temp(auth,
+					json_object_get_string(jauth)));
+		}
+	}
+
+out:
+	ACVP_JSON_PUT_NULL(req);
+	return ret;
+}
+
+/* Refresh the JWTs of the test sessions with one request */
+static void acvp_auth_refresh_batch(struct acvp_auth_refresh **sessions,
+				    const unsigned int nr_sessions)
+{
+	struct acvp_auth_refresh_item *items = NULL;
+	struct json_object *login = NULL, *entry, *jauth;
+	ACVP_BUFFER_INIT(response_buf);
+	char url[ACVP_NET_URL_MAXLEN];
+	unsigned int nr = 0, max = 0, refreshed = 0, i;
+	int ret;
+
+	login = json_object_new_array();
+	CKNULL(login, -ENOMEM);
+	CKINT(acvp_req_add_version(login));
+	entry = json_object_new_object();
+	CKNULL(entry, -ENOMEM);
+	CKINT(json_object_array_add(login, entry));
+
+	/* This may wait for the next TOTP time step, do not hold any lock */
+	CKINT(acvp_login_totp(entry, false));
+
+	jauth = json_object_new_array();
+	CKNULL(jauth, -ENOMEM);
+	CKINT(json_object_object_add(entry, "accessToken", jauth));
+
+	/* The SD list must not change between counting and locking */
+	acvp_auth_refresh_sd_lock();
+
+	for (i = 0; i < nr_sessions; i++)
+		max += acvp_auth_refresh_nr_auths(sessions[i]->testid_ctx);
+
+	items = calloc(max, sizeof(*items));
+	if (!items) {
+		acvp_auth_refresh_sd_unlock();
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nr_sessions; i++) {
+		if (acvp_auth_refresh_lock_session(sessions[i]->testid_ctx,
+						   items, &nr))
+			continue;
+
+		/* Mark the session as handled */
+		sessions[i]->retry = 0;
+		refreshed++;
+	}
+
+	acvp_auth_refresh_sd_unlock();
+
+	for (i = 0; i < nr; i++) {
+		CKINT(json_object_array_add(jauth,
+			json_object_new_string(items[i].auth->jwt_token)));
+	}
+
+	if (!nr) {
+		ret = 0;
+		goto out;
+	}
+
+	logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+	       "Refreshing %u auth tokens of %u test sessions before they expire\n",
+	       nr, refreshed);
+
+	CKINT(acvp_create_url(NIST_VAL_OP_LOGIN_REFRESH, url, sizeof(url)));
+	CKINT(acvp_login_submit(login, url, &response_buf));
+	CKINT(acvp_auth_refresh_process(items, nr, &response_buf));
+
+out:
+	if (items)
+		acvp_auth_refresh_unlock(items, nr);
+
+	if (ret) {
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "Refresh of auth tokens failed (%d), tokens are refreshed with their next use\n",
+		       ret);
+	}
+
+	mutex_w_lock(&acvp_auth_refresh_lock);
+	for (i = 0; i < nr_sessions; i++) {
+		/* Retry skipped or failed sessions with the next time step */
+		if (ret || sessions[i]->retry)
+			sessions[i]->retry = time(NULL) + TOTP_STEP_SIZE;
+		sessions[i]->busy = false;
+	}
+	pthread_cond_broadcast(&acvp_auth_refresh_done);
+	mutex_w_unlock(&acvp_auth_refresh_lock);
+
+	ACVP_JSON_PUT_NULL(login);
+	acvp_free_buf(&response_buf);
+	if (items)
+		free(items);
+}
+
+static int acvp_auth_refresh_thread(void *arg)
+{
+	struct acvp_auth_refresh *session, **sessions = NULL;
+	struct timespec deadline = { .tv_sec = 0, .tv_nsec = 0 };
+	unsigned int nr_sessions, max_sessions = 0;
+	time_t now, due, next;
+
+	(void)arg;
+
+	thread_set_name(acvp_jwtrefresh, 0);
+
+	mutex_w_lock(&acvp_auth_refresh_lock);
+
+	while (!acvp_auth_refresh_shutdown) {
+		now = time(NULL);
+		next = 0;
+		nr_sessions = 0;
+
+		/*
+		 * Select all sessions due within the refresh horizon - busy
+		 * sessions cannot be released.
+		 */
+		for (session = acvp_auth_refresh_head; session;
+		     session = session->next) {
+			due = acvp_auth_refresh_due(session, now);
+			if (!due)
+				continue;
+
+			if (due > now) {
+				if (!next || due < next)
+					next = due;
+				continue;
+			}
+
+			if (nr_sessions == max_sessions) {
+				struct acvp_auth_refresh **tmp;
+
+				tmp = realloc(sessions,
+					      (max_sessions + 16) *
+						      sizeof(*sessions));
+				if (!tmp)
+					break;
+				sessions = tmp;
+				max_sessions += 16;
+			}
+
+			/* Any failure until the refresh implies a retry */
+			session->retry = now;
+			session->busy = true;
+			sessions[nr_sessions++] = session;
+		}
+
+		if (nr_sessions) {
+			mutex_w_unlock(&acvp_auth_refresh_lock);
+			acvp_auth_refresh_batch(sessions, nr_sessions);
+			mutex_w_lock(&acvp_auth_refresh_lock);
+			continue;
+		}
+
+		if (next) {
+			deadline.tv_sec = next;
+			pthread_cond_timedwait(&acvp_auth_refresh_work,
+					       &acvp_auth_refresh_lock,
+					       &deadline);
+		} else {
+			pthread_cond_wait(&acvp_auth_refresh_work,
+					  &acvp_auth_refresh_lock);
+		}
+	}
+
+	acvp_auth_refresh_running = false;
+	pthread_cond_broadcast(&acvp_auth_refresh_done);
+
+	mutex_w_unlock(&acvp_auth_refresh_lock);
+
+	if (sessions)
+		free(sessions);
+
+	return 0;
+}
+
+int acvp_auth_refresh_track(const struct acvp_testid_ctx *testid_ctx)
+{
+	struct acvp_auth_refresh *session;
+	int ret = 0;
+
+	/* Only test sessions with a permanently stored JWT are refreshed */
+	if (!testid_ctx || !testid_ctx->server_auth || !testid_ctx->testid ||
+	    !testid_ctx->def || !testid_ctx->ctx ||
+	    testid_ctx->ctx->req_details.dump_register)
+		return 0;
+
+	mutex_w_lock(&acvp_auth_refresh_lock);
+
+	for (session = acvp_auth_refresh_head; session;
+	     session = session->next) {
+		if (session->testid_ctx == testid_ctx)
+			goto out;
+	}
+
+	if (acvp_auth_refresh_shutdown || !acvp_library_initialized()) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	/* Start the refresh thread with the first test session */
+	if (!acvp_auth_refresh_running) {
+		CKINT(thread_start(acvp_auth_refresh_thread, NULL,
+				   ACVP_THREAD_AUTH_REFRESH_GROUP, NULL));
+		acvp_auth_refresh_running = true;
+		logger(LOGGER_DEBUG, LOGGER_C_ANY,
+		       "Auth token refresh thread started\n");
+	}
+
+	session = calloc(1, sizeof(*session));
+	CKNULL(session, -ENOMEM);
+	session->testid_ctx = testid_ctx;
+	session->next = acvp_auth_refresh_head;
+	acvp_auth_refresh_head = session;
+
+	/* The new JWT may expire before the one the thread waits for */
+	pthread_cond_signal(&acvp_auth_refresh_work);
+
+out:
+	mutex_w_unlock(&acvp_auth_refresh_lock);
+	return ret;
+}
+
+void acvp_auth_refresh_untrack(const struct acvp_testid_ctx *testid_ctx)
+{
+	struct acvp_auth_refresh *session, *prev;
+
+	mutex_w_lock(&acvp_auth_refresh_lock);
+
+restart:
+	for (session = acvp_auth_refresh_head, prev = NULL; session;
+	     prev = session, session = session->next) {
+		if (session->testid_ctx != testid_ctx)
+			continue;
+
+		/* Wait until the refresh thread is done with the session */
+		if (session->busy) {
+			pthread_cond_wait(&acvp_auth_refresh_done,
+					  &acvp_auth_refresh_lock);
+			goto restart;
+		}
+
+		if (prev)
+			prev->next = session->next;
+		else
+			acvp_auth_refresh_head = session->next;
+		free(session);
+		break;
+	}
+
+	mutex_w_unlock(&acvp_auth_refresh_lock);
+}
+
+void acvp_auth_refresh_release(void)
+{
+	struct acvp_auth_refresh *session;
+
+	mutex_w_lock(&acvp_auth_refresh_lock);
+
+	if (acvp_auth_refresh_running) {
+		acvp_auth_refresh_shutdown = true;
+		pthread_cond_broadcast(&acvp_auth_refresh_work);
+
+		while (acvp_auth_refresh_running)
+			pthread_cond_wait(&acvp_auth_refresh_done,
+					  &acvp_auth_refresh_lock);
+
+		acvp_auth_refresh_shutdown = false;
+	}
+
+	while (acvp_auth_refresh_head) {
+		session = acvp_auth_refresh_head;
+		acvp_auth_refresh_head = session->next;
+		free(session);
+	}
+
+	mutex_w_unlock(&acvp_auth_refresh_lock);
+}
+
+#else /* ACVP_USE_PTHREAD */
+
+int acvp_auth_refresh_track(const struct acvp_testid_ctx *testid_ctx)
+{
+	(void)testid_ctx;
+	return 0;
+}
+
+void acvp_auth_refresh_untrack(const struct acvp_testid_ctx *testid_ctx)
+{
+	(void)testid_ctx;
+}
+
+void acvp_auth_refresh_release(void)
+{
+}
+
+#endif /* ACVP_USE_PTHREAD */
@@ -0,0 +1,372 @@
+/* Host-wide JWT authentication token broker
+ *
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "authtoken_broker.h"
+#include "binhexbin.h"
+#include "config.h"
+#include "datastore_sync.h"
+#include "hash/sha256.h"
+#include "internal.h"
+#include "json_wrapper.h"
+#include "logger.h"
+#include "ret_checkers.h"
+
+#ifdef ACVP_TOTP_MQ_SERVER
+
+/* Number of bytes of the identity digest used in the cache file name */
+#define ACVP_AUTHTOKEN_BROKER_ID_LEN 8
+
+#define ACVP_AUTHTOKEN_BROKER_FILE "jwt_broker_%s.json"
+#define ACVP_AUTHTOKEN_BROKER_LOCK "jwt_broker_%s.lock"
+
+/*
+ * The broker lock is a file lock which serializes the threads of this process
+ * as well as all other processes. It is held by one thread which may take it
+ * recursively, e.g. when the processing of a login publishes the new token.
+ */
+static __thread int acvp_authtoken_broker_fd = -1;
+static __thread unsigned int acvp_authtoken_broker_depth = 0;
+
+static void acvp_authtoken_broker_hash_str(struct sha_ctx *hash_ctx,
+					   const char *str)
+{
+	/* Include the terminating NULL to separate the strings */
+	if (str)
+		sha256->update(hash_ctx, (const uint8_t *)str, strlen(str) + 1);
+	else
+		sha256->update(hash_ctx, (const uint8_t *)"", 1);
+}
+
+/*
+ * The tokens are bound to the ACVP server and the client certificate. Use
+ * one cache file for each combination.
+ */
+static int acvp_authtoken_broker_path(const struct acvp_ctx *ctx,
+				      const char *fmt, char *pathname,
+				      const size_t pathnamelen)
+{
+	const struct acvp_datastore_ctx *datastore;
+	const struct acvp_net_ctx *net;
+	uint8_t digest[SHA256_SIZE_DIGEST];
+	char id[2 * ACVP_AUTHTOKEN_BROKER_ID_LEN + 1] = { 0 }, file[64];
+	int ret;
+	HASH_CTX_ON_STACK(hash_ctx);
+
+	CKNULL(ctx, -EINVAL);
+	datastore = &ctx->datastore;
+	CKNULL(datastore->secure_basedir, -EINVAL);
+	CKINT(acvp_get_net(&net));
+
+	sha256->init(hash_ctx);
+	acvp_authtoken_broker_hash_str(hash_ctx, net->server_name);
+	sha256->update(hash_ctx, (const uint8_t *)&net->server_port,
+		       sizeof(net->server_port));
+	acvp_authtoken_broker_hash_str(hash_ctx, net->certs_clnt_file);
+	acvp_authtoken_broker_hash_str(hash_ctx,
+				       net->certs_clnt_macos_keychain_ref);
+	sha256->final(hash_ctx, digest);
+
+	bin2hex(digest, ACVP_AUTHTOKEN_BROKER_ID_LEN, id, sizeof(id) - 1, 0);
+	snprintf(file, sizeof(file), fmt, id);
+
+	ret = snprintf(pathname, pathnamelen, "%s/%s",
+		       datastore->secure_basedir, file);
+	if (ret < 0 || (size_t)ret >= pathnamelen) {
+		ret = -ENAMETOOLONG;
+		goto out;
+	}
+
+	ret = 0;
+
+out:
+	return ret;
+}
+
+int acvp_authtoken_broker_lock(const struct acvp_ctx *ctx)
+{
+	char pathname[FILENAME_MAX];
+	int fd, ret;
+
+	if (acvp_authtoken_broker_depth) {
+		acvp_authtoken_broker_depth++;
+		return 0;
+	}
+
+	CKINT(acvp_authtoken_broker_path(ctx, ACVP_AUTHTOKEN_BROKER_LOCK,
+					 pathname, sizeof(pathname)));
+
+	fd = open(pathname, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0 && errno == ENOENT) {
+		/* The secure data store is created on first use */
+		if (!mkdir(ctx->datastore.secure_basedir, 0700))
+			fd = open(pathname, O_RDWR | O_CREAT | O_CLOEXEC,
+				  0600);
+	}
+	if (fd < 0) {
+		ret = -errno;
+		logger(LOGGER_DEBUG, LOGGER_C_ANY,
+		       "Cannot open JWT broker lock file %s (%d)\n", pathname,
+		       ret);
+		goto out;
+	}
+
+	while (flock(fd, LOCK_EX)) {
+		if (errno == EINTR)
+			continue;
+
+		ret = -errno;
+		logger(LOGGER_DEBUG, LOGGER_C_ANY,
+		       "Cannot lock JWT broker lock file %s (%d)\n", pathname,
+		       ret);
+		close(fd);
+		goto out;
+	}
+
+	acvp_authtoken_broker_fd = fd;
+	acvp_authtoken_broker_depth = 1;
+
+out:
+	return ret;
+}
+
+void acvp_authtoken_broker_unlock(void)
+{
+	if (!acvp_authtoken_broker_depth)
+		return;
+
+	if (--acvp_authtoken_broker_depth)
+		return;
+
+	flock(acvp_authtoken_broker_fd, LOCK_UN);
+	close(acvp_authtoken_broker_fd);
+	acvp_authtoken_broker_fd = -1;
+}
+
+/*
+ * Get the generation time of a cached token. Returns -ENOENT if the token
+ * is expired.
+ */
+static int acvp_authtoken_broker_generated(struct json_object *entry,
+					   time_t now, time_t *generated)
+{
+	uint64_t val;
+	int ret;
+
+	CKINT(json_get_uint64(entry, "generated", &val));
+
+	/* Tokens from the future are not trusted */
+	if ((time_t)val > now || now - (time_t)val >= ACVP_JWT_TOKEN_LIFETIME)
+		return -ENOENT;
+
+	*generated = (time_t)val;
+
+out:
+	return ret;
+}
+
+static struct json_object *acvp_authtoken_broker_read(const char *pathname)
+{
+	struct json_object *cache;
+
+	if (access(pathname, F_OK))
+		return NULL;
+
+	cache = json_object_from_file(pathname);
+	if (cache && !json_object_is_type(cache, json_type_object)) {
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "JWT broker cache %s is invalid, ignoring it\n",
+		       pathname);
+		ACVP_JSON_PUT_NULL(cache);
+	}
+
+	return cache;
+}
+
+int acvp_authtoken_broker_get(const struct acvp_ctx *ctx, uint32_t testid,
+			      struct acvp_auth_ctx *auth)
+{
+	struct json_object *cache = NULL, *entry;
+	const char *token;
+	uint64_t size;
+	time_t generated;
+	char pathname[FILENAME_MAX], key[11];
+	int ret;
+
+	CKNULL(auth, -EINVAL);
+
+	CKINT(acvp_authtoken_broker_path(ctx, ACVP_AUTHTOKEN_BROKER_FILE,
+					 pathname, sizeof(pathname)));
+
+	cache = acvp_authtoken_broker_read(pathname);
+	CKNULL(cache, -ENOENT);
+
+	snprintf(key, sizeof(key), "%u", testid);
+	CKINT(json_find_key(cache, key, &entry, json_type_object));
+	CKINT(acvp_authtoken_broker_generated(entry, time(NULL), &generated));
+
+	/* Only a token generated after the one we hold is of interest */
+	if (auth->jwt_token && auth->jwt_token_len &&
+	    generated <= auth->jwt_token_generated) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	CKINT(json_get_string(entry, "accessToken", &token));
+	CKINT(json_get_uint64(entry, "sizeConstraint", &size));
+
+	/* A token we hold was possibly invalidated after a server rejection */
+	if (auth->jwt_token && !strncmp(auth->jwt_token, token,
+					 ACVP_JWT_TOKEN_MAX)) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	CKINT(acvp_set_authtoken_temp(auth, token));
+	auth->jwt_token_generated = generated;
+	auth->max_reg_msg_size = (size > UINT32_MAX) ? UINT32_MAX :
+							(uint32_t)size;
+
+	logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+	       "Obtained JWT access token for test session %u from JWT broker\n",
+	       testid);
+
+out:
+	ACVP_JSON_PUT_NULL(cache);
+	return ret;
+}
+
+int acvp_authtoken_broker_put(const struct acvp_ctx *ctx, uint32_t testid,
+			      const struct acvp_auth_ctx *auth)
+{
+	struct json_object *cache = NULL, *newcache = NULL, *entry;
+	const char *str;
+	time_t now = time(NULL), generated;
+	char pathname[FILENAME_MAX], key[11];
+	int ret;
+	bool locked = false;
+
+	CKNULL(auth, -EINVAL);
+	if (!auth->jwt_token || !auth->jwt_token_len)
+		return 0;
+
+	CKINT(acvp_authtoken_broker_lock(ctx));
+	locked = true;
+
+	CKINT(acvp_authtoken_broker_path(ctx, ACVP_AUTHTOKEN_BROKER_FILE,
+					 pathname, sizeof(pathname)));
+
+	snprintf(key, sizeof(key), "%u", testid);
+
+	newcache = json_object_new_object();
+	CKNULL(newcache, -ENOMEM);
+
+	/* Carry over the valid tokens of all other test sessions */
+	cache = acvp_authtoken_broker_read(pathname);
+	if (cache) {
+		json_object_object_foreach(cache, cache_key, cache_entry)
+		{
+			if (!strncmp(cache_key, key, sizeof(key)))
+				continue;
+			if (!json_object_is_type(cache_entry,
+						 json_type_object))
+				continue;
+			if (acvp_authtoken_broker_generated(cache_entry, now,
+							    &generated))
+				continue;
+
+			CKINT(json_object_object_add(
+				newcache, cache_key,
+				json_object_get(cache_entry)));
+		}
+	}
+
+	entry = json_object_new_object();
+	CKNULL(entry, -ENOMEM);
+	CKINT(json_object_object_add(newcache, key, entry));
+	CKINT(json_object_object_add(entry, "accessToken",
+				     json_object_new_string(auth->jwt_token)));
+	CKINT(json_object_object_add(
+		entry, "generated",
+		json_object_new_int64((int64_t)auth->jwt_token_generated)));
+	CKINT(json_object_object_add(
+		entry, "sizeConstraint",
+		json_object_new_int64((int64_t)auth->max_reg_msg_size)));
+
+	str = json_object_to_json_string_ext(
+		newcache,
+		JSON_C_TO_STRING_PLAIN | JSON_C_TO_STRING_NOSLASHESCAPE);
+	CKNULL_LOG(str, -EFAULT,
+		   "JSON object conversion into string failed\n");
+
+	CKINT(acvp_ds_sync_write(pathname, (const uint8_t *)str, strlen(str),
+				 0600));
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY,
+	       "JWT access token for test session %u published to JWT broker\n",
+	       testid);
+
+out:
+	if (locked)
+		acvp_authtoken_broker_unlock();
+	ACVP_JSON_PUT_NULL(cache);
+	ACVP_JSON_PUT_NULL(newcache);
+	return ret;
+}
+
+#else /* ACVP_TOTP_MQ_SERVER */
+
+int acvp_authtoken_broker_lock(const struct acvp_ctx *ctx)
+{
+	(void)ctx;
+	return -EOPNOTSUPP;
+}
+
+void acvp_authtoken_broker_unlock(void)
+{
+}
+
+int acvp_authtoken_broker_get(const struct acvp_ctx *ctx, uint32_t testid,
+			      struct acvp_auth_ctx *auth)
+{
+	(void)ctx;
+	(void)testid;
+	(void)auth;
+	return -ENOENT;
+}
+
+int acvp_authtoken_broker_put(const struct acvp_ctx *ctx, uint32_t testid,
+			      const struct acvp_auth_ctx *auth)
+{
+	(void)ctx;
+	(void)testid;
+	(void)auth;
+	return 0;
+}
+
+#endif /* ACVP_TOTP_MQ_SERVER */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef _AUTHTOKEN_BROKER_H
+#define _AUTHTOKEN_BROKER_H
+
+#include <stdint.h>
+
+#include "acvpproxy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Host-wide JWT authentication token broker
+ *
+ * The TOTP MQ server ensures that concurrently running ACVP Proxy processes
+ * do not generate more than one TOTP value per time step. Yet, each process
+ * would still log in on its own. The broker shares the JWT authentication
+ * tokens between all processes using the same secure data store and the same
+ * ACVP server and client certificate.
+ *
+ * The broker maintains one cache file per server and client certificate
+ * holding the initial login token (test session ID 0) as well as the tokens
+ * bound to test sessions. The cache file is rewritten atomically. A login
+ * is performed with the broker lock taken, so that other processes wait for
+ * the login and obtain the resulting token instead of logging in themselves.
+ * Each refreshed token is published to the broker.
+ *
+ * All broker operations are a best effort: if the broker cannot be used,
+ * the ACVP Proxy logs in as usual.
+ */
+
+/* Test session ID under which the initial login token is maintained */
+#define ACVP_AUTHTOKEN_BROKER_INITIAL 0
+
+/**
+ * @brief Acquire the broker lock serializing the logins of all processes.
+ *	  The lock may be taken recursively by the same thread.
+ *
+ * @param ctx [in] ACVP context
+ *
+ * @return 0 on success, < 0 on error (the lock is not held)
+ */
+int acvp_authtoken_broker_lock(const struct acvp_ctx *ctx);
+
+/**
+ * @brief Release the broker lock.
+ */
+void acvp_authtoken_broker_unlock(void);
+
+/**
+ * @brief Fetch a valid token from the broker. The token is only applied if it
+ *	  was generated after the token held by @param auth. The caller must
+ *	  hold the broker lock.
+ *
+ * @param ctx [in] ACVP context
+ * @param testid [in] Test session ID or ACVP_AUTHTOKEN_BROKER_INITIAL
+ * @param auth [out] Authentication context receiving the token
+ *
+ * @return 0 when a token was applied, -ENOENT when the broker holds no newer
+ *	   valid token, < 0 on other errors
+ */
+int acvp_authtoken_broker_get(const struct acvp_ctx *ctx, uint32_t testid,
+			      struct acvp_auth_ctx *auth);
+
+/**
+ * @brief Publish a token to the broker. Expired tokens are purged from the
+ *	  broker at the same time.
+ *
+ * @param ctx [in] ACVP context
+ * @param testid [in] Test session ID or ACVP_AUTHTOKEN_BROKER_INITIAL
+ * @param auth [in] Authentication context holding the token
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_authtoken_broker_put(const struct acvp_ctx *ctx, uint32_t testid,
+			      const struct acvp_auth_ctx *auth);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AUTHTOKEN_BROKER_H */
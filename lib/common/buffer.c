@@ -23,6 +23,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "buffer.h"
@@ -60,6 +63,50 @@ void acvp_free_buf(struct acvp_buf *buf)
 	buf->len = 0;
 }
 
+/* Initial allocation of a growing buffer */
+#define ACVP_BUF_MINALLOC 4096
+
+int acvp_buf_append(struct acvp_buf *buf, uint32_t *bufsize,
+		    const uint8_t *data, uint32_t len, uint32_t maxlen)
+{
+	uint64_t needed, newsize;
+	uint8_t *tmp;
+
+	if (!len)
+		return 0;
+
+	/* Add one for the NULL terminator */
+	needed = (uint64_t)buf->len + len + 1;
+	if (needed > (uint64_t)maxlen + 1 || needed > UINT32_MAX)
+		return -EOVERFLOW;
+
+	if (!buf->buf)
+		*bufsize = 0;
+
+	if (needed > *bufsize) {
+		newsize = *bufsize ? *bufsize : ACVP_BUF_MINALLOC;
+		while (newsize < needed)
+			newsize <<= 1;
+		if (newsize > (uint64_t)maxlen + 1)
+			newsize = (uint64_t)maxlen + 1;
+		if (newsize > UINT32_MAX)
+			newsize = UINT32_MAX;
+
+		tmp = realloc(buf->buf, (size_t)newsize);
+		if (!tmp)
+			return -ENOMEM;
+
+		buf->buf = tmp;
+		*bufsize = (uint32_t)newsize;
+	}
+
+	memcpy(buf->buf + buf->len, data, len);
+	buf->len += len;
+	buf->buf[buf->len] = '\0';
+
+	return 0;
+}
+
 void acvp_free_ext_buf(struct acvp_ext_buf *buf)
 {
 	if (!buf)
@@ -77,3 +124,114 @@ void acvp_free_ext_buf(struct acvp_ext_buf *buf)
 
 	/* leave the next buffer untouched to not leak memory */
 }
+
+/*****************************************************************************
+ * File-backed buffers
+ *****************************************************************************/
+int acvp_ext_buf_map_fd(int fd, const char *name, struct acvp_ext_buf *buf)
+{
+	struct stat statbuf;
+	uint8_t *map;
+
+	if (fstat(fd, &statbuf)) {
+		int ret = -errno;
+
+		logger(LOGGER_WARN, LOGGER_C_ANY, "Cannot stat file %s (%d)\n",
+		       name, ret);
+		return ret;
+	}
+
+	if (!S_ISREG(statbuf.st_mode) || !statbuf.st_size) {
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "File %s is no regular file or empty\n", name);
+		return -EINVAL;
+	}
+
+	if ((uint64_t)statbuf.st_size > UINT32_MAX) {
+		logger(LOGGER_WARN, LOGGER_C_ANY, "File %s is too large\n",
+		       name);
+		return -EFBIG;
+	}
+
+	map = mmap(NULL, (size_t)statbuf.st_size, PROT_READ, MAP_SHARED, fd,
+		   0);
+	if (map == MAP_FAILED) {
+		logger(LOGGER_WARN, LOGGER_C_ANY, "Cannot mmap file %s\n",
+		       name);
+		return -ENOMEM;
+	}
+
+	/* The data is read front to back - let the kernel read ahead */
+	madvise(map, (size_t)statbuf.st_size, MADV_SEQUENTIAL);
+
+	buf->buf = map;
+	buf->len = (uint32_t)statbuf.st_size;
+	buf->mapped = true;
+
+	return 0;
+}
+
+int acvp_ext_buf_map(const char *pathname, struct acvp_ext_buf *buf)
+{
+	int fd, ret;
+
+	fd = open(pathname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ret = -errno;
+		logger(LOGGER_WARN, LOGGER_C_ANY, "Cannot open file %s (%d)\n",
+		       pathname, ret);
+		return ret;
+	}
+
+	ret = acvp_ext_buf_map_fd(fd, pathname, buf);
+
+	/* The mapping remains valid after closing the file */
+	close(fd);
+	return ret;
+}
+
+void acvp_ext_buf_unmap(struct acvp_ext_buf *buf)
+{
+	if (!buf || !buf->mapped)
+		return;
+	if (buf->buf)
+		munmap(buf->buf, buf->len);
+	buf->buf = NULL;
+	buf->len = 0;
+	buf->mapped = false;
+}
+
+/* Return processed pages in chunks of this size to limit the syscalls */
+#define ACVP_EXT_BUF_RELEASE_CHUNK (1 << 20)
+
+void acvp_ext_buf_consumed(const struct acvp_ext_buf *buf, uint32_t *released,
+			   uint32_t consumed)
+{
+	long pagesize;
+	uint32_t end;
+
+	if (!buf || !buf->mapped || consumed <= *released)
+		return;
+
+	/* Release the rest of the mapping when all data is consumed */
+	if (consumed < buf->len &&
+	    consumed - *released < ACVP_EXT_BUF_RELEASE_CHUNK)
+		return;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pagesize <= 0)
+		return;
+
+	/*
+	 * The mapping starts page-aligned, a partially consumed page at the
+	 * end is kept until it is processed completely.
+	 */
+	end = (consumed == buf->len) ?
+		      consumed :
+		      consumed - (consumed % (uint32_t)pagesize);
+	if (end <= *released)
+		return;
+
+	madvise(buf->buf + *released, end - *released, MADV_DONTNEED);
+	*released = end;
+}
@@ -22,6 +22,8 @@
 
 #include <stdint.h>
 
+#include "bool.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -37,16 +39,102 @@ struct acvp_ext_buf {
 	char *filename;
 	char *data_type;
 	struct acvp_ext_buf *next;
+	bool mapped;
+};
+
+/*
+ * Consumer of a byte stream that is delivered in chunks, such as the body of
+ * an HTTP response.
+ *
+ * @write: Consume the next chunk - return 0 on success or a negative errno
+ * @reset: Discard all data received so far, e.g. when a transfer is
+ *	   repeated - may be NULL
+ * @ctx: Opaque context handed to the callbacks
+ */
+struct acvp_buf_sink {
+	int (*write)(void *ctx, const uint8_t *data, uint32_t len);
+	int (*reset)(void *ctx);
+	void *ctx;
 };
 
 #define ACVP_BUFFER_INIT(buffer) struct acvp_buf buffer = { 0, NULL }
 
 #define ACVP_EXT_BUFFER_INIT(buffer)                                           \
-	struct acvp_ext_buf buffer = { 0, NULL, NULL, NULL, NULL }
+	struct acvp_ext_buf buffer = { 0, NULL, NULL, NULL, NULL, false }
 
 void acvp_free_buf(struct acvp_buf *buf);
 int acvp_alloc_buf(uint32_t size, struct acvp_buf *buf);
 
+/**
+ * @brief Append data to a buffer that grows geometrically
+ *
+ * The allocation of the buffer is at least doubled when it needs to grow to
+ * keep the number of reallocations and copies logarithmic in the final size.
+ * The buffer is always NULL-terminated.
+ *
+ * @param buf [in/out] Buffer to append to
+ * @param bufsize [in/out] Allocated size of buf->buf - must be 0 if the buffer
+ *			   is not yet allocated by this function
+ * @param data [in] Data to append
+ * @param len [in] Length of data
+ * @param maxlen [in] Maximum length the buffer is allowed to reach
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_buf_append(struct acvp_buf *buf, uint32_t *bufsize,
+		    const uint8_t *data, uint32_t len, uint32_t maxlen);
+
+/**
+ * @brief Map a file read-only into an external buffer
+ *
+ * The buffer is backed by the page cache and its pages are only read from
+ * the file when accessed. Thus, the file is never copied into the heap.
+ * The buffer must be released with acvp_ext_buf_unmap.
+ *
+ * @param pathname [in] File to map
+ * @param buf [out] Buffer that is filled with the mapping
+ *
+ * @return 0 on success, -EINVAL for an empty or non-regular file, -EFBIG for
+ *	   a file that is too large, other < 0 on error
+ */
+int acvp_ext_buf_map(const char *pathname, struct acvp_ext_buf *buf);
+
+/**
+ * @brief Map an open file read-only into an external buffer
+ *
+ * Same as acvp_ext_buf_map for a file descriptor opened for reading. The
+ * file descriptor may be closed after the call.
+ *
+ * @param fd [in] File descriptor of the file to map
+ * @param name [in] Name of the file for log messages
+ * @param buf [out] Buffer that is filled with the mapping
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ext_buf_map_fd(int fd, const char *name, struct acvp_ext_buf *buf);
+
+/**
+ * @brief Release a buffer obtained with acvp_ext_buf_map
+ */
+void acvp_ext_buf_unmap(struct acvp_ext_buf *buf);
+
+/**
+ * @brief Return the pages of a mapped buffer a consumer has processed
+ *
+ * The consumer of a mapped buffer which reads it sequentially (e.g. during
+ * an upload) informs about the processed data. The pages holding this data
+ * are dropped from the process memory. They remain in the page cache and are
+ * transparently read again if they are accessed later. For buffers that are
+ * no mapping, this call is a noop.
+ *
+ * @param buf [in] Buffer
+ * @param released [in/out] Offset up to which the buffer was released
+ *			    before - it is updated by the call
+ * @param consumed [in] Offset up to which the buffer was processed
+ */
+void acvp_ext_buf_consumed(const struct acvp_ext_buf *buf, uint32_t *released,
+			   uint32_t consumed);
+
 #ifdef __cplusplus
 }
 #endif
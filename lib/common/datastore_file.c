@@ -32,9 +32,12 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "acvp_error_handler.h"
 #include "acvpproxy.h"
+#include "datastore_manifest.h"
+#include "datastore_sync.h"
 #include "internal.h"
 #include "json_wrapper.h"
 #include "logger.h"
@@ -45,36 +48,213 @@ static DEFINE_MUTEX_UNLOCKED(acvp_datastore_create);
 
 struct acvp_datastore_thread_ctx {
 	struct acvp_vsid_ctx *vsid_ctx;
+	struct acvp_ds_manifest_entry entry;
 	const char *datastore_base;
 	const char *secure_base;
 	int (*cb)(const struct acvp_vsid_ctx *vsid_ctx,
-		  const struct acvp_buf *buf);
+		  const struct acvp_ext_buf *buf);
 };
 
+/*
+ * The data is written to a temporary file that is synced to disk and renamed
+ * to the final name. Thus, a crash never leaves a truncated file behind. The
+ * sync requests of all threads are committed together, see datastore_sync.h.
+ */
 static int acvp_datastore_write_data(const struct acvp_buf *data,
 				     const char *filename)
 {
-	FILE *file;
-	size_t written;
+	int ret;
+
+	if (!data || !data->buf)
+		return 0;
+
+	ret = acvp_ds_sync_write(filename, data->buf, data->len, 0666);
+	if (ret) {
+		logger(LOGGER_WARN, LOGGER_C_DS_FILE,
+		       "Writing data to file %s failed (%d)\n", filename, ret);
+	}
+
+	return ret;
+}
+
+/*
+ * Test vectors may be stored compressed with gzip. Such files carry the
+ * suffix below and are transparently decompressed when they are read.
+ */
+#define ACVP_DS_GZIP_SUFFIX ".gz"
+#define ACVP_DS_GZIP_CHUNK (1 << 16)
+
+static int acvp_datastore_write_data_gz(const struct acvp_buf *data,
+					const char *filename)
+{
+	gzFile gz;
+	uint32_t written = 0, todo;
 	int ret = 0;
+	char tmpname[FILENAME_MAX];
 
 	if (!data || !data->buf)
 		return 0;
 
-	file = fopen(filename, "w");
-	CKNULL(file, -errno);
+	CKINT(acvp_ds_sync_tmpname(filename, tmpname, sizeof(tmpname)));
+
+	gz = gzopen(tmpname, "wb");
+	if (!gz)
+		return errno ? -errno : -ENOMEM;
 
-	written = fwrite(data->buf, 1, data->len, file);
-	if (written != data->len)
+	while (written < data->len) {
+		todo = data->len - written;
+		if (todo > ACVP_DS_GZIP_CHUNK)
+			todo = ACVP_DS_GZIP_CHUNK;
+
+		if (gzwrite(gz, data->buf + written, todo) != (int)todo) {
+			logger(LOGGER_WARN, LOGGER_C_DS_FILE,
+			       "Writing compressed data to file %s failed\n",
+			       filename);
+			ret = -EIO;
+			break;
+		}
+		written += todo;
+	}
+
+	if (gzclose(gz) != Z_OK && !ret)
+		ret = -EIO;
+	if (!ret)
+		ret = acvp_ds_sync_path(tmpname);
+	if (!ret && rename(tmpname, filename))
+		ret = -errno;
+
+	if (ret)
+		unlink(tmpname);
+	else
+		acvp_ds_sync_dir(filename);
+
+out:
+	return ret;
+}
+
+/*
+ * Decompress the file window by window into an unlinked temporary file which
+ * is mapped into memory. Like an uncompressed file, the data is handed to the
+ * consumer as a mapping and never copied into the heap.
+ */
+static int acvp_datastore_map_data_gz(const char *filename,
+				      struct acvp_ext_buf *map)
+{
+	gzFile gz;
+	FILE *out;
+	uint8_t chunk[ACVP_DS_GZIP_CHUNK / 4];
+	int read, ret = 0;
+
+	gz = gzopen(filename, "rb");
+	if (!gz)
+		return errno ? -errno : -ENOMEM;
+
+	out = tmpfile();
+	if (!out) {
+		ret = -errno;
 		logger(LOGGER_WARN, LOGGER_C_DS_FILE,
-		       "data written (%zu) mismatch with data available (%u)\n",
-		       written, data->len);
-	fclose(file);
+		       "Cannot create temporary file to decompress file %s (%d)\n",
+		       filename, ret);
+		goto out;
+	}
+
+	while ((read = gzread(gz, chunk, sizeof(chunk))) > 0) {
+		if (fwrite(chunk, 1, (size_t)read, out) != (size_t)read) {
+			ret = -EIO;
+			goto out;
+		}
+	}
+
+	if (read < 0) {
+		logger(LOGGER_WARN, LOGGER_C_DS_FILE,
+		       "Decompressing file %s failed\n", filename);
+		ret = -EIO;
+		goto out;
+	}
+
+	if (fflush(out)) {
+		ret = -errno;
+		goto out;
+	}
+
+	/* The mapping remains valid after closing the temporary file */
+	CKINT(acvp_ext_buf_map_fd(fileno(out), filename, map));
+
+out:
+	if (out)
+		fclose(out);
+	gzclose(gz);
+	return ret;
+}
+
+/*
+ * Look up a data file which may be stored compressed. If the file does not
+ * exist, the compressed variant is looked up and the compression suffix is
+ * appended to the pathname.
+ */
+static int acvp_datastore_file_find(char *pathname, const size_t pathlen,
+				    struct stat *statbuf, bool *compressed)
+{
+	int ret;
+
+	*compressed = false;
+
+	if (!stat(pathname, statbuf))
+		return 0;
+	if (errno != ENOENT)
+		return -errno;
+
+	CKINT(acvp_extend_string(pathname, pathlen, ACVP_DS_GZIP_SUFFIX));
+	if (stat(pathname, statbuf)) {
+		ret = -errno;
+		/* Report the original file name to the caller */
+		pathname[strlen(pathname) - strlen(ACVP_DS_GZIP_SUFFIX)] = '\0';
+		goto out;
+	}
+
+	*compressed = true;
 
 out:
 	return ret;
 }
 
+/* Shall the given data store file be written compressed? */
+static bool acvp_datastore_file_compress(const struct acvp_ctx *ctx,
+					 const char *filename)
+{
+	return (ctx->options.compress_datastore &&
+		!strncmp(filename, ctx->datastore.vectorfile,
+			 strlen(ctx->datastore.vectorfile) + 1));
+}
+
+/*
+ * Remove the variant of a data file with the other storage format to avoid
+ * that a stale file is picked up when reading the data.
+ */
+static void acvp_datastore_file_remove_variant(const char *pathname,
+					       const bool compressed)
+{
+	char variant[FILENAME_MAX];
+	size_t len = strlen(pathname);
+
+	if (compressed) {
+		len -= strlen(ACVP_DS_GZIP_SUFFIX);
+		if (len >= sizeof(variant))
+			return;
+		memcpy(variant, pathname, len);
+		variant[len] = '\0';
+	} else {
+		if (len >= sizeof(variant))
+			return;
+		memcpy(variant, pathname, len + 1);
+		if (acvp_extend_string(variant, sizeof(variant),
+				       ACVP_DS_GZIP_SUFFIX))
+			return;
+	}
+
+	unlink(variant);
+}
+
 static int acvp_datastore_read_data(uint8_t **buf, size_t *buflen,
 				    const char *filename)
 {
@@ -236,7 +416,7 @@ out:
 	return ret;
 }
 
-static int
+int
 acvp_datastore_file_testsessiondir(const struct acvp_testid_ctx *testid_ctx,
 				   char *pathname, const size_t pathnamelen,
 				   const bool createdir,
@@ -295,6 +475,38 @@ out:
 	return ret;
 }
 
+/*
+ * Obtain the secure vector directory without creating it. If it does not
+ * exist yet, its name is derived from the vector directory so that lookups
+ * of files in the secure location simply do not find anything.
+ */
+static int
+acvp_datastore_file_secure_vectordir(const struct acvp_testid_ctx *testid_ctx,
+				     const char *base, char *pathname,
+				     const size_t pathnamelen)
+{
+	const struct acvp_datastore_ctx *datastore =
+		&testid_ctx->ctx->datastore;
+	size_t baselen;
+	int ret;
+
+	ret = acvp_datastore_file_vectordir(testid_ctx, pathname, pathnamelen,
+					    false, true);
+	if (ret != -ENOENT)
+		return ret;
+
+	baselen = strlen(datastore->basedir);
+	if (strncmp(base, datastore->basedir, baselen))
+		return -EINVAL;
+
+	ret = snprintf(pathname, pathnamelen, "%s/%s",
+		       datastore->secure_basedir, base + baselen);
+	if (ret < 0 || (size_t)ret >= pathnamelen)
+		return -ENAMETOOLONG;
+
+	return 0;
+}
+
 static int
 acvp_datastore_file_rename_version(const struct acvp_testid_ctx *testid_ctx,
 				   char *newversion)
@@ -692,6 +904,162 @@ out:
 	return ret;
 }
 
+/*
+ * The manifest of a test session records the files present for its vsIDs.
+ * It is stored in the secure test session directory and refers to the vsID
+ * directories of the test session directory in the regular data store.
+ */
+struct acvp_datastore_manifest_scan {
+	const struct acvp_datastore_ctx *datastore;
+	const char *base;
+	const char *secure_base;
+};
+
+static int acvp_datastore_file_vsid_path(char *pathname,
+					 const size_t pathnamelen,
+					 const char *base, uint32_t vsid,
+					 const char *filename)
+{
+	int ret = snprintf(pathname, pathnamelen, "%s/%u/%s", base, vsid,
+			   filename);
+
+	if (ret < 0 || (size_t)ret >= pathnamelen)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/* Obtain the manifest entry of one vsID from the files in the data store */
+static int acvp_datastore_manifest_scan(void *ctx, uint32_t vsid,
+					struct acvp_ds_manifest_entry *entry)
+{
+	const struct acvp_datastore_manifest_scan *scan = ctx;
+	const struct acvp_datastore_ctx *datastore = scan->datastore;
+	struct stat statbuf;
+	uint32_t flags = 0;
+	bool compressed;
+	char pathname[FILENAME_MAX];
+	int ret;
+
+	CKINT(acvp_datastore_file_vsid_path(pathname, sizeof(pathname),
+					    scan->base, vsid,
+					    datastore->vectorfile));
+	ret = acvp_datastore_file_find(pathname, sizeof(pathname), &statbuf,
+				       &compressed);
+	if (!ret) {
+		flags |= ACVP_DS_MANIFEST_VECTOR;
+		if (compressed)
+			flags |= ACVP_DS_MANIFEST_VECTOR_GZ;
+
+		/* The cipher information is kept for an unchanged file */
+		if ((entry->flags & ACVP_DS_MANIFEST_ALGOINFO) &&
+		    entry->vector_size == (uint64_t)statbuf.st_size)
+			flags |= ACVP_DS_MANIFEST_ALGOINFO;
+		entry->vector_size = (uint64_t)statbuf.st_size;
+	} else if (ret == -ENOENT) {
+		entry->vector_size = 0;
+	} else {
+		goto out;
+	}
+	if (!(flags & ACVP_DS_MANIFEST_ALGOINFO)) {
+		memset(entry->cipher_name, 0, sizeof(entry->cipher_name));
+		memset(entry->cipher_mode, 0, sizeof(entry->cipher_mode));
+	}
+
+	CKINT(acvp_datastore_file_vsid_path(pathname, sizeof(pathname),
+					    scan->base, vsid,
+					    datastore->expectedfile));
+	if (!stat(pathname, &statbuf))
+		flags |= ACVP_DS_MANIFEST_EXPECTED;
+
+	CKINT(acvp_datastore_file_vsid_path(pathname, sizeof(pathname),
+					    scan->base, vsid,
+					    datastore->verdictfile));
+	entry->verdict = acvp_verdict_unknown;
+	if (!stat(pathname, &statbuf)) {
+		ACVP_EXT_BUFFER_INIT(map);
+		enum acvp_test_verdict verdict = acvp_verdict_unknown;
+
+		flags |= ACVP_DS_MANIFEST_VERDICT;
+
+		/* An invalid verdict file reports the vsID as unverified */
+		if (!acvp_ext_buf_map(pathname, &map)) {
+			ACVP_BUFFER_INIT(verdict_buf);
+
+			verdict_buf.buf = map.buf;
+			verdict_buf.len = map.len;
+			if (acvp_get_verdict_json(&verdict_buf, &verdict)) {
+				logger(LOGGER_WARN, LOGGER_C_ANY,
+				       "File %s does not contain valid verdict\n",
+				       pathname);
+			}
+			acvp_ext_buf_unmap(&map);
+		}
+		entry->verdict = (uint32_t)verdict;
+	}
+
+	CKINT(acvp_datastore_file_vsid_path(pathname, sizeof(pathname),
+					    scan->secure_base, vsid,
+					    datastore->processedfile));
+	if (!stat(pathname, &statbuf))
+		flags |= ACVP_DS_MANIFEST_PROCESSED;
+
+	entry->flags = flags;
+
+out:
+	return ret;
+}
+
+/* Is the file recorded in the manifest? */
+static bool acvp_datastore_manifest_tracked(const struct acvp_ctx *ctx,
+					    const char *filename,
+					    const bool secure_location)
+{
+	const struct acvp_datastore_ctx *datastore = &ctx->datastore;
+
+	if (secure_location)
+		return !strncmp(filename, datastore->processedfile,
+				strlen(datastore->processedfile) + 1);
+
+	return (!strncmp(filename, datastore->vectorfile,
+			 strlen(datastore->vectorfile) + 1) ||
+		!strncmp(filename, datastore->expectedfile,
+			 strlen(datastore->expectedfile) + 1) ||
+		!strncmp(filename, datastore->verdictfile,
+			 strlen(datastore->verdictfile) + 1));
+}
+
+/*
+ * Refresh the manifest entry after a file of the vsID was written. The
+ * manifest is removed if this is not possible, thus an error is not
+ * propagated.
+ */
+static void
+acvp_datastore_manifest_update(const struct acvp_vsid_ctx *vsid_ctx)
+{
+	const struct acvp_testid_ctx *testid_ctx = vsid_ctx->testid_ctx;
+	struct acvp_datastore_manifest_scan scan;
+	char base[FILENAME_MAX], secure_base[FILENAME_MAX];
+	int ret;
+
+	CKINT(acvp_datastore_file_vectordir(testid_ctx, base, sizeof(base),
+					    false, false));
+	CKINT(acvp_datastore_file_vectordir(testid_ctx, secure_base,
+					    sizeof(secure_base), true, true));
+
+	scan.datastore = &testid_ctx->ctx->datastore;
+	scan.base = base;
+	scan.secure_base = secure_base;
+	CKINT(acvp_ds_manifest_update(secure_base, base, vsid_ctx->vsid,
+				      acvp_datastore_manifest_scan, &scan));
+
+out:
+	if (ret) {
+		logger(LOGGER_DEBUG, LOGGER_C_DS_FILE,
+		       "Cannot update manifest for vsID %u (%d)\n",
+		       vsid_ctx->vsid, ret);
+	}
+}
+
 static int acvp_datastore_file_write_vsid(const struct acvp_vsid_ctx *vsid_ctx,
 					  const char *filename,
 					  const bool secure_location,
@@ -727,13 +1095,215 @@ static int acvp_datastore_file_write_vsid(const struct acvp_vsid_ctx *vsid_ctx,
 		vsid_ctx, pathname, sizeof(pathname), true, secure_location));
 	CKINT(acvp_extend_string(pathname, sizeof(pathname), "/%s", filename));
 
-	CKINT(acvp_datastore_write_data(data, pathname));
+	if (acvp_datastore_file_compress(ctx, filename)) {
+		CKINT(acvp_extend_string(pathname, sizeof(pathname),
+					 ACVP_DS_GZIP_SUFFIX));
+		CKINT(acvp_datastore_write_data_gz(data, pathname));
+		acvp_datastore_file_remove_variant(pathname, true);
+	} else {
+		CKINT(acvp_datastore_write_data(data, pathname));
+		if (!strncmp(filename, datastore->vectorfile,
+			     strlen(datastore->vectorfile) + 1))
+			acvp_datastore_file_remove_variant(pathname, false);
+	}
+
+	if (acvp_datastore_manifest_tracked(ctx, filename, secure_location))
+		acvp_datastore_manifest_update(vsid_ctx);
 
 	logger(LOGGER_VERBOSE, LOGGER_C_DS_FILE,
 	       "data written for testID %u / vsID %u to file %s\n",
-	       testid_ctx->testid, vsid_ctx->vsid, filename);
+	       testid_ctx->testid, vsid_ctx->vsid, pathname);
+
+out:
+	return ret;
+}
+
+/*
+ * Streamed write of a vsID file: the data is written to a temporary file
+ * which is renamed to the final name on commit. Thus, an interrupted
+ * download never leaves a truncated file behind that would be taken as
+ * complete data later on.
+ */
+struct acvp_datastore_file_sink {
+	const struct acvp_vsid_ctx *vsid_ctx;
+	FILE *file;
+	gzFile gz;
+	bool compressed;
+	bool check_variant;
+	bool tracked;
+	char pathname[FILENAME_MAX];
+	char tmpname[FILENAME_MAX];
+};
+
+static int acvp_datastore_file_sink_write_gz(void *ctx, const uint8_t *data,
+					     uint32_t len)
+{
+	struct acvp_datastore_file_sink *fsink = ctx;
+
+	if (len && gzwrite(fsink->gz, data, len) != (int)len) {
+		logger(LOGGER_WARN, LOGGER_C_DS_FILE,
+		       "Streaming compressed data to file %s failed\n",
+		       fsink->tmpname);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int acvp_datastore_file_sink_reset_gz(void *ctx)
+{
+	struct acvp_datastore_file_sink *fsink = ctx;
+
+	if (fsink->gz)
+		gzclose(fsink->gz);
+	fsink->gz = gzopen(fsink->tmpname, "wb");
+	if (!fsink->gz)
+		return errno ? -errno : -ENOMEM;
+
+	return 0;
+}
+
+static int acvp_datastore_file_sink_write(void *ctx, const uint8_t *data,
+					  uint32_t len)
+{
+	struct acvp_datastore_file_sink *fsink = ctx;
+
+	if (fwrite(data, 1, len, fsink->file) != len) {
+		logger(LOGGER_WARN, LOGGER_C_DS_FILE,
+		       "Streaming data to file %s failed\n", fsink->tmpname);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int acvp_datastore_file_sink_reset(void *ctx)
+{
+	struct acvp_datastore_file_sink *fsink = ctx;
+
+	if (fflush(fsink->file) || ftruncate(fileno(fsink->file), 0))
+		return -errno;
+	rewind(fsink->file);
+
+	return 0;
+}
+
+static int acvp_datastore_file_open_vsid(const struct acvp_vsid_ctx *vsid_ctx,
+					 const char *filename,
+					 const bool secure_location,
+					 struct acvp_buf_sink *sink)
+{
+	const struct acvp_ctx *ctx;
+	struct acvp_datastore_file_sink *fsink = NULL;
+	bool compress;
+	int ret;
+
+	CKNULL_C_LOG(vsid_ctx, -EINVAL, LOGGER_C_DS_FILE,
+		     "Data store backend exchange info missing\n");
+	CKNULL_C_LOG(filename, -EINVAL, LOGGER_C_DS_FILE, "Filename missing\n");
+	CKNULL_C_LOG(sink, -EINVAL, LOGGER_C_DS_FILE, "Sink missing\n");
+
+	ctx = vsid_ctx->testid_ctx->ctx;
+	compress = acvp_datastore_file_compress(ctx, filename);
+
+	fsink = calloc(1, sizeof(*fsink));
+	CKNULL(fsink, -ENOMEM);
+
+	CKINT(acvp_datastore_file_vectordir_vsid(vsid_ctx, fsink->pathname,
+						 sizeof(fsink->pathname), true,
+						 secure_location));
+	CKINT(acvp_extend_string(fsink->pathname, sizeof(fsink->pathname),
+				 "/%s", filename));
+	if (compress) {
+		CKINT(acvp_extend_string(fsink->pathname,
+					 sizeof(fsink->pathname),
+					 ACVP_DS_GZIP_SUFFIX));
+	}
+	fsink->check_variant = !strncmp(filename, ctx->datastore.vectorfile,
+					strlen(ctx->datastore.vectorfile) + 1);
+	fsink->tracked = acvp_datastore_manifest_tracked(ctx, filename,
+							 secure_location);
+	fsink->vsid_ctx = vsid_ctx;
+	memcpy(fsink->tmpname, fsink->pathname, sizeof(fsink->tmpname));
+	CKINT(acvp_extend_string(fsink->tmpname, sizeof(fsink->tmpname),
+				 ".tmp"));
+
+	fsink->compressed = compress;
+	if (compress) {
+		fsink->gz = gzopen(fsink->tmpname, "wb");
+		if (!fsink->gz) {
+			ret = errno ? -errno : -ENOMEM;
+			goto out;
+		}
+		sink->write = acvp_datastore_file_sink_write_gz;
+		sink->reset = acvp_datastore_file_sink_reset_gz;
+	} else {
+		fsink->file = fopen(fsink->tmpname, "w");
+		CKNULL(fsink->file, -errno);
+		sink->write = acvp_datastore_file_sink_write;
+		sink->reset = acvp_datastore_file_sink_reset;
+	}
+
+	sink->ctx = fsink;
+	fsink = NULL;
 
 out:
+	if (fsink)
+		free(fsink);
+	return ret;
+}
+
+static int acvp_datastore_file_close_vsid(struct acvp_buf_sink *sink,
+					  const bool commit)
+{
+	struct acvp_datastore_file_sink *fsink;
+	int ret = 0;
+
+	if (!sink || !sink->ctx)
+		return 0;
+
+	fsink = sink->ctx;
+
+	if (fsink->compressed) {
+		/* The reset may have failed to reopen the file */
+		if (!fsink->gz || gzclose(fsink->gz) != Z_OK)
+			ret = -EIO;
+		else if (commit)
+			ret = acvp_ds_sync_path(fsink->tmpname);
+	} else {
+		if (commit) {
+			if (fflush(fsink->file))
+				ret = -errno;
+			else
+				ret = acvp_ds_sync_fd(fileno(fsink->file));
+		}
+		if (fclose(fsink->file) && !ret)
+			ret = -errno;
+	}
+
+	if (commit && !ret) {
+		if (rename(fsink->tmpname, fsink->pathname)) {
+			ret = -errno;
+		} else {
+			acvp_ds_sync_dir(fsink->pathname);
+			if (fsink->check_variant)
+				acvp_datastore_file_remove_variant(
+					fsink->pathname, fsink->compressed);
+			if (fsink->tracked)
+				acvp_datastore_manifest_update(fsink->vsid_ctx);
+			logger(LOGGER_VERBOSE, LOGGER_C_DS_FILE,
+			       "data streamed to file %s\n", fsink->pathname);
+		}
+	}
+
+	if (!commit || ret)
+		unlink(fsink->tmpname);
+
+	free(fsink);
+	sink->ctx = NULL;
+	sink->write = NULL;
+	sink->reset = NULL;
+
 	return ret;
 }
 
@@ -978,42 +1548,29 @@ acvp_datastore_find_modinfo(const struct acvp_datastore_ctx *datastore,
 			    const size_t dir_len)
 {
 	struct stat statbuf;
+	bool compressed;
 	int ret;
 
 	CKINT(acvp_extend_string(dir, dir_len, "/%s", datastore->vectorfile));
 
 	/* Verdict file exists, return information to  */
-	if (!stat(dir, &statbuf)) {
+	if (!acvp_datastore_file_find(dir, dir_len, &statbuf, &compressed)) {
 		ACVP_BUFFER_INIT(buf);
-		int fd;
+		ACVP_EXT_BUFFER_INIT(map);
 
 		/* Positive return code as this is no error */
 		if (!verdict)
 			return EEXIST;
 
-		fd = open(dir, O_RDONLY | O_CLOEXEC);
-		if (fd < 0) {
-			ret = -errno;
-
-			logger(LOGGER_WARN, LOGGER_C_DS_FILE,
-			       "Cannot open file %s (%d)\n", dir, ret);
-			goto out;
-		}
-
-		buf.buf = mmap(NULL, (size_t)statbuf.st_size, PROT_READ,
-			       MAP_SHARED, fd, 0);
-		if (buf.buf == MAP_FAILED) {
-			logger(LOGGER_WARN, LOGGER_C_DS_FILE,
-			       "Cannot mmap file %s\n", dir);
-			ret = -ENOMEM;
-			goto out;
+		if (compressed) {
+			CKINT(acvp_datastore_map_data_gz(dir, &map));
+		} else {
+			CKINT(acvp_ext_buf_map(dir, &map));
 		}
-
-		buf.len = (uint32_t)statbuf.st_size;
+		buf.buf = map.buf;
+		buf.len = map.len;
 		ret = acvp_get_algoinfo_json(&buf, verdict);
-
-		munmap(buf.buf, (size_t)statbuf.st_size);
-		close(fd);
+		acvp_ext_buf_unmap(&map);
 
 		if (ret) {
 			logger(LOGGER_WARN, LOGGER_C_ANY,
@@ -1100,40 +1657,52 @@ out:
 	return ret;
 }
 
-static int acvp_datastore_find_vsid_verdict(struct acvp_vsid_ctx *vsid_ctx)
+/*
+ * Provide the cipher information of the vsID. If the manifest does not hold
+ * it yet, it is obtained from the test vector file and added to the entry.
+ */
+static int
+acvp_datastore_manifest_algoinfo(const struct acvp_datastore_ctx *datastore,
+				 const char *base,
+				 struct acvp_ds_manifest_entry *entry,
+				 struct acvp_test_verdict_status *verdict,
+				 bool *updated)
 {
-	const struct acvp_testid_ctx *testid_ctx;
-	const struct acvp_ctx *ctx;
-	const struct acvp_datastore_ctx *datastore;
 	char vector_dir[FILENAME_MAX];
-	int ret;
+	int ret = 0;
 
-	CKNULL_C_LOG(vsid_ctx, -EINVAL, LOGGER_C_DS_FILE,
-		     "Data store backend exchange info missing\n");
-	testid_ctx = vsid_ctx->testid_ctx;
+	if (entry->flags & ACVP_DS_MANIFEST_ALGOINFO) {
+		if (entry->cipher_name[0]) {
+			CKINT(acvp_duplicate(&verdict->cipher_name,
+					     entry->cipher_name));
+		}
+		if (entry->cipher_mode[0]) {
+			CKINT(acvp_duplicate(&verdict->cipher_mode,
+					     entry->cipher_mode));
+		}
+		return 0;
+	}
 
-	CKNULL_C_LOG(testid_ctx, -EINVAL, LOGGER_C_DS_FILE,
-		     "Data store backend exchange info missing\n");
+	if (!(entry->flags & ACVP_DS_MANIFEST_VECTOR))
+		return 0;
 
-	ctx = testid_ctx->ctx;
-	datastore = &ctx->datastore;
+	snprintf(vector_dir, sizeof(vector_dir), "%s/%u", base, entry->vsid);
+	CKINT(acvp_datastore_find_modinfo(datastore, verdict, vector_dir,
+					  sizeof(vector_dir)));
 
-	ret = acvp_datastore_file_vectordir_vsid(
-		vsid_ctx, vector_dir, sizeof(vector_dir), false, false);
-	if (ret) {
-		/* If pathname does not exist, we ignore it. */
+	/* Names exceeding the entry are obtained from the file each time */
+	if ((verdict->cipher_name &&
+	     strlen(verdict->cipher_name) >= sizeof(entry->cipher_name)) ||
+	    (verdict->cipher_mode &&
+	     strlen(verdict->cipher_mode) >= sizeof(entry->cipher_mode)))
 		return 0;
-	} else {
-		CKINT(acvp_datastore_find_verdict(datastore, NULL, vector_dir,
-						  sizeof(vector_dir)));
-
-		CKINT(acvp_datastore_file_vectordir_vsid(vsid_ctx, vector_dir,
-							 sizeof(vector_dir),
-							 false, false));
-		CKINT(acvp_datastore_find_modinfo(datastore, &vsid_ctx->verdict,
-						  vector_dir,
-						  sizeof(vector_dir)));
-	}
+
+	snprintf(entry->cipher_name, sizeof(entry->cipher_name), "%s",
+		 verdict->cipher_name ? verdict->cipher_name : "");
+	snprintf(entry->cipher_mode, sizeof(entry->cipher_mode), "%s",
+		 verdict->cipher_mode ? verdict->cipher_mode : "");
+	entry->flags |= ACVP_DS_MANIFEST_ALGOINFO;
+	*updated = true;
 
 out:
 	return ret;
@@ -1177,24 +1746,25 @@ out:
 
 static int
 acvp_datastore_process_vsid(struct acvp_vsid_ctx *vsid_ctx,
+			    const struct acvp_ds_manifest_entry *entry,
 			    const char *datastore_base, const char *secure_base,
 			    int (*cb)(const struct acvp_vsid_ctx *vsid_ctx,
-				      const struct acvp_buf *buf))
+				      const struct acvp_ext_buf *buf))
 {
 	const struct acvp_testid_ctx *testid_ctx = vsid_ctx->testid_ctx;
 	const struct acvp_ctx *ctx = testid_ctx->ctx;
 	const struct acvp_datastore_ctx *datastore = &ctx->datastore;
 	const struct acvp_opts_ctx *ctx_opts = &ctx->options;
 	const struct acvp_auth_ctx *auth = testid_ctx->server_auth;
-	FILE *file;
 	struct stat statbuf;
-	struct acvp_buf buf;
+	ACVP_BUFFER_INIT(processed);
+	ACVP_EXT_BUFFER_INIT(buf);
 	time_t now;
 	struct tm now_detail;
-	uint8_t *resp_buf;
-	int fd = -1, ret = 0;
+	bool compressed;
+	int ret = 0;
 	char resppath[FILENAME_MAX], processedpath[FILENAME_MAX],
-		vectorfile[FILENAME_MAX], expected[FILENAME_MAX], now_buf[30];
+		expected[FILENAME_MAX], now_buf[30];
 
 	CKNULL_C_LOG(datastore_base, -EINVAL, LOGGER_C_DS_FILE,
 		     "Data store base missing\n");
@@ -1219,32 +1789,21 @@ acvp_datastore_process_vsid(struct acvp_vsid_ctx *vsid_ctx,
 		return 0;
 	}
 
-	/* Create path names */
-	CKINT(acvp_datastore_file_vectordir_vsid(
-		vsid_ctx, resppath, sizeof(resppath), false, false));
-	CKINT(acvp_extend_string(resppath, sizeof(resppath), "/%s",
-				 datastore->resultsfile));
-
-	ret = acvp_datastore_file_vectordir_vsid(
-		vsid_ctx, processedpath, sizeof(processedpath), false, true);
 	/*
-	 * It is permissible to have a non-existing path here, we check it
-	 * further down with stat anyway.
+	 * Create path names - the presence of the files except the response
+	 * file which is created outside of the ACVP Proxy is recorded in the
+	 * manifest entry.
 	 */
-	if (ret && ret != -ENOENT)
-		goto out;
-	CKINT(acvp_extend_string(processedpath, sizeof(processedpath), "/%s",
-				 datastore->processedfile));
-
-	CKINT(acvp_datastore_file_vectordir_vsid(
-		vsid_ctx, vectorfile, sizeof(vectorfile), false, false));
-	CKINT(acvp_extend_string(vectorfile, sizeof(vectorfile), "/%s",
-				 datastore->vectorfile));
-
-	CKINT(acvp_datastore_file_vectordir_vsid(
-		vsid_ctx, expected, sizeof(expected), false, false));
-	CKINT(acvp_extend_string(expected, sizeof(expected), "/%s",
-				 datastore->expectedfile));
+	CKINT(acvp_datastore_file_vsid_path(resppath, sizeof(resppath),
+					    datastore_base, vsid_ctx->vsid,
+					    datastore->resultsfile));
+	CKINT(acvp_datastore_file_vsid_path(processedpath,
+					    sizeof(processedpath), secure_base,
+					    vsid_ctx->vsid,
+					    datastore->processedfile));
+	CKINT(acvp_datastore_file_vsid_path(expected, sizeof(expected),
+					    datastore_base, vsid_ctx->vsid,
+					    datastore->expectedfile));
 
 	logger(LOGGER_DEBUG, LOGGER_C_DS_FILE,
 	       "Read response from %s and processed file from %s\n", resppath,
@@ -1254,7 +1813,7 @@ acvp_datastore_process_vsid(struct acvp_vsid_ctx *vsid_ctx,
 	 * If we have an expected result on file, we cannot submit real results
 	 * any more - the ACVP server will reject it.
 	 */
-	if (!stat(expected, &statbuf)) {
+	if (entry->flags & ACVP_DS_MANIFEST_EXPECTED) {
 		logger_status(
 			LOGGER_C_DS_FILE,
 			"Skipping submission for vsID %u since expected results are present (%s exists)\n",
@@ -1268,20 +1827,12 @@ acvp_datastore_process_vsid(struct acvp_vsid_ctx *vsid_ctx,
 	}
 
 	/* If there is already a processed file, do a resubmit */
-	if (!stat(processedpath, &statbuf)) {
+	if (entry->flags & ACVP_DS_MANIFEST_PROCESSED) {
 		if (ctx_opts->delete_vsid) {
 			return cb(vsid_ctx, NULL);
 		}
 		if (!ctx_opts->resubmit_result) {
-			char verdict_file[FILENAME_MAX];
-
-			CKINT(acvp_datastore_file_vectordir_vsid(
-				vsid_ctx, verdict_file, sizeof(verdict_file),
-				false, false));
-			CKINT(acvp_extend_string(verdict_file,
-						 sizeof(verdict_file), "/%s",
-						 datastore->verdictfile));
-			if (stat(verdict_file, &statbuf)) {
+			if (!(entry->flags & ACVP_DS_MANIFEST_VERDICT)) {
 				logger(LOGGER_VERBOSE, LOGGER_C_DS_FILE,
 				       "Skipping submission for vsID %u since it was submitted already, but fetching verdict\n",
 				       vsid_ctx->vsid);
@@ -1297,8 +1848,8 @@ acvp_datastore_process_vsid(struct acvp_vsid_ctx *vsid_ctx,
 				vsid_ctx->fetch_verdict = true;
 				return cb(vsid_ctx, NULL);
 			} else {
-				CKINT(acvp_datastore_get_vsid_verdict(
-					vsid_ctx));
+				vsid_ctx->verdict.verdict =
+					(enum acvp_test_verdict)entry->verdict;
 
 				/*
 				 * If we have a verdict which shows
@@ -1318,13 +1869,11 @@ acvp_datastore_process_vsid(struct acvp_vsid_ctx *vsid_ctx,
 	}
 
 	/* Get response file */
-	if (stat(resppath, &statbuf)) {
-		int errsv = errno;
-
-		if (errsv != ENOENT) {
-			ret = -errsv;
+	ret = acvp_datastore_file_find(resppath, sizeof(resppath), &statbuf,
+				       &compressed);
+	if (ret) {
+		if (ret != -ENOENT)
 			goto out;
-		}
 
 		logger(LOGGER_VERBOSE, LOGGER_C_DS_FILE,
 		       "No response file for vsID %u found (%s not found)\n",
@@ -1334,7 +1883,7 @@ acvp_datastore_process_vsid(struct acvp_vsid_ctx *vsid_ctx,
 		 * Download pending vsID requests (do not try to submit
 		 * responses).
 		 */
-		if (stat(vectorfile, &statbuf)) {
+		if (!(entry->flags & ACVP_DS_MANIFEST_VECTOR)) {
 			logger(LOGGER_VERBOSE, LOGGER_C_DS_FILE,
 			       "No request file for vsID %u found\n",
 			       vsid_ctx->vsid);
@@ -1365,32 +1914,19 @@ acvp_datastore_process_vsid(struct acvp_vsid_ctx *vsid_ctx,
 			goto out;
 		}
 
-		fd = open(resppath, O_RDONLY | O_CLOEXEC);
-		if (fd < 0) {
-			ret = -errno;
-
-			logger(LOGGER_WARN, LOGGER_C_DS_FILE,
-			       "Cannot open file %s (%d)\n", resppath, ret);
-			goto out;
-		}
-
-		resp_buf = mmap(NULL, (size_t)statbuf.st_size, PROT_READ,
-				MAP_SHARED, fd, 0);
-		if (resp_buf == MAP_FAILED) {
-			logger(LOGGER_WARN, LOGGER_C_DS_FILE,
-			       "Cannot mmap file %s\n", resppath);
-			close(fd);
-			ret = -ENOMEM;
-			goto out;
+		/*
+		 * The response file is mapped and handed to the network
+		 * backend which streams it without copying it into the heap.
+		 */
+		if (compressed) {
+			CKINT(acvp_datastore_map_data_gz(resppath, &buf));
+		} else {
+			CKINT(acvp_ext_buf_map(resppath, &buf));
 		}
 
-		buf.buf = resp_buf;
-		buf.len = (uint32_t)statbuf.st_size;
-
 		/* Process response file */
 		ret = cb(vsid_ctx, &buf);
-		munmap(resp_buf, (size_t)statbuf.st_size);
-		close(fd);
+		acvp_ext_buf_unmap(&buf);
 
 		if (ret < 0) {
 			/*
@@ -1418,10 +1954,11 @@ acvp_datastore_process_vsid(struct acvp_vsid_ctx *vsid_ctx,
 			 now_detail.tm_mday, now_detail.tm_hour,
 			 now_detail.tm_min, now_detail.tm_sec);
 
-		file = fopen(processedpath, "w");
-		CKNULL(file, -errno);
-		fwrite(now_buf, 1, strlen(now_buf), file);
-		fclose(file);
+		processed.buf = (uint8_t *)now_buf;
+		processed.len = (uint32_t)strlen(now_buf);
+		CKINT(acvp_datastore_write_data(&processed, processedpath));
+
+		acvp_datastore_manifest_update(vsid_ctx);
 	}
 
 out:
@@ -1434,18 +1971,19 @@ static int acvp_datastore_file_find_responses_thread(void *arg)
 	struct acvp_datastore_thread_ctx *tdata =
 		(struct acvp_datastore_thread_ctx *)arg;
 	struct acvp_vsid_ctx *vsid_ctx = tdata->vsid_ctx;
+	struct acvp_ds_manifest_entry entry = tdata->entry;
 	const char *datastore_base = tdata->datastore_base;
 	const char *secure_base = tdata->secure_base;
 	int (*cb)(const struct acvp_vsid_ctx *vsid_ctx,
-		  const struct acvp_buf *buf) = tdata->cb;
+		  const struct acvp_ext_buf *buf) = tdata->cb;
 	int ret;
 
 	free(tdata);
 
 	thread_set_name(acvp_vsid, vsid_ctx->vsid);
 
-	ret = acvp_datastore_process_vsid(vsid_ctx, datastore_base, secure_base,
-					  cb);
+	ret = acvp_datastore_process_vsid(vsid_ctx, &entry, datastore_base,
+					  secure_base, cb);
 
 	acvp_release_vsid_ctx(vsid_ctx);
 
@@ -1489,19 +2027,22 @@ out:
 static int acvp_datastore_file_find_responses(
 	const struct acvp_testid_ctx *testid_ctx,
 	int (*cb)(const struct acvp_vsid_ctx *vsid_ctx,
-		  const struct acvp_buf *buf))
+		  const struct acvp_ext_buf *buf))
 {
 	const struct acvp_ctx *ctx;
 	const struct acvp_datastore_ctx *datastore;
 	const struct acvp_opts_ctx *opts;
 	const struct definition *def;
-	struct dirent *dirent;
-	DIR *dir = NULL;
-	char datastore_base[FILENAME_MAX - 100];
+	struct acvp_datastore_manifest_scan scan;
+	struct acvp_ds_manifest manifest;
 	char base[FILENAME_MAX - 100];
 	char secure_base[FILENAME_MAX - 100];
+	uint32_t n;
+	bool algoinfo_updated = false;
 	int ret;
 
+	memset(&manifest, 0, sizeof(manifest));
+
 	CKNULL_C_LOG(testid_ctx, -EINVAL, LOGGER_C_DS_FILE,
 		     "Data store backend exchange info missing\n");
 
@@ -1524,14 +2065,6 @@ static int acvp_datastore_file_find_responses(
 	CKNULL_C_LOG(cb, -EINVAL, LOGGER_C_DS_FILE,
 		     "Callback function missing\n");
 
-	ret = acvp_datastore_file_vectordir(testid_ctx, datastore_base,
-					    sizeof(datastore_base), false,
-					    false);
-	if (ret == -ENOENT)
-		return 0;
-	else if (ret)
-		return ret;
-
 	ret = acvp_datastore_file_vectordir(testid_ctx, base, sizeof(base),
 					    false, false);
 	if (ret == -ENOENT)
@@ -1539,15 +2072,12 @@ static int acvp_datastore_file_find_responses(
 	else if (ret)
 		return ret;
 
-	ret = acvp_datastore_file_vectordir(testid_ctx, secure_base,
-					    sizeof(secure_base), true, false);
-	if (ret == -ENOENT)
-		return 0;
-	else if (ret)
-		return ret;
+	/* The secure location holds the manifest */
+	CKINT(acvp_datastore_file_secure_vectordir(testid_ctx, base, secure_base,
+						   sizeof(secure_base)));
 
 	logger(LOGGER_DEBUG, LOGGER_C_DS_FILE, "Read results directory %s\n",
-	       datastore_base);
+	       base);
 
 	/*
 	 * Update testid_ctx:
@@ -1558,35 +2088,23 @@ static int acvp_datastore_file_find_responses(
 	if (acvp_def_check(testid_ctx, base))
 		return 0;
 
-	dir = opendir(datastore_base);
-	CKNULL(dir, -errno);
+	/*
+	 * The vsIDs and their files are obtained from the manifest instead of
+	 * looking up each file of each vsID.
+	 */
+	scan.datastore = datastore;
+	scan.base = base;
+	scan.secure_base = secure_base;
+	CKINT(acvp_ds_manifest_load(secure_base, base, &manifest,
+				    acvp_datastore_manifest_scan, &scan));
 
-	while ((dirent = readdir(dir)) != NULL) {
+	for (n = 0; n < manifest.nr_entries; n++) {
 		const struct acvp_search_ctx *search = &datastore->search;
+		struct acvp_ds_manifest_entry *entry = &manifest.entries[n];
 		struct acvp_vsid_ctx *vsid_ctx = NULL;
-		unsigned long vsid_val;
-		unsigned int i, skip = 0;
-
-		if (!strncmp(dirent->d_name, ".", 1))
-			continue;
-
-		for (i = 0; i < strlen(dirent->d_name); i++) {
-			if (!isdigit((unsigned char)dirent->d_name[i])) {
-				skip = 1;
-				break;
-			}
-		}
-		if (skip)
-			continue;
 
 		logger(LOGGER_VERBOSE, LOGGER_C_DS_FILE,
-		       "Process results directory %s\n", dirent->d_name);
-
-		vsid_val = strtoul(dirent->d_name, NULL, 10);
-		if (vsid_val == ULONG_MAX) {
-			ret = -errno;
-			goto out;
-		}
+		       "Process results directory %u\n", entry->vsid);
 
 		/*
 		 * If specific vsID is requested, only return requested vsID.
@@ -1596,7 +2114,7 @@ static int acvp_datastore_file_find_responses(
 			unsigned int j, found = 0;
 
 			for (j = 0; j < search->nr_submit_vsid; j++) {
-				if (search->submit_vsid[j] == vsid_val) {
+				if (search->submit_vsid[j] == entry->vsid) {
 					found = 1;
 					break;
 				}
@@ -1604,8 +2122,8 @@ static int acvp_datastore_file_find_responses(
 
 			if (!found) {
 				logger(LOGGER_DEBUG, LOGGER_C_DS_FILE,
-				       "Skipping test results dir %lu\n",
-				       vsid_val);
+				       "Skipping test results dir %u\n",
+				       entry->vsid);
 				continue;
 			}
 		}
@@ -1613,7 +2131,7 @@ static int acvp_datastore_file_find_responses(
 		vsid_ctx = calloc(1, sizeof(*vsid_ctx));
 		CKNULL(vsid_ctx, -ENOMEM);
 
-		vsid_ctx->vsid = (uint32_t)vsid_val;
+		vsid_ctx->vsid = entry->vsid;
 		vsid_ctx->testid_ctx = testid_ctx;
 		if (clock_gettime(CLOCK_REALTIME, &vsid_ctx->start)) {
 			ret = -errno;
@@ -1621,12 +2139,14 @@ static int acvp_datastore_file_find_responses(
 			goto out;
 		}
 
-		ret = acvp_datastore_find_vsid_verdict(vsid_ctx);
+		ret = acvp_datastore_manifest_algoinfo(datastore, base, entry,
+						       &vsid_ctx->verdict,
+						       &algoinfo_updated);
 		if (ret < 0) {
 			acvp_release_vsid_ctx(vsid_ctx);
 			goto out;
 		}
-		if (ret == EEXIST)
+		if (entry->flags & ACVP_DS_MANIFEST_VERDICT)
 			vsid_ctx->verdict_file_present = true;
 
 		/*
@@ -1649,8 +2169,8 @@ static int acvp_datastore_file_find_responses(
 		if (opts->threading_disabled) {
 			logger(LOGGER_DEBUG, LOGGER_C_DS_FILE,
 			       "Disable threading support\n");
-			ret = acvp_datastore_process_vsid(
-				vsid_ctx, datastore_base, secure_base, cb);
+			ret = acvp_datastore_process_vsid(vsid_ctx, entry, base,
+							  secure_base, cb);
 			acvp_release_vsid_ctx(vsid_ctx);
 			if (ret)
 				goto out;
@@ -1665,7 +2185,8 @@ static int acvp_datastore_file_find_responses(
 				goto out;
 			}
 			tdata->vsid_ctx = vsid_ctx;
-			tdata->datastore_base = datastore_base;
+			tdata->entry = *entry;
+			tdata->datastore_base = base;
 			tdata->secure_base = secure_base;
 			tdata->cb = cb;
 			CKINT(thread_start(
@@ -1674,7 +2195,7 @@ static int acvp_datastore_file_find_responses(
 			ret |= ret_ancestor;
 		}
 #else
-		ret = acvp_datastore_process_vsid(vsid_ctx, datastore_base,
+		ret = acvp_datastore_process_vsid(vsid_ctx, entry, base,
 						  secure_base, cb);
 		acvp_release_vsid_ctx(vsid_ctx);
 		if (ret)
@@ -1693,15 +2214,20 @@ out:
 	ret |= thread_wait();
 #endif
 
-	if (dir)
-		closedir(dir);
+	/* Keep the cipher information obtained from the test vector files */
+	if (algoinfo_updated) {
+		acvp_ds_manifest_store_algoinfo(secure_base, base, &manifest,
+						acvp_datastore_manifest_scan,
+						&scan);
+	}
+	acvp_ds_manifest_release(&manifest);
 
 	return ret;
 }
 
 static int acvp_datastore_file_find_testsession(const struct definition *def,
 						const struct acvp_ctx *ctx,
-						uint32_t *testids,
+						uint32_t **testids,
 						unsigned int *testid_count)
 {
 	const struct acvp_datastore_ctx *datastore;
@@ -1710,7 +2236,7 @@ static int acvp_datastore_file_find_testsession(const struct definition *def,
 	DIR *dir = NULL;
 	char pathname[FILENAME_MAX - 100];
 	char base[FILENAME_MAX - 100];
-	unsigned int tcount = 0;
+	unsigned int tcount = 0, talloc = 0;
 	int ret;
 
 	CKNULL_C_LOG(ctx, -EINVAL, LOGGER_C_DS_FILE,
@@ -1718,6 +2244,9 @@ static int acvp_datastore_file_find_testsession(const struct definition *def,
 	CKNULL_C_LOG(def, -EINVAL, LOGGER_C_DS_FILE,
 		     "Data store backend exchange info missing\n");
 
+	*testids = NULL;
+	*testid_count = 0;
+
 	if (acvp_op_get_interrupted())
 		return 0;
 
@@ -1734,8 +2263,6 @@ static int acvp_datastore_file_find_testsession(const struct definition *def,
 	ret = acvp_datastore_file_testsessiondir(
 		&testid_ctx, pathname, sizeof(pathname), false, false);
 	if (ret) {
-		*testid_count = 0;
-
 		if (ret == -ENOENT)
 			return 0;
 		else
@@ -1749,15 +2276,20 @@ static int acvp_datastore_file_find_testsession(const struct definition *def,
 	CKNULL(dir, -errno);
 
 	/* Iterate through test session directory and process files */
-	while ((tcount < *testid_count) && (dirent = readdir(dir)) != NULL) {
+	while ((dirent = readdir(dir)) != NULL) {
 		const struct acvp_search_ctx *search = &datastore->search;
-		unsigned long testid = strtoul(dirent->d_name, NULL, 10);
+		char *end;
+		unsigned long testid = strtoul(dirent->d_name, &end, 10);
 
 		if (testid >= UINT_MAX) {
 			ret = -errno;
 			goto out;
 		}
 
+		/* Skip other entries, e.g. the logs of the log backend */
+		if (*end)
+			continue;
+
 		/* Skip the special purpose dir of zero */
 		if (!testid)
 			continue;
@@ -1838,13 +2370,20 @@ static int acvp_datastore_file_find_testsession(const struct definition *def,
 		}
 		ret = 0;
 
-		testids[tcount] = (uint32_t)testid;
+		if (tcount >= talloc) {
+			uint32_t *tmp;
+
+			talloc = talloc ? talloc * 2 : 16;
+			tmp = realloc(*testids, talloc * sizeof(*tmp));
+			CKNULL(tmp, -ENOMEM);
+			*testids = tmp;
+		}
+		(*testids)[tcount] = (uint32_t)testid;
 		tcount++;
 	}
 
-	*testid_count = tcount;
-
 out:
+	*testid_count = tcount;
 	if (dir)
 		closedir(dir);
 	return ret;
@@ -1862,6 +2401,8 @@ static struct acvp_datastore_be acvp_datastore_file = {
 	&acvp_datastore_get_vsid_verdict,
 	&acvp_datastore_file_rename_version,
 	&acvp_datastore_file_rename_name,
+	&acvp_datastore_file_open_vsid,
+	&acvp_datastore_file_close_vsid,
 };
 
 ACVP_DEFINE_CONSTRUCTOR(acvp_datastore_init)
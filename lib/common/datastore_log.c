@@ -0,0 +1,1923 @@
+/* Datastore backend storing the data of a test session in log files
+ *
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Instead of one directory per test session and vsID holding one file per
+ * artifact, this backend keeps all artifacts of a test session in the log
+ * file <testID>.acvplog located in the directory of the module. The data
+ * destined for the secure data store is kept in a log with the same name in
+ * the secure data store. The file names of the artifacts of the file backend
+ * are used as record names. Thus, both backends can be converted into each
+ * other with acvp_datastore_log_import and acvp_datastore_log_export.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "acvp_error_handler.h"
+#include "acvpproxy.h"
+#include "datastore_log_file.h"
+#include "datastore_manifest.h"
+#include "datastore_sync.h"
+#include "internal.h"
+#include "json_wrapper.h"
+#include "logger.h"
+#include "request_helper.h"
+#include "threading_support.h"
+
+struct acvp_datastore_log_thread_ctx {
+	struct acvp_vsid_ctx *vsid_ctx;
+	struct acvp_ds_log *log;
+	struct acvp_ds_log *secure_log;
+	int (*cb)(const struct acvp_vsid_ctx *vsid_ctx,
+		  const struct acvp_ext_buf *buf);
+};
+
+static int
+acvp_datastore_log_path(const struct acvp_testid_ctx *testid_ctx,
+			char *pathname, const size_t pathnamelen,
+			const bool createdir, const bool secure_location)
+{
+	int ret;
+
+	CKINT(acvp_datastore_file_testsessiondir(
+		testid_ctx, pathname, pathnamelen, createdir, secure_location));
+	CKINT(acvp_extend_string(pathname, pathnamelen, "/%u%s",
+				 testid_ctx->testid, ACVP_DS_LOG_SUFFIX));
+
+out:
+	return ret;
+}
+
+/* Group commit of the records appended to the log - see datastore_sync.h */
+static int acvp_datastore_log_sync(struct acvp_ds_log *log)
+{
+	int fd = acvp_ds_log_dup_fd(log), ret;
+
+	if (fd < 0)
+		return fd;
+
+	ret = acvp_ds_sync_fd(fd);
+	close(fd);
+
+	return ret;
+}
+
+static int acvp_datastore_log_open(const struct acvp_testid_ctx *testid_ctx,
+				   const bool create,
+				   const bool secure_location,
+				   struct acvp_ds_log **log)
+{
+	char pathname[FILENAME_MAX];
+	int ret;
+
+	CKINT(acvp_datastore_log_path(testid_ctx, pathname, sizeof(pathname),
+				      create, secure_location));
+	CKINT(acvp_ds_log_get(pathname, create,
+			      secure_location ? (S_IRUSR | S_IWUSR) : 0666,
+			      log));
+
+out:
+	return ret;
+}
+
+static int acvp_datastore_log_write(const struct acvp_testid_ctx *testid_ctx,
+				    const uint32_t vsid, const char *filename,
+				    const bool secure_location,
+				    const struct acvp_buf *data)
+{
+	struct acvp_ds_log *log = NULL;
+	int ret;
+
+	if (!data->buf)
+		return 0;
+
+	CKINT(acvp_datastore_log_open(testid_ctx, true, secure_location,
+				      &log));
+	CKINT(acvp_ds_log_append(log, vsid, filename, data->buf, data->len,
+				 0));
+	CKINT(acvp_datastore_log_sync(log));
+
+out:
+	acvp_ds_log_put(log);
+	return ret;
+}
+
+/* Read a record, -ENOENT is returned if neither the log nor the record exist */
+static int acvp_datastore_log_read(const struct acvp_testid_ctx *testid_ctx,
+				   const uint32_t vsid, const char *filename,
+				   const bool secure_location,
+				   struct acvp_buf *buf)
+{
+	struct acvp_ds_log *log = NULL;
+	int ret;
+
+	CKINT(acvp_datastore_log_open(testid_ctx, false, secure_location,
+				      &log));
+	CKINT(acvp_ds_log_read(log, vsid, filename, &buf->buf, &buf->len,
+			       NULL));
+
+out:
+	acvp_ds_log_put(log);
+	return ret;
+}
+
+static int
+acvp_datastore_log_rename(const struct acvp_testid_ctx *testid_ctx,
+			  char **component, char *newcomponent)
+{
+	char *curr = *component;
+	char pathname[FILENAME_MAX];
+	char newpathname[FILENAME_MAX];
+	unsigned int i;
+	int ret = 0;
+
+	/* rename secure location first, then regular location */
+	for (i = 0; i < 2; i++) {
+		const bool secure_location = !i;
+
+		CKINT(acvp_datastore_log_path(testid_ctx, pathname,
+					      sizeof(pathname), false,
+					      secure_location));
+		*component = newcomponent;
+		CKINT(acvp_sanitize_string(*component));
+		CKINT(acvp_datastore_log_path(testid_ctx, newpathname,
+					      sizeof(newpathname), true,
+					      secure_location));
+		*component = curr;
+
+		CKINT(acvp_ds_log_rename(pathname, newpathname));
+	}
+
+out:
+	*component = curr;
+	return ret;
+}
+
+static int
+acvp_datastore_log_rename_version(const struct acvp_testid_ctx *testid_ctx,
+				  char *newversion)
+{
+	const struct definition *def = testid_ctx->def;
+	struct def_info *info = def->info;
+
+	if (acvp_op_get_interrupted())
+		return 0;
+
+	if (!info->module_version_filesafe)
+		return -EINVAL;
+
+	return acvp_datastore_log_rename(
+		testid_ctx, &info->module_version_filesafe, newversion);
+}
+
+static int
+acvp_datastore_log_rename_name(const struct acvp_testid_ctx *testid_ctx,
+			       char *newname)
+{
+	const struct definition *def = testid_ctx->def;
+	struct def_info *info = def->info;
+
+	if (acvp_op_get_interrupted())
+		return 0;
+
+	if (!info->module_name_filesafe)
+		return -EINVAL;
+
+	return acvp_datastore_log_rename(
+		testid_ctx, &info->module_name_filesafe, newname);
+}
+
+static int
+acvp_datastore_log_write_authtoken(const struct acvp_testid_ctx *testid_ctx)
+{
+	const struct acvp_auth_ctx *auth;
+	const struct acvp_ctx *ctx;
+	const struct acvp_datastore_ctx *datastore;
+	const struct definition *def;
+	struct acvp_ds_log *log = NULL;
+	struct acvp_buf tmp;
+	char msgsize[12];
+	int ret;
+
+	CKNULL_C_LOG(testid_ctx, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+
+	if (acvp_op_get_interrupted())
+		return 0;
+
+	auth = testid_ctx->server_auth;
+	ctx = testid_ctx->ctx;
+	datastore = &ctx->datastore;
+	def = testid_ctx->def;
+
+	CKNULL_C_LOG(datastore, -EINVAL, LOGGER_C_DS_LOG,
+		     "Datastore context missing\n");
+	CKNULL_C_LOG(def, -EINVAL, LOGGER_C_DS_LOG,
+		     "Module definition context missing\n");
+	CKNULL_C_LOG(auth, -EINVAL, LOGGER_C_DS_LOG,
+		     "Authentication context missing\n");
+
+	/* The secure log is only accessible by the ACVP Proxy */
+	CKINT(acvp_datastore_log_open(testid_ctx, true, true, &log));
+
+	/* Write JWT access token */
+	if (auth->jwt_token) {
+		CKINT(acvp_ds_log_append(log, ACVP_DS_LOG_TESTID,
+					 datastore->jwttokenfile,
+					 (uint8_t *)auth->jwt_token,
+					 (uint32_t)auth->jwt_token_len, 0));
+		logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+		       "JWT access token stored in log for testID %u\n",
+		       testid_ctx->testid);
+	}
+
+	/* Write JWT certificate reference */
+	tmp.buf = NULL;
+	tmp.len = 0;
+	CKINT(acvp_cert_ref(&tmp));
+	if (tmp.buf) {
+		ret = acvp_ds_log_append(log, ACVP_DS_LOG_TESTID,
+					 datastore->jwtcertref, tmp.buf,
+					 tmp.len, 0);
+		acvp_free_buf(&tmp);
+		if (ret)
+			goto out;
+	}
+
+	/* Write message size constraint information */
+	snprintf(msgsize, sizeof(msgsize), "%u", auth->max_reg_msg_size);
+	CKINT(acvp_ds_log_append(log, ACVP_DS_LOG_TESTID,
+				 datastore->messagesizeconstraint,
+				 (uint8_t *)msgsize, (uint32_t)strlen(msgsize),
+				 0));
+	CKINT(acvp_datastore_log_sync(log));
+
+out:
+	acvp_ds_log_put(log);
+	return ret;
+}
+
+static int acvp_datastore_log_uint(struct acvp_ds_log *log,
+				   const char *filename, uint32_t *id)
+{
+	unsigned long val;
+	uint32_t len;
+	int ret;
+	char *str = NULL;
+
+	ret = acvp_ds_log_read(log, ACVP_DS_LOG_TESTID, filename,
+			       (uint8_t **)&str, &len, NULL);
+	if (ret == -ENOENT)
+		return 0;
+	if (ret)
+		return ret;
+
+	if (len) {
+		val = strtoul(str, NULL, 10);
+
+		/* do not throw an error */
+		if (val >= UINT_MAX)
+			*id = UINT_MAX;
+		else
+			*id = (uint32_t)val;
+	}
+
+	free(str);
+	return 0;
+}
+
+/* Parse the JSON data of a record, *json is NULL if the record is empty */
+static int acvp_datastore_log_json(struct acvp_ds_log *log, const uint32_t vsid,
+				   const char *filename,
+				   struct json_object **json)
+{
+	ACVP_BUFFER_INIT(buf);
+	int ret;
+
+	*json = NULL;
+
+	CKINT(acvp_ds_log_read(log, vsid, filename, &buf.buf, &buf.len, NULL));
+	if (!buf.len)
+		goto out;
+
+	*json = json_tokener_parse((char *)buf.buf);
+	CKNULL_C_LOG(*json, -EFAULT, LOGGER_C_DS_LOG,
+		     "Cannot parse record %s of vsID %u\n", filename, vsid);
+
+out:
+	acvp_free_buf(&buf);
+	return ret;
+}
+
+static int acvp_datastore_log_certinfo(struct acvp_ds_log *log,
+				       const char *filename, char **cert_no)
+{
+	struct json_object *certinfo = NULL, *certdata, *certversion;
+	const char *valId;
+	int ret;
+
+	ret = acvp_datastore_log_json(log, ACVP_DS_LOG_TESTID, filename,
+				      &certinfo);
+	if (ret == -ENOENT)
+		return 0;
+	if (ret || !certinfo)
+		goto out;
+
+	CKINT(json_split_version(certinfo, &certdata, &certversion));
+	CKINT(json_get_string(certdata, "validationId", &valId));
+	CKINT(acvp_duplicate(cert_no, valId));
+
+out:
+	ACVP_JSON_PUT_NULL(certinfo);
+	return ret;
+}
+
+static int acvp_datastore_log_status(struct acvp_ds_log *log,
+				     const char *filename,
+				     const struct acvp_testid_ctx *testid_ctx)
+{
+	struct json_object *status = NULL;
+	int ret;
+
+	if (!testid_ctx->status_parse)
+		return 0;
+
+	ret = acvp_datastore_log_json(log, ACVP_DS_LOG_TESTID, filename,
+				      &status);
+	if (ret == -ENOENT)
+		return 0;
+	if (ret || !status)
+		goto out;
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY, "Loading status record %s\n",
+	       filename);
+	CKINT(testid_ctx->status_parse(testid_ctx, status));
+
+out:
+	ACVP_JSON_PUT_NULL(status);
+	return ret;
+}
+
+static int
+acvp_datastore_log_read_authtoken(const struct acvp_testid_ctx *testid_ctx)
+{
+	struct acvp_auth_ctx *auth;
+	const struct acvp_ctx *ctx;
+	const struct acvp_datastore_ctx *datastore;
+	const struct definition *def;
+	struct acvp_ds_log *log = NULL;
+	uint8_t *token = NULL;
+	uint32_t token_len;
+	int64_t generated;
+	int ret;
+
+	CKNULL_C_LOG(testid_ctx, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+
+	if (acvp_op_get_interrupted())
+		return 0;
+
+	auth = testid_ctx->server_auth;
+	ctx = testid_ctx->ctx;
+	datastore = &ctx->datastore;
+	def = testid_ctx->def;
+
+	CKNULL_C_LOG(datastore, -EINVAL, LOGGER_C_DS_LOG,
+		     "Datastore context missing\n");
+	CKNULL_C_LOG(def, -EINVAL, LOGGER_C_DS_LOG,
+		     "Module definition context missing\n");
+	CKNULL_C_LOG(auth, -EINVAL, LOGGER_C_DS_LOG,
+		     "Authentication context missing\n");
+
+	ret = acvp_datastore_log_open(testid_ctx, false, true, &log);
+	if (ret == -ENOENT)
+		return 0;
+	else if (ret)
+		return ret;
+
+	/* Get JWT token */
+	ret = acvp_ds_log_read(log, ACVP_DS_LOG_TESTID, datastore->jwttokenfile,
+			       &token, &token_len, &generated);
+	if (!ret && token_len) {
+		if (auth->jwt_token) {
+			free(auth->jwt_token);
+			auth->jwt_token = NULL;
+			auth->jwt_token_len = 0;
+		}
+
+		auth->jwt_token = (char *)token;
+		auth->jwt_token_len = token_len;
+		auth->jwt_token_generated = (time_t)generated;
+		token = NULL;
+
+		logger(LOGGER_DEBUG, LOGGER_C_DS_LOG,
+		       "Got authorization token %s\n", auth->jwt_token);
+	} else if (ret && ret != -ENOENT) {
+		goto out;
+	}
+
+	/* Get message size */
+	auth->max_reg_msg_size = UINT_MAX;
+	CKINT(acvp_datastore_log_uint(log, datastore->messagesizeconstraint,
+				      &auth->max_reg_msg_size));
+	logger(LOGGER_DEBUG, LOGGER_C_DS_LOG,
+	       "Maximum file size constraint %u\n", auth->max_reg_msg_size);
+
+	/* Get testsession certificate request ID */
+	auth->testsession_certificate_id = 0;
+	CKINT(acvp_datastore_log_uint(log,
+				      datastore->testsession_certificate_id,
+				      &auth->testsession_certificate_id));
+	logger(LOGGER_DEBUG, LOGGER_C_DS_LOG,
+	       "Test session certificate ID: %u\n",
+	       auth->testsession_certificate_id);
+
+	/* Get testsession certificate number */
+	auth->testsession_certificate_number = NULL;
+	CKINT(acvp_datastore_log_certinfo(
+		log, datastore->testsession_certificate_info,
+		&auth->testsession_certificate_number));
+
+	CKINT(acvp_datastore_log_status(log, datastore->esvp_statusfile,
+					testid_ctx));
+
+out:
+	if (token)
+		free(token);
+	acvp_ds_log_put(log);
+	return ret;
+}
+
+static int acvp_datastore_log_write_vsid(const struct acvp_vsid_ctx *vsid_ctx,
+					 const char *filename,
+					 const bool secure_location,
+					 const struct acvp_buf *data)
+{
+	const struct acvp_testid_ctx *testid_ctx;
+	const struct acvp_ctx *ctx;
+	const struct acvp_datastore_ctx *datastore;
+	const struct definition *def;
+	int ret;
+
+	CKNULL_C_LOG(vsid_ctx, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+
+	if (acvp_op_get_interrupted())
+		return 0;
+
+	testid_ctx = vsid_ctx->testid_ctx;
+	ctx = testid_ctx->ctx;
+	datastore = &ctx->datastore;
+	def = testid_ctx->def;
+
+	CKNULL_C_LOG(datastore, -EINVAL, LOGGER_C_DS_LOG,
+		     "Datastore context missing\n");
+	CKNULL_C_LOG(def, -EINVAL, LOGGER_C_DS_LOG,
+		     "Module definition context missing\n");
+	CKNULL_C_LOG(filename, -EINVAL, LOGGER_C_DS_LOG, "Filename missing\n");
+	CKNULL_C_LOG(data, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data buffer to be written missing\n");
+
+	CKINT(acvp_datastore_log_write(testid_ctx, vsid_ctx->vsid, filename,
+				       secure_location, data));
+
+	logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+	       "data written for testID %u / vsID %u to record %s\n",
+	       testid_ctx->testid, vsid_ctx->vsid, filename);
+
+out:
+	return ret;
+}
+
+/*
+ * Streamed write of a vsID record: the data is collected in memory and
+ * appended as one record on commit. Thus, an interrupted download never
+ * leaves a truncated record behind.
+ */
+struct acvp_datastore_log_sink {
+	const struct acvp_vsid_ctx *vsid_ctx;
+	const char *filename;
+	struct acvp_buf buf;
+	uint32_t bufsize;
+	bool secure_location;
+};
+
+static int acvp_datastore_log_sink_write(void *ctx, const uint8_t *data,
+					 uint32_t len)
+{
+	struct acvp_datastore_log_sink *lsink = ctx;
+
+	return acvp_buf_append(&lsink->buf, &lsink->bufsize, data, len,
+			       UINT32_MAX - 1);
+}
+
+static int acvp_datastore_log_sink_reset(void *ctx)
+{
+	struct acvp_datastore_log_sink *lsink = ctx;
+
+	acvp_free_buf(&lsink->buf);
+	lsink->bufsize = 0;
+
+	return 0;
+}
+
+static int acvp_datastore_log_open_vsid(const struct acvp_vsid_ctx *vsid_ctx,
+					const char *filename,
+					const bool secure_location,
+					struct acvp_buf_sink *sink)
+{
+	struct acvp_datastore_log_sink *lsink;
+	int ret = 0;
+
+	CKNULL_C_LOG(vsid_ctx, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+	CKNULL_C_LOG(filename, -EINVAL, LOGGER_C_DS_LOG, "Filename missing\n");
+	CKNULL_C_LOG(sink, -EINVAL, LOGGER_C_DS_LOG, "Sink missing\n");
+
+	lsink = calloc(1, sizeof(*lsink));
+	CKNULL(lsink, -ENOMEM);
+
+	lsink->vsid_ctx = vsid_ctx;
+	lsink->filename = filename;
+	lsink->secure_location = secure_location;
+
+	sink->write = acvp_datastore_log_sink_write;
+	sink->reset = acvp_datastore_log_sink_reset;
+	sink->ctx = lsink;
+
+out:
+	return ret;
+}
+
+static int acvp_datastore_log_close_vsid(struct acvp_buf_sink *sink,
+					 const bool commit)
+{
+	struct acvp_datastore_log_sink *lsink;
+	struct acvp_ds_log *log = NULL;
+	int ret = 0;
+
+	if (!sink || !sink->ctx)
+		return 0;
+
+	lsink = sink->ctx;
+
+	if (commit) {
+		const struct acvp_vsid_ctx *vsid_ctx = lsink->vsid_ctx;
+
+		CKINT(acvp_datastore_log_open(vsid_ctx->testid_ctx, true,
+					      lsink->secure_location, &log));
+		CKINT(acvp_ds_log_append(log, vsid_ctx->vsid, lsink->filename,
+					 lsink->buf.buf, lsink->buf.len, 0));
+		CKINT(acvp_datastore_log_sync(log));
+
+		logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+		       "data streamed for testID %u / vsID %u to record %s\n",
+		       vsid_ctx->testid_ctx->testid, vsid_ctx->vsid,
+		       lsink->filename);
+	}
+
+out:
+	acvp_ds_log_put(log);
+	acvp_free_buf(&lsink->buf);
+	free(lsink);
+	sink->ctx = NULL;
+	sink->write = NULL;
+	sink->reset = NULL;
+
+	return ret;
+}
+
+static int acvp_datastore_log_write_testid(
+	const struct acvp_testid_ctx *testid_ctx, const char *filename,
+	const bool secure_location, const struct acvp_buf *data)
+{
+	const struct acvp_ctx *ctx;
+	const struct acvp_datastore_ctx *datastore;
+	const struct definition *def;
+	int ret;
+
+	CKNULL_C_LOG(testid_ctx, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+
+	if (acvp_op_get_interrupted())
+		return 0;
+
+	ctx = testid_ctx->ctx;
+	datastore = &ctx->datastore;
+	def = testid_ctx->def;
+
+	CKNULL_C_LOG(datastore, -EINVAL, LOGGER_C_DS_LOG,
+		     "Datastore context missing\n");
+	CKNULL_C_LOG(def, -EINVAL, LOGGER_C_DS_LOG,
+		     "Module definition context missing\n");
+	CKNULL_C_LOG(filename, -EINVAL, LOGGER_C_DS_LOG, "Filename missing\n");
+	CKNULL_C_LOG(data, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data buffer to be written missing\n");
+
+	CKINT(acvp_datastore_log_write(testid_ctx, ACVP_DS_LOG_TESTID,
+				       filename, secure_location, data));
+
+	logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+	       "data written for testID %u to record %s\n", testid_ctx->testid,
+	       filename);
+
+out:
+	return ret;
+}
+
+static int acvp_datastore_log_compare(const struct acvp_vsid_ctx *vsid_ctx,
+				      const char *filename,
+				      const bool secure_location,
+				      const bool vsid_location,
+				      const struct acvp_buf *data)
+{
+	const struct acvp_testid_ctx *testid_ctx;
+	const struct acvp_ctx *ctx;
+	const struct acvp_datastore_ctx *datastore;
+	const struct definition *def;
+	ACVP_BUFFER_INIT(buf);
+	int ret;
+
+	CKNULL_C_LOG(vsid_ctx, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+
+	if (acvp_op_get_interrupted())
+		return 0;
+
+	testid_ctx = vsid_ctx->testid_ctx;
+	ctx = testid_ctx->ctx;
+	datastore = &ctx->datastore;
+	def = testid_ctx->def;
+
+	CKNULL_C_LOG(datastore, -EINVAL, LOGGER_C_DS_LOG,
+		     "Datastore context missing\n");
+	CKNULL_C_LOG(def, -EINVAL, LOGGER_C_DS_LOG,
+		     "Module definition context missing\n");
+	CKNULL_C_LOG(filename, -EINVAL, LOGGER_C_DS_LOG, "Filename missing\n");
+	CKNULL_C_LOG(data, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data buffer to be compared missing\n");
+	CKNULL_C_LOG(data->buf, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data buffer to be compared missing\n");
+
+	CKINT(acvp_datastore_log_read(testid_ctx,
+				      vsid_location ? vsid_ctx->vsid :
+						      ACVP_DS_LOG_TESTID,
+				      filename, secure_location, &buf));
+
+	if (data->len != buf.len) {
+		logger(LOGGER_DEBUG, LOGGER_C_DS_LOG,
+		       "Datastore compare: string lengths do not match (requested length %u, found length %u)\n",
+		       data->len, buf.len);
+		ret = 0;
+		goto out;
+	}
+	if (memcmp(data->buf, buf.buf, data->len)) {
+		logger(LOGGER_DEBUG, LOGGER_C_DS_LOG,
+		       "Datastore compare: strings do not match\n");
+		ret = 0;
+	} else {
+		ret = 1;
+	}
+
+out:
+	acvp_free_buf(&buf);
+	return ret;
+}
+
+/* Obtain the verdict from a verdict record if it exists */
+static int acvp_datastore_log_verdict(struct acvp_ds_log *log,
+				      const uint32_t vsid,
+				      const struct acvp_datastore_ctx *datastore,
+				      struct acvp_test_verdict_status *verdict)
+{
+	ACVP_BUFFER_INIT(buf);
+	int ret;
+
+	ret = acvp_ds_log_read(log, vsid, datastore->verdictfile, &buf.buf,
+			       &buf.len, NULL);
+	if (ret == -ENOENT) {
+		verdict->verdict = acvp_verdict_unknown;
+		return 0;
+	}
+	if (ret)
+		return ret;
+
+	if (acvp_get_verdict_json(&buf, &verdict->verdict)) {
+		/*
+		 * We are not stopping here since we will report that the ID
+		 * is unverified.
+		 */
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "Record %s of vsID %u does not contain valid verdict\n",
+		       datastore->verdictfile, vsid);
+	}
+
+	acvp_free_buf(&buf);
+	return 0;
+}
+
+/* Obtain the cipher information from a test vector record if it exists */
+static int acvp_datastore_log_modinfo(struct acvp_ds_log *log,
+				      const uint32_t vsid,
+				      const struct acvp_datastore_ctx *datastore,
+				      struct acvp_test_verdict_status *verdict)
+{
+	ACVP_BUFFER_INIT(buf);
+	int ret;
+
+	ret = acvp_ds_log_read(log, vsid, datastore->vectorfile, &buf.buf,
+			       &buf.len, NULL);
+	if (ret == -ENOENT)
+		return 0;
+	if (ret)
+		return ret;
+
+	if (acvp_get_algoinfo_json(&buf, verdict)) {
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "Record %s of vsID %u does not contain valid cipher information\n",
+		       datastore->vectorfile, vsid);
+	}
+
+	acvp_free_buf(&buf);
+	return 0;
+}
+
+static int acvp_datastore_log_metadata(struct acvp_ds_log *log,
+				       struct acvp_testid_ctx *testid_ctx)
+{
+	ACVP_BUFFER_INIT(buf);
+	int ret;
+
+	ret = acvp_ds_log_read(log, ACVP_DS_LOG_TESTID, ACVP_DS_TESTIDMETA,
+			       &buf.buf, &buf.len, NULL);
+	if (ret == -ENOENT)
+		return 0;
+	if (ret)
+		return ret;
+
+	if (acvp_get_testsession_expiry_epoch(&buf, &testid_ctx->expiry)) {
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "Record %s does not contain valid expiry date information\n",
+		       ACVP_DS_TESTIDMETA);
+	}
+
+	acvp_free_buf(&buf);
+	return 0;
+}
+
+static int
+acvp_datastore_log_get_testid_verdict(struct acvp_testid_ctx *testid_ctx)
+{
+	const struct acvp_ctx *ctx;
+	const struct acvp_datastore_ctx *datastore;
+	struct acvp_ds_log *log = NULL, *secure_log = NULL;
+	int ret;
+
+	CKNULL_C_LOG(testid_ctx, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+
+	if (acvp_op_get_interrupted())
+		return 0;
+
+	ctx = testid_ctx->ctx;
+	datastore = &ctx->datastore;
+
+	/* If the logs do not exist, we ignore it. */
+	if (acvp_datastore_log_open(testid_ctx, false, false, &log) ||
+	    acvp_datastore_log_open(testid_ctx, false, true, &secure_log)) {
+		ret = 0;
+		goto out;
+	}
+
+	CKINT(acvp_datastore_log_verdict(log, ACVP_DS_LOG_TESTID, datastore,
+					 &testid_ctx->verdict));
+	CKINT(acvp_datastore_log_modinfo(log, ACVP_DS_LOG_TESTID, datastore,
+					 &testid_ctx->verdict));
+	CKINT(acvp_datastore_log_metadata(secure_log, testid_ctx));
+
+out:
+	acvp_ds_log_put(log);
+	acvp_ds_log_put(secure_log);
+	return ret;
+}
+
+static int acvp_datastore_log_get_vsid_verdict(struct acvp_vsid_ctx *vsid_ctx)
+{
+	const struct acvp_testid_ctx *testid_ctx;
+	const struct acvp_ctx *ctx;
+	const struct acvp_datastore_ctx *datastore;
+	struct acvp_ds_log *log = NULL;
+	int ret;
+
+	CKNULL_C_LOG(vsid_ctx, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+	testid_ctx = vsid_ctx->testid_ctx;
+
+	CKNULL_C_LOG(testid_ctx, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+
+	if (acvp_op_get_interrupted())
+		return 0;
+
+	ctx = testid_ctx->ctx;
+	datastore = &ctx->datastore;
+
+	/* If the vsID does not exist, we ignore it. */
+	if (acvp_datastore_log_open(testid_ctx, false, false, &log) ||
+	    acvp_ds_log_has_vsid(log, vsid_ctx->vsid)) {
+		ret = 0;
+		goto out;
+	}
+
+	CKINT(acvp_datastore_log_verdict(log, vsid_ctx->vsid, datastore,
+					 &vsid_ctx->verdict));
+
+out:
+	acvp_ds_log_put(log);
+	return ret;
+}
+
+static int
+acvp_datastore_log_process_vsid(struct acvp_vsid_ctx *vsid_ctx,
+				struct acvp_ds_log *log,
+				struct acvp_ds_log *secure_log,
+				int (*cb)(const struct acvp_vsid_ctx *vsid_ctx,
+					  const struct acvp_ext_buf *buf))
+{
+	const struct acvp_testid_ctx *testid_ctx = vsid_ctx->testid_ctx;
+	const struct acvp_ctx *ctx = testid_ctx->ctx;
+	const struct acvp_datastore_ctx *datastore = &ctx->datastore;
+	const struct acvp_opts_ctx *ctx_opts = &ctx->options;
+	const struct acvp_auth_ctx *auth = testid_ctx->server_auth;
+	ACVP_BUFFER_INIT(resp);
+	ACVP_EXT_BUFFER_INIT(buf);
+	time_t now;
+	struct tm now_detail;
+	int ret = 0;
+	char now_buf[30];
+
+	/*
+	 * The vsID of 0 is special as it contains status information for the
+	 * test session authentication where no vsID exists yet.
+	 */
+	if (!vsid_ctx->vsid) {
+		logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+		       "Skipping special vsID without any test data of testID %u\n",
+		       testid_ctx->testid);
+		return 0;
+	}
+
+	if (auth && auth->testsession_certificate_number) {
+		logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+		       "Skipping processing of test data as certificate %s was received\n",
+		       auth->testsession_certificate_number);
+		return 0;
+	}
+
+	/*
+	 * If we have an expected result on file, we cannot submit real results
+	 * any more - the ACVP server will reject it.
+	 */
+	if (!acvp_ds_log_stat(log, vsid_ctx->vsid, datastore->expectedfile,
+			      NULL)) {
+		logger_status(
+			LOGGER_C_DS_LOG,
+			"Skipping submission for vsID %u since expected results are present\n",
+			vsid_ctx->vsid);
+		logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+		       "Skipping submission for vsID %u since expected results are present\n",
+		       vsid_ctx->vsid);
+		vsid_ctx->sample_file_present = true;
+
+		return 0;
+	}
+
+	/* If the responses were processed already, do a resubmit */
+	if (!acvp_ds_log_stat(secure_log, vsid_ctx->vsid,
+			      datastore->processedfile, NULL)) {
+		if (ctx_opts->delete_vsid) {
+			return cb(vsid_ctx, NULL);
+		}
+		if (!ctx_opts->resubmit_result) {
+			if (acvp_ds_log_stat(log, vsid_ctx->vsid,
+					     datastore->verdictfile, NULL)) {
+				logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+				       "Skipping submission for vsID %u since it was submitted already, but fetching verdict\n",
+				       vsid_ctx->vsid);
+
+				/*
+				 * Tell the callback to only download the
+				 * verdict but not process any results.
+				 */
+				vsid_ctx->fetch_verdict = true;
+				return cb(vsid_ctx, NULL);
+			}
+
+			CKINT(acvp_datastore_log_verdict(log, vsid_ctx->vsid,
+							 datastore,
+							 &vsid_ctx->verdict));
+
+			/*
+			 * If we have a verdict which shows
+			 * acvp_verdict_unreceived, then resubmit as POST
+			 * operation.
+			 */
+			if (vsid_ctx->verdict.verdict !=
+			    acvp_verdict_unreceived) {
+				logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+				       "Skipping submission for vsID %u since it was submitted already\n",
+				       vsid_ctx->vsid);
+				return 0;
+			}
+		}
+	}
+
+	/* Get response */
+	ret = acvp_ds_log_read(log, vsid_ctx->vsid, datastore->resultsfile,
+			       &resp.buf, &resp.len, NULL);
+	if (ret == -ENOENT) {
+		logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+		       "No response for vsID %u found\n", vsid_ctx->vsid);
+
+		/*
+		 * Download pending vsID requests (do not try to submit
+		 * responses).
+		 */
+		vsid_ctx->vector_file_present =
+			!acvp_ds_log_stat(log, vsid_ctx->vsid,
+					  datastore->vectorfile, NULL);
+		vsid_ctx->sample_file_present = false;
+
+		CKINT(cb(vsid_ctx, NULL));
+
+		ret = 0;
+		goto out;
+	}
+	if (ret)
+		goto out;
+
+	if (!resp.len) {
+		logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+		       "Skipping submission for vsID %u since response is empty\n",
+		       vsid_ctx->vsid);
+		goto out;
+	}
+
+	/* Process response */
+	buf.buf = resp.buf;
+	buf.len = resp.len;
+	ret = cb(vsid_ctx, &buf);
+	if (ret < 0) {
+		/*
+		 * If the upload was rejected, we do not create the processed
+		 * record. Yet, we return an error of 0 to keep the other
+		 * threads processing.
+		 */
+		if (ret == -ACVP_ERR_RESPONSE_REJECTED)
+			ret = 0;
+		goto out;
+	}
+
+	/* Create processed record */
+	now = time(NULL);
+	if (now == (time_t)-1) {
+		ret = -errno;
+		logger(LOGGER_WARN, LOGGER_C_DS_LOG,
+		       "Cannot obtain local time\n");
+		goto out;
+	}
+	localtime_r(&now, &now_detail);
+
+	snprintf(now_buf, sizeof(now_buf), "%d%.2d%.2d %.2d:%.2d:%.2d",
+		 now_detail.tm_year + 1900, now_detail.tm_mon + 1,
+		 now_detail.tm_mday, now_detail.tm_hour, now_detail.tm_min,
+		 now_detail.tm_sec);
+
+	CKINT(acvp_ds_log_append(secure_log, vsid_ctx->vsid,
+				 datastore->processedfile, (uint8_t *)now_buf,
+				 (uint32_t)strlen(now_buf), (int64_t)now));
+	CKINT(acvp_datastore_log_sync(secure_log));
+
+out:
+	acvp_free_buf(&resp);
+	return ret;
+}
+
+#ifdef ACVP_USE_PTHREAD
+static int acvp_datastore_log_find_responses_thread(void *arg)
+{
+	struct acvp_datastore_log_thread_ctx *tdata =
+		(struct acvp_datastore_log_thread_ctx *)arg;
+	struct acvp_vsid_ctx *vsid_ctx = tdata->vsid_ctx;
+	struct acvp_ds_log *log = tdata->log;
+	struct acvp_ds_log *secure_log = tdata->secure_log;
+	int (*cb)(const struct acvp_vsid_ctx *vsid_ctx,
+		  const struct acvp_ext_buf *buf) = tdata->cb;
+	int ret;
+
+	free(tdata);
+
+	thread_set_name(acvp_vsid, vsid_ctx->vsid);
+
+	ret = acvp_datastore_log_process_vsid(vsid_ctx, log, secure_log, cb);
+
+	acvp_release_vsid_ctx(vsid_ctx);
+
+	return ret;
+}
+#endif
+
+/*
+ * Ensure there is no mismatch between the module definition used to download
+ * the test vectors compared to the module definition when uploading the
+ * responses and getting the verdict - see acvp_def_check of the file backend.
+ */
+static int acvp_datastore_log_def_check(const struct acvp_testid_ctx *testid_ctx,
+					struct acvp_ds_log *log)
+{
+	struct json_object *def_config = NULL;
+	int ret;
+
+	CKNULL_C_LOG(testid_ctx->def, -EFAULT, LOGGER_C_DS_LOG,
+		     "Module definition context missing\n");
+
+	/* Do not do anyting if we did not find a definition search record */
+	if (acvp_datastore_log_json(log, ACVP_DS_LOG_TESTID,
+				    ACVP_DS_DEF_REFERENCE, &def_config) ||
+	    !def_config)
+		return 0;
+
+	CKINT(acvp_match_def(testid_ctx, def_config));
+
+out:
+	ACVP_JSON_PUT_NULL(def_config);
+	return ret;
+}
+
+static int acvp_datastore_log_find_responses(
+	const struct acvp_testid_ctx *testid_ctx,
+	int (*cb)(const struct acvp_vsid_ctx *vsid_ctx,
+		  const struct acvp_ext_buf *buf))
+{
+	const struct acvp_ctx *ctx;
+	const struct acvp_datastore_ctx *datastore;
+	const struct acvp_opts_ctx *opts;
+	const struct definition *def;
+	struct acvp_ds_log *log = NULL, *secure_log = NULL;
+	uint32_t n, nr_vsids = 0, *vsids = NULL;
+	int ret;
+
+	CKNULL_C_LOG(testid_ctx, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+
+	if (acvp_op_get_interrupted())
+		return 0;
+
+	ctx = testid_ctx->ctx;
+	datastore = &ctx->datastore;
+	opts = &ctx->options;
+	def = testid_ctx->def;
+
+	CKNULL_C_LOG(datastore, -EINVAL, LOGGER_C_DS_LOG,
+		     "Datastore context missing\n");
+	/*
+	 * Although not needed in this function, we check for the presence as
+	 * later functions may require its presence.
+	 */
+	CKNULL_C_LOG(def, -EINVAL, LOGGER_C_DS_LOG,
+		     "Module definition context missing\n");
+	CKNULL_C_LOG(cb, -EINVAL, LOGGER_C_DS_LOG,
+		     "Callback function missing\n");
+
+	ret = acvp_datastore_log_open(testid_ctx, false, false, &log);
+	if (ret == -ENOENT)
+		return 0;
+	else if (ret)
+		return ret;
+
+	/* The secure log receives the processed records */
+	CKINT(acvp_datastore_log_open(testid_ctx, true, true, &secure_log));
+
+	/*
+	 * Update testid_ctx:
+	 * In case a specific cipher definition is stored there, use it.
+	 *
+	 * In case we do not find a match, just disregard the current testID.
+	 */
+	if (acvp_datastore_log_def_check(testid_ctx, log)) {
+		ret = 0;
+		goto out;
+	}
+
+	CKINT(acvp_ds_log_vsids(log, &vsids, &nr_vsids));
+
+	for (n = 0; n < nr_vsids; n++) {
+		const struct acvp_search_ctx *search = &datastore->search;
+		struct acvp_vsid_ctx *vsid_ctx = NULL;
+
+		logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+		       "Process results of vsID %u\n", vsids[n]);
+
+		/*
+		 * If specific vsID is requested, only return requested vsID.
+		 * If there is no vsID search criteria, all vsIDs will be used.
+		 */
+		if (search->nr_submit_vsid) {
+			unsigned int j, found = 0;
+
+			for (j = 0; j < search->nr_submit_vsid; j++) {
+				if (search->submit_vsid[j] == vsids[n]) {
+					found = 1;
+					break;
+				}
+			}
+
+			if (!found) {
+				logger(LOGGER_DEBUG, LOGGER_C_DS_LOG,
+				       "Skipping test results of vsID %u\n",
+				       vsids[n]);
+				continue;
+			}
+		}
+
+		vsid_ctx = calloc(1, sizeof(*vsid_ctx));
+		CKNULL(vsid_ctx, -ENOMEM);
+
+		vsid_ctx->vsid = vsids[n];
+		vsid_ctx->testid_ctx = testid_ctx;
+		if (clock_gettime(CLOCK_REALTIME, &vsid_ctx->start)) {
+			ret = -errno;
+			acvp_release_vsid_ctx(vsid_ctx);
+			goto out;
+		}
+
+		ret = acvp_datastore_log_modinfo(log, vsid_ctx->vsid, datastore,
+						 &vsid_ctx->verdict);
+		if (ret < 0) {
+			acvp_release_vsid_ctx(vsid_ctx);
+			goto out;
+		}
+		if (!acvp_ds_log_stat(log, vsid_ctx->vsid,
+				      datastore->verdictfile, NULL))
+			vsid_ctx->verdict_file_present = true;
+
+		/*
+		 * If the testid_ctx contains a test verdict retrieval,
+		 * we only try to invoke the callback as our invocation
+		 * is only intended to retrieve the test verdict.
+		 */
+		if (testid_ctx->verdict.verdict) {
+			ret = cb(vsid_ctx, NULL);
+			acvp_release_vsid_ctx(vsid_ctx);
+
+			if (ret < 0)
+				goto out;
+
+			continue;
+		}
+
+#ifdef ACVP_USE_PTHREAD
+		/* Disable threading in DEBUG mode */
+		if (opts->threading_disabled) {
+			logger(LOGGER_DEBUG, LOGGER_C_DS_LOG,
+			       "Disable threading support\n");
+			ret = acvp_datastore_log_process_vsid(vsid_ctx, log,
+							      secure_log, cb);
+			acvp_release_vsid_ctx(vsid_ctx);
+			if (ret)
+				goto out;
+		} else {
+			struct acvp_datastore_log_thread_ctx *tdata;
+			int ret_ancestor;
+
+			tdata = calloc(1, sizeof(*tdata));
+			if (!tdata) {
+				acvp_release_vsid_ctx(vsid_ctx);
+				ret = -ENOMEM;
+				goto out;
+			}
+			tdata->vsid_ctx = vsid_ctx;
+			tdata->log = log;
+			tdata->secure_log = secure_log;
+			tdata->cb = cb;
+			CKINT(thread_start(
+				acvp_datastore_log_find_responses_thread,
+				tdata, 1, &ret_ancestor));
+			ret |= ret_ancestor;
+		}
+#else
+		(void)opts;
+		ret = acvp_datastore_log_process_vsid(vsid_ctx, log,
+						      secure_log, cb);
+		acvp_release_vsid_ctx(vsid_ctx);
+		if (ret)
+			goto out;
+#endif
+	}
+
+	if (ret)
+		goto out;
+
+	/* Positive return code as this is no error - see the file backend */
+	if (!acvp_ds_log_stat(log, ACVP_DS_LOG_TESTID, datastore->verdictfile,
+			      NULL))
+		ret = EEXIST;
+
+out:
+
+#ifdef ACVP_USE_PTHREAD
+	ret |= thread_wait();
+#endif
+
+	if (vsids)
+		free(vsids);
+	acvp_ds_log_put(log);
+	acvp_ds_log_put(secure_log);
+
+	return ret;
+}
+
+static int acvp_datastore_log_find_testsession(const struct definition *def,
+					       const struct acvp_ctx *ctx,
+					       uint32_t **testids,
+					       unsigned int *testid_count)
+{
+	const struct acvp_datastore_ctx *datastore;
+	struct acvp_testid_ctx testid_ctx;
+	struct dirent *dirent;
+	DIR *dir = NULL;
+	char pathname[FILENAME_MAX - 100];
+	unsigned int tcount = 0, talloc = 0;
+	int ret;
+
+	CKNULL_C_LOG(ctx, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+	CKNULL_C_LOG(def, -EINVAL, LOGGER_C_DS_LOG,
+		     "Data store backend exchange info missing\n");
+
+	*testids = NULL;
+	*testid_count = 0;
+
+	if (acvp_op_get_interrupted())
+		return 0;
+
+	memset(&testid_ctx, 0, sizeof(testid_ctx));
+	testid_ctx.def = def;
+	testid_ctx.ctx = ctx;
+
+	datastore = &ctx->datastore;
+
+	CKNULL_C_LOG(datastore, -EINVAL, LOGGER_C_DS_LOG,
+		     "Datastore context missing\n");
+
+	/* Get reference to test session directory without creating it */
+	ret = acvp_datastore_file_testsessiondir(
+		&testid_ctx, pathname, sizeof(pathname), false, false);
+	if (ret) {
+		if (ret == -ENOENT)
+			return 0;
+		else
+			return ret;
+	}
+
+	logger(LOGGER_DEBUG, LOGGER_C_DS_LOG,
+	       "Read test session directory %s\n", pathname);
+
+	dir = opendir(pathname);
+	CKNULL(dir, -errno);
+
+	/* Iterate through the test session logs */
+	while ((dirent = readdir(dir)) != NULL) {
+		const struct acvp_search_ctx *search = &datastore->search;
+		struct acvp_ds_log *log = NULL;
+		char *end;
+		unsigned long testid = strtoul(dirent->d_name, &end, 10);
+
+		if (end == dirent->d_name || strcmp(end, ACVP_DS_LOG_SUFFIX))
+			continue;
+
+		/* Skip the special purpose session of zero */
+		if (!testid || testid >= UINT_MAX)
+			continue;
+
+		/* Fudge the testid_ctx */
+		testid_ctx.testid = (uint32_t)testid;
+
+		/*
+		 * If specific testID is requested, only return requested
+		 * testID. If there is no testID search criteria, all testIDs
+		 * will be used.
+		 */
+		if (search->nr_submit_testid) {
+			unsigned int i, found = 0;
+
+			for (i = 0; i < search->nr_submit_testid; i++) {
+				if (search->submit_testid[i] == testid ||
+				    search->submit_testid[i] == UINT_MAX) {
+					found = 1;
+					break;
+				}
+			}
+
+			if (!found) {
+				logger(LOGGER_DEBUG, LOGGER_C_DS_LOG,
+				       "Skipping test session %lu\n", testid);
+				continue;
+			}
+		}
+
+		if (acvp_datastore_log_open(&testid_ctx, false, false, &log))
+			continue;
+
+		/* Search for vsIDs */
+		if (search->nr_submit_vsid) {
+			unsigned int i, found = 0;
+
+			for (i = 0; i < search->nr_submit_vsid; i++) {
+				if (!acvp_ds_log_has_vsid(
+					    log, search->submit_vsid[i])) {
+					found = 1;
+					break;
+				}
+			}
+
+			if (!found) {
+				logger(LOGGER_DEBUG, LOGGER_C_DS_LOG,
+				       "Skipping test session %lu\n", testid);
+				acvp_ds_log_put(log);
+				continue;
+			}
+		}
+
+		/*
+		 * Skip the test session if the stored definition does not
+		 * match the current module definition - see the file backend.
+		 */
+		ret = acvp_datastore_log_def_check(&testid_ctx, log);
+		acvp_ds_log_put(log);
+		if (ret) {
+			ret = 0;
+			continue;
+		}
+
+		if (tcount >= talloc) {
+			uint32_t *tmp;
+
+			talloc = talloc ? talloc * 2 : 16;
+			tmp = realloc(*testids, talloc * sizeof(*tmp));
+			CKNULL(tmp, -ENOMEM);
+			*testids = tmp;
+		}
+		(*testids)[tcount] = (uint32_t)testid;
+		tcount++;
+	}
+
+out:
+	*testid_count = tcount;
+	if (dir)
+		closedir(dir);
+	return ret;
+}
+
+static struct acvp_datastore_be acvp_datastore_log = {
+	&acvp_datastore_log_find_testsession,
+	&acvp_datastore_log_find_responses,
+	&acvp_datastore_log_write_vsid,
+	&acvp_datastore_log_write_testid,
+	&acvp_datastore_log_compare,
+	&acvp_datastore_log_write_authtoken,
+	&acvp_datastore_log_read_authtoken,
+	&acvp_datastore_log_get_testid_verdict,
+	&acvp_datastore_log_get_vsid_verdict,
+	&acvp_datastore_log_rename_version,
+	&acvp_datastore_log_rename_name,
+	&acvp_datastore_log_open_vsid,
+	&acvp_datastore_log_close_vsid,
+};
+
+ACVP_DEFINE_CONSTRUCTOR(acvp_datastore_log_init)
+static void acvp_datastore_log_init(void)
+{
+	acvp_register_ds_log(&acvp_datastore_log);
+}
+
+/************************************************************************
+ * Conversion between the file backend and the log backend
+ ************************************************************************/
+
+/*
+ * Depth of the test session directories below the data store base:
+ * <vendor>/<module>/<version>/<testID>
+ */
+#define ACVP_DS_LOG_TESTID_DEPTH 4
+
+#define ACVP_DS_LOG_GZIP_SUFFIX ".gz"
+#define ACVP_DS_LOG_TMP_SUFFIX ".tmp"
+
+/* Parse a number followed by the given suffix */
+static bool acvp_datastore_log_number(const char *name, const char *suffix,
+				      uint32_t *val)
+{
+	unsigned long num;
+	char *end;
+
+	if (*name < '0' || *name > '9')
+		return false;
+
+	num = strtoul(name, &end, 10);
+	if (num >= UINT32_MAX || strcmp(end, suffix))
+		return false;
+
+	*val = (uint32_t)num;
+	return true;
+}
+
+static bool acvp_datastore_log_has_suffix(const char *name, const char *suffix)
+{
+	size_t len = strlen(name), slen = strlen(suffix);
+
+	return (len > slen && !strcmp(name + len - slen, suffix));
+}
+
+/* Read a file, gzip compressed files are decompressed transparently */
+static int acvp_datastore_log_read_file(const char *pathname,
+					struct acvp_buf *buf)
+{
+	gzFile gz;
+	uint8_t chunk[16384];
+	uint32_t bufsize = 0;
+	int read, ret = 0;
+
+	gz = gzopen(pathname, "rb");
+	if (!gz)
+		return errno ? -errno : -ENOMEM;
+
+	while ((read = gzread(gz, chunk, sizeof(chunk))) > 0) {
+		CKINT(acvp_buf_append(buf, &bufsize, chunk, (uint32_t)read,
+				      UINT32_MAX - 1));
+	}
+
+	if (read < 0) {
+		logger(LOGGER_WARN, LOGGER_C_DS_LOG, "Reading file %s failed\n",
+		       pathname);
+		ret = -EIO;
+	}
+
+out:
+	gzclose(gz);
+	if (ret)
+		acvp_free_buf(buf);
+	return ret;
+}
+
+/* Is the data identical to the data of the latest record? */
+static bool acvp_datastore_log_unchanged(struct acvp_ds_log *log,
+					 const uint32_t vsid, const char *name,
+					 const struct acvp_buf *data)
+{
+	ACVP_BUFFER_INIT(rec);
+	bool unchanged;
+
+	if (acvp_ds_log_read(log, vsid, name, &rec.buf, &rec.len, NULL))
+		return false;
+
+	unchanged = (rec.len == data->len &&
+		     (!rec.len || !memcmp(rec.buf, data->buf, rec.len)));
+	acvp_free_buf(&rec);
+
+	return unchanged;
+}
+
+static int acvp_datastore_log_import_file(struct acvp_ds_log *log,
+					  const char *dir, const char *filename,
+					  const uint32_t vsid,
+					  const struct stat *statbuf,
+					  unsigned int *imported)
+{
+	struct stat variant;
+	ACVP_BUFFER_INIT(data);
+	size_t len = strlen(filename);
+	int ret;
+	char pathname[FILENAME_MAX], name[ACVP_DS_LOG_NAMELEN + 1];
+
+	/* Skip incomplete files and the manifest of the file backend */
+	if (acvp_datastore_log_has_suffix(filename, ACVP_DS_LOG_TMP_SUFFIX) ||
+	    !strcmp(filename, ACVP_DS_MANIFEST) ||
+	    !strcmp(filename, ACVP_DS_MANIFEST_LOCK))
+		return 0;
+
+	if (acvp_datastore_log_has_suffix(filename, ACVP_DS_LOG_GZIP_SUFFIX))
+		len -= strlen(ACVP_DS_LOG_GZIP_SUFFIX);
+	if (len > ACVP_DS_LOG_NAMELEN) {
+		logger(LOGGER_WARN, LOGGER_C_DS_LOG,
+		       "Skipping file %s/%s with too long name\n", dir,
+		       filename);
+		return 0;
+	}
+	memcpy(name, filename, len);
+	name[len] = '\0';
+
+	/* The uncompressed variant takes precedence as in the file backend */
+	if (len != strlen(filename)) {
+		snprintf(pathname, sizeof(pathname), "%s/%s", dir, name);
+		if (!stat(pathname, &variant))
+			return 0;
+	}
+
+	ret = snprintf(pathname, sizeof(pathname), "%s/%s", dir, filename);
+	if (ret < 0 || (size_t)ret >= sizeof(pathname))
+		return -ENAMETOOLONG;
+
+	CKINT(acvp_datastore_log_read_file(pathname, &data));
+
+	if (acvp_datastore_log_unchanged(log, vsid, name, &data))
+		goto out;
+
+#ifdef __APPLE__
+	CKINT(acvp_ds_log_append(log, vsid, name, data.buf, data.len,
+				 statbuf->st_mtimespec.tv_sec));
+#else
+	CKINT(acvp_ds_log_append(log, vsid, name, data.buf, data.len,
+				 statbuf->st_mtim.tv_sec));
+#endif
+	(*imported)++;
+
+	logger(LOGGER_DEBUG, LOGGER_C_DS_LOG, "Imported file %s\n", pathname);
+
+out:
+	acvp_free_buf(&data);
+	return ret;
+}
+
+/*
+ * Import the files of a test session directory (vsid is ACVP_DS_LOG_TESTID)
+ * including its vsID directories or the files of a vsID directory.
+ */
+static int acvp_datastore_log_import_dir(struct acvp_ds_log *log,
+					 const char *dir, const uint32_t vsid,
+					 unsigned int *imported)
+{
+	struct dirent *dirent;
+	struct stat statbuf;
+	DIR *d;
+	int ret = 0;
+	char pathname[FILENAME_MAX];
+
+	d = opendir(dir);
+	CKNULL(d, -errno);
+
+	while ((dirent = readdir(d)) != NULL) {
+		uint32_t sub_vsid;
+
+		if (dirent->d_name[0] == '.')
+			continue;
+
+		ret = snprintf(pathname, sizeof(pathname), "%s/%s", dir,
+			       dirent->d_name);
+		if (ret < 0 || (size_t)ret >= sizeof(pathname)) {
+			ret = -ENAMETOOLONG;
+			goto out;
+		}
+		ret = 0;
+
+		if (stat(pathname, &statbuf)) {
+			ret = -errno;
+			goto out;
+		}
+
+		if (S_ISREG(statbuf.st_mode)) {
+			CKINT(acvp_datastore_log_import_file(log, dir,
+							     dirent->d_name,
+							     vsid, &statbuf,
+							     imported));
+		} else if (S_ISDIR(statbuf.st_mode) &&
+			   vsid == ACVP_DS_LOG_TESTID &&
+			   acvp_datastore_log_number(dirent->d_name, "",
+						     &sub_vsid)) {
+			CKINT(acvp_datastore_log_import_dir(log, pathname,
+							    sub_vsid,
+							    imported));
+		} else {
+			logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+			       "Skipping unknown entry %s\n", pathname);
+		}
+	}
+
+out:
+	if (d)
+		closedir(d);
+	return ret;
+}
+
+static int acvp_datastore_log_import_testid(const char *parent,
+					    const uint32_t testid,
+					    const bool secure_location)
+{
+	struct acvp_ds_log *log = NULL;
+	unsigned int imported = 0;
+	int ret;
+	char dir[FILENAME_MAX], logpath[FILENAME_MAX];
+
+	snprintf(dir, sizeof(dir), "%s/%u", parent, testid);
+	ret = snprintf(logpath, sizeof(logpath), "%s/%u%s", parent, testid,
+		       ACVP_DS_LOG_SUFFIX);
+	if (ret < 0 || (size_t)ret >= sizeof(logpath))
+		return -ENAMETOOLONG;
+
+	CKINT(acvp_ds_log_get(logpath, true,
+			      secure_location ? (S_IRUSR | S_IWUSR) : 0666,
+			      &log));
+	CKINT(acvp_datastore_log_import_dir(log, dir, ACVP_DS_LOG_TESTID,
+					    &imported));
+
+	/* Drop the records superseded by a repeated import */
+	CKINT(acvp_ds_log_compact(log));
+
+	logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+	       "Imported %u files of test session directory %s into %s\n",
+	       imported, dir, logpath);
+
+out:
+	acvp_ds_log_put(log);
+	return ret;
+}
+
+struct acvp_datastore_log_export_ctx {
+	const char *dir;
+	unsigned int exported;
+	bool secure_location;
+	int ret;
+};
+
+static int acvp_datastore_log_export_rec(void *ctx, uint32_t vsid,
+					 const char *name, const uint8_t *data,
+					 uint32_t len, int64_t mtime)
+{
+	struct acvp_datastore_log_export_ctx *export = ctx;
+	ACVP_BUFFER_INIT(existing);
+	struct stat statbuf;
+	struct timespec times[2];
+	int ret, fd = -1;
+	char pathname[FILENAME_MAX], tmpname[FILENAME_MAX];
+
+	/* A record name must not move in the file hierarchy */
+	if (strchr(name, '/') || !strcmp(name, ".") || !strcmp(name, "..")) {
+		logger(LOGGER_WARN, LOGGER_C_DS_LOG,
+		       "Skipping record with invalid name %s\n", name);
+		return 0;
+	}
+
+	if (vsid == ACVP_DS_LOG_TESTID) {
+		snprintf(pathname, sizeof(pathname), "%s", export->dir);
+	} else {
+		snprintf(pathname, sizeof(pathname), "%s/%u", export->dir,
+			 vsid);
+		CKINT(acvp_datastore_file_dir(pathname, true));
+	}
+	CKINT(acvp_extend_string(pathname, sizeof(pathname), "/%s", name));
+
+	/* Keep files which were changed after the record was written */
+	if (!stat(pathname, &statbuf)) {
+#ifdef __APPLE__
+		if ((int64_t)statbuf.st_mtimespec.tv_sec > mtime) {
+#else
+		if ((int64_t)statbuf.st_mtim.tv_sec > mtime) {
+#endif
+			logger(LOGGER_WARN, LOGGER_C_DS_LOG,
+			       "Keeping file %s which is newer than the record\n",
+			       pathname);
+			return 0;
+		}
+
+		if (!acvp_datastore_log_read_file(pathname, &existing)) {
+			bool unchanged = (existing.len == len &&
+					  (!len ||
+					   !memcmp(existing.buf, data, len)));
+
+			acvp_free_buf(&existing);
+			if (unchanged)
+				return 0;
+		}
+	}
+
+	ret = snprintf(tmpname, sizeof(tmpname), "%s%s", pathname,
+		       ACVP_DS_LOG_TMP_SUFFIX);
+	if (ret < 0 || (size_t)ret >= sizeof(tmpname))
+		return -ENAMETOOLONG;
+	ret = 0;
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		  export->secure_location ? (S_IRUSR | S_IWUSR) : 0666);
+	if (fd < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	while (len) {
+		ssize_t written = write(fd, data, len);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			goto out;
+		}
+		data += written;
+		len -= (uint32_t)written;
+	}
+
+	/* Retain the time of the write, e.g. for the age of the JWT */
+	times[0].tv_sec = (time_t)mtime;
+	times[0].tv_nsec = 0;
+	times[1] = times[0];
+	futimens(fd, times);
+
+	if (close(fd)) {
+		fd = -1;
+		ret = -errno;
+		goto out;
+	}
+	fd = -1;
+
+	if (rename(tmpname, pathname)) {
+		ret = -errno;
+		goto out;
+	}
+
+	export->exported++;
+
+	logger(LOGGER_DEBUG, LOGGER_C_DS_LOG, "Exported file %s\n", pathname);
+
+out:
+	if (fd >= 0) {
+		close(fd);
+		unlink(tmpname);
+	}
+	return ret;
+}
+
+static int acvp_datastore_log_export_testid(const char *parent,
+					    const uint32_t testid,
+					    const bool secure_location)
+{
+	struct acvp_datastore_log_export_ctx export;
+	struct acvp_ds_log *log = NULL;
+	int ret;
+	char dir[FILENAME_MAX], logpath[FILENAME_MAX];
+
+	ret = snprintf(logpath, sizeof(logpath), "%s/%u%s", parent, testid,
+		       ACVP_DS_LOG_SUFFIX);
+	if (ret < 0 || (size_t)ret >= sizeof(logpath))
+		return -ENAMETOOLONG;
+	snprintf(dir, sizeof(dir), "%s/%u", parent, testid);
+
+	CKINT(acvp_datastore_file_dir(dir, true));
+	if (secure_location)
+		chmod(dir, S_IRWXU);
+
+	memset(&export, 0, sizeof(export));
+	export.dir = dir;
+	export.secure_location = secure_location;
+
+	CKINT(acvp_ds_log_get(logpath, false, 0, &log));
+	CKINT(acvp_ds_log_iterate(log, acvp_datastore_log_export_rec,
+				  &export));
+
+	logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+	       "Exported %u records of %s into test session directory %s\n",
+	       export.exported, logpath, dir);
+
+out:
+	acvp_ds_log_put(log);
+	return ret;
+}
+
+static int acvp_datastore_log_walk(const char *dir, const unsigned int depth,
+				   const bool secure_location,
+				   const bool import)
+{
+	struct dirent *dirent;
+	struct stat statbuf;
+	DIR *d;
+	int ret = 0;
+	char pathname[FILENAME_MAX];
+
+	d = opendir(dir);
+	CKNULL(d, -errno);
+
+	while ((dirent = readdir(d)) != NULL) {
+		uint32_t testid;
+
+		if (dirent->d_name[0] == '.')
+			continue;
+
+		ret = snprintf(pathname, sizeof(pathname), "%s/%s", dir,
+			       dirent->d_name);
+		if (ret < 0 || (size_t)ret >= sizeof(pathname)) {
+			ret = -ENAMETOOLONG;
+			goto out;
+		}
+		ret = 0;
+
+		if (stat(pathname, &statbuf))
+			continue;
+
+		if (depth < ACVP_DS_LOG_TESTID_DEPTH) {
+			if (S_ISDIR(statbuf.st_mode)) {
+				CKINT(acvp_datastore_log_walk(pathname,
+							      depth + 1,
+							      secure_location,
+							      import));
+			}
+			continue;
+		}
+
+		if (import) {
+			if (S_ISDIR(statbuf.st_mode) &&
+			    acvp_datastore_log_number(dirent->d_name, "",
+						      &testid)) {
+				CKINT(acvp_datastore_log_import_testid(
+					dir, testid, secure_location));
+			}
+		} else {
+			if (S_ISREG(statbuf.st_mode) &&
+			    acvp_datastore_log_number(dirent->d_name,
+						      ACVP_DS_LOG_SUFFIX,
+						      &testid)) {
+				CKINT(acvp_datastore_log_export_testid(
+					dir, testid, secure_location));
+			}
+		}
+	}
+
+out:
+	if (d)
+		closedir(d);
+	return ret;
+}
+
+static int acvp_datastore_log_convert(const struct acvp_ctx *ctx,
+				      const bool import)
+{
+	const struct acvp_datastore_ctx *datastore;
+	int ret;
+
+	CKNULL_LOG(ctx, -EINVAL, "ACVP volatile request context missing\n");
+
+	datastore = &ctx->datastore;
+	CKNULL_LOG(datastore->basedir, -EINVAL, "Data store missing\n");
+	CKNULL_LOG(datastore->secure_basedir, -EINVAL,
+		   "Secure data store missing\n");
+
+	ret = acvp_datastore_log_walk(datastore->basedir, 1, false, import);
+	if (ret && ret != -ENOENT)
+		goto out;
+
+	ret = acvp_datastore_log_walk(datastore->secure_basedir, 1, true,
+				      import);
+	if (ret == -ENOENT)
+		ret = 0;
+
+out:
+	return ret;
+}
+
+DSO_PUBLIC
+int acvp_datastore_log_import(const struct acvp_ctx *ctx)
+{
+	return acvp_datastore_log_convert(ctx, true);
+}
+
+DSO_PUBLIC
+int acvp_datastore_log_export(const struct acvp_ctx *ctx)
+{
+	return acvp_datastore_log_convert(ctx, false);
+}
@@ -0,0 +1,1204 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "datastore_log_file.h"
+#include "logger.h"
+#include "mutex_w.h"
+#include "ret_checkers.h"
+
+/*
+ * On-disk format - all integers are stored in little endian byte order as the
+ * log is the primary copy of the data and must be usable on any system.
+ *
+ * File header:
+ *	magic[8]	ACVP_DS_LOG_MAGIC
+ *	le32		ACVP_DS_LOG_VERSION
+ *	le32		reserved
+ *
+ * Record header followed by the name (not NULL-terminated) and the data:
+ *	le32		ACVP_DS_LOG_REC_MAGIC
+ *	le32		CRC32 of the record header with this field set to zero
+ *			and the name
+ *	le32		CRC32 of the data
+ *	le32		vsID
+ *	le32		length of the name
+ *	le32		flags (reserved)
+ *	le64		length of the data
+ *	le64		time of the write (seconds since the epoch)
+ */
+#define ACVP_DS_LOG_MAGIC "ACVPLOG"
+#define ACVP_DS_LOG_VERSION 1
+#define ACVP_DS_LOG_HDRSIZE 16
+
+#define ACVP_DS_LOG_REC_MAGIC 0x52505641 /* "AVPR" */
+#define ACVP_DS_LOG_REC_HDRSIZE 40
+
+/* Number of unused logs kept open */
+#define ACVP_DS_LOG_CACHED 16
+
+struct acvp_ds_log_rec {
+	uint32_t magic;
+	uint32_t hdr_crc;
+	uint32_t data_crc;
+	uint32_t vsid;
+	uint32_t namelen;
+	uint32_t flags;
+	uint64_t datalen;
+	int64_t mtime;
+};
+
+/*
+ * Index entry referring to the latest record of an artifact
+ *
+ * @offset: Offset of the data of the record in the log file
+ */
+struct acvp_ds_log_idx {
+	uint32_t vsid;
+	uint32_t len;
+	uint32_t data_crc;
+	uint32_t namelen;
+	uint64_t offset;
+	int64_t mtime;
+	char *name;
+};
+
+/*
+ * @end: End of the last complete or reserved record, all data beyond is
+ *	 incomplete
+ * @stale: Number of bytes of the superseded records
+ * @tail: Size of the file when the incomplete data was reported
+ * @idx: Index of the latest records sorted by vsID and name
+ * @lock: Lock protecting the index, the offsets and the fd - the data is
+ *	  read and written without holding it
+ * @cond: Signalled when an append or a read of the data completes
+ * @committed: End of the records whose appends completed in order
+ * @writers: Number of appends in flight, the file lock is held while
+ *	     appends are in flight
+ * @io: Number of reads of the data in flight, the fd is not replaced while
+ *	I/O is in flight
+ * @failed: An append in flight failed, all appends after it fail as well
+ */
+struct acvp_ds_log {
+	struct acvp_ds_log *next;
+	char *pathname;
+	int fd;
+	dev_t dev;
+	ino_t ino;
+	uint64_t end;
+	uint64_t stale;
+	uint64_t tail;
+	struct acvp_ds_log_idx *idx;
+	uint32_t nr_idx;
+	uint32_t alloced;
+	unsigned int refcnt;
+	mutex_w_t lock;
+	pthread_cond_t cond;
+	uint64_t committed;
+	unsigned int writers;
+	unsigned int io;
+	bool failed;
+};
+
+/* List of the open logs protected by the mutex */
+static struct acvp_ds_log *acvp_ds_logs = NULL;
+static DEFINE_MUTEX_W_UNLOCKED(acvp_ds_log_mutex);
+
+static void acvp_ds_log_put_le32(uint8_t *p, uint32_t val)
+{
+	p[0] = (uint8_t)val;
+	p[1] = (uint8_t)(val >> 8);
+	p[2] = (uint8_t)(val >> 16);
+	p[3] = (uint8_t)(val >> 24);
+}
+
+static void acvp_ds_log_put_le64(uint8_t *p, uint64_t val)
+{
+	acvp_ds_log_put_le32(p, (uint32_t)val);
+	acvp_ds_log_put_le32(p + 4, (uint32_t)(val >> 32));
+}
+
+static uint32_t acvp_ds_log_get_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+	       ((uint32_t)p[3] << 24);
+}
+
+static uint64_t acvp_ds_log_get_le64(const uint8_t *p)
+{
+	return (uint64_t)acvp_ds_log_get_le32(p) |
+	       ((uint64_t)acvp_ds_log_get_le32(p + 4) << 32);
+}
+
+static uint32_t acvp_ds_log_crc(uint32_t crc, const uint8_t *data, uint64_t len)
+{
+	/* crc32 processes at most UINT_MAX bytes at once */
+	while (len) {
+		uInt todo = len > UINT32_MAX ? UINT32_MAX : (uInt)len;
+
+		crc = (uint32_t)crc32(crc, data, todo);
+		data += todo;
+		len -= todo;
+	}
+
+	return crc;
+}
+
+/* Serialize the record header and calculate the header CRC */
+static void acvp_ds_log_rec_encode(struct acvp_ds_log_rec *rec,
+				   const char *name, uint8_t *hdr)
+{
+	acvp_ds_log_put_le32(hdr, ACVP_DS_LOG_REC_MAGIC);
+	acvp_ds_log_put_le32(hdr + 4, 0);
+	acvp_ds_log_put_le32(hdr + 8, rec->data_crc);
+	acvp_ds_log_put_le32(hdr + 12, rec->vsid);
+	acvp_ds_log_put_le32(hdr + 16, rec->namelen);
+	acvp_ds_log_put_le32(hdr + 20, rec->flags);
+	acvp_ds_log_put_le64(hdr + 24, rec->datalen);
+	acvp_ds_log_put_le64(hdr + 32, (uint64_t)rec->mtime);
+
+	rec->hdr_crc = acvp_ds_log_crc(0, hdr, ACVP_DS_LOG_REC_HDRSIZE);
+	rec->hdr_crc = acvp_ds_log_crc(rec->hdr_crc, (const uint8_t *)name,
+				       rec->namelen);
+	acvp_ds_log_put_le32(hdr + 4, rec->hdr_crc);
+}
+
+static void acvp_ds_log_rec_decode(struct acvp_ds_log_rec *rec,
+				   uint8_t *hdr)
+{
+	rec->magic = acvp_ds_log_get_le32(hdr);
+	rec->hdr_crc = acvp_ds_log_get_le32(hdr + 4);
+	rec->data_crc = acvp_ds_log_get_le32(hdr + 8);
+	rec->vsid = acvp_ds_log_get_le32(hdr + 12);
+	rec->namelen = acvp_ds_log_get_le32(hdr + 16);
+	rec->flags = acvp_ds_log_get_le32(hdr + 20);
+	rec->datalen = acvp_ds_log_get_le64(hdr + 24);
+	rec->mtime = (int64_t)acvp_ds_log_get_le64(hdr + 32);
+
+	/* Prepare the header for the calculation of the header CRC */
+	acvp_ds_log_put_le32(hdr + 4, 0);
+}
+
+static int acvp_ds_log_pread(int fd, void *buf, size_t len, uint64_t offset)
+{
+	uint8_t *p = buf;
+
+	while (len) {
+		ssize_t rc = pread(fd, p, len, (off_t)offset);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		/* The file is shorter than the index claims */
+		if (!rc)
+			return -EIO;
+
+		p += rc;
+		len -= (size_t)rc;
+		offset += (uint64_t)rc;
+	}
+
+	return 0;
+}
+
+static int acvp_ds_log_pwrite(int fd, const void *buf, size_t len,
+			      uint64_t offset)
+{
+	const uint8_t *p = buf;
+
+	while (len) {
+		ssize_t rc = pwrite(fd, p, len, (off_t)offset);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		p += rc;
+		len -= (size_t)rc;
+		offset += (uint64_t)rc;
+	}
+
+	return 0;
+}
+
+/* Write a complete record at the given offset */
+static int acvp_ds_log_write_rec(int fd, uint64_t offset, uint32_t vsid,
+				 const char *name, uint32_t namelen,
+				 const uint8_t *data, uint32_t len,
+				 uint32_t data_crc, int64_t mtime)
+{
+	struct acvp_ds_log_rec rec;
+	uint8_t hdr[ACVP_DS_LOG_REC_HDRSIZE];
+	int ret;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.data_crc = data_crc;
+	rec.vsid = vsid;
+	rec.namelen = namelen;
+	rec.datalen = len;
+	rec.mtime = mtime;
+	acvp_ds_log_rec_encode(&rec, name, hdr);
+
+	CKINT(acvp_ds_log_pwrite(fd, hdr, sizeof(hdr), offset));
+	offset += sizeof(hdr);
+	CKINT(acvp_ds_log_pwrite(fd, name, namelen, offset));
+	offset += namelen;
+	CKINT(acvp_ds_log_pwrite(fd, data, len, offset));
+
+out:
+	return ret;
+}
+
+static uint64_t acvp_ds_log_rec_size(uint32_t namelen, uint32_t len)
+{
+	return ACVP_DS_LOG_REC_HDRSIZE + (uint64_t)namelen + len;
+}
+
+static int acvp_ds_log_write_hdr(int fd)
+{
+	uint8_t hdr[ACVP_DS_LOG_HDRSIZE];
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, ACVP_DS_LOG_MAGIC, sizeof(ACVP_DS_LOG_MAGIC));
+	acvp_ds_log_put_le32(hdr + 8, ACVP_DS_LOG_VERSION);
+
+	return acvp_ds_log_pwrite(fd, hdr, sizeof(hdr), 0);
+}
+
+/************************************************************************
+ * Index handling
+ ************************************************************************/
+
+static int acvp_ds_log_idx_cmp(uint32_t vsid, const char *name,
+			       const struct acvp_ds_log_idx *idx)
+{
+	if (vsid != idx->vsid)
+		return (vsid < idx->vsid) ? -1 : 1;
+	return strcmp(name, idx->name);
+}
+
+/* Return the position of the entry or the position to insert it */
+static uint32_t acvp_ds_log_idx_search(const struct acvp_ds_log *log,
+				       uint32_t vsid, const char *name,
+				       bool *found)
+{
+	uint32_t low = 0, high = log->nr_idx;
+
+	*found = false;
+
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		int cmp = acvp_ds_log_idx_cmp(vsid, name, &log->idx[mid]);
+
+		if (!cmp) {
+			*found = true;
+			return mid;
+		}
+		if (cmp < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	return low;
+}
+
+static struct acvp_ds_log_idx *acvp_ds_log_idx_find(struct acvp_ds_log *log,
+						    uint32_t vsid,
+						    const char *name)
+{
+	bool found;
+	uint32_t pos = acvp_ds_log_idx_search(log, vsid, name, &found);
+
+	return found ? &log->idx[pos] : NULL;
+}
+
+static int acvp_ds_log_idx_add(struct acvp_ds_log *log, uint32_t vsid,
+			       const char *name, uint32_t namelen,
+			       uint64_t offset, uint32_t len, uint32_t data_crc,
+			       int64_t mtime)
+{
+	struct acvp_ds_log_idx *idx;
+	bool found;
+	uint32_t pos = acvp_ds_log_idx_search(log, vsid, name, &found);
+
+	if (found) {
+		idx = &log->idx[pos];
+
+		/* A later record of the artifact is already indexed */
+		if (idx->offset > offset) {
+			log->stale += acvp_ds_log_rec_size(namelen, len);
+			return 0;
+		}
+
+		log->stale += acvp_ds_log_rec_size(idx->namelen, idx->len);
+	} else {
+		char *dup;
+
+		if (log->nr_idx == log->alloced) {
+			uint32_t alloced = log->alloced ? log->alloced * 2 : 64;
+
+			idx = realloc(log->idx, alloced * sizeof(*idx));
+			if (!idx)
+				return -ENOMEM;
+			log->idx = idx;
+			log->alloced = alloced;
+		}
+
+		dup = strdup(name);
+		if (!dup)
+			return -ENOMEM;
+
+		idx = &log->idx[pos];
+		memmove(idx + 1, idx, (log->nr_idx - pos) * sizeof(*idx));
+		log->nr_idx++;
+
+		idx->vsid = vsid;
+		idx->name = dup;
+		idx->namelen = namelen;
+	}
+
+	idx->len = len;
+	idx->data_crc = data_crc;
+	idx->offset = offset;
+	idx->mtime = mtime;
+
+	return 0;
+}
+
+static void acvp_ds_log_idx_reset(struct acvp_ds_log *log)
+{
+	uint32_t i;
+
+	for (i = 0; i < log->nr_idx; i++)
+		free(log->idx[i].name);
+	log->nr_idx = 0;
+	log->end = 0;
+	log->stale = 0;
+	log->tail = 0;
+}
+
+/************************************************************************
+ * Log file handling
+ ************************************************************************/
+
+/* Wait until no I/O is in flight - caller holds the log lock */
+static void acvp_ds_log_quiesce(struct acvp_ds_log *log)
+{
+	while (log->io || log->writers)
+		pthread_cond_wait(&log->cond, &log->lock);
+}
+
+/* Account for a completed read of the data */
+static void acvp_ds_log_io_done(struct acvp_ds_log *log)
+{
+	mutex_w_lock(&log->lock);
+	if (!--log->io)
+		pthread_cond_broadcast(&log->cond);
+	mutex_w_unlock(&log->lock);
+}
+
+/*
+ * (Re)open the log file and drop the index - caller holds the log lock and
+ * no I/O is in flight.
+ */
+static int acvp_ds_log_open(struct acvp_ds_log *log, bool create, mode_t mode)
+{
+	struct stat statbuf;
+	int fd;
+
+	fd = open(log->pathname, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0),
+		  mode);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &statbuf)) {
+		int errsv = errno;
+
+		close(fd);
+		return -errsv;
+	}
+
+	if (log->fd >= 0)
+		close(log->fd);
+	log->fd = fd;
+	log->dev = statbuf.st_dev;
+	log->ino = statbuf.st_ino;
+	acvp_ds_log_idx_reset(log);
+
+	return 0;
+}
+
+/*
+ * Lock the log file against other processes. If the log file was replaced by
+ * a compaction in the meantime, the new file is opened and locked instead.
+ */
+static int acvp_ds_log_lock(struct acvp_ds_log *log, int operation)
+{
+	struct stat statbuf;
+	int ret;
+
+	for (;;) {
+		if (flock(log->fd, operation))
+			return -errno;
+
+		if (stat(log->pathname, &statbuf)) {
+			ret = -errno;
+			flock(log->fd, LOCK_UN);
+			return ret;
+		}
+
+		if (statbuf.st_dev == log->dev && statbuf.st_ino == log->ino)
+			return 0;
+
+		flock(log->fd, LOCK_UN);
+
+		logger(LOGGER_DEBUG, LOGGER_C_DS_LOG,
+		       "Log %s was replaced, reopening it\n", log->pathname);
+		acvp_ds_log_quiesce(log);
+		CKINT(acvp_ds_log_open(log, false, 0));
+	}
+
+out:
+	return ret;
+}
+
+static void acvp_ds_log_unlock(struct acvp_ds_log *log)
+{
+	flock(log->fd, LOCK_UN);
+}
+
+/*
+ * Add the records appended since the last scan to the index. The caller must
+ * hold the file lock. The scan stops at the first incomplete or corrupted
+ * record.
+ */
+static int acvp_ds_log_scan(struct acvp_ds_log *log)
+{
+	struct stat statbuf;
+	uint64_t size, offset;
+	uint8_t hdr[ACVP_DS_LOG_REC_HDRSIZE];
+	char name[ACVP_DS_LOG_NAMELEN + 1];
+	int ret = 0;
+
+	if (fstat(log->fd, &statbuf))
+		return -errno;
+	size = (uint64_t)statbuf.st_size;
+
+	/* The log is never shortened below its complete records */
+	if (size < log->end) {
+		logger(LOGGER_WARN, LOGGER_C_DS_LOG,
+		       "Log %s was truncated, rebuilding index\n",
+		       log->pathname);
+		acvp_ds_log_idx_reset(log);
+	}
+
+	if (!log->end) {
+		/* Log created, but nothing written yet */
+		if (size < ACVP_DS_LOG_HDRSIZE)
+			return 0;
+
+		CKINT(acvp_ds_log_pread(log->fd, hdr, ACVP_DS_LOG_HDRSIZE, 0));
+		if (memcmp(hdr, ACVP_DS_LOG_MAGIC, sizeof(ACVP_DS_LOG_MAGIC)) ||
+		    acvp_ds_log_get_le32(hdr + 8) != ACVP_DS_LOG_VERSION) {
+			logger(LOGGER_ERR, LOGGER_C_DS_LOG,
+			       "File %s is no data store log of version %u\n",
+			       log->pathname, ACVP_DS_LOG_VERSION);
+			return -EINVAL;
+		}
+		log->end = ACVP_DS_LOG_HDRSIZE;
+	}
+
+	offset = log->end;
+	while (size - offset >= ACVP_DS_LOG_REC_HDRSIZE) {
+		struct acvp_ds_log_rec rec;
+		uint32_t crc;
+
+		CKINT(acvp_ds_log_pread(log->fd, hdr, sizeof(hdr), offset));
+		acvp_ds_log_rec_decode(&rec, hdr);
+
+		if (rec.magic != ACVP_DS_LOG_REC_MAGIC || !rec.namelen ||
+		    rec.namelen > ACVP_DS_LOG_NAMELEN ||
+		    rec.datalen >= UINT32_MAX)
+			break;
+		if (size - offset - ACVP_DS_LOG_REC_HDRSIZE <
+		    rec.namelen + rec.datalen)
+			break;
+
+		CKINT(acvp_ds_log_pread(log->fd, name, rec.namelen,
+					offset + ACVP_DS_LOG_REC_HDRSIZE));
+		name[rec.namelen] = '\0';
+
+		crc = acvp_ds_log_crc(0, hdr, sizeof(hdr));
+		crc = acvp_ds_log_crc(crc, (uint8_t *)name, rec.namelen);
+		if (crc != rec.hdr_crc || strlen(name) != rec.namelen)
+			break;
+
+		CKINT(acvp_ds_log_idx_add(
+			log, rec.vsid, name, rec.namelen,
+			offset + ACVP_DS_LOG_REC_HDRSIZE + rec.namelen,
+			(uint32_t)rec.datalen, rec.data_crc, rec.mtime));
+
+		offset += acvp_ds_log_rec_size(rec.namelen,
+					       (uint32_t)rec.datalen);
+	}
+
+	log->end = offset;
+
+	if (offset < size && log->tail != size) {
+		logger(LOGGER_WARN, LOGGER_C_DS_LOG,
+		       "Ignoring %" PRIu64
+		       " bytes of incomplete record at end of log %s\n",
+		       size - offset, log->pathname);
+		log->tail = size;
+	}
+
+out:
+	return ret;
+}
+
+/* Update the index - caller holds the log lock */
+static int acvp_ds_log_refresh(struct acvp_ds_log *log)
+{
+	int ret;
+
+	/*
+	 * While appends are in flight, this process holds the file lock and
+	 * the index covers all complete records.
+	 */
+	if (log->writers)
+		return 0;
+
+	CKINT(acvp_ds_log_lock(log, LOCK_SH));
+	ret = acvp_ds_log_scan(log);
+	acvp_ds_log_unlock(log);
+
+out:
+	return ret;
+}
+
+static void acvp_ds_log_free(struct acvp_ds_log *log)
+{
+	acvp_ds_log_idx_reset(log);
+	if (log->idx)
+		free(log->idx);
+	if (log->fd >= 0)
+		close(log->fd);
+	if (log->pathname)
+		free(log->pathname);
+	mutex_w_destroy(&log->lock);
+	pthread_cond_destroy(&log->cond);
+	free(log);
+}
+
+int acvp_ds_log_get(const char *pathname, bool create, mode_t mode,
+		    struct acvp_ds_log **log)
+{
+	struct acvp_ds_log *l, *prev = NULL;
+	struct stat statbuf;
+	int ret = 0;
+
+	mutex_w_lock(&acvp_ds_log_mutex);
+
+	for (l = acvp_ds_logs; l; prev = l, l = l->next) {
+		if (!strcmp(l->pathname, pathname))
+			break;
+	}
+
+	if (l) {
+		/* Keep the most recently used logs at the front */
+		if (prev) {
+			prev->next = l->next;
+			l->next = acvp_ds_logs;
+			acvp_ds_logs = l;
+		}
+
+		/* The log file may have been removed or replaced */
+		if (stat(pathname, &statbuf) || statbuf.st_dev != l->dev ||
+		    statbuf.st_ino != l->ino) {
+			mutex_w_lock(&l->lock);
+			acvp_ds_log_quiesce(l);
+			ret = acvp_ds_log_open(l, create, mode);
+			mutex_w_unlock(&l->lock);
+			if (ret)
+				goto out;
+		}
+	} else {
+		l = calloc(1, sizeof(*l));
+		CKNULL(l, -ENOMEM);
+		l->fd = -1;
+		l->pathname = strdup(pathname);
+		if (!l->pathname) {
+			free(l);
+			ret = -ENOMEM;
+			goto out;
+		}
+		mutex_w_init(&l->lock, 0);
+		pthread_cond_init(&l->cond, NULL);
+
+		ret = acvp_ds_log_open(l, create, mode);
+		if (ret) {
+			acvp_ds_log_free(l);
+			goto out;
+		}
+
+		l->next = acvp_ds_logs;
+		acvp_ds_logs = l;
+	}
+
+	l->refcnt++;
+	*log = l;
+
+out:
+	mutex_w_unlock(&acvp_ds_log_mutex);
+	return ret;
+}
+
+void acvp_ds_log_put(struct acvp_ds_log *log)
+{
+	struct acvp_ds_log *l, *prev = NULL, *next;
+	unsigned int unused = 0;
+
+	if (!log)
+		return;
+
+	mutex_w_lock(&acvp_ds_log_mutex);
+
+	if (log->refcnt)
+		log->refcnt--;
+
+	/* Close the least recently used logs exceeding the cache */
+	for (l = acvp_ds_logs; l; l = next) {
+		next = l->next;
+
+		if (!l->refcnt && ++unused > ACVP_DS_LOG_CACHED) {
+			if (prev)
+				prev->next = next;
+			else
+				acvp_ds_logs = next;
+			acvp_ds_log_free(l);
+			continue;
+		}
+
+		prev = l;
+	}
+
+	mutex_w_unlock(&acvp_ds_log_mutex);
+}
+
+/*
+ * Bring the index up to date and drop an incomplete record left behind by an
+ * interrupted write - caller holds the log lock and the file lock.
+ */
+static int acvp_ds_log_prepare(struct acvp_ds_log *log)
+{
+	struct stat statbuf;
+	int ret;
+
+	CKINT(acvp_ds_log_scan(log));
+
+	if (!log->end) {
+		if (ftruncate(log->fd, 0)) {
+			ret = -errno;
+			goto out;
+		}
+		CKINT(acvp_ds_log_write_hdr(log->fd));
+		log->end = ACVP_DS_LOG_HDRSIZE;
+	}
+
+	if (fstat(log->fd, &statbuf)) {
+		ret = -errno;
+		goto out;
+	}
+	if ((uint64_t)statbuf.st_size > log->end) {
+		logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+		       "Truncating incomplete record of log %s\n",
+		       log->pathname);
+		if (ftruncate(log->fd, (off_t)log->end)) {
+			ret = -errno;
+			goto out;
+		}
+		log->tail = 0;
+	}
+
+out:
+	return ret;
+}
+
+int acvp_ds_log_append(struct acvp_ds_log *log, uint32_t vsid,
+		       const char *name, const uint8_t *data, uint32_t len,
+		       int64_t mtime)
+{
+	uint64_t offset, size;
+	size_t namelen;
+	uint32_t data_crc;
+	int ret;
+
+	if (!log || !name)
+		return -EINVAL;
+	if (len && !data)
+		return -EINVAL;
+	if (len == UINT32_MAX)
+		return -EFBIG;
+
+	namelen = strlen(name);
+	if (!namelen || namelen > ACVP_DS_LOG_NAMELEN)
+		return -EINVAL;
+
+	if (!mtime)
+		mtime = (int64_t)time(NULL);
+
+	/* Calculate the CRC without holding the lock */
+	data_crc = acvp_ds_log_crc(0, data, len);
+	size = acvp_ds_log_rec_size((uint32_t)namelen, len);
+
+	mutex_w_lock(&log->lock);
+
+	/* The first append in flight takes the file lock for all others */
+	if (!log->writers) {
+		CKINT(acvp_ds_log_lock(log, LOCK_EX));
+		ret = acvp_ds_log_prepare(log);
+		if (ret) {
+			acvp_ds_log_unlock(log);
+			goto out;
+		}
+		log->committed = log->end;
+	}
+
+	/* Reserve the space of the record */
+	log->writers++;
+	offset = log->end;
+	log->end += size;
+
+	mutex_w_unlock(&log->lock);
+
+	ret = acvp_ds_log_write_rec(log->fd, offset, vsid, name,
+				    (uint32_t)namelen, data, len, data_crc,
+				    mtime);
+
+	mutex_w_lock(&log->lock);
+
+	/* Records become visible in the order of the log */
+	while (!log->failed && log->committed != offset)
+		pthread_cond_wait(&log->cond, &log->lock);
+
+	if (log->failed) {
+		if (!ret)
+			ret = -EIO;
+	} else if (!ret) {
+		ret = acvp_ds_log_idx_add(log, vsid, name, (uint32_t)namelen,
+					  offset + ACVP_DS_LOG_REC_HDRSIZE +
+						  namelen,
+					  len, data_crc, mtime);
+	}
+	if (ret)
+		log->failed = true;
+	else
+		log->committed = offset + size;
+
+	if (!--log->writers) {
+		/* Drop the records following a failed append */
+		if (log->failed) {
+			logger(LOGGER_WARN, LOGGER_C_DS_LOG,
+			       "Truncating incomplete records of log %s\n",
+			       log->pathname);
+			if (ftruncate(log->fd, (off_t)log->committed)) {
+				logger(LOGGER_WARN, LOGGER_C_DS_LOG,
+				       "Truncating log %s failed (%d)\n",
+				       log->pathname, -errno);
+			}
+			log->end = log->committed;
+			log->tail = 0;
+			log->failed = false;
+		}
+		acvp_ds_log_unlock(log);
+	}
+	pthread_cond_broadcast(&log->cond);
+
+	if (!ret) {
+		logger(LOGGER_DEBUG2, LOGGER_C_DS_LOG,
+		       "Appended record %s of vsID %u with %u bytes to log %s\n",
+		       name, vsid, len, log->pathname);
+	}
+
+out:
+	mutex_w_unlock(&log->lock);
+	return ret;
+}
+
+/*
+ * Read the data of an index entry - the caller holds the log lock or accounts
+ * for the read as I/O in flight.
+ */
+static int acvp_ds_log_read_idx(struct acvp_ds_log *log,
+				const struct acvp_ds_log_idx *idx,
+				uint8_t **data)
+{
+	uint8_t *buf;
+	int ret;
+
+	buf = malloc((size_t)idx->len + 1);
+	CKNULL(buf, -ENOMEM);
+
+	CKINT(acvp_ds_log_pread(log->fd, buf, idx->len, idx->offset));
+
+	if (acvp_ds_log_crc(0, buf, idx->len) != idx->data_crc) {
+		logger(LOGGER_ERR, LOGGER_C_DS_LOG,
+		       "Checksum mismatch of record %s of vsID %u in log %s\n",
+		       idx->name, idx->vsid, log->pathname);
+		ret = -EIO;
+		goto out;
+	}
+
+	buf[idx->len] = '\0';
+	*data = buf;
+	buf = NULL;
+
+out:
+	if (buf)
+		free(buf);
+	return ret;
+}
+
+int acvp_ds_log_read(struct acvp_ds_log *log, uint32_t vsid, const char *name,
+		     uint8_t **data, uint32_t *len, int64_t *mtime)
+{
+	struct acvp_ds_log_idx *idx, entry;
+	int ret;
+
+	if (!log || !name || !data || !len)
+		return -EINVAL;
+
+	mutex_w_lock(&log->lock);
+
+	ret = acvp_ds_log_refresh(log);
+	if (ret) {
+		mutex_w_unlock(&log->lock);
+		return ret;
+	}
+
+	idx = acvp_ds_log_idx_find(log, vsid, name);
+	if (!idx) {
+		mutex_w_unlock(&log->lock);
+		return -ENOENT;
+	}
+
+	/* The index may change while the data is read */
+	entry = *idx;
+	entry.name = (char *)name;
+	log->io++;
+
+	mutex_w_unlock(&log->lock);
+
+	ret = acvp_ds_log_read_idx(log, &entry, data);
+	acvp_ds_log_io_done(log);
+	if (ret)
+		return ret;
+
+	*len = entry.len;
+	if (mtime)
+		*mtime = entry.mtime;
+
+	return 0;
+}
+
+int acvp_ds_log_dup_fd(struct acvp_ds_log *log)
+{
+	int fd;
+
+	if (!log)
+		return -EINVAL;
+
+	mutex_w_lock(&log->lock);
+	fd = fcntl(log->fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+		fd = -errno;
+	mutex_w_unlock(&log->lock);
+
+	return fd;
+}
+
+int acvp_ds_log_stat(struct acvp_ds_log *log, uint32_t vsid, const char *name,
+		     uint32_t *len)
+{
+	struct acvp_ds_log_idx *idx;
+	int ret;
+
+	if (!log || !name)
+		return -EINVAL;
+
+	mutex_w_lock(&log->lock);
+
+	CKINT(acvp_ds_log_refresh(log));
+
+	idx = acvp_ds_log_idx_find(log, vsid, name);
+	CKNULL(idx, -ENOENT);
+	if (len)
+		*len = idx->len;
+
+out:
+	mutex_w_unlock(&log->lock);
+	return ret;
+}
+
+int acvp_ds_log_has_vsid(struct acvp_ds_log *log, uint32_t vsid)
+{
+	bool found;
+	uint32_t pos;
+	int ret;
+
+	if (!log)
+		return -EINVAL;
+
+	mutex_w_lock(&log->lock);
+
+	CKINT(acvp_ds_log_refresh(log));
+
+	/* The empty name sorts before all names of the vsID */
+	pos = acvp_ds_log_idx_search(log, vsid, "", &found);
+	if (pos >= log->nr_idx || log->idx[pos].vsid != vsid)
+		ret = -ENOENT;
+
+out:
+	mutex_w_unlock(&log->lock);
+	return ret;
+}
+
+int acvp_ds_log_vsids(struct acvp_ds_log *log, uint32_t **vsids,
+		      uint32_t *nr_vsids)
+{
+	uint32_t i, nr = 0, *l_vsids = NULL;
+	int ret;
+
+	if (!log || !vsids || !nr_vsids)
+		return -EINVAL;
+
+	mutex_w_lock(&log->lock);
+
+	CKINT(acvp_ds_log_refresh(log));
+
+	if (log->nr_idx) {
+		l_vsids = calloc(log->nr_idx, sizeof(*l_vsids));
+		CKNULL(l_vsids, -ENOMEM);
+	}
+
+	for (i = 0; i < log->nr_idx; i++) {
+		uint32_t vsid = log->idx[i].vsid;
+
+		if (vsid == ACVP_DS_LOG_TESTID)
+			break;
+		if (nr && l_vsids[nr - 1] == vsid)
+			continue;
+		l_vsids[nr++] = vsid;
+	}
+
+	*vsids = l_vsids;
+	*nr_vsids = nr;
+
+out:
+	mutex_w_unlock(&log->lock);
+	return ret;
+}
+
+int acvp_ds_log_iterate(struct acvp_ds_log *log, acvp_ds_log_iterate_t cb,
+			void *ctx)
+{
+	uint32_t i;
+	int ret;
+
+	if (!log || !cb)
+		return -EINVAL;
+
+	mutex_w_lock(&log->lock);
+
+	CKINT(acvp_ds_log_refresh(log));
+
+	for (i = 0; i < log->nr_idx; i++) {
+		const struct acvp_ds_log_idx *idx = &log->idx[i];
+		uint8_t *data = NULL;
+
+		CKINT(acvp_ds_log_read_idx(log, idx, &data));
+		ret = cb(ctx, idx->vsid, idx->name, data, idx->len,
+			 idx->mtime);
+		free(data);
+		if (ret)
+			goto out;
+	}
+
+out:
+	mutex_w_unlock(&log->lock);
+	return ret;
+}
+
+int acvp_ds_log_compact(struct acvp_ds_log *log)
+{
+	struct stat statbuf;
+	uint64_t offset, *offsets = NULL;
+	uint32_t i;
+	int ret, fd = -1, locked = 0;
+	char tmpname[FILENAME_MAX];
+
+	if (!log)
+		return -EINVAL;
+
+	mutex_w_lock(&log->lock);
+
+	/* The fd is replaced below */
+	acvp_ds_log_quiesce(log);
+
+	CKINT(acvp_ds_log_lock(log, LOCK_EX));
+	locked = 1;
+	CKINT(acvp_ds_log_scan(log));
+
+	if (fstat(log->fd, &statbuf)) {
+		ret = -errno;
+		goto out;
+	}
+	if (!log->stale && (uint64_t)statbuf.st_size == log->end)
+		goto out;
+
+	ret = snprintf(tmpname, sizeof(tmpname), "%s.tmp", log->pathname);
+	if (ret < 0 || (size_t)ret >= sizeof(tmpname)) {
+		ret = -ENAMETOOLONG;
+		goto out;
+	}
+
+	fd = open(tmpname, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+		  statbuf.st_mode & 0777);
+	if (fd < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	if (log->nr_idx) {
+		offsets = calloc(log->nr_idx, sizeof(*offsets));
+		CKNULL(offsets, -ENOMEM);
+	}
+
+	CKINT(acvp_ds_log_write_hdr(fd));
+	offset = ACVP_DS_LOG_HDRSIZE;
+
+	for (i = 0; i < log->nr_idx; i++) {
+		const struct acvp_ds_log_idx *idx = &log->idx[i];
+		uint8_t *data = NULL;
+
+		CKINT(acvp_ds_log_read_idx(log, idx, &data));
+		ret = acvp_ds_log_write_rec(fd, offset, idx->vsid, idx->name,
+					    idx->namelen, data, idx->len,
+					    idx->data_crc, idx->mtime);
+		free(data);
+		if (ret)
+			goto out;
+
+		offsets[i] = offset + ACVP_DS_LOG_REC_HDRSIZE + idx->namelen;
+		offset += acvp_ds_log_rec_size(idx->namelen, idx->len);
+	}
+
+	if (fsync(fd) || fstat(fd, &statbuf)) {
+		ret = -errno;
+		goto out;
+	}
+
+	/* Other processes notice the new inode when locking the log */
+	if (rename(tmpname, log->pathname)) {
+		ret = -errno;
+		goto out;
+	}
+
+	logger(LOGGER_VERBOSE, LOGGER_C_DS_LOG,
+	       "Log %s compacted from %" PRIu64 " to %" PRIu64 " bytes\n",
+	       log->pathname, log->end, offset);
+
+	for (i = 0; i < log->nr_idx; i++)
+		log->idx[i].offset = offsets[i];
+	log->end = offset;
+	log->stale = 0;
+	log->tail = 0;
+
+	acvp_ds_log_unlock(log);
+	locked = 0;
+	close(log->fd);
+	log->fd = fd;
+	log->dev = statbuf.st_dev;
+	log->ino = statbuf.st_ino;
+	fd = -1;
+
+out:
+	if (fd >= 0) {
+		close(fd);
+		unlink(tmpname);
+	}
+	if (locked)
+		acvp_ds_log_unlock(log);
+	if (offsets)
+		free(offsets);
+	mutex_w_unlock(&log->lock);
+	return ret;
+}
+
+int acvp_ds_log_rename(const char *oldpath, const char *newpath)
+{
+	struct acvp_ds_log *l;
+	int ret = 0;
+
+	if (!oldpath || !newpath)
+		return -EINVAL;
+
+	mutex_w_lock(&acvp_ds_log_mutex);
+
+	if (rename(oldpath, newpath)) {
+		ret = -errno;
+		goto out;
+	}
+
+	/* The open file descriptors still refer to the moved log */
+	for (l = acvp_ds_logs; l; l = l->next) {
+		char *dup;
+
+		if (strcmp(l->pathname, oldpath))
+			continue;
+
+		dup = strdup(newpath);
+		CKNULL(dup, -ENOMEM);
+		mutex_w_lock(&l->lock);
+		free(l->pathname);
+		l->pathname = dup;
+		mutex_w_unlock(&l->lock);
+	}
+
+out:
+	mutex_w_unlock(&acvp_ds_log_mutex);
+	return ret;
+}
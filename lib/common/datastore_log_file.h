@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef _DATASTORE_LOG_FILE_H
+#define _DATASTORE_LOG_FILE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "bool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Append-only log file holding the artifacts of one test session
+ *
+ * Every write appends a record consisting of a header, the name of the
+ * artifact and its data. The header and the data are protected by a CRC32.
+ * A record supersedes all earlier records with the same vsID and name. When
+ * the log is opened, it is scanned once to build an in-memory index of the
+ * latest record of each artifact. Reads are served with one pread from the
+ * offset found in the index.
+ *
+ * A record that was not completely written, e.g. due to a crash, is detected
+ * during the scan and truncated by the next append. Appends of different
+ * processes are serialized with flock. Other processes appending to the log
+ * are detected by the size of the file, a compaction of the log by the
+ * change of its inode.
+ */
+
+/* Suffix of the log file name */
+#define ACVP_DS_LOG_SUFFIX ".acvplog"
+
+/* vsID of the records belonging to the test session */
+#define ACVP_DS_LOG_TESTID UINT32_MAX
+
+/* Maximum length of the name of a record */
+#define ACVP_DS_LOG_NAMELEN 255
+
+struct acvp_ds_log;
+
+/**
+ * @brief Callback invoked for the latest record of each artifact.
+ *
+ * @param ctx [in] Context provided by the caller
+ * @param vsid [in] vsID of the record or ACVP_DS_LOG_TESTID
+ * @param name [in] Name of the artifact
+ * @param data [in] Data of the record
+ * @param len [in] Length of the data
+ * @param mtime [in] Time of the write of the record (seconds since the epoch)
+ *
+ * @return 0 to continue, < 0 to stop the iteration with the given error
+ */
+typedef int (*acvp_ds_log_iterate_t)(void *ctx, uint32_t vsid,
+				     const char *name, const uint8_t *data,
+				     uint32_t len, int64_t mtime);
+
+/**
+ * @brief Obtain a reference to the log at the given path. Open logs are
+ *	  cached, i.e. the index is only built once per process.
+ *
+ * @param pathname [in] Path of the log file
+ * @param create [in] Create the log if it does not exist
+ * @param mode [in] Permissions of a newly created log file
+ * @param log [out] Log to be released with acvp_ds_log_put
+ *
+ * @return 0 on success, -ENOENT if the log does not exist and shall not be
+ *	   created, < 0 on other errors
+ */
+int acvp_ds_log_get(const char *pathname, bool create, mode_t mode,
+		    struct acvp_ds_log **log);
+
+void acvp_ds_log_put(struct acvp_ds_log *log);
+
+/**
+ * @brief Append a record to the log
+ *
+ * @param log [in] Log
+ * @param vsid [in] vsID of the record or ACVP_DS_LOG_TESTID
+ * @param name [in] Name of the artifact
+ * @param data [in] Data to be stored (may be NULL if len is 0)
+ * @param len [in] Length of the data
+ * @param mtime [in] Time of the write (seconds since the epoch), 0 for now
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_log_append(struct acvp_ds_log *log, uint32_t vsid,
+		       const char *name, const uint8_t *data, uint32_t len,
+		       int64_t mtime);
+
+/**
+ * @brief Read the latest record of an artifact. The data is NULL-terminated.
+ *
+ * @param log [in] Log
+ * @param vsid [in] vsID of the record or ACVP_DS_LOG_TESTID
+ * @param name [in] Name of the artifact
+ * @param data [out] Data of the record to be freed by the caller
+ * @param len [out] Length of the data
+ * @param mtime [out] Time of the write of the record (may be NULL)
+ *
+ * @return 0 on success, -ENOENT if no record exists, -EIO if the record is
+ *	   corrupted, < 0 on other errors
+ */
+int acvp_ds_log_read(struct acvp_ds_log *log, uint32_t vsid, const char *name,
+		     uint8_t **data, uint32_t *len, int64_t *mtime);
+
+/**
+ * @brief Check whether a record of an artifact exists
+ *
+ * @param len [out] Length of the data of the record (may be NULL)
+ *
+ * @return 0 if the record exists, -ENOENT if not, < 0 on other errors
+ */
+int acvp_ds_log_stat(struct acvp_ds_log *log, uint32_t vsid, const char *name,
+		     uint32_t *len);
+
+/**
+ * @brief Check whether any record of the given vsID exists
+ *
+ * @return 0 if a record exists, -ENOENT if not, < 0 on other errors
+ */
+int acvp_ds_log_has_vsid(struct acvp_ds_log *log, uint32_t vsid);
+
+/**
+ * @brief Obtain the vsIDs of all records in ascending order. The test session
+ *	  records are not reported.
+ *
+ * @param log [in] Log
+ * @param vsids [out] Array of vsIDs to be freed by the caller
+ * @param nr_vsids [out] Number of vsIDs
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_log_vsids(struct acvp_ds_log *log, uint32_t **vsids,
+		      uint32_t *nr_vsids);
+
+/**
+ * @brief Invoke the callback for the latest record of each artifact sorted by
+ *	  vsID and name. The callback must not access any log.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_log_iterate(struct acvp_ds_log *log, acvp_ds_log_iterate_t cb,
+			void *ctx);
+
+/**
+ * @brief Rewrite the log with only the latest record of each artifact. The
+ *	  log is replaced atomically, other processes pick up the new log with
+ *	  their next access. Nothing is done if the log holds no superseded
+ *	  records.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_log_compact(struct acvp_ds_log *log);
+
+/**
+ * @brief Obtain a duplicate of the file descriptor of the log, e.g. to sync
+ *	  the appended records to disk. The caller must close it.
+ *
+ * @return file descriptor on success, < 0 on error
+ */
+int acvp_ds_log_dup_fd(struct acvp_ds_log *log);
+
+/**
+ * @brief Move a log file to a new path. Cached references to the log refer
+ *	  to the new path afterwards.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_log_rename(const char *oldpath, const char *newpath);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DATASTORE_LOG_FILE_H */
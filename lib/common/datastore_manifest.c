@@ -0,0 +1,616 @@
+/* Manifest of the vsIDs of a test session
+ *
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "datastore_manifest.h"
+#include "logger.h"
+#include "mutex_w.h"
+#include "ret_checkers.h"
+
+#define ACVP_DS_MANIFEST_MAGIC "ACVPMNF"
+#define ACVP_DS_MANIFEST_VERSION 1
+
+/*
+ * On-disk header of the manifest followed by the entries. The data is stored
+ * in host byte order - a manifest of a different architecture is rebuilt.
+ */
+struct acvp_ds_manifest_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+	uint32_t nr_entries;
+	uint32_t reserved;
+	int64_t dir_mtime_sec;
+	int64_t dir_mtime_nsec;
+	int64_t saved;
+};
+
+/* Serialize the manifest updates of the threads of this process */
+static DEFINE_MUTEX_W_UNLOCKED(acvp_ds_manifest_mutex);
+
+static int acvp_ds_manifest_path(char *pathname, const size_t len,
+				 const char *dir, const char *file)
+{
+	int ret = snprintf(pathname, len, "%s/%s", dir, file);
+
+	if (ret < 0 || (size_t)ret >= len)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/*
+ * Serialize the updates with other processes using the same data store.
+ * Returns the file descriptor of the lock file or -1 if locking is not
+ * possible, e.g. in a read-only data store.
+ */
+static int acvp_ds_manifest_lock(const char *manifest_dir)
+{
+	char pathname[FILENAME_MAX];
+	int fd;
+
+	mutex_w_lock(&acvp_ds_manifest_mutex);
+
+	if (acvp_ds_manifest_path(pathname, sizeof(pathname), manifest_dir,
+				  ACVP_DS_MANIFEST_LOCK))
+		return -1;
+
+	fd = open(pathname, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		logger(LOGGER_DEBUG, LOGGER_C_DS_FILE,
+		       "Cannot open manifest lock file %s (%d)\n", pathname,
+		       -errno);
+		return -1;
+	}
+
+	if (flock(fd, LOCK_EX)) {
+		logger(LOGGER_DEBUG, LOGGER_C_DS_FILE,
+		       "Cannot lock manifest lock file %s (%d)\n", pathname,
+		       -errno);
+	}
+
+	return fd;
+}
+
+static void acvp_ds_manifest_unlock(int fd)
+{
+	if (fd >= 0) {
+		flock(fd, LOCK_UN);
+		close(fd);
+	}
+
+	mutex_w_unlock(&acvp_ds_manifest_mutex);
+}
+
+void acvp_ds_manifest_release(struct acvp_ds_manifest *manifest)
+{
+	if (!manifest)
+		return;
+
+	if (manifest->entries)
+		free(manifest->entries);
+	memset(manifest, 0, sizeof(*manifest));
+}
+
+static int acvp_ds_manifest_read_all(int fd, void *buf, size_t len)
+{
+	uint8_t *p = buf;
+
+	while (len) {
+		ssize_t rc = read(fd, p, len);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (!rc)
+			return -EINVAL;
+
+		p += rc;
+		len -= (size_t)rc;
+	}
+
+	return 0;
+}
+
+static int acvp_ds_manifest_write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len) {
+		ssize_t rc = write(fd, p, len);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		p += rc;
+		len -= (size_t)rc;
+	}
+
+	return 0;
+}
+
+/* Read the manifest file - any inconsistency is reported as -EINVAL */
+static int acvp_ds_manifest_read(const char *manifest_dir,
+				 struct acvp_ds_manifest *manifest,
+				 int64_t *saved)
+{
+	struct acvp_ds_manifest_hdr hdr;
+	struct stat statbuf;
+	char pathname[FILENAME_MAX];
+	uint32_t i;
+	int fd = -1, ret;
+
+	CKINT(acvp_ds_manifest_path(pathname, sizeof(pathname), manifest_dir,
+				    ACVP_DS_MANIFEST));
+
+	fd = open(pathname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	if (fstat(fd, &statbuf)) {
+		ret = -errno;
+		goto out;
+	}
+
+	CKINT(acvp_ds_manifest_read_all(fd, &hdr, sizeof(hdr)));
+
+	if (memcmp(hdr.magic, ACVP_DS_MANIFEST_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != ACVP_DS_MANIFEST_VERSION ||
+	    hdr.entry_size != sizeof(struct acvp_ds_manifest_entry) ||
+	    (uint64_t)statbuf.st_size !=
+		    sizeof(hdr) + (uint64_t)hdr.nr_entries * hdr.entry_size) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (hdr.nr_entries) {
+		manifest->entries =
+			calloc(hdr.nr_entries, sizeof(*manifest->entries));
+		CKNULL(manifest->entries, -ENOMEM);
+		manifest->alloced = hdr.nr_entries;
+
+		CKINT(acvp_ds_manifest_read_all(
+			fd, manifest->entries,
+			hdr.nr_entries * sizeof(*manifest->entries)));
+	}
+	manifest->nr_entries = hdr.nr_entries;
+
+	for (i = 0; i < manifest->nr_entries; i++) {
+		struct acvp_ds_manifest_entry *entry = &manifest->entries[i];
+
+		/* The entries must be sorted to allow a binary search */
+		if (i && entry->vsid <= manifest->entries[i - 1].vsid) {
+			ret = -EINVAL;
+			goto out;
+		}
+
+		entry->cipher_name[sizeof(entry->cipher_name) - 1] = '\0';
+		entry->cipher_mode[sizeof(entry->cipher_mode) - 1] = '\0';
+	}
+
+	manifest->dir_mtime_sec = hdr.dir_mtime_sec;
+	manifest->dir_mtime_nsec = hdr.dir_mtime_nsec;
+	*saved = hdr.saved;
+
+out:
+	if (fd >= 0)
+		close(fd);
+	if (ret)
+		acvp_ds_manifest_release(manifest);
+	return ret;
+}
+
+/* Replace the manifest file atomically */
+static int acvp_ds_manifest_write(const char *manifest_dir,
+				  const struct acvp_ds_manifest *manifest)
+{
+	struct acvp_ds_manifest_hdr hdr;
+	char pathname[FILENAME_MAX], tmpname[FILENAME_MAX];
+	int fd = -1, ret;
+
+	CKINT(acvp_ds_manifest_path(pathname, sizeof(pathname), manifest_dir,
+				    ACVP_DS_MANIFEST));
+	CKINT(acvp_ds_manifest_path(tmpname, sizeof(tmpname), manifest_dir,
+				    ACVP_DS_MANIFEST ".tmp"));
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, ACVP_DS_MANIFEST_MAGIC, sizeof(hdr.magic));
+	hdr.version = ACVP_DS_MANIFEST_VERSION;
+	hdr.entry_size = sizeof(struct acvp_ds_manifest_entry);
+	hdr.nr_entries = manifest->nr_entries;
+	hdr.dir_mtime_sec = manifest->dir_mtime_sec;
+	hdr.dir_mtime_nsec = manifest->dir_mtime_nsec;
+	hdr.saved = (int64_t)time(NULL);
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	CKINT(acvp_ds_manifest_write_all(fd, &hdr, sizeof(hdr)));
+	if (manifest->nr_entries) {
+		CKINT(acvp_ds_manifest_write_all(
+			fd, manifest->entries,
+			manifest->nr_entries * sizeof(*manifest->entries)));
+	}
+
+	if (close(fd)) {
+		fd = -1;
+		ret = -errno;
+		goto out;
+	}
+	fd = -1;
+
+	if (rename(tmpname, pathname))
+		ret = -errno;
+
+out:
+	if (fd >= 0)
+		close(fd);
+	if (ret) {
+		logger(LOGGER_WARN, LOGGER_C_DS_FILE,
+		       "Cannot store manifest in %s (%d)\n", manifest_dir, ret);
+		unlink(tmpname);
+	}
+	return ret;
+}
+
+struct acvp_ds_manifest_entry *
+acvp_ds_manifest_find(const struct acvp_ds_manifest *manifest, uint32_t vsid)
+{
+	uint32_t low = 0, high;
+
+	if (!manifest)
+		return NULL;
+
+	high = manifest->nr_entries;
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		struct acvp_ds_manifest_entry *entry = &manifest->entries[mid];
+
+		if (entry->vsid == vsid)
+			return entry;
+		if (entry->vsid < vsid)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return NULL;
+}
+
+static int acvp_ds_manifest_vsid_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* List the vsID directories of the test session in ascending order */
+static int acvp_ds_manifest_list_vsids(const char *vector_dir,
+				       uint32_t **vsids_out, uint32_t *nr_out)
+{
+	struct dirent *dirent;
+	DIR *dir;
+	uint32_t *vsids = NULL, nr = 0, alloced = 0;
+	int ret = 0;
+
+	dir = opendir(vector_dir);
+	CKNULL(dir, -errno);
+
+	while ((dirent = readdir(dir)) != NULL) {
+		unsigned long vsid_val;
+		size_t i, len = strlen(dirent->d_name);
+
+		if (!len || len > 10)
+			continue;
+		for (i = 0; i < len; i++) {
+			if (!isdigit((unsigned char)dirent->d_name[i]))
+				break;
+		}
+		if (i < len)
+			continue;
+
+		vsid_val = strtoul(dirent->d_name, NULL, 10);
+		if (vsid_val > UINT32_MAX)
+			continue;
+
+		if (nr == alloced) {
+			uint32_t *tmp;
+
+			alloced = alloced ? alloced * 2 : 64;
+			tmp = realloc(vsids, alloced * sizeof(*vsids));
+			CKNULL(tmp, -ENOMEM);
+			vsids = tmp;
+		}
+		vsids[nr++] = (uint32_t)vsid_val;
+	}
+
+	if (nr)
+		qsort(vsids, nr, sizeof(*vsids), acvp_ds_manifest_vsid_cmp);
+
+	*vsids_out = vsids;
+	*nr_out = nr;
+	vsids = NULL;
+
+out:
+	if (dir)
+		closedir(dir);
+	if (vsids)
+		free(vsids);
+	return ret;
+}
+
+/*
+ * Match the manifest with the vsID directories: entries of new directories
+ * are obtained with the scan callback, entries of removed directories are
+ * dropped.
+ */
+static int acvp_ds_manifest_reconcile(const char *vector_dir,
+				      struct acvp_ds_manifest *manifest,
+				      acvp_ds_manifest_scan_t scan,
+				      void *scan_ctx, bool *changed)
+{
+	struct acvp_ds_manifest_entry *entries = NULL;
+	uint32_t *vsids = NULL, nr_vsids = 0, i, j = 0;
+	int ret;
+
+	CKINT(acvp_ds_manifest_list_vsids(vector_dir, &vsids, &nr_vsids));
+
+	if (nr_vsids) {
+		entries = calloc(nr_vsids, sizeof(*entries));
+		CKNULL(entries, -ENOMEM);
+	}
+
+	for (i = 0; i < nr_vsids; i++) {
+		/* Both lists are sorted */
+		while (j < manifest->nr_entries &&
+		       manifest->entries[j].vsid < vsids[i]) {
+			j++;
+			*changed = true;
+		}
+
+		if (j < manifest->nr_entries &&
+		    manifest->entries[j].vsid == vsids[i]) {
+			entries[i] = manifest->entries[j++];
+			continue;
+		}
+
+		entries[i].vsid = vsids[i];
+		CKINT(scan(scan_ctx, vsids[i], &entries[i]));
+		entries[i].vsid = vsids[i];
+		entries[i].updated = (int64_t)time(NULL);
+		*changed = true;
+	}
+	if (j < manifest->nr_entries)
+		*changed = true;
+
+	if (manifest->entries)
+		free(manifest->entries);
+	manifest->entries = entries;
+	manifest->nr_entries = nr_vsids;
+	manifest->alloced = nr_vsids;
+	entries = NULL;
+
+out:
+	if (entries)
+		free(entries);
+	if (vsids)
+		free(vsids);
+	return ret;
+}
+
+/*
+ * Obtain the manifest consistent with the data store - the caller must hold
+ * the lock.
+ */
+static int acvp_ds_manifest_get(const char *manifest_dir,
+				const char *vector_dir,
+				struct acvp_ds_manifest *manifest,
+				acvp_ds_manifest_scan_t scan, void *scan_ctx,
+				bool *changed)
+{
+	struct stat statbuf;
+	int64_t saved = 0, mtime_sec, mtime_nsec;
+	int ret;
+
+	memset(manifest, 0, sizeof(*manifest));
+	*changed = false;
+
+	if (stat(vector_dir, &statbuf))
+		return -errno;
+
+#ifdef __APPLE__
+	mtime_sec = (int64_t)statbuf.st_mtimespec.tv_sec;
+	mtime_nsec = (int64_t)statbuf.st_mtimespec.tv_nsec;
+#else
+	mtime_sec = (int64_t)statbuf.st_mtim.tv_sec;
+	mtime_nsec = (int64_t)statbuf.st_mtim.tv_nsec;
+#endif
+
+	ret = acvp_ds_manifest_read(manifest_dir, manifest, &saved);
+	if (ret) {
+		logger(LOGGER_DEBUG, LOGGER_C_DS_FILE,
+		       "Rebuilding manifest for %s (%d)\n", vector_dir, ret);
+		*changed = true;
+		CKINT(acvp_ds_manifest_reconcile(vector_dir, manifest, scan,
+						 scan_ctx, changed));
+	} else if (manifest->dir_mtime_sec != mtime_sec ||
+		   manifest->dir_mtime_nsec != mtime_nsec) {
+		*changed = true;
+		CKINT(acvp_ds_manifest_reconcile(vector_dir, manifest, scan,
+						 scan_ctx, changed));
+	} else if (mtime_sec + 1 >= saved) {
+		/*
+		 * The directory may have been changed again after the manifest
+		 * was stored within the granularity of the time stamp. Once
+		 * this window passed, the manifest is stored again to mark it
+		 * as consistent.
+		 */
+		CKINT(acvp_ds_manifest_reconcile(vector_dir, manifest, scan,
+						 scan_ctx, changed));
+		if ((int64_t)time(NULL) > mtime_sec + 1)
+			*changed = true;
+	}
+
+	manifest->dir_mtime_sec = mtime_sec;
+	manifest->dir_mtime_nsec = mtime_nsec;
+
+out:
+	if (ret)
+		acvp_ds_manifest_release(manifest);
+	return ret;
+}
+
+int acvp_ds_manifest_load(const char *manifest_dir, const char *vector_dir,
+			  struct acvp_ds_manifest *manifest,
+			  acvp_ds_manifest_scan_t scan, void *scan_ctx)
+{
+	bool changed;
+	int fd, ret;
+
+	if (!manifest_dir || !vector_dir || !manifest || !scan)
+		return -EINVAL;
+
+	fd = acvp_ds_manifest_lock(manifest_dir);
+
+	ret = acvp_ds_manifest_get(manifest_dir, vector_dir, manifest, scan,
+				   scan_ctx, &changed);
+
+	/* A manifest that cannot be stored is still usable */
+	if (!ret && changed && fd >= 0)
+		acvp_ds_manifest_write(manifest_dir, manifest);
+
+	acvp_ds_manifest_unlock(fd);
+
+	return ret;
+}
+
+int acvp_ds_manifest_update(const char *manifest_dir, const char *vector_dir,
+			    uint32_t vsid, acvp_ds_manifest_scan_t scan,
+			    void *scan_ctx)
+{
+	struct acvp_ds_manifest manifest;
+	struct acvp_ds_manifest_entry *entry;
+	bool changed;
+	int fd, ret;
+
+	if (!manifest_dir || !vector_dir || !scan)
+		return -EINVAL;
+
+	fd = acvp_ds_manifest_lock(manifest_dir);
+
+	CKINT(acvp_ds_manifest_get(manifest_dir, vector_dir, &manifest, scan,
+				   scan_ctx, &changed));
+
+	entry = acvp_ds_manifest_find(&manifest, vsid);
+	if (!entry) {
+		/* The vsID directory was removed */
+		if (changed && fd >= 0)
+			acvp_ds_manifest_write(manifest_dir, &manifest);
+		goto out;
+	}
+
+	CKINT(scan(scan_ctx, vsid, entry));
+	entry->vsid = vsid;
+	entry->updated = (int64_t)time(NULL);
+
+	if (fd >= 0)
+		ret = acvp_ds_manifest_write(manifest_dir, &manifest);
+
+out:
+	acvp_ds_manifest_unlock(fd);
+	acvp_ds_manifest_release(&manifest);
+	return ret;
+}
+
+int acvp_ds_manifest_store_algoinfo(const char *manifest_dir,
+				    const char *vector_dir,
+				    const struct acvp_ds_manifest *manifest,
+				    acvp_ds_manifest_scan_t scan,
+				    void *scan_ctx)
+{
+	struct acvp_ds_manifest current;
+	uint32_t i;
+	bool changed;
+	int fd, ret = 0;
+
+	if (!manifest_dir || !vector_dir || !manifest || !scan)
+		return -EINVAL;
+
+	/* Without the lock, the manifest cannot be stored */
+	fd = acvp_ds_manifest_lock(manifest_dir);
+	if (fd < 0)
+		goto out;
+
+	/* Merge into the current state which may have changed meanwhile */
+	CKINT(acvp_ds_manifest_get(manifest_dir, vector_dir, &current, scan,
+				   scan_ctx, &changed));
+
+	for (i = 0; i < manifest->nr_entries; i++) {
+		const struct acvp_ds_manifest_entry *src = &manifest->entries[i];
+		struct acvp_ds_manifest_entry *dst;
+
+		if (!(src->flags & ACVP_DS_MANIFEST_ALGOINFO))
+			continue;
+
+		dst = acvp_ds_manifest_find(&current, src->vsid);
+		if (!dst || (dst->flags & ACVP_DS_MANIFEST_ALGOINFO) ||
+		    !(dst->flags & ACVP_DS_MANIFEST_VECTOR) ||
+		    dst->vector_size != src->vector_size)
+			continue;
+
+		memcpy(dst->cipher_name, src->cipher_name,
+		       sizeof(dst->cipher_name));
+		memcpy(dst->cipher_mode, src->cipher_mode,
+		       sizeof(dst->cipher_mode));
+		dst->flags |= ACVP_DS_MANIFEST_ALGOINFO;
+		changed = true;
+	}
+
+	if (changed)
+		ret = acvp_ds_manifest_write(manifest_dir, &current);
+
+	acvp_ds_manifest_release(&current);
+
+out:
+	acvp_ds_manifest_unlock(fd);
+	return ret;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef _DATASTORE_MANIFEST_H
+#define _DATASTORE_MANIFEST_H
+
+#include <stdint.h>
+
+#include "bool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Manifest of the vsIDs of one test session
+ *
+ * The manifest records which files are present for each vsID of a test
+ * session together with the verdict and the cipher information. Scans of the
+ * datastore read the manifest instead of looking up all files of all vsIDs.
+ *
+ * The manifest is a cache of the state of the data store: it is rebuilt
+ * from the files when it is missing or invalid. vsID directories added or
+ * removed without updating the manifest are detected by the modification
+ * time of the test session directory. Files of a vsID that are modified
+ * outside of the ACVP Proxy are not detected - the manifest must be deleted
+ * in this case.
+ */
+
+/* File holding the manifest */
+#define ACVP_DS_MANIFEST "vsid_manifest.bin"
+/* Lock file serializing the updates of the manifest */
+#define ACVP_DS_MANIFEST_LOCK "vsid_manifest.lock"
+
+/* Test vector file is present */
+#define ACVP_DS_MANIFEST_VECTOR (1 << 0)
+/* Test vector file is gzip compressed */
+#define ACVP_DS_MANIFEST_VECTOR_GZ (1 << 1)
+/* Expected results file is present */
+#define ACVP_DS_MANIFEST_EXPECTED (1 << 2)
+/* Verdict file is present, the verdict field is valid */
+#define ACVP_DS_MANIFEST_VERDICT (1 << 3)
+/* Test responses were submitted */
+#define ACVP_DS_MANIFEST_PROCESSED (1 << 4)
+/* The cipher information fields are valid */
+#define ACVP_DS_MANIFEST_ALGOINFO (1 << 5)
+
+#define ACVP_DS_MANIFEST_NAMELEN 64
+
+/*
+ * @vsid: vsID the entry refers to
+ * @flags: ACVP_DS_MANIFEST_* flags
+ * @verdict: enum acvp_test_verdict of the verdict file
+ * @vector_size: Size of the test vector file
+ * @updated: Time of the last update of the entry (seconds since the epoch)
+ * @cipher_name: Cipher name of the test vector (NULL-terminated)
+ * @cipher_mode: Cipher mode of the test vector (NULL-terminated, may be empty)
+ */
+struct acvp_ds_manifest_entry {
+	uint32_t vsid;
+	uint32_t flags;
+	uint32_t verdict;
+	uint32_t reserved;
+	uint64_t vector_size;
+	int64_t updated;
+	char cipher_name[ACVP_DS_MANIFEST_NAMELEN];
+	char cipher_mode[ACVP_DS_MANIFEST_NAMELEN];
+};
+
+/*
+ * @entries: Entries sorted by vsID
+ * @nr_entries: Number of entries
+ * @dir_mtime_sec, @dir_mtime_nsec: Modification time of the test session
+ *				    directory the manifest is consistent with
+ */
+struct acvp_ds_manifest {
+	struct acvp_ds_manifest_entry *entries;
+	uint32_t nr_entries;
+	uint32_t alloced;
+	int64_t dir_mtime_sec;
+	int64_t dir_mtime_nsec;
+};
+
+/**
+ * @brief Callback filling in the manifest entry of one vsID from the files in
+ *	  the data store. The entry contains the previously recorded data or is
+ *	  zeroized for a new vsID.
+ */
+typedef int (*acvp_ds_manifest_scan_t)(void *ctx, uint32_t vsid,
+				       struct acvp_ds_manifest_entry *entry);
+
+/**
+ * @brief Load the manifest of a test session. A missing or outdated manifest
+ *	  is rebuilt with the scan callback and stored.
+ *
+ * @param manifest_dir [in] Directory holding the manifest file
+ * @param vector_dir [in] Test session directory holding the vsID directories
+ * @param manifest [out] Manifest to be released with acvp_ds_manifest_release
+ * @param scan [in] Callback to obtain the information of one vsID
+ * @param scan_ctx [in] Context of the callback
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_manifest_load(const char *manifest_dir, const char *vector_dir,
+			  struct acvp_ds_manifest *manifest,
+			  acvp_ds_manifest_scan_t scan, void *scan_ctx);
+
+/**
+ * @brief Refresh the manifest entry of one vsID after its files changed.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_manifest_update(const char *manifest_dir, const char *vector_dir,
+			    uint32_t vsid, acvp_ds_manifest_scan_t scan,
+			    void *scan_ctx);
+
+/**
+ * @brief Store the cipher information obtained for the entries of the given
+ *	  manifest in the manifest file.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_manifest_store_algoinfo(const char *manifest_dir,
+				    const char *vector_dir,
+				    const struct acvp_ds_manifest *manifest,
+				    acvp_ds_manifest_scan_t scan,
+				    void *scan_ctx);
+
+/**
+ * @brief Find the entry of a vsID
+ *
+ * @return entry or NULL if the vsID is not in the manifest
+ */
+struct acvp_ds_manifest_entry *
+acvp_ds_manifest_find(const struct acvp_ds_manifest *manifest, uint32_t vsid);
+
+void acvp_ds_manifest_release(struct acvp_ds_manifest *manifest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DATASTORE_MANIFEST_H */
@@ -0,0 +1,457 @@
+/* Group commit of data store writes
+ *
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "acvpproxy.h"
+#include "atomic.h"
+#include "config.h"
+#include "datastore_sync.h"
+#include "internal.h"
+#include "logger.h"
+#include "mutex_w.h"
+#include "ret_checkers.h"
+#include "threading_support.h"
+
+/*
+ * Number of pending requests of one file system from which on the file system
+ * is committed with one syncfs instead of one fdatasync per file.
+ */
+#define ACVP_DS_SYNC_SYNCFS_MIN 8
+
+/*
+ * @next: Next request of the queue
+ * @fd: File descriptor to sync
+ * @dev: Device of the file
+ * @ino: Inode of the file
+ * @ret: Result of the sync
+ * @dir: The file descriptor refers to a directory
+ * @wait: The writer waits for the request - otherwise the sync thread closes
+ *	  the file descriptor and frees the request
+ * @synced: The request is committed (only accessed by the sync thread)
+ * @done: The request is committed (protected by acvp_ds_sync_lock)
+ */
+struct acvp_ds_sync_req {
+	struct acvp_ds_sync_req *next;
+	int fd;
+	dev_t dev;
+	ino_t ino;
+	int ret;
+	bool dir;
+	bool wait;
+	bool synced;
+	bool done;
+};
+
+static bool acvp_ds_sync_enabled = true;
+static atomic_t acvp_ds_sync_counter = ATOMIC_INIT(0);
+
+/* Directories are synced with fsync as fdatasync may not apply */
+static int acvp_ds_sync_one(int fd, bool dir)
+{
+	if (dir ? fsync(fd) : fdatasync(fd))
+		return -errno;
+	return 0;
+}
+
+#ifdef ACVP_USE_PTHREAD
+
+static DEFINE_MUTEX_W_UNLOCKED(acvp_ds_sync_lock);
+static pthread_cond_t acvp_ds_sync_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t acvp_ds_sync_done = PTHREAD_COND_INITIALIZER;
+static struct acvp_ds_sync_req *acvp_ds_sync_head = NULL;
+static struct acvp_ds_sync_req **acvp_ds_sync_tail = &acvp_ds_sync_head;
+static unsigned int acvp_ds_sync_interval = ACVP_DATASTORE_SYNC_INTERVAL;
+static bool acvp_ds_sync_running = false;
+static bool acvp_ds_sync_shutdown = false;
+
+/* Set the result of all requests matching the given one */
+static void acvp_ds_sync_result(struct acvp_ds_sync_req *batch,
+				struct acvp_ds_sync_req *req, bool same_fs,
+				int ret)
+{
+	for (; batch; batch = batch->next) {
+		if (batch->synced || batch->dev != req->dev)
+			continue;
+		if (!same_fs && batch->ino != req->ino)
+			continue;
+
+		batch->ret = ret;
+		batch->synced = true;
+	}
+}
+
+/* Commit a batch - the synced flag marks the committed requests */
+static void acvp_ds_sync_commit(struct acvp_ds_sync_req *batch)
+{
+	struct acvp_ds_sync_req *req;
+	unsigned int nr = 0, files = 0, filesystems = 0;
+
+	for (req = batch; req; req = req->next)
+		nr++;
+
+#ifdef __linux__
+	/* Commit file systems with many pending requests with one syncfs */
+	for (req = batch; req; req = req->next) {
+		struct acvp_ds_sync_req *other;
+		unsigned int pending = 0;
+
+		if (req->synced)
+			continue;
+
+		for (other = req; other; other = other->next) {
+			if (other->dev == req->dev)
+				pending++;
+		}
+
+		if (pending < ACVP_DS_SYNC_SYNCFS_MIN)
+			continue;
+
+		acvp_ds_sync_result(batch, req, true,
+				    syncfs(req->fd) ? -errno : 0);
+		filesystems++;
+	}
+#endif
+
+	/* Commit the remaining files individually, each file only once */
+	for (req = batch; req; req = req->next) {
+		if (req->synced)
+			continue;
+
+		acvp_ds_sync_result(batch, req, false,
+				    acvp_ds_sync_one(req->fd, req->dir));
+		files++;
+	}
+
+	logger(LOGGER_DEBUG, LOGGER_C_DS_FILE,
+	       "Committed %u sync requests with %u syncfs and %u fsync/fdatasync calls\n",
+	       nr, filesystems, files);
+}
+
+static void acvp_ds_sync_deadline(struct timespec *deadline,
+				  unsigned int interval_ms)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_sec += interval_ms / 1000;
+	deadline->tv_nsec += (long)(interval_ms % 1000) * 1000000L;
+	if (deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+static int acvp_ds_sync_thread(void *arg)
+{
+	struct acvp_ds_sync_req *batch, *req, *next;
+	struct timespec deadline;
+
+	(void)arg;
+
+	thread_set_name(acvp_dssync, 0);
+
+	mutex_w_lock(&acvp_ds_sync_lock);
+
+	while (1) {
+		while (!acvp_ds_sync_head && !acvp_ds_sync_shutdown)
+			pthread_cond_wait(&acvp_ds_sync_work,
+					  &acvp_ds_sync_lock);
+
+		/* Shutdown is only performed once all requests are done */
+		if (!acvp_ds_sync_head)
+			break;
+
+		/* Collect the requests of the other threads for the batch */
+		acvp_ds_sync_deadline(&deadline, acvp_ds_sync_interval);
+		while (!acvp_ds_sync_shutdown) {
+			if (pthread_cond_timedwait(&acvp_ds_sync_work,
+						   &acvp_ds_sync_lock,
+						   &deadline) == ETIMEDOUT)
+				break;
+		}
+
+		batch = acvp_ds_sync_head;
+		acvp_ds_sync_head = NULL;
+		acvp_ds_sync_tail = &acvp_ds_sync_head;
+
+		mutex_w_unlock(&acvp_ds_sync_lock);
+
+		acvp_ds_sync_commit(batch);
+
+		mutex_w_lock(&acvp_ds_sync_lock);
+
+		/* The writer owns its request once it sees the done flag */
+		for (req = batch; req; req = next) {
+			next = req->next;
+
+			if (req->wait) {
+				req->done = true;
+			} else {
+				close(req->fd);
+				free(req);
+			}
+		}
+		pthread_cond_broadcast(&acvp_ds_sync_done);
+	}
+
+	acvp_ds_sync_running = false;
+	pthread_cond_broadcast(&acvp_ds_sync_done);
+
+	mutex_w_unlock(&acvp_ds_sync_lock);
+
+	return 0;
+}
+
+/*
+ * Queue the request for the sync thread. An error is returned if the request
+ * shall be processed by the caller.
+ */
+static int acvp_ds_sync_queue(struct acvp_ds_sync_req *req)
+{
+	struct stat statbuf;
+	int ret = 0;
+
+	if (fstat(req->fd, &statbuf))
+		return -errno;
+	req->dev = statbuf.st_dev;
+	req->ino = statbuf.st_ino;
+
+	mutex_w_lock(&acvp_ds_sync_lock);
+
+	/* The sync thread requires the threading support of the library */
+	if (!acvp_ds_sync_interval || acvp_ds_sync_shutdown ||
+	    !acvp_library_initialized()) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	/* Start the sync thread with the first request */
+	if (!acvp_ds_sync_running) {
+		CKINT(thread_start(acvp_ds_sync_thread, NULL,
+				   ACVP_THREAD_DS_SYNC_GROUP, NULL));
+		acvp_ds_sync_running = true;
+		logger(LOGGER_DEBUG, LOGGER_C_DS_FILE,
+		       "Data store sync thread started\n");
+	}
+
+	*acvp_ds_sync_tail = req;
+	acvp_ds_sync_tail = &req->next;
+	pthread_cond_signal(&acvp_ds_sync_work);
+
+out:
+	mutex_w_unlock(&acvp_ds_sync_lock);
+	return ret;
+}
+
+static void acvp_ds_sync_wait(struct acvp_ds_sync_req *req)
+{
+	mutex_w_lock(&acvp_ds_sync_lock);
+	while (!req->done)
+		pthread_cond_wait(&acvp_ds_sync_done, &acvp_ds_sync_lock);
+	mutex_w_unlock(&acvp_ds_sync_lock);
+}
+
+void acvp_ds_sync_set_interval(unsigned int interval_ms)
+{
+	mutex_w_lock(&acvp_ds_sync_lock);
+	acvp_ds_sync_interval = interval_ms;
+	mutex_w_unlock(&acvp_ds_sync_lock);
+}
+
+void acvp_ds_sync_release(void)
+{
+	mutex_w_lock(&acvp_ds_sync_lock);
+
+	if (acvp_ds_sync_running) {
+		acvp_ds_sync_shutdown = true;
+		pthread_cond_broadcast(&acvp_ds_sync_work);
+
+		while (acvp_ds_sync_running)
+			pthread_cond_wait(&acvp_ds_sync_done,
+					  &acvp_ds_sync_lock);
+
+		acvp_ds_sync_shutdown = false;
+	}
+
+	mutex_w_unlock(&acvp_ds_sync_lock);
+}
+
+#else /* ACVP_USE_PTHREAD */
+
+static int acvp_ds_sync_queue(struct acvp_ds_sync_req *req)
+{
+	(void)req;
+	return -EOPNOTSUPP;
+}
+
+static void acvp_ds_sync_wait(struct acvp_ds_sync_req *req)
+{
+	(void)req;
+}
+
+void acvp_ds_sync_set_interval(unsigned int interval_ms)
+{
+	(void)interval_ms;
+}
+
+void acvp_ds_sync_release(void)
+{
+}
+
+#endif /* ACVP_USE_PTHREAD */
+
+void acvp_ds_sync_enable(bool enable)
+{
+	acvp_ds_sync_enabled = enable;
+}
+
+int acvp_ds_sync_fd(int fd)
+{
+	struct acvp_ds_sync_req req;
+
+	if (!acvp_ds_sync_enabled)
+		return 0;
+
+	memset(&req, 0, sizeof(req));
+	req.fd = fd;
+	req.wait = true;
+
+	if (acvp_ds_sync_queue(&req))
+		return acvp_ds_sync_one(fd, false);
+
+	acvp_ds_sync_wait(&req);
+
+	return req.ret;
+}
+
+int acvp_ds_sync_path(const char *pathname)
+{
+	int fd, ret;
+
+	if (!acvp_ds_sync_enabled)
+		return 0;
+
+	fd = open(pathname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	ret = acvp_ds_sync_fd(fd);
+	close(fd);
+
+	return ret;
+}
+
+void acvp_ds_sync_dir(const char *pathname)
+{
+	struct acvp_ds_sync_req *req;
+	char dir[FILENAME_MAX];
+	int fd;
+
+	if (!acvp_ds_sync_enabled)
+		return;
+
+	/* dirname may modify its argument */
+	snprintf(dir, sizeof(dir), "%s", pathname);
+	fd = open(dirname(dir), O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+	if (fd < 0)
+		return;
+
+	req = calloc(1, sizeof(*req));
+	if (req) {
+		req->fd = fd;
+		req->dir = true;
+		if (!acvp_ds_sync_queue(req))
+			return;
+		free(req);
+	}
+
+	acvp_ds_sync_one(fd, true);
+	close(fd);
+}
+
+int acvp_ds_sync_tmpname(const char *pathname, char *tmpname,
+			 size_t tmpnamelen)
+{
+	int ret = snprintf(tmpname, tmpnamelen, "%s.%ld.%d.tmp", pathname,
+			   (long)getpid(), atomic_inc(&acvp_ds_sync_counter));
+
+	if (ret < 0 || (size_t)ret >= tmpnamelen)
+		return -ENAMETOOLONG;
+
+	return 0;
+}
+
+int acvp_ds_sync_write(const char *pathname, const uint8_t *data, size_t len,
+		       mode_t mode)
+{
+	char tmpname[FILENAME_MAX];
+	int fd, ret;
+
+	ret = acvp_ds_sync_tmpname(pathname, tmpname, sizeof(tmpname));
+	if (ret)
+		return ret;
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+	if (fd < 0)
+		return -errno;
+
+	while (len) {
+		ssize_t written = write(fd, data, len);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			close(fd);
+			goto out;
+		}
+		data += written;
+		len -= (size_t)written;
+	}
+
+	ret = acvp_ds_sync_fd(fd);
+	if (close(fd) && !ret)
+		ret = -errno;
+	if (ret)
+		goto out;
+
+	if (rename(tmpname, pathname)) {
+		ret = -errno;
+		goto out;
+	}
+
+	acvp_ds_sync_dir(pathname);
+
+out:
+	if (ret)
+		unlink(tmpname);
+	return ret;
+}
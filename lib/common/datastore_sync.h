@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef _DATASTORE_SYNC_H
+#define _DATASTORE_SYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "bool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Group commit of data store writes
+ *
+ * Files of the data store are written to a temporary file which is synced to
+ * disk before it is renamed to its final name. Thus, after a crash a file
+ * either holds its old or its new content in full.
+ *
+ * Syncing every file on its own is expensive when hundreds of vsID threads
+ * write concurrently. Therefore, a background thread collects the sync
+ * requests of all threads for the sync interval and commits them as one
+ * batch: the files of a file system with many pending requests are committed
+ * with one syncfs, other files with one fdatasync each. The writer waits until
+ * the batch holding its request is committed. The directories of renamed files
+ * are synced with the next batch without waiting for it.
+ */
+
+/**
+ * @brief Set the interval collecting the sync requests of one batch.
+ *
+ * @param interval_ms [in] Interval in milliseconds - 0 syncs each file
+ *			   immediately in the calling thread
+ */
+void acvp_ds_sync_set_interval(unsigned int interval_ms);
+
+/**
+ * @brief Enable or disable the syncing of data store writes. When disabled,
+ *	  the files are still written atomically, but not synced to disk.
+ */
+void acvp_ds_sync_enable(bool enable);
+
+/**
+ * @brief Sync the data of the file to disk. The call returns when the batch
+ *	  holding the request is committed.
+ *
+ * @param fd [in] File descriptor of the file (the caller keeps ownership)
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_sync_fd(int fd);
+
+/**
+ * @brief Sync the data of the file at the given path to disk.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_sync_path(const char *pathname);
+
+/**
+ * @brief Sync the directory holding the given file with the next batch to
+ *	  persist a rename. The call does not wait for the batch.
+ *
+ * @param pathname [in] Path of the file whose directory shall be synced
+ */
+void acvp_ds_sync_dir(const char *pathname);
+
+/**
+ * @brief Write the data into a temporary file, sync it and rename it to the
+ *	  final path.
+ *
+ * @param pathname [in] Final path of the file
+ * @param data [in] Data to write
+ * @param len [in] Length of the data
+ * @param mode [in] Permissions of the file
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_sync_write(const char *pathname, const uint8_t *data, size_t len,
+		       mode_t mode);
+
+/**
+ * @brief Generate the name of a temporary file which is unique for the
+ *	  process and thread for the given path.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_ds_sync_tmpname(const char *pathname, char *tmpname,
+			 size_t tmpnamelen);
+
+/**
+ * @brief Commit all pending requests and terminate the sync thread.
+ */
+void acvp_ds_sync_release(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DATASTORE_SYNC_H */
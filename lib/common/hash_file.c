@@ -0,0 +1,437 @@
+/* Streaming message digest calculation of files
+ *
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "binhexbin.h"
+#include "datastore_sync.h"
+#include "hash/memset_secure.h"
+#include "hash/sha256.h"
+#include "hash/sha3.h"
+#include "hash/sha512.h"
+#include "internal.h"
+#include "json_wrapper.h"
+#include "logger.h"
+
+/*
+ * The files are hashed in windows of the given size. Only one window per
+ * file is mapped at any time which keeps the address space and page cache
+ * footprint independent of the file size.
+ */
+#define ACVP_HASH_FILE_WINDOW (16UL * 1024 * 1024)
+
+struct acvp_hash_file_stream {
+	const char *pathname;
+	struct acvp_buf *md;
+	struct sha_ctx *ctx;
+	struct stat statbuf;
+	off_t offset;
+	uint8_t *win;
+	size_t winlen;
+	int fd;
+	bool cached;
+};
+
+/* Name of the hash used in the cache - NULL if the hash is not cached */
+static const char *acvp_hash_file_algo(const struct hash *hash)
+{
+	if (hash == sha256)
+		return "SHA2-256";
+	if (hash == sha512)
+		return "SHA2-512";
+	if (hash == sha3_224)
+		return "SHA3-224";
+	if (hash == sha3_256)
+		return "SHA3-256";
+	if (hash == sha3_384)
+		return "SHA3-384";
+	if (hash == sha3_512)
+		return "SHA3-512";
+	return NULL;
+}
+
+static int64_t acvp_hash_file_mtime_nsec(const struct stat *statbuf)
+{
+#ifdef __APPLE__
+	return (int64_t)statbuf->st_mtimespec.tv_nsec;
+#else
+	return (int64_t)statbuf->st_mtim.tv_nsec;
+#endif
+}
+
+/*
+ * Obtain the message digest from the cache if inode, size and modification
+ * time of the file are unchanged.
+ */
+static int acvp_hash_file_cache_get(struct json_object *cache,
+				    const char *algo, const struct hash *hash,
+				    struct acvp_hash_file_stream *stream)
+{
+	struct json_object *entry;
+	const char *hex;
+	uint64_t inode, size, mtime, mtime_nsec;
+	int ret;
+
+	CKINT(json_find_key(cache, stream->pathname, &entry,
+			    json_type_object));
+	CKINT(json_get_uint64(entry, "inode", &inode));
+	CKINT(json_get_uint64(entry, "size", &size));
+	CKINT(json_get_uint64(entry, "mtime", &mtime));
+	CKINT(json_get_uint64(entry, "mtimeNsec", &mtime_nsec));
+
+	if (inode != (uint64_t)stream->statbuf.st_ino ||
+	    size != (uint64_t)stream->statbuf.st_size ||
+	    mtime != (uint64_t)stream->statbuf.st_mtime ||
+	    mtime_nsec !=
+		    (uint64_t)acvp_hash_file_mtime_nsec(&stream->statbuf))
+		return -ENOENT;
+
+	CKINT(json_get_string(entry, algo, &hex));
+	if (strlen(hex) != (size_t)hash->digestsize * 2)
+		return -EINVAL;
+
+	hex2bin(hex, (uint32_t)strlen(hex), stream->md->buf, stream->md->len);
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY,
+	       "Message digest of file %s obtained from cache\n",
+	       stream->pathname);
+
+out:
+	return ret;
+}
+
+static int acvp_hash_file_cache_add(struct json_object *cache,
+				    const char *algo,
+				    const struct acvp_hash_file_stream *stream)
+{
+	struct json_object *entry;
+	char hex[2 * 64 + 1];
+	int ret;
+
+	if (stream->md->len > 64)
+		return -EINVAL;
+
+	memset(hex, 0, sizeof(hex));
+	bin2hex(stream->md->buf, stream->md->len, hex, sizeof(hex) - 1, 0);
+
+	entry = json_object_new_object();
+	CKNULL(entry, -ENOMEM);
+	CKINT(json_object_object_add(cache, stream->pathname, entry));
+	CKINT(json_object_object_add(
+		entry, "inode",
+		json_object_new_int64((int64_t)stream->statbuf.st_ino)));
+	CKINT(json_object_object_add(
+		entry, "size",
+		json_object_new_int64((int64_t)stream->statbuf.st_size)));
+	CKINT(json_object_object_add(
+		entry, "mtime",
+		json_object_new_int64((int64_t)stream->statbuf.st_mtime)));
+	CKINT(json_object_object_add(
+		entry, "mtimeNsec",
+		json_object_new_int64(
+			acvp_hash_file_mtime_nsec(&stream->statbuf))));
+	CKINT(json_object_object_add(entry, algo, json_object_new_string(hex)));
+
+out:
+	return ret;
+}
+
+static struct json_object *acvp_hash_file_cache_read(const char *cache_file)
+{
+	struct json_object *cache = NULL;
+
+	if (!access(cache_file, F_OK))
+		cache = json_object_from_file(cache_file);
+
+	if (cache && !json_object_is_type(cache, json_type_object)) {
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "Hash cache %s is invalid, ignoring it\n", cache_file);
+		ACVP_JSON_PUT_NULL(cache);
+	}
+
+	if (!cache)
+		cache = json_object_new_object();
+
+	return cache;
+}
+
+static int acvp_hash_file_cache_write(struct json_object *cache,
+				      const char *cache_file)
+{
+	const char *str;
+	int ret;
+
+	str = json_object_to_json_string_ext(
+		cache, JSON_C_TO_STRING_PRETTY | JSON_C_TO_STRING_NOSLASHESCAPE);
+	CKNULL_LOG(str, -EFAULT,
+		   "JSON object conversion into string failed\n");
+
+	CKINT(acvp_ds_sync_write(cache_file, (const uint8_t *)str, strlen(str),
+				 0666));
+
+out:
+	return ret;
+}
+
+static int acvp_hash_file_open(struct acvp_hash_file_stream *stream)
+{
+	int ret = 0;
+
+	if (stat(stream->pathname, &stream->statbuf)) {
+		ret = -errno;
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "File name %s does not exist\n", stream->pathname);
+		return ret;
+	}
+
+	if (!S_ISREG(stream->statbuf.st_mode)) {
+		logger(LOGGER_ERR, LOGGER_C_ANY, "%s is not a regular file\n",
+		       stream->pathname);
+		return -EINVAL;
+	}
+
+	return ret;
+}
+
+/* Map the next window of the file */
+static int acvp_hash_file_map(struct acvp_hash_file_stream *stream)
+{
+	off_t remain = stream->statbuf.st_size - stream->offset;
+
+	stream->winlen = (remain > (off_t)ACVP_HASH_FILE_WINDOW) ?
+				 ACVP_HASH_FILE_WINDOW :
+				 (size_t)remain;
+	if (!stream->winlen)
+		return 0;
+
+	stream->win = mmap(NULL, stream->winlen, PROT_READ, MAP_SHARED,
+			   stream->fd, stream->offset);
+	if (stream->win == MAP_FAILED) {
+		int ret = -errno;
+
+		stream->win = NULL;
+		logger(LOGGER_WARN, LOGGER_C_DS_FILE,
+		       "Cannot mmap file %s (%d)\n", stream->pathname, ret);
+		return ret;
+	}
+
+	madvise(stream->win, stream->winlen, MADV_SEQUENTIAL);
+
+#ifdef POSIX_FADV_WILLNEED
+	/* Let the kernel read the next window while this one is hashed */
+	if (stream->offset + (off_t)stream->winlen < stream->statbuf.st_size)
+		posix_fadvise(stream->fd,
+			      stream->offset + (off_t)stream->winlen,
+			      (off_t)ACVP_HASH_FILE_WINDOW,
+			      POSIX_FADV_WILLNEED);
+#endif
+
+	return 0;
+}
+
+static void acvp_hash_file_unmap(struct acvp_hash_file_stream *stream)
+{
+	if (stream->win) {
+		munmap(stream->win, stream->winlen);
+		stream->win = NULL;
+	}
+	stream->offset += (off_t)stream->winlen;
+	stream->winlen = 0;
+}
+
+/*
+ * Hash the files window by window. The windows of all files are processed
+ * together with the multi-buffer update.
+ */
+static int acvp_hash_file_stream(const struct hash *hash,
+				 struct acvp_hash_file_stream *streams,
+				 unsigned int num)
+{
+	struct sha_ctx **ctx = NULL;
+	const uint8_t **in = NULL;
+	size_t *inlen = NULL;
+	unsigned int i, active;
+	int ret = 0;
+
+	ctx = calloc(num, sizeof(*ctx));
+	CKNULL(ctx, -ENOMEM);
+	in = calloc(num, sizeof(*in));
+	CKNULL(in, -ENOMEM);
+	inlen = calloc(num, sizeof(*inlen));
+	CKNULL(inlen, -ENOMEM);
+
+	for (i = 0; i < num; i++) {
+		struct acvp_hash_file_stream *stream = &streams[i];
+
+		if (stream->cached)
+			continue;
+
+		stream->fd = open(stream->pathname, O_RDONLY | O_CLOEXEC);
+		if (stream->fd < 0) {
+			ret = -errno;
+			logger(LOGGER_WARN, LOGGER_C_DS_FILE,
+			       "Cannot open file %s (%d)\n", stream->pathname,
+			       ret);
+			goto out;
+		}
+
+		stream->ctx = malloc(hash->ctxsize);
+		CKNULL(stream->ctx, -ENOMEM);
+		hash->init(stream->ctx);
+	}
+
+	do {
+		active = 0;
+
+		for (i = 0; i < num; i++) {
+			struct acvp_hash_file_stream *stream = &streams[i];
+
+			if (stream->cached ||
+			    stream->offset >= stream->statbuf.st_size)
+				continue;
+
+			CKINT(acvp_hash_file_map(stream));
+
+			ctx[active] = stream->ctx;
+			in[active] = stream->win;
+			inlen[active] = stream->winlen;
+			active++;
+		}
+
+		if (active)
+			hash->update_mb(ctx, in, inlen, active);
+
+		for (i = 0; i < num; i++) {
+			if (streams[i].win)
+				acvp_hash_file_unmap(&streams[i]);
+		}
+	} while (active);
+
+	for (i = 0; i < num; i++) {
+		struct acvp_hash_file_stream *stream = &streams[i];
+
+		if (stream->cached)
+			continue;
+
+		hash->final(stream->ctx, stream->md->buf);
+
+		logger(LOGGER_DEBUG, LOGGER_C_ANY,
+		       "Hashing of file %s completed\n", stream->pathname);
+		logger_binary(LOGGER_DEBUG, LOGGER_C_ANY, stream->md->buf,
+			      stream->md->len, "Message digest of file");
+	}
+
+out:
+	for (i = 0; i < num; i++) {
+		struct acvp_hash_file_stream *stream = &streams[i];
+
+		if (stream->win)
+			acvp_hash_file_unmap(stream);
+		if (stream->fd >= 0)
+			close(stream->fd);
+		stream->fd = -1;
+		if (stream->ctx) {
+			memset_secure(stream->ctx, 0, hash->ctxsize);
+			free(stream->ctx);
+			stream->ctx = NULL;
+		}
+	}
+	if (ctx)
+		free(ctx);
+	if (in)
+		free(in);
+	if (inlen)
+		free(inlen);
+	return ret;
+}
+
+int acvp_hash_files(const char *const pathnames[], const struct hash *hash,
+		    struct acvp_buf *const md[], unsigned int num,
+		    const char *cache_file)
+{
+	struct acvp_hash_file_stream *streams = NULL;
+	struct json_object *cache = NULL;
+	const char *algo = acvp_hash_file_algo(hash);
+	unsigned int i, hashed = 0;
+	int ret = 0;
+
+	CKNULL(pathnames, -EINVAL);
+	CKNULL(hash, -EINVAL);
+	CKNULL(md, -EINVAL);
+
+	if (!num)
+		return 0;
+
+	streams = calloc(num, sizeof(*streams));
+	CKNULL(streams, -ENOMEM);
+
+	if (cache_file && algo)
+		cache = acvp_hash_file_cache_read(cache_file);
+
+	for (i = 0; i < num; i++) {
+		struct acvp_hash_file_stream *stream = &streams[i];
+
+		stream->pathname = pathnames[i];
+		stream->md = md[i];
+		stream->fd = -1;
+
+		CKINT(acvp_hash_file_open(stream));
+		CKINT(acvp_alloc_buf(hash->digestsize, stream->md));
+
+		if (cache &&
+		    !acvp_hash_file_cache_get(cache, algo, hash, stream)) {
+			stream->cached = true;
+		} else {
+			hashed++;
+		}
+	}
+
+	if (!hashed)
+		goto out;
+
+	CKINT(acvp_hash_file_stream(hash, streams, num));
+
+	if (!cache)
+		goto out;
+
+	for (i = 0; i < num; i++) {
+		if (!streams[i].cached)
+			CKINT(acvp_hash_file_cache_add(cache, algo,
+						       &streams[i]));
+	}
+
+	/* A cache which cannot be written only costs a rehash on next use */
+	if (acvp_hash_file_cache_write(cache, cache_file)) {
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "Cannot write hash cache %s\n", cache_file);
+	}
+
+out:
+	ACVP_JSON_PUT_NULL(cache);
+	if (streams)
+		free(streams);
+	return ret;
+}
@@ -343,6 +343,10 @@ struct acvp_net_ctx {
 	char *certs_ca_macos_keychain_ref;
 	char *certs_clnt_macos_keychain_ref;
 
+	bool accept_compression; /* Accept compressed response bodies */
+	bool compress_request; /* Send compressed request bodies */
+	bool http2; /* Negotiate HTTP/2 and multiplex requests */
+
 	const struct acvp_net_proto *proto;
 };
 
@@ -351,6 +355,8 @@ struct acvp_na_ex {
 	const struct acvp_net_ctx *net;
 	const char *url;
 	const struct acvp_auth_ctx *server_auth;
+	const struct acvp_buf_sink *sink;
+	uint32_t *retry_after; /* Retry-After of an error response in seconds */
 };
 
 /**
@@ -495,9 +501,10 @@ struct acvp_vsid_ctx {
  *
  * @acvp_datastore_find_testsession: Find a test session that shall be
  *				     processed. The found test session is
- *				     in the testids array. The found test
- *				     test sessions are limited when specifying
- *				     datastore->search->testid.
+ *				     in the testids array which is allocated
+ *				     by the backend and freed by the caller.
+ *				     The found test sessions are limited when
+ *				     specifying datastore->search->testid.
  * @acvp_datastore_find_responses: Find the test results for the given vsID and
  *				   invoke the provided callback with the data.
  *				   Note, the data parameter shall be treated as
@@ -528,17 +535,24 @@ struct acvp_vsid_ctx {
  * @acvp_datastore_get_vsid_verdict Get verdict information for vsID
  * @acvp_datastore_file_rename_version Rename module: change version number
  * @acvp_datastore_file_rename_name Rename module: change module name
+ * @acvp_datastore_open_vsid: Prepare the sink to stream data to the location
+ *			      pointed to by filename at the vsID level. The
+ *			      data only becomes visible under filename when
+ *			      the sink is closed with commit set.
+ * @acvp_datastore_close_vsid: Close a sink opened with
+ *			       acvp_datastore_open_vsid and either commit or
+ *			       discard the streamed data.
  */
 struct acvp_datastore_be {
 	int (*acvp_datastore_find_testsession)(const struct definition *def,
 					       const struct acvp_ctx *ctx,
-					       uint32_t *testids,
+					       uint32_t **testids,
 					       unsigned int *testid_count);
 	int (*acvp_datastore_find_responses)(
 		const struct acvp_testid_ctx *testid_ctx,
 		int (*acvp_submit_one_response)(
 			const struct acvp_vsid_ctx *vsid_ctx,
-			const struct acvp_buf *buf));
+			const struct acvp_ext_buf *buf));
 	int (*acvp_datastore_write_vsid)(const struct acvp_vsid_ctx *vsid_ctx,
 					 const char *filename,
 					 bool secure_location,
@@ -562,12 +576,19 @@ struct acvp_datastore_be {
 		const struct acvp_testid_ctx *testid_ctx, char *newversion);
 	int (*acvp_datastore_rename_name)(
 		const struct acvp_testid_ctx *testid_ctx, char *newname);
+	int (*acvp_datastore_open_vsid)(const struct acvp_vsid_ctx *vsid_ctx,
+					const char *filename,
+					bool secure_location,
+					struct acvp_buf_sink *sink);
+	int (*acvp_datastore_close_vsid)(struct acvp_buf_sink *sink,
+					 bool commit);
 };
 
 /**
  * @brief Register datastore backend.
  */
 void acvp_register_ds(const struct acvp_datastore_be *datastore);
+void acvp_register_ds_log(const struct acvp_datastore_be *datastore);
 
 #define CKNULL_C_LOG(v, r, c, ...)                                             \
 	{                                                                      \
@@ -817,6 +838,38 @@ int acvp_register_cb(const struct acvp_ctx *ctx,
  */
 int acvp_testids_refresh(const struct acvp_ctx *ctx);
 
+/**
+ * @brief Get the testIDs of the test sessions of the given definition.
+ *
+ * On first use for a context, the test sessions of all definitions matching
+ * the search criteria are collected with one parallel crawl of the data
+ * store. Other definitions (e.g. dependencies) are crawled on first use.
+ *
+ * @param ctx [in] ACVP context
+ * @param def [in] Module definition
+ * @param testids [out] Sorted testIDs - the array is owned by the index and
+ *			valid until acvp_testids_index_release is called
+ * @param testid_count [out] Number of testIDs
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_testids_index_get(const struct acvp_ctx *ctx,
+			   const struct definition *def,
+			   const uint32_t **testids,
+			   unsigned int *testid_count);
+
+/**
+ * @brief Drop the test session index of the context so that the next lookup
+ *	  crawls the data store again.
+ */
+void acvp_testids_index_release(const struct acvp_ctx *ctx);
+
+/**
+ * @brief Release the cache of the algorithms arrays of the registration
+ *	  requests.
+ */
+void acvp_req_algo_cache_release(void);
+
 /**
  * @brief Match two strings
  */
@@ -867,6 +920,55 @@ int acvp_net_op(const struct acvp_testid_ctx *testid_ctx, const char *url,
 		const struct acvp_ext_buf *submit, struct acvp_buf *response,
 		enum acvp_http_type nettype);
 
+/**
+ * @brief Helper to perform HTTP GET operation streaming the data into a sink
+ *
+ * A successfully retrieved body is handed to the sink in chunks as it arrives
+ * from the server and is not collected in memory. Error responses of the
+ * server are placed into the response buffer.
+ *
+ * @param testid_ctx [in] TestID context with set credentials
+ * @param url [in] URL to access
+ * @param sink [in] Sink receiving the response body
+ * @param response [out] Buffer to hold an error response (buffer will be
+ *			 allocated by acvp_net_op_sink and must be freed by
+ *			 caller)
+ *
+ * @return: see acvp_net_op
+ */
+int acvp_net_op_sink(const struct acvp_testid_ctx *testid_ctx, const char *url,
+		     const struct acvp_buf_sink *sink,
+		     struct acvp_buf *response);
+
+/**
+ * @brief Inform the request rate limiter about a retry request of the server
+ *
+ * The rate limiter does not increase the request rate while the server asks
+ * for retries.
+ *
+ * @param seconds [in] Number of seconds the server asked to wait
+ */
+void acvp_net_rate_retry_hint(uint32_t seconds);
+
+/**
+ * @brief Configure the request rate limiter - see acvp_set_net_rate_limit
+ *
+ * @return 0 on success, -EINVAL for inconsistent rates
+ */
+int acvp_net_rate_limit(bool enable, uint32_t rate_start, uint32_t rate_min,
+			uint32_t rate_max);
+
+/**
+ * @brief Sleep for a jittered exponential backoff time
+ *
+ * @param attempt [in] Number of the attempt starting with 1 - the backoff
+ *		       time doubles with every attempt
+ * @param interrupted [in] Variable that interrupts the sleep when set
+ *
+ * @return 0 on success, -EINTR when interrupted
+ */
+int acvp_net_backoff(unsigned int attempt, atomic_bool_t *interrupted);
+
 /************************************************************************
  * ACVP meta data handling
  ************************************************************************/
@@ -965,6 +1067,37 @@ int acvp_login(const struct acvp_testid_ctx *testid_ctx);
  */
 int acvp_login_refresh(const struct acvp_testid_ctx *testid_ctx_head);
 
+/**
+ * @brief Track the JWT auth tokens of the test session for the proactive
+ *	  refresh.
+ *
+ * All tracked JWTs expiring soon are refreshed with one /login/refresh request
+ * by a background thread before they expire. The test session must be
+ * untracked with acvp_auth_refresh_untrack before it is released.
+ *
+ * @param testid_ctx [in] Test session context with an initialized server_auth
+ * @return 0 on success, < 0 on error
+ */
+int acvp_auth_refresh_track(const struct acvp_testid_ctx *testid_ctx);
+
+/**
+ * @brief Stop tracking the test session - waits while the refresh of its JWT
+ *	  is in progress.
+ */
+void acvp_auth_refresh_untrack(const struct acvp_testid_ctx *testid_ctx);
+
+/**
+ * @brief Stop the JWT refresh thread.
+ */
+void acvp_auth_refresh_release(void);
+
+/**
+ * @brief Serialize changes to the ESVP SD list of a tracked test session with
+ *	  the JWT refresh thread.
+ */
+void acvp_auth_refresh_sd_lock(void);
+void acvp_auth_refresh_sd_unlock(void);
+
 /**
  * @brief Check whether auth token needs a refresh by the ACVP server
  *
@@ -1051,6 +1184,11 @@ void sig_uninstall_handler(void);
 
 int acvp_duplicate(char **dst, const char *src);
 int acvp_datastore_file_dir(char *dirname, const bool createdir);
+int
+acvp_datastore_file_testsessiondir(const struct acvp_testid_ctx *testid_ctx,
+				   char *pathname, const size_t pathnamelen,
+				   const bool createdir,
+				   const bool secure_location);
 int acvp_sanitize_string(char *string);
 int acvp_store_vector_status(const struct acvp_vsid_ctx *vsid_ctx,
 			     const char *fmt, ...);
@@ -1083,6 +1221,28 @@ int acvp_req_check_filename(char *string, const size_t slen);
 void acvp_print_expiry(FILE *stream, time_t expiry);
 int acvp_hash_file(const char *pathname, const struct hash *hash,
 		   struct acvp_buf *md);
+
+/**
+ * @brief Calculate the message digests of files. The files are read in
+ *	  windows of limited size and processed together with the
+ *	  multi-buffer hash operation. Thus, files of arbitrary size can be
+ *	  hashed.
+ *
+ * @param pathnames [in] Files to hash
+ * @param hash [in] Hash to use
+ * @param md [out] Message digest of each file - the caller must free the
+ *		   buffers with acvp_free_buf
+ * @param num [in] Number of files
+ * @param cache_file [in] Optional JSON file caching the message digests keyed
+ *			  by the path name - a cached message digest is used
+ *			  if inode, size and modification time of the file
+ *			  are unchanged.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int acvp_hash_files(const char *const pathnames[], const struct hash *hash,
+		    struct acvp_buf *const md[], unsigned int num,
+		    const char *cache_file);
 int acvp_cert_ref(struct acvp_buf *buf);
 
 bool acvp_req_is_production(void);
@@ -1173,6 +1333,9 @@ int acvp_req_kas_r3_kc_method(const struct def_algo_kas_r3_kc *kcm,
 #define ACVP_DEF_DIR_MODINFO "module_info"
 #define ACVP_DEF_DIR_IMPLEMENTATIONS "implementations"
 #define ACVP_DEF_CONFIG_FILE_EXTENSION ".json"
+/* Binary snapshot of the definitions of a definition directory */
+#define ACVP_DEF_SNAPSHOT_PREFIX ".acvpproxy_definitions_"
+#define ACVP_DEF_SNAPSHOT_SUFFIX ".snapshot"
 
 /************************************************************************
  * Auxiliary information
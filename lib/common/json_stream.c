@@ -0,0 +1,450 @@
+/* Streaming processing of ACVP messages
+ *
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "json_stream.h"
+
+/*
+ * State of the array element the processor currently operates on.
+ *
+ * An object element is held back in the pending buffer until its first key
+ * is known which tells whether it is the version or the data object.
+ */
+enum json_stream_elem {
+	JSON_STREAM_ELEM_NONE, /* Between the elements of the message array */
+	JSON_STREAM_ELEM_PENDING, /* Object with unknown first key */
+	JSON_STREAM_ELEM_VERSION, /* Version object */
+	JSON_STREAM_ELEM_DATA, /* Data object */
+	JSON_STREAM_ELEM_OTHER, /* Any other element */
+};
+
+void json_stream_init(struct json_stream *js)
+{
+	memset(js, 0, sizeof(*js));
+}
+
+static int json_stream_flush(struct json_stream *js)
+{
+	const struct acvp_buf_sink *out = js->out;
+	int ret = 0;
+
+	if (out && js->outlen)
+		ret = out->write(out->ctx, js->outbuf, js->outlen);
+	js->outlen = 0;
+
+	return ret;
+}
+
+static int json_stream_emit(struct json_stream *js, const char c)
+{
+	if (!js->out)
+		return 0;
+
+	if (js->outlen == sizeof(js->outbuf)) {
+		int ret = json_stream_flush(js);
+
+		if (ret)
+			return ret;
+	}
+
+	js->outbuf[js->outlen++] = (uint8_t)c;
+
+	return 0;
+}
+
+/* Data object members are emitted unless the first key is still unknown */
+static int json_stream_route(struct json_stream *js, const char c);
+
+static int json_stream_route_str(struct json_stream *js, const char *str)
+{
+	int ret = 0;
+
+	while (*str && !ret)
+		ret = json_stream_route(js, *str++);
+
+	return ret;
+}
+
+/* Decide about the pending element */
+static int json_stream_resolve(struct json_stream *js, const bool version)
+{
+	unsigned int i;
+	int ret = 0;
+
+	if (version) {
+		js->elem_state = JSON_STREAM_ELEM_VERSION;
+	} else if (js->strip_version && js->data_elements) {
+		/* Only the first data object is emitted when stripping */
+		js->elem_state = JSON_STREAM_ELEM_OTHER;
+	} else {
+		js->elem_state = JSON_STREAM_ELEM_DATA;
+		js->data_elements++;
+		js->inject_present = false;
+		js->inject_replacing = false;
+	}
+
+	for (i = 0; i < js->pendinglen && !ret; i++)
+		ret = json_stream_route(js, js->pending[i]);
+	js->pendinglen = 0;
+
+	return ret;
+}
+
+static int json_stream_route(struct json_stream *js, const char c)
+{
+	switch (js->elem_state) {
+	case JSON_STREAM_ELEM_PENDING:
+		if (js->pendinglen == sizeof(js->pending)) {
+			/* Such a long key cannot be the version keyword */
+			int ret = json_stream_resolve(js, false);
+
+			if (ret)
+				return ret;
+			return json_stream_route(js, c);
+		}
+		js->pending[js->pendinglen++] = c;
+		return 0;
+	case JSON_STREAM_ELEM_DATA:
+		/* The value of a member replaced by the injection is dropped */
+		if (js->inject_dropping)
+			return 0;
+		return json_stream_emit(js, c);
+	case JSON_STREAM_ELEM_NONE:
+	case JSON_STREAM_ELEM_VERSION:
+	case JSON_STREAM_ELEM_OTHER:
+	default:
+		if (js->strip_version)
+			return 0;
+		return json_stream_emit(js, c);
+	}
+}
+
+static bool json_stream_in_element_object(const struct json_stream *js)
+{
+	return (js->depth == 2 && js->stack[1] == '{');
+}
+
+static void json_stream_capture(struct json_stream *js, const char c)
+{
+	if (!js->capturing)
+		return;
+
+	if (js->capturelen >= sizeof(js->capture) - 1) {
+		/* Value too large - it is not captured */
+		js->capturing = false;
+		js->capturelen = 0;
+		return;
+	}
+
+	js->capture[js->capturelen++] = c;
+}
+
+static void json_stream_capture_end(struct json_stream *js)
+{
+	if (!js->capturing)
+		return;
+
+	js->capturing = false;
+	if (!js->capturelen)
+		return;
+
+	js->capture[js->capturelen] = '\0';
+	js->captured = true;
+}
+
+/* Is the key the one of the member to inject? */
+static bool json_stream_inject_key(const struct json_stream *js)
+{
+	const char *inject = js->inject;
+
+	/* The member to inject starts with its quoted key */
+	if (!inject || inject[0] != '"' || js->keylen_overflow)
+		return false;
+
+	return (strlen(inject) > js->keylen + 1 &&
+		!memcmp(inject + 1, js->key, js->keylen) &&
+		inject[js->keylen + 1] == '"');
+}
+
+/*
+ * The key of the member to inject is present - emit the remainder of the
+ * member to inject in place of the separator and drop the present value.
+ */
+static int json_stream_inject_value(struct json_stream *js)
+{
+	int ret;
+
+	js->inject_replacing = false;
+	ret = json_stream_route_str(js, js->inject + js->keylen + 2);
+	if (ret)
+		return ret;
+
+	js->inject_dropping = true;
+	js->inject_replaced = true;
+
+	return 0;
+}
+
+/* A key of a member of the array element object is complete */
+static int json_stream_key(struct json_stream *js)
+{
+	int ret = 0;
+
+	js->members = true;
+
+	if (js->elem_state == JSON_STREAM_ELEM_PENDING) {
+		ret = json_stream_resolve(
+			js, !js->keylen_overflow && js->version_keyword &&
+				    js->keylen == strlen(js->version_keyword) &&
+				    !memcmp(js->key, js->version_keyword,
+					    js->keylen));
+		if (ret)
+			return ret;
+	}
+
+	if (js->elem_state != JSON_STREAM_ELEM_DATA)
+		return 0;
+
+	if (json_stream_inject_key(js)) {
+		js->inject_present = true;
+		js->inject_replacing = true;
+	}
+
+	if (!js->capture_key || js->captured || js->keylen_overflow)
+		return 0;
+
+	if (js->keylen == strlen(js->capture_key) &&
+	    !memcmp(js->key, js->capture_key, js->keylen)) {
+		js->capturing = true;
+		js->capturelen = 0;
+	}
+
+	return 0;
+}
+
+static int json_stream_string_char(struct json_stream *js, const char c)
+{
+	int ret;
+
+	if (js->escape) {
+		js->escape = false;
+	} else if (c == '\\') {
+		js->escape = true;
+	} else if (c == '"') {
+		js->in_string = false;
+	}
+
+	/* Strings are part of the captured value including the quotes */
+	json_stream_capture(js, c);
+
+	if (js->in_key && js->in_string) {
+		if (js->keylen < sizeof(js->key))
+			js->key[js->keylen++] = c;
+		else
+			js->keylen_overflow = true;
+	}
+
+	ret = json_stream_route(js, c);
+	if (ret)
+		return ret;
+
+	if (js->in_key && !js->in_string) {
+		js->in_key = false;
+		return json_stream_key(js);
+	}
+
+	return 0;
+}
+
+static int json_stream_open(struct json_stream *js, const char c)
+{
+	if (js->depth >= JSON_STREAM_MAXDEPTH)
+		return -EOVERFLOW;
+
+	switch (js->depth) {
+	case 0:
+		/* An ACVP message is an array */
+		if (c != '[')
+			return -EINVAL;
+		break;
+	case 1:
+		js->elem_state = (c == '{') ? JSON_STREAM_ELEM_PENDING :
+					      JSON_STREAM_ELEM_OTHER;
+		js->expect_key = true;
+		js->members = false;
+		break;
+	default:
+		/* Only scalar values are captured */
+		js->capturing = false;
+		break;
+	}
+
+	js->stack[js->depth++] = c;
+
+	return json_stream_route(js, c);
+}
+
+static int json_stream_close(struct json_stream *js, const char c)
+{
+	int ret;
+
+	if (!js->depth)
+		return -EINVAL;
+
+	if (js->stack[js->depth - 1] != ((c == '}') ? '{' : '['))
+		return -EINVAL;
+
+	if (json_stream_in_element_object(js)) {
+		json_stream_capture_end(js);
+
+		/* Empty object */
+		if (js->elem_state == JSON_STREAM_ELEM_PENDING) {
+			ret = json_stream_resolve(js, false);
+			if (ret)
+				return ret;
+		}
+
+		js->inject_dropping = false;
+
+		/* A present member already received the value to inject */
+		if (js->elem_state == JSON_STREAM_ELEM_DATA && js->inject &&
+		    !js->inject_present) {
+			if (js->members) {
+				ret = json_stream_route_str(js, ", ");
+				if (ret)
+					return ret;
+			}
+			ret = json_stream_route_str(js, js->inject);
+			if (ret)
+				return ret;
+		}
+	}
+
+	if (js->depth == 1)
+		js->elem_state = JSON_STREAM_ELEM_NONE;
+
+	ret = json_stream_route(js, c);
+	if (ret)
+		return ret;
+
+	js->depth--;
+	if (js->depth == 1)
+		js->elem_state = JSON_STREAM_ELEM_NONE;
+	if (!js->depth)
+		js->done = true;
+
+	return 0;
+}
+
+static int json_stream_char(struct json_stream *js, const char c)
+{
+	/* Any data after the message is ignored */
+	if (js->done)
+		return 0;
+
+	if (js->in_string)
+		return json_stream_string_char(js, c);
+
+	switch (c) {
+	case ' ':
+	case '\t':
+	case '\r':
+	case '\n':
+		return json_stream_route(js, c);
+
+	case '"':
+		if (!js->depth)
+			return -EINVAL;
+		if (js->depth == 1)
+			js->elem_state = JSON_STREAM_ELEM_OTHER;
+		js->in_string = true;
+		js->escape = false;
+		if (json_stream_in_element_object(js) && js->expect_key) {
+			js->in_key = true;
+			js->keylen = 0;
+			js->keylen_overflow = false;
+		}
+		json_stream_capture(js, c);
+		return json_stream_route(js, c);
+
+	case '{':
+	case '[':
+		return json_stream_open(js, c);
+
+	case '}':
+	case ']':
+		return json_stream_close(js, c);
+
+	case ',':
+		if (!js->depth)
+			return -EINVAL;
+		if (js->depth == 1)
+			js->elem_state = JSON_STREAM_ELEM_NONE;
+		if (json_stream_in_element_object(js)) {
+			json_stream_capture_end(js);
+			js->expect_key = true;
+			js->inject_dropping = false;
+		}
+		return json_stream_route(js, c);
+
+	case ':':
+		if (json_stream_in_element_object(js)) {
+			js->expect_key = false;
+			if (js->inject_replacing)
+				return json_stream_inject_value(js);
+		}
+		return json_stream_route(js, c);
+
+	default:
+		/* Literals and numbers */
+		if (!js->depth)
+			return -EINVAL;
+		if (js->depth == 1)
+			js->elem_state = JSON_STREAM_ELEM_OTHER;
+		json_stream_capture(js, c);
+		return json_stream_route(js, c);
+	}
+}
+
+int json_stream_update(struct json_stream *js, const uint8_t *data,
+		       uint32_t len)
+{
+	uint32_t i;
+	int ret = 0;
+
+	for (i = 0; i < len && !ret; i++)
+		ret = json_stream_char(js, (char)data[i]);
+
+	return ret;
+}
+
+int json_stream_final(struct json_stream *js)
+{
+	if (!js->done || js->in_string)
+		return -EINVAL;
+
+	/* There must be a data object to emit or to inject into */
+	if ((js->strip_version || js->inject) && !js->data_elements)
+		return -EINVAL;
+
+	return json_stream_flush(js);
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef _JSON_STREAM_H
+#define _JSON_STREAM_H
+
+#include <stdint.h>
+
+#include "bool.h"
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Streaming processing of an ACVP message
+ *
+ * ACVP messages are JSON arrays holding a version object and a data object:
+ *
+ * [
+ *   { "acvVersion": "1.0" },
+ *   { "vsId": 1437,
+ *     ....
+ *   }
+ * ]
+ *
+ * The stream processor operates on the message in chunks of arbitrary size
+ * without building a JSON object tree. Its memory consumption only depends on
+ * the nesting depth of the message. It can
+ *
+ *	* strip the version object and emit only the data object,
+ *
+ *	* inject a JSON member into the data object - if the data object
+ *	  already contains its key, the value of that member is replaced,
+ *
+ *	* capture the scalar value of one member of the data object.
+ *
+ * The processor validates the structure of the message (nesting of objects,
+ * arrays and strings), but not the syntax of literals.
+ */
+
+#define JSON_STREAM_MAXDEPTH 64
+#define JSON_STREAM_KEYLEN 64
+#define JSON_STREAM_PENDINGLEN 256
+#define JSON_STREAM_OUTLEN 4096
+
+/*
+ * @version_keyword: Key identifying the version object (e.g. "acvVersion")
+ * @strip_version: Emit only the data object
+ * @inject: JSON member to add to the data object (e.g. "\"key\": true"),
+ *	    may be NULL
+ * @capture_key: Key of the member of the data object whose scalar value shall
+ *		 be captured, may be NULL
+ * @out: Sink receiving the resulting message, may be NULL
+ * @capture: Captured value (NULL-terminated, strings with quotes)
+ * @captured: Is the captured value present?
+ * @inject_replaced: The key of @inject was already present in the data object
+ *		     and the value of that member was replaced
+ */
+struct json_stream {
+	const char *version_keyword;
+	bool strip_version;
+	const char *inject;
+	const char *capture_key;
+	const struct acvp_buf_sink *out;
+
+	char capture[JSON_STREAM_KEYLEN];
+	bool captured;
+	bool inject_replaced;
+
+	/* Private state */
+	char stack[JSON_STREAM_MAXDEPTH];
+	unsigned int depth;
+	unsigned int elem_state;
+	unsigned int data_elements;
+	bool in_string;
+	bool escape;
+	bool done;
+	bool expect_key;
+	bool members;
+	bool in_key;
+	bool capturing;
+	bool keylen_overflow;
+	bool inject_present;
+	bool inject_replacing;
+	bool inject_dropping;
+	char key[JSON_STREAM_KEYLEN];
+	unsigned int keylen;
+	unsigned int capturelen;
+	char pending[JSON_STREAM_PENDINGLEN];
+	unsigned int pendinglen;
+	uint8_t outbuf[JSON_STREAM_OUTLEN];
+	unsigned int outlen;
+};
+
+/**
+ * @brief Initialize the stream processor - the configuration fields of
+ *	  the context must be set after the initialization.
+ */
+void json_stream_init(struct json_stream *js);
+
+/**
+ * @brief Process the next chunk of the message.
+ *
+ * @return 0 on success, -EINVAL on malformed data, -EOVERFLOW if the nesting
+ *	   is too deep, other error of the sink
+ */
+int json_stream_update(struct json_stream *js, const uint8_t *data,
+		       uint32_t len);
+
+/**
+ * @brief Finish the processing - flush the remaining output and check that
+ *	  the complete message was received.
+ *
+ * @return 0 on success, -EINVAL when the message is incomplete, other error of
+ *	   the sink
+ */
+int json_stream_final(struct json_stream *js);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _JSON_STREAM_H */
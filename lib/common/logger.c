@@ -19,6 +19,7 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -28,7 +29,9 @@
 
 #include "aux_helper.h"
 #include "binhexbin.h"
+#include "bool.h"
 #include "build_bug_on.h"
+#include "config.h"
 #include "constructor.h"
 #include "logger.h"
 #include "term_colors.h"
@@ -53,6 +56,7 @@ static const struct logger_class_map logger_class_mapping[] = {
 	{ LOGGER_C_DS_FILE, "File backend" },
 	{ LOGGER_C_TOTP, "TOTP generation" },
 	{ LOGGER_C_CURL, "HTTP operation" },
+	{ LOGGER_C_DS_LOG, "Log backend" },
 };
 
 static void logger_severity(enum logger_verbosity severity, char *sev,
@@ -121,75 +125,80 @@ static int logger_class(const enum logger_class class, char *s,
 	return 0;
 }
 
-DSO_PUBLIC
-void _logger(const enum logger_verbosity severity,
-	     const enum logger_class class, const char *file, const char *func,
-	     const uint32_t line, const char *fmt, ...)
-{
-	time_t now;
-	struct tm now_detail;
-	va_list args;
-	int (*fprintf_color)(FILE * stream, const char *format, ...) = &fprintf;
-	int ret;
-	char msg[4096];
-	char sev[10];
-	char c[30];
-	char thread_name[ACVP_THREAD_MAX_NAMELEN];
-
-	if (!logger_stream)
-		logger_stream = stderr;
-
-	if (severity > logger_verbosity_level)
-		return;
-
-	va_start(args, fmt);
-	vsnprintf(msg, sizeof(msg), fmt, args);
-	va_end(args);
+/*
+ * Format the local time as hh:mm:ss. The conversion is cached per thread as
+ * localtime_r is comparably expensive and the time only changes once a second.
+ */
+static __thread time_t logger_time_last = (time_t)-1;
+static __thread struct tm logger_time_detail;
 
-	logger_severity(severity, sev, sizeof(sev));
-	ret = logger_class(class, c, sizeof(c));
-	if (ret)
-		return;
+static const struct tm *logger_localtime(time_t now)
+{
+	if (now != logger_time_last) {
+		localtime_r(&now, &logger_time_detail);
+		logger_time_last = now;
+	}
 
-	now = time(NULL);
-	localtime_r(&now, &now_detail);
+	return &logger_time_detail;
+}
 
+static const char *logger_color(enum logger_verbosity severity)
+{
 	switch (severity) {
 	case LOGGER_DEBUG2:
-		fprintf_color = &fprintf_cyan;
-		break;
+		return TERM_COLOR_CYAN;
 	case LOGGER_DEBUG:
-		fprintf_color = &fprintf_blue;
-		break;
+		return TERM_COLOR_BLUE;
 	case LOGGER_VERBOSE:
-		fprintf_color = &fprintf_green;
-		break;
+		return TERM_COLOR_GREEN;
 	case LOGGER_WARN:
-		fprintf_color = &fprintf_yellow;
-		break;
+		return TERM_COLOR_YELLOW;
 	case LOGGER_ERR:
-		fprintf_color = &fprintf_red;
-		break;
+		return TERM_COLOR_RED;
 	case LOGGER_STATUS:
-		fprintf_color = &fprintf_magenta;
-		break;
+		return TERM_COLOR_MAGENTA;
 	case LOGGER_NONE:
 	case LOGGER_MAX_LEVEL:
 	default:
-		fprintf_color = &fprintf;
+		return NULL;
 	}
+}
 
-	thread_get_name(thread_name, sizeof(thread_name));
+/*
+ * Write one log line with a single stdio operation so that lines of
+ * different threads are not interleaved.
+ */
+static void logger_write(const enum logger_verbosity severity,
+			 const unsigned int class_idx, const char *file,
+			 const char *func, const uint32_t line,
+			 const char *thread_name, const time_t now,
+			 const char *msg)
+{
+	const struct tm *now_detail = logger_localtime(now);
+	const char *color = logger_color(severity);
+	char out[4096 + 512];
+	char sev[10];
+	char c[30];
+	int len;
+
+	logger_severity(severity, sev, sizeof(sev));
+
+	if (logger_class_mapping[class_idx].logdata)
+		snprintf(c, sizeof(c), " - %s",
+			 logger_class_mapping[class_idx].logdata);
+	else
+		c[0] = '\0';
 
 	switch (logger_verbosity_level) {
 	case LOGGER_DEBUG2:
 	case LOGGER_DEBUG:
-		fprintf_color(
-			logger_stream,
-			"ACVPProxy (%.2d:%.2d:%.2d) (%s) %s%s [%s:%s:%u]: ",
-			now_detail.tm_hour, now_detail.tm_min,
-			now_detail.tm_sec, thread_name, sev, c, file, func,
-			line);
+		len = snprintf(
+			out, sizeof(out),
+			"%sACVPProxy (%.2d:%.2d:%.2d) (%s) %s%s [%s:%s:%u]: %s%s",
+			color ? color : "", now_detail->tm_hour,
+			now_detail->tm_min, now_detail->tm_sec, thread_name,
+			sev, c, file, func, line,
+			color ? TERM_COLOR_NORMAL : "", msg);
 		break;
 	case LOGGER_VERBOSE:
 	case LOGGER_WARN:
@@ -198,14 +207,464 @@ void _logger(const enum logger_verbosity severity,
 	case LOGGER_NONE:
 	case LOGGER_MAX_LEVEL:
 	default:
-		fprintf_color(logger_stream,
-			      "ACVPProxy (%.2d:%.2d:%.2d) (%s) %s%s: ",
-			      now_detail.tm_hour, now_detail.tm_min,
-			      now_detail.tm_sec, thread_name, sev, c);
+		len = snprintf(out, sizeof(out),
+			       "%sACVPProxy (%.2d:%.2d:%.2d) (%s) %s%s: %s%s",
+			       color ? color : "", now_detail->tm_hour,
+			       now_detail->tm_min, now_detail->tm_sec,
+			       thread_name, sev, c,
+			       color ? TERM_COLOR_NORMAL : "", msg);
 		break;
 	}
 
-	fprintf(logger_stream, "%s", msg);
+	if (len < 0)
+		return;
+	if ((size_t)len >= sizeof(out))
+		len = sizeof(out) - 1;
+
+	fwrite(out, 1, (size_t)len, logger_stream);
+}
+
+#ifdef ACVP_USE_PTHREAD
+
+#include <pthread.h>
+
+/*
+ * Asynchronous logging
+ *
+ * Every logging thread owns a ring buffer it is the only writer of. The
+ * message is formatted by the caller, but the line prefix formatting and the
+ * I/O is performed by one drain thread which is the only reader of all ring
+ * buffers. Thus no locks are needed in the logging path and the order of the
+ * messages of one thread is retained. If a ring buffer is full, the message is
+ * dropped and accounted for.
+ *
+ * When all ring buffers are empty, the drain thread blocks on a condition
+ * variable. A logging thread only takes the wait lock to wake it up when it
+ * publishes a message while the drain thread announced that it sleeps.
+ */
+#define LOGGER_ASYNC_RING_SIZE (64 * 1024)
+#define LOGGER_ASYNC_ALIGN 8
+#define LOGGER_ASYNC_PAD ((uint32_t)-1)
+
+/* Header of one message in the ring buffer followed by the message string */
+struct logger_async_rec {
+	uint32_t size; /* must be first as padding only consists of the size */
+	uint32_t line;
+	uint8_t severity;
+	uint8_t class_idx;
+	time_t now;
+	const char *file;
+	const char *func;
+	char thread_name[ACVP_THREAD_MAX_NAMELEN];
+	char msg[];
+};
+
+struct logger_async_ring {
+	struct logger_async_ring *next;
+	uint64_t head; /* written by the owning thread */
+	uint64_t tail; /* written by the drain thread */
+	uint64_t dropped; /* written by the owning thread */
+	uint64_t dropped_reported; /* written by the drain thread */
+	bool orphaned;
+	uint8_t buf[LOGGER_ASYNC_RING_SIZE]
+		__attribute__((aligned(LOGGER_ASYNC_ALIGN)));
+};
+
+static struct logger_async_ring *logger_async_rings = NULL;
+static __thread struct logger_async_ring *logger_async_ring = NULL;
+static pthread_key_t logger_async_key;
+static bool logger_async_key_created = false;
+static pthread_mutex_t logger_async_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t logger_async_ctrl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t logger_async_wait_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logger_async_wait_cond = PTHREAD_COND_INITIALIZER;
+static bool logger_async_sleeping = false;
+static pthread_t logger_async_thread_id;
+static bool logger_async_enabled = false;
+static bool logger_async_running = false;
+static bool logger_async_stop = false;
+
+/* The owning thread terminates - the drain thread releases the ring buffer */
+static void logger_async_ring_orphan(void *arg)
+{
+	struct logger_async_ring *ring = arg;
+
+	logger_async_ring = NULL;
+	__atomic_store_n(&ring->orphaned, true, __ATOMIC_RELEASE);
+}
+
+static struct logger_async_ring *logger_async_ring_get(void)
+{
+	struct logger_async_ring *ring = logger_async_ring;
+
+	if (ring)
+		return ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	if (pthread_setspecific(logger_async_key, ring)) {
+		free(ring);
+		return NULL;
+	}
+
+	ring->next = __atomic_load_n(&logger_async_rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&logger_async_rings, &ring->next,
+					    ring, true, __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+
+	logger_async_ring = ring;
+
+	return ring;
+}
+
+/* Enqueue a message - returns false if the message must be logged directly */
+static bool logger_async_enqueue(const enum logger_verbosity severity,
+				 const unsigned int class_idx, const char *file,
+				 const char *func, const uint32_t line,
+				 const char *msg)
+{
+	struct logger_async_ring *ring;
+	struct logger_async_rec *rec;
+	uint64_t head, tail;
+	size_t msglen, size, off, contig;
+
+	if (!__atomic_load_n(&logger_async_enabled, __ATOMIC_ACQUIRE))
+		return false;
+
+	ring = logger_async_ring_get();
+	if (!ring)
+		return false;
+
+	msglen = strlen(msg) + 1;
+	size = (sizeof(*rec) + msglen + LOGGER_ASYNC_ALIGN - 1) &
+	       ~((size_t)LOGGER_ASYNC_ALIGN - 1);
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	off = head & (LOGGER_ASYNC_RING_SIZE - 1);
+	contig = LOGGER_ASYNC_RING_SIZE - off;
+
+	/* The record must be contiguous, pad the remainder of the ring */
+	if (LOGGER_ASYNC_RING_SIZE - (head - tail) <
+	    size + (contig < size ? contig : 0)) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1,
+				 __ATOMIC_RELAXED);
+		return true;
+	}
+	if (contig < size) {
+		*(uint32_t *)(ring->buf + off) = LOGGER_ASYNC_PAD;
+		head += contig;
+		off = 0;
+	}
+
+	rec = (struct logger_async_rec *)(ring->buf + off);
+	rec->size = (uint32_t)size;
+	rec->line = line;
+	rec->severity = (uint8_t)severity;
+	rec->class_idx = (uint8_t)class_idx;
+	rec->now = time(NULL);
+	rec->file = file;
+	rec->func = func;
+	rec->thread_name[0] = '\0';
+	thread_get_name(rec->thread_name, sizeof(rec->thread_name));
+	memcpy(rec->msg, msg, msglen);
+
+	__atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);
+
+	/*
+	 * Order the publication of the message before checking whether the
+	 * drain thread sleeps - pairs with the fence in logger_async_thread.
+	 * Only the first thread observing the sleeping drain thread wakes it.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&logger_async_sleeping, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&logger_async_sleeping, false,
+				__ATOMIC_ACQ_REL)) {
+		pthread_mutex_lock(&logger_async_wait_lock);
+		pthread_cond_signal(&logger_async_wait_cond);
+		pthread_mutex_unlock(&logger_async_wait_lock);
+	}
+
+	return true;
+}
+
+/* Write all messages of one ring buffer - caller holds the drain lock */
+static unsigned int logger_async_drain_ring(struct logger_async_ring *ring)
+{
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = ring->tail, dropped;
+	unsigned int written = 0;
+
+	while (tail != head) {
+		struct logger_async_rec *rec =
+			(struct logger_async_rec *)(ring->buf +
+						    (tail &
+						     (LOGGER_ASYNC_RING_SIZE -
+						      1)));
+
+		if (rec->size == LOGGER_ASYNC_PAD) {
+			tail += LOGGER_ASYNC_RING_SIZE -
+				(tail & (LOGGER_ASYNC_RING_SIZE - 1));
+			continue;
+		}
+
+		logger_write((enum logger_verbosity)rec->severity,
+			     rec->class_idx, rec->file, rec->func, rec->line,
+			     rec->thread_name, rec->now, rec->msg);
+		tail += rec->size;
+		written++;
+
+		/* Give the space back early to the logging thread */
+		if (!(written & 63))
+			__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	if (dropped != ring->dropped_reported) {
+		char msg[80];
+
+		snprintf(msg, sizeof(msg), "%" PRIu64 " log messages dropped\n",
+			 dropped - ring->dropped_reported);
+		logger_write(LOGGER_WARN, 0, __FILE__, __func__, __LINE__,
+			     "logger", time(NULL), msg);
+		ring->dropped_reported = dropped;
+		written++;
+	}
+
+	return written;
+}
+
+/* Write all pending messages and release the rings of terminated threads */
+static unsigned int logger_async_drain(void)
+{
+	struct logger_async_ring *ring, *prev = NULL, *next;
+	unsigned int written = 0;
+
+	pthread_mutex_lock(&logger_async_drain_lock);
+
+	for (ring = __atomic_load_n(&logger_async_rings, __ATOMIC_ACQUIRE);
+	     ring; ring = next) {
+		bool orphaned = __atomic_load_n(&ring->orphaned,
+						__ATOMIC_ACQUIRE);
+
+		next = ring->next;
+		written += logger_async_drain_ring(ring);
+
+		if (!orphaned ||
+		    ring->tail != __atomic_load_n(&ring->head,
+						  __ATOMIC_ACQUIRE)) {
+			prev = ring;
+			continue;
+		}
+
+		/*
+		 * Unlink the ring - new rings are only ever added at the head
+		 * of the list.
+		 */
+		if (prev) {
+			prev->next = next;
+		} else {
+			struct logger_async_ring *expected = ring;
+
+			if (!__atomic_compare_exchange_n(
+				    &logger_async_rings, &expected, next, false,
+				    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				for (prev = expected; prev->next != ring;
+				     prev = prev->next)
+					;
+				prev->next = next;
+			}
+		}
+		free(ring);
+	}
+
+	if (written && logger_stream)
+		fflush(logger_stream);
+
+	pthread_mutex_unlock(&logger_async_drain_lock);
+
+	return written;
+}
+
+/* Is any message pending in one of the ring buffers? */
+static bool logger_async_pending(void)
+{
+	struct logger_async_ring *ring;
+	bool pending = false;
+
+	pthread_mutex_lock(&logger_async_drain_lock);
+	for (ring = __atomic_load_n(&logger_async_rings, __ATOMIC_ACQUIRE);
+	     ring; ring = ring->next) {
+		if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) !=
+		    ring->tail) {
+			pending = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&logger_async_drain_lock);
+
+	return pending;
+}
+
+/* Block until a logging thread publishes a message or the thread is stopped */
+static void logger_async_wait(void)
+{
+	pthread_mutex_lock(&logger_async_wait_lock);
+
+	__atomic_store_n(&logger_async_sleeping, true, __ATOMIC_RELAXED);
+
+	/* Pairs with the fence in logger_async_enqueue */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (logger_async_pending()) {
+		__atomic_store_n(&logger_async_sleeping, false,
+				 __ATOMIC_RELAXED);
+		goto out;
+	}
+
+	while (__atomic_load_n(&logger_async_sleeping, __ATOMIC_ACQUIRE) &&
+	       !__atomic_load_n(&logger_async_stop, __ATOMIC_ACQUIRE))
+		pthread_cond_wait(&logger_async_wait_cond,
+				  &logger_async_wait_lock);
+
+	__atomic_store_n(&logger_async_sleeping, false, __ATOMIC_RELAXED);
+
+out:
+	pthread_mutex_unlock(&logger_async_wait_lock);
+}
+
+static void *logger_async_thread(void *arg)
+{
+	(void)arg;
+
+	while (!__atomic_load_n(&logger_async_stop, __ATOMIC_ACQUIRE)) {
+		if (!logger_async_drain())
+			logger_async_wait();
+	}
+
+	logger_async_drain();
+
+	return NULL;
+}
+
+static void logger_async_flush(void)
+{
+	if (__atomic_load_n(&logger_async_rings, __ATOMIC_ACQUIRE))
+		logger_async_drain();
+}
+
+static void logger_async_disable(void)
+{
+	pthread_mutex_lock(&logger_async_ctrl_lock);
+	__atomic_store_n(&logger_async_enabled, false, __ATOMIC_RELEASE);
+	if (logger_async_running) {
+		pthread_mutex_lock(&logger_async_wait_lock);
+		__atomic_store_n(&logger_async_stop, true, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&logger_async_wait_cond);
+		pthread_mutex_unlock(&logger_async_wait_lock);
+		pthread_join(logger_async_thread_id, NULL);
+		logger_async_running = false;
+	}
+	pthread_mutex_unlock(&logger_async_ctrl_lock);
+
+	logger_async_flush();
+}
+
+static int logger_async_enable(void)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&logger_async_ctrl_lock);
+	if (logger_async_running)
+		goto out;
+
+	if (!logger_async_key_created) {
+		ret = -pthread_key_create(&logger_async_key,
+					  logger_async_ring_orphan);
+		if (ret)
+			goto out;
+		logger_async_key_created = true;
+	}
+
+	__atomic_store_n(&logger_async_stop, false, __ATOMIC_RELEASE);
+	ret = -pthread_create(&logger_async_thread_id, NULL,
+			      logger_async_thread, NULL);
+	if (ret)
+		goto out;
+
+	logger_async_running = true;
+	__atomic_store_n(&logger_async_enabled, true, __ATOMIC_RELEASE);
+
+out:
+	pthread_mutex_unlock(&logger_async_ctrl_lock);
+	return ret;
+}
+
+#else /* ACVP_USE_PTHREAD */
+
+static bool logger_async_enqueue(const enum logger_verbosity severity,
+				 const unsigned int class_idx, const char *file,
+				 const char *func, const uint32_t line,
+				 const char *msg)
+{
+	(void)severity;
+	(void)class_idx;
+	(void)file;
+	(void)func;
+	(void)line;
+	(void)msg;
+	return false;
+}
+
+static void logger_async_flush(void)
+{
+}
+
+static void logger_async_disable(void)
+{
+}
+
+static int logger_async_enable(void)
+{
+	return -EOPNOTSUPP;
+}
+
+#endif /* ACVP_USE_PTHREAD */
+
+DSO_PUBLIC
+void _logger(const enum logger_verbosity severity,
+	     const enum logger_class class, const char *file, const char *func,
+	     const uint32_t line, const char *fmt, ...)
+{
+	va_list args;
+	unsigned int class_idx;
+	char msg[4096];
+	char thread_name[ACVP_THREAD_MAX_NAMELEN] = { 0 };
+
+	if (!logger_stream)
+		logger_stream = stderr;
+
+	if (severity > logger_verbosity_level)
+		return;
+
+	if (logger_class_idx(class, &class_idx))
+		return;
+
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+
+	if (logger_async_enqueue(severity, class_idx, file, func, line, msg))
+		return;
+
+	thread_get_name(thread_name, sizeof(thread_name));
+	logger_write(severity, class_idx, file, func, line, thread_name,
+		     time(NULL), msg);
+	fflush(logger_stream);
 }
 
 DSO_PUBLIC
@@ -255,6 +714,7 @@ void _logger_binary(const enum logger_verbosity severity,
 		break;
 	}
 
+	logger_async_flush();
 	bin2print(bin, binlen, logger_stream, msg);
 }
 
@@ -266,6 +726,8 @@ void logger_spinner(const unsigned int percentage, const char *fmt, ...)
 	if (logger_verbosity_level > LOGGER_ERR)
 		return;
 
+	logger_async_flush();
+
 	if (percentage >= 100) {
 		if (start < 2) {
 			fprintf(stderr, "\n");
@@ -298,8 +760,13 @@ void logger_spinner(const unsigned int percentage, const char *fmt, ...)
 
 static void logger_destructor(void)
 {
-	if (logger_stream && logger_stream != stderr)
+	logger_async_disable();
+
+	if (logger_stream && logger_stream != stderr) {
 		fclose(logger_stream);
+		/* Messages of later exit handlers */
+		logger_stream = stderr;
+	}
 }
 
 ACVP_DEFINE_CONSTRUCTOR(logger_constructor)
@@ -334,6 +801,29 @@ int logger_set_file(const char *pathname)
 	return 0;
 }
 
+DSO_PUBLIC
+int logger_set_async(const bool enable)
+{
+	static bool registered = false;
+	int ret;
+
+	if (!enable) {
+		logger_async_disable();
+		return 0;
+	}
+
+	ret = logger_async_enable();
+	if (ret)
+		return ret;
+
+	if (!registered) {
+		atexit(logger_destructor);
+		registered = true;
+	}
+
+	return 0;
+}
+
 DSO_PUBLIC
 void logger_set_verbosity(const enum logger_verbosity level)
 {
@@ -23,6 +23,8 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "bool.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -48,6 +50,7 @@ enum logger_class {
 	LOGGER_C_DS_FILE,
 	LOGGER_C_TOTP,
 	LOGGER_C_CURL,
+	LOGGER_C_DS_LOG,
 
 	LOGGER_C_LAST /* This must be last entry */
 };
@@ -146,6 +149,22 @@ void logger_inc_verbosity(void);
  */
 int logger_set_file(const char *pathname);
 
+/**
+ * Enable or disable asynchronous logging
+ *
+ * With asynchronous logging, each thread stores its log messages in its own
+ * ring buffer without taking any lock. A separate thread writes the messages
+ * to the log stream. The order of the messages of one thread is retained,
+ * messages of different threads may be reordered. If the ring buffer of a
+ * thread is full, its messages are dropped and the number of dropped messages
+ * is logged.
+ *
+ * @param enable [in] true to enable, false to disable and write all pending
+ *		      messages
+ * @return 0 on success, < 0 on error
+ */
+int logger_set_async(const bool enable);
+
 /**
  * Retrieve the file stream to log to.
  */
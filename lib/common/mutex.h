@@ -42,6 +42,16 @@ static inline void mutex_lock(mutex_t *mutex)
 	pthread_rwlock_wrlock(mutex);
 }
 
+/**
+ * Try to take the mutual exclusion lock without waiting.
+ * @param mutex [in] lock variable to lock
+ * @return 0 if the lock was taken, < 0 otherwise
+ */
+static inline int mutex_trylock(mutex_t *mutex)
+{
+	return -pthread_rwlock_trywrlock(mutex);
+}
+
 /**
  * Unlock the lock
  * @param mutex [in] lock variable to lock
@@ -24,15 +24,38 @@
 #include <unistd.h>
 
 #include <curl/curl.h>
+#include <zlib.h>
 
+#include "atomic.h"
 #include "atomic_bool.h"
 #include "logger.h"
 #include "acvpproxy.h"
 #include "internal.h"
-#include "sleep.h"
+#include "mutex_w.h"
 
 #define HTTP_OK 200
 #define ACVP_CURL_MAX_RETRIES 3
+/* First backoff attempt used for failed transfers - about 4 to 8 seconds */
+#define ACVP_CURL_BACKOFF_START 5
+
+/*
+ * Maximum number of idle CURL easy handles kept in the handle pool. If more
+ * handles are concurrently in use, the surplus handles are released after
+ * their use.
+ */
+#define ACVP_CURL_POOL_SIZE 64
+
+/*
+ * Maximum number of connections to one server used by the HTTP/2 multiplexer.
+ * Each connection carries up to the number of concurrent streams the server
+ * permits.
+ */
+#define ACVP_CURL_MUX_MAX_CONNECTIONS 4
+
+/* The multiplexer requires curl_multi_poll and curl_multi_wakeup */
+#if LIBCURL_VERSION_NUM >= 0x074400
+#define ACVP_CURL_MUX
+#endif
 
 #define CURL_CKINT(x)                                                          \
 	{                                                                      \
@@ -53,6 +76,422 @@ static void acvp_curl_interrupt(void)
 	atomic_bool_set_true(&acvp_curl_interrupted);
 }
 
+/*****************************************************************************
+ * Connection and handle pool
+ *
+ * All CURL easy handles are attached to one CURL share object which holds
+ * the connection cache, the TLS session cache and the DNS cache. This way
+ * an established (mutual-)TLS connection to the ACVP server is reused by
+ * all subsequent HTTP requests independent of the thread issuing them.
+ *
+ * In addition, the easy handles are not destroyed after use, but kept in
+ * a pool and reset before the next use.
+ *****************************************************************************/
+static CURLSH *acvp_curl_share = NULL;
+static mutex_w_t acvp_curl_share_lock[CURL_LOCK_DATA_LAST];
+
+static CURL *acvp_curl_pool[ACVP_CURL_POOL_SIZE];
+static unsigned int acvp_curl_pool_idle = 0;
+static DEFINE_MUTEX_W_UNLOCKED(acvp_curl_pool_lock);
+
+/* Statistics about the connection reuse */
+static atomic_t acvp_curl_stat_transfers = ATOMIC_INIT(0);
+static atomic_t acvp_curl_stat_connects = ATOMIC_INIT(0);
+static atomic_t acvp_curl_stat_reused = ATOMIC_INIT(0);
+static atomic_t acvp_curl_stat_http2 = ATOMIC_INIT(0);
+
+static void acvp_curl_share_lock_cb(CURL *handle, curl_lock_data data,
+				    curl_lock_access access, void *userptr)
+{
+	(void)handle;
+	(void)access;
+	(void)userptr;
+
+	if (data < CURL_LOCK_DATA_LAST)
+		mutex_w_lock(&acvp_curl_share_lock[data]);
+}
+
+static void acvp_curl_share_unlock_cb(CURL *handle, curl_lock_data data,
+				      void *userptr)
+{
+	(void)handle;
+	(void)userptr;
+
+	if (data < CURL_LOCK_DATA_LAST)
+		mutex_w_unlock(&acvp_curl_share_lock[data]);
+}
+
+static int acvp_curl_share_init(void)
+{
+	CURLSHcode sret;
+	unsigned int i;
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		mutex_w_init(&acvp_curl_share_lock[i], 0);
+
+	acvp_curl_share = curl_share_init();
+	if (!acvp_curl_share)
+		return -ENOMEM;
+
+	sret = curl_share_setopt(acvp_curl_share, CURLSHOPT_LOCKFUNC,
+				 acvp_curl_share_lock_cb);
+	if (sret)
+		goto err;
+	sret = curl_share_setopt(acvp_curl_share, CURLSHOPT_UNLOCKFUNC,
+				 acvp_curl_share_unlock_cb);
+	if (sret)
+		goto err;
+	sret = curl_share_setopt(acvp_curl_share, CURLSHOPT_SHARE,
+				 CURL_LOCK_DATA_DNS);
+	if (sret)
+		goto err;
+	sret = curl_share_setopt(acvp_curl_share, CURLSHOPT_SHARE,
+				 CURL_LOCK_DATA_SSL_SESSION);
+	if (sret)
+		goto err;
+#if LIBCURL_VERSION_NUM >= 0x073900
+	sret = curl_share_setopt(acvp_curl_share, CURLSHOPT_SHARE,
+				 CURL_LOCK_DATA_CONNECT);
+	if (sret)
+		goto err;
+#endif
+
+	return 0;
+
+err:
+	logger(LOGGER_WARN, LOGGER_C_CURL,
+	       "Setting up CURL share object failed: %s\n",
+	       curl_share_strerror(sret));
+	curl_share_cleanup(acvp_curl_share);
+	acvp_curl_share = NULL;
+	return -EFAULT;
+}
+
+static void acvp_curl_share_release(void)
+{
+	unsigned int i;
+
+	if (!acvp_curl_share)
+		return;
+
+	curl_share_cleanup(acvp_curl_share);
+	acvp_curl_share = NULL;
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		mutex_w_destroy(&acvp_curl_share_lock[i]);
+}
+
+/* Obtain an easy handle - either an idle handle from the pool or a new one */
+static CURL *acvp_curl_handle_get(void)
+{
+	CURL *curl = NULL;
+
+	mutex_w_lock(&acvp_curl_pool_lock);
+	if (acvp_curl_pool_idle) {
+		acvp_curl_pool_idle--;
+		curl = acvp_curl_pool[acvp_curl_pool_idle];
+		acvp_curl_pool[acvp_curl_pool_idle] = NULL;
+	}
+	mutex_w_unlock(&acvp_curl_pool_lock);
+
+	if (curl) {
+		/*
+		 * The reset only clears the options, the live connections
+		 * and the session ID cache remain available.
+		 */
+		curl_easy_reset(curl);
+		return curl;
+	}
+
+	return curl_easy_init();
+}
+
+/* Return an easy handle to the pool */
+static void acvp_curl_handle_put(CURL *curl)
+{
+	if (!curl)
+		return;
+
+	mutex_w_lock(&acvp_curl_pool_lock);
+	if (acvp_curl_pool_idle < ACVP_CURL_POOL_SIZE &&
+	    !atomic_bool_read(&acvp_curl_interrupted)) {
+		acvp_curl_pool[acvp_curl_pool_idle] = curl;
+		acvp_curl_pool_idle++;
+		curl = NULL;
+	}
+	mutex_w_unlock(&acvp_curl_pool_lock);
+
+	if (curl)
+		curl_easy_cleanup(curl);
+}
+
+static void acvp_curl_handle_release_all(void)
+{
+	unsigned int i;
+
+	mutex_w_lock(&acvp_curl_pool_lock);
+	for (i = 0; i < acvp_curl_pool_idle; i++) {
+		curl_easy_cleanup(acvp_curl_pool[i]);
+		acvp_curl_pool[i] = NULL;
+	}
+	acvp_curl_pool_idle = 0;
+	mutex_w_unlock(&acvp_curl_pool_lock);
+}
+
+/*****************************************************************************
+ * HTTP/2 multiplexing
+ *
+ * With HTTP/2 enabled, all transfers are executed by one CURL multi handle
+ * which allows curl to multiplex them as streams over a few connections
+ * instead of using one connection per concurrent transfer. Each transfer is
+ * still issued by its own thread that waits for its completion. One of the
+ * waiting threads drives the multi handle on behalf of all others. Once its
+ * own transfer completed, it hands this duty over to one of the remaining
+ * waiting threads. Thus, no dedicated thread is needed. Note, the callbacks
+ * of a transfer may be executed by any thread waiting for a transfer.
+ *****************************************************************************/
+#ifdef ACVP_CURL_MUX
+
+struct acvp_curl_mux_xfer {
+	CURL *curl;
+	CURLcode result;
+	bool done;
+	struct acvp_curl_mux_xfer *next;
+};
+
+static CURLM *acvp_curl_mux = NULL;
+/* Transfers that are not yet added to the multi handle */
+static struct acvp_curl_mux_xfer *acvp_curl_mux_pending = NULL;
+/* Is a thread driving the multi handle? */
+static bool acvp_curl_mux_driven = false;
+static DEFINE_MUTEX_W_UNLOCKED(acvp_curl_mux_lock);
+static pthread_cond_t acvp_curl_mux_cond = PTHREAD_COND_INITIALIZER;
+
+static void acvp_curl_mux_init(void)
+{
+	acvp_curl_mux = curl_multi_init();
+	if (!acvp_curl_mux)
+		return;
+
+	if (curl_multi_setopt(acvp_curl_mux, CURLMOPT_PIPELINING,
+			      CURLPIPE_MULTIPLEX) ||
+	    curl_multi_setopt(acvp_curl_mux, CURLMOPT_MAX_HOST_CONNECTIONS,
+			      (long)ACVP_CURL_MUX_MAX_CONNECTIONS)) {
+		logger(LOGGER_WARN, LOGGER_C_CURL,
+		       "Setting up CURL multiplexer failed\n");
+		curl_multi_cleanup(acvp_curl_mux);
+		acvp_curl_mux = NULL;
+	}
+}
+
+static void acvp_curl_mux_release(void)
+{
+	if (!acvp_curl_mux)
+		return;
+
+	curl_multi_cleanup(acvp_curl_mux);
+	acvp_curl_mux = NULL;
+}
+
+/* Mark the completed transfers as done */
+static void acvp_curl_mux_collect(void)
+{
+	struct acvp_curl_mux_xfer *xfer;
+	CURLMsg *msg;
+	CURLcode result;
+	CURL *curl;
+	int msgs;
+	bool completed = false;
+
+	while ((msg = curl_multi_info_read(acvp_curl_mux, &msgs))) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		/* The message is invalid after removing the handle */
+		curl = msg->easy_handle;
+		result = msg->data.result;
+
+		xfer = NULL;
+		curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&xfer);
+		curl_multi_remove_handle(acvp_curl_mux, curl);
+		if (!xfer)
+			continue;
+
+		mutex_w_lock(&acvp_curl_mux_lock);
+		xfer->result = result;
+		xfer->done = true;
+		mutex_w_unlock(&acvp_curl_mux_lock);
+		completed = true;
+	}
+
+	if (completed)
+		pthread_cond_broadcast(&acvp_curl_mux_cond);
+}
+
+/*
+ * Drive the multi handle until the own transfer completed. The caller must
+ * hold the lock which is released while the transfers are executed.
+ */
+static void acvp_curl_mux_drive(struct acvp_curl_mux_xfer *own)
+{
+	struct acvp_curl_mux_xfer *xfer;
+	CURLMcode mc;
+	int running;
+
+	while (!own->done) {
+		/* Attach the newly queued transfers */
+		while ((xfer = acvp_curl_mux_pending)) {
+			acvp_curl_mux_pending = xfer->next;
+			mc = curl_multi_add_handle(acvp_curl_mux, xfer->curl);
+			if (mc != CURLM_OK) {
+				logger(LOGGER_WARN, LOGGER_C_CURL,
+				       "Addition of CURL easy-handle failed with code %d (%s)\n",
+				       mc, curl_multi_strerror(mc));
+				xfer->result = CURLE_FAILED_INIT;
+				xfer->done = true;
+				pthread_cond_broadcast(&acvp_curl_mux_cond);
+			}
+		}
+		if (own->done)
+			break;
+		mutex_w_unlock(&acvp_curl_mux_lock);
+
+		mc = curl_multi_perform(acvp_curl_mux, &running);
+		if (mc == CURLM_OK)
+			acvp_curl_mux_collect();
+		if (mc == CURLM_OK && !own->done) {
+			/* Returns early on activity or on a new transfer */
+			mc = curl_multi_poll(acvp_curl_mux, NULL, 0, 1000,
+					     NULL);
+		}
+
+		mutex_w_lock(&acvp_curl_mux_lock);
+
+		/* Fail all transfers as the multi handle is unusable */
+		if (mc != CURLM_OK) {
+			logger(LOGGER_WARN, LOGGER_C_CURL,
+			       "Curl multi-HTTP operation failed with code %d (%s)\n",
+			       mc, curl_multi_strerror(mc));
+			own->result = CURLE_FAILED_INIT;
+			own->done = true;
+			curl_multi_remove_handle(acvp_curl_mux, own->curl);
+		}
+	}
+}
+
+static CURLcode acvp_curl_mux_perform(CURL *curl)
+{
+	struct acvp_curl_mux_xfer xfer = { .curl = curl,
+					   .result = CURLE_OK,
+					   .done = false,
+					   .next = NULL };
+
+	if (curl_easy_setopt(curl, CURLOPT_PRIVATE, (char *)&xfer))
+		return CURLE_FAILED_INIT;
+
+	mutex_w_lock(&acvp_curl_mux_lock);
+	xfer.next = acvp_curl_mux_pending;
+	acvp_curl_mux_pending = &xfer;
+	mutex_w_unlock(&acvp_curl_mux_lock);
+
+	/* Let the driving thread pick up the new transfer */
+	curl_multi_wakeup(acvp_curl_mux);
+
+	mutex_w_lock(&acvp_curl_mux_lock);
+	while (!xfer.done) {
+		if (acvp_curl_mux_driven) {
+			pthread_cond_wait(&acvp_curl_mux_cond,
+					  &acvp_curl_mux_lock);
+			continue;
+		}
+
+		acvp_curl_mux_driven = true;
+		acvp_curl_mux_drive(&xfer);
+		acvp_curl_mux_driven = false;
+
+		/* Hand over the multi handle to a waiting thread */
+		pthread_cond_broadcast(&acvp_curl_mux_cond);
+	}
+	mutex_w_unlock(&acvp_curl_mux_lock);
+
+	return xfer.result;
+}
+
+#else /* ACVP_CURL_MUX */
+
+static void acvp_curl_mux_init(void)
+{
+}
+
+static void acvp_curl_mux_release(void)
+{
+}
+
+#endif /* ACVP_CURL_MUX */
+
+static bool acvp_curl_mux_enabled(const struct acvp_net_ctx *net)
+{
+#ifdef ACVP_CURL_MUX
+	return (net && net->http2 && acvp_curl_mux);
+#else
+	(void)net;
+	return false;
+#endif
+}
+
+/* Execute one transfer - multiplexed with other transfers if possible */
+static CURLcode acvp_curl_perform(const struct acvp_net_ctx *net, CURL *curl)
+{
+#ifdef ACVP_CURL_MUX
+	if (acvp_curl_mux_enabled(net))
+		return acvp_curl_mux_perform(curl);
+#else
+	(void)net;
+#endif
+
+	return curl_easy_perform(curl);
+}
+
+/* Account whether the transfer required a new connection */
+static void acvp_curl_stat_update(CURL *curl)
+{
+	long connects = 0, version = 0;
+
+	atomic_inc(&acvp_curl_stat_transfers);
+
+#if LIBCURL_VERSION_NUM >= 0x073200
+	if (!curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &version) &&
+	    version == CURL_HTTP_VERSION_2_0)
+		atomic_inc(&acvp_curl_stat_http2);
+#else
+	(void)version;
+#endif
+
+	if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects))
+		return;
+
+	if (connects > 0) {
+		atomic_add((int)connects, &acvp_curl_stat_connects);
+	} else {
+		atomic_inc(&acvp_curl_stat_reused);
+		logger(LOGGER_DEBUG, LOGGER_C_CURL,
+		       "Existing connection reused for HTTP request\n");
+	}
+}
+
+static void acvp_curl_stat_log(void)
+{
+	if (!atomic_read(&acvp_curl_stat_transfers))
+		return;
+
+	logger(LOGGER_VERBOSE, LOGGER_C_CURL,
+	       "HTTP transfers: %d (HTTP/2: %d), new connections: %d, TLS handshakes avoided by connection reuse: %d\n",
+	       atomic_read(&acvp_curl_stat_transfers),
+	       atomic_read(&acvp_curl_stat_http2),
+	       atomic_read(&acvp_curl_stat_connects),
+	       atomic_read(&acvp_curl_stat_reused));
+}
+
 static int acvp_curl_progress_callback(void *clientp, curl_off_t dltotal,
 				       curl_off_t dlnow, curl_off_t ultotal,
 				       curl_off_t ulnow)
@@ -66,24 +505,98 @@ static int acvp_curl_progress_callback(void *clientp, curl_off_t dltotal,
 	return atomic_bool_read(&acvp_curl_interrupted);
 }
 
+/*
+ * Sender of the HTTP request body of one transfer.
+ *
+ * The data is handed to curl directly from the submitted buffer. When the
+ * buffer is a file mapping, the pages that are sent are released again so
+ * that the upload of a large file does not accumulate it in memory.
+ */
+struct acvp_curl_upload {
+	const struct acvp_ext_buf *buf;
+	uint32_t offset;
+	uint32_t released;
+
+	/* Request body compression */
+	z_stream zstream;
+	bool compress;
+	bool compress_done;
+};
+
+/*
+ * Request bodies smaller than this size are not compressed as the gzip
+ * framing outweighs the gain.
+ */
+#define ACVP_CURL_COMPRESS_MIN 1024
+
+/* gzip framing for deflateInit2 */
+#define ACVP_CURL_GZIP_WINDOWBITS (15 + 16)
+
+static size_t acvp_curl_read_compress(struct acvp_curl_upload *upload,
+				      char *buffer, size_t sendsize)
+{
+	z_stream *zstream = &upload->zstream;
+	int zret;
+
+	if (upload->compress_done)
+		return 0;
+
+	zstream->next_out = (Bytef *)buffer;
+	zstream->avail_out = (uInt)sendsize;
+
+	/* Fill the buffer of curl as far as possible */
+	while (zstream->avail_out) {
+		zstream->next_in = (Bytef *)upload->buf->buf + upload->offset;
+		zstream->avail_in = upload->buf->len - upload->offset;
+
+		zret = deflate(zstream, zstream->avail_in ? Z_NO_FLUSH :
+							    Z_FINISH);
+
+		upload->offset = upload->buf->len - zstream->avail_in;
+
+		if (zret == Z_STREAM_END) {
+			upload->compress_done = true;
+			break;
+		}
+		if (zret != Z_OK && zret != Z_BUF_ERROR) {
+			logger(LOGGER_WARN, LOGGER_C_CURL,
+			       "Compression of request body failed: %d\n",
+			       zret);
+			return CURL_READFUNC_ABORT;
+		}
+	}
+
+	acvp_ext_buf_consumed(upload->buf, &upload->released, upload->offset);
+
+	sendsize -= zstream->avail_out;
+	logger(LOGGER_DEBUG2, LOGGER_C_CURL,
+	       "Number of compressed bytes uploaded: %zu\n", sendsize);
+
+	return sendsize;
+}
+
 static size_t acvp_curl_read_cb(char *buffer, size_t size, size_t nitems,
 				void *userdata)
 {
-	struct acvp_buf *send_buf = (struct acvp_buf *)userdata;
+	struct acvp_curl_upload *upload = (struct acvp_curl_upload *)userdata;
 	size_t sendsize = (size * nitems);
 
-	if (!send_buf)
+	if (!upload || !upload->buf)
 		return 0;
 
-	if (sendsize > send_buf->len)
-		sendsize = send_buf->len;
+	if (upload->compress)
+		return acvp_curl_read_compress(upload, buffer, sendsize);
+
+	if (sendsize > upload->buf->len - upload->offset)
+		sendsize = upload->buf->len - upload->offset;
 
 	if (!sendsize)
 		return 0;
 
-	memcpy(buffer, send_buf->buf, sendsize);
-	send_buf->buf += sendsize;
-	send_buf->len -= (uint32_t)sendsize;
+	memcpy(buffer, upload->buf->buf + upload->offset, sendsize);
+	upload->offset += (uint32_t)sendsize;
+
+	acvp_ext_buf_consumed(upload->buf, &upload->released, upload->offset);
 
 	logger(LOGGER_DEBUG2, LOGGER_C_CURL, "Number of bytes uploaded: %zu\n",
 	       sendsize);
@@ -91,53 +604,166 @@ static size_t acvp_curl_read_cb(char *buffer, size_t size, size_t nitems,
 	return sendsize;
 }
 
+/* Send the request body again from its start */
+static int acvp_curl_upload_rewind(struct acvp_curl_upload *upload)
+{
+	/* Pages that are accessed again are faulted in from the file */
+	upload->offset = 0;
+	upload->released = 0;
+
+	if (upload->compress) {
+		upload->compress_done = false;
+		if (deflateReset(&upload->zstream) != Z_OK)
+			return -EFAULT;
+	}
+
+	return 0;
+}
+
+/* Curl needs to rewind the request body, e.g. for a redirect */
+static int acvp_curl_seek_cb(void *userdata, curl_off_t offset, int origin)
+{
+	struct acvp_curl_upload *upload = (struct acvp_curl_upload *)userdata;
+
+	if (!upload || !upload->buf || origin != SEEK_SET || offset < 0 ||
+	    offset > (curl_off_t)upload->buf->len)
+		return CURL_SEEKFUNC_CANTSEEK;
+
+	/* The compressed stream can only be restarted */
+	if (upload->compress && offset)
+		return CURL_SEEKFUNC_CANTSEEK;
+
+	if (acvp_curl_upload_rewind(upload))
+		return CURL_SEEKFUNC_FAIL;
+	upload->offset = (uint32_t)offset;
+
+	return CURL_SEEKFUNC_OK;
+}
+
+static void acvp_curl_upload_release(struct acvp_curl_upload *upload)
+{
+	if (upload->compress)
+		deflateEnd(&upload->zstream);
+	upload->compress = false;
+}
+
+static int acvp_curl_upload_init(CURL *curl, struct acvp_curl_upload *upload,
+				 const struct acvp_ext_buf *submit_buf,
+				 const bool compress)
+{
+	CURLcode cret;
+	int ret = 0;
+
+	upload->buf = submit_buf;
+	upload->offset = 0;
+	upload->released = 0;
+	upload->compress_done = false;
+
+	if (compress) {
+		memset(&upload->zstream, 0, sizeof(upload->zstream));
+		if (deflateInit2(&upload->zstream, Z_DEFAULT_COMPRESSION,
+				 Z_DEFLATED, ACVP_CURL_GZIP_WINDOWBITS, 8,
+				 Z_DEFAULT_STRATEGY) != Z_OK) {
+			logger(LOGGER_WARN, LOGGER_C_CURL,
+			       "Cannot initialize request body compression\n");
+			ret = -EFAULT;
+			goto out;
+		}
+		upload->compress = true;
+	}
+
+	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_READFUNCTION,
+				    acvp_curl_read_cb));
+	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_READDATA, upload));
+	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION,
+				    acvp_curl_seek_cb));
+	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_SEEKDATA, upload));
+
+out:
+	return ret;
+}
+
+/*
+ * Receiver of the HTTP response body of one transfer.
+ *
+ * The body is collected in a geometrically growing buffer. If a sink is
+ * provided, a successful (HTTP 200) body is handed to the sink chunk by chunk
+ * instead and never held in memory as a whole. Error bodies are always
+ * collected in the buffer as they are small and needed for the error
+ * handling.
+ */
+struct acvp_curl_response {
+	struct acvp_buf *buf;
+	uint32_t bufsize;
+	const struct acvp_buf_sink *sink;
+	CURL *curl;
+	int sink_ret;
+};
+
+static int acvp_curl_response_reset(struct acvp_curl_response *response)
+{
+	const struct acvp_buf_sink *sink = response->sink;
+
+	if (response->buf && response->buf->buf) {
+		response->buf->len = 0;
+		response->buf->buf[0] = '\0';
+	}
+	response->sink_ret = 0;
+
+	if (sink && sink->reset)
+		return sink->reset(sink->ctx);
+
+	return 0;
+}
+
 static size_t acvp_curl_write_cb(void *ptr, size_t size, size_t nmemb,
 				 void *userdata)
 {
-	struct acvp_buf *response_buf = (struct acvp_buf *)userdata;
+	struct acvp_curl_response *response =
+		(struct acvp_curl_response *)userdata;
+	const struct acvp_buf_sink *sink = response->sink;
 	size_t bufsize = (size * nmemb);
-	size_t totalsize;
-	uint8_t *resp_p;
+	long http_response_code = 0;
+	int ret;
 
-	if (!response_buf) {
+	if (!response->buf && !sink) {
 		logger(LOGGER_DEBUG, LOGGER_C_CURL,
 		       "Retrieved data size : %zu\n", bufsize);
-		logger(LOGGER_DEBUG, LOGGER_C_CURL, "Retrieved data: %s\n",
-		       (char *)ptr);
 		return bufsize;
 	}
 
 	if (!bufsize)
 		return 0;
 
-	totalsize = bufsize + response_buf->len;
-	if (totalsize > ACVP_RESPONSE_MAXLEN || totalsize < response_buf->len) {
+	if (bufsize > ACVP_RESPONSE_MAXLEN) {
 		logger(LOGGER_WARN, LOGGER_C_CURL,
-		       "Received data is too big: %zu\n", totalsize);
+		       "Received data is too big: %zu\n", bufsize);
 		return 0;
 	}
 
-	if (!response_buf->buf)
-		response_buf->buf = malloc(bufsize + 1); /* add one for \0 */
-	else
-		response_buf->buf = realloc(response_buf->buf, totalsize + 1);
-
-	if (!response_buf->buf) {
-		response_buf->len = 0;
-		return 0;
+	if (sink) {
+		curl_easy_getinfo(response->curl, CURLINFO_RESPONSE_CODE,
+				  &http_response_code);
 	}
 
-	resp_p = response_buf->buf + response_buf->len;
-	response_buf->len = (uint32_t)totalsize;
-
-	memcpy(resp_p, ptr, bufsize);
-
-	/* NULL-terminate string */
-	response_buf->buf[response_buf->len] = '\0';
+	if (sink && http_response_code == HTTP_OK) {
+		ret = sink->write(sink->ctx, ptr, (uint32_t)bufsize);
+	} else if (response->buf) {
+		ret = acvp_buf_append(response->buf, &response->bufsize, ptr,
+				      (uint32_t)bufsize, ACVP_RESPONSE_MAXLEN);
+		if (ret == -EOVERFLOW) {
+			logger(LOGGER_WARN, LOGGER_C_CURL,
+			       "Received data is too big: %zu\n",
+			       bufsize + response->buf->len);
+		}
+	} else {
+		ret = 0;
+	}
 
-	logger(LOGGER_DEBUG2, LOGGER_C_CURL,
-	       "Current complete retrieved data (len %u): %s\n",
-	       response_buf->len, response_buf->buf);
+	if (ret) {
+		response->sink_ret = ret;
+		return 0;
+	}
 
 	return bufsize;
 }
@@ -273,7 +899,7 @@ static int acvp_curl_debug_cb(CURL *handle, curl_infotype type, char *data,
 }
 
 static int acvp_curl_common_init(const struct acvp_na_ex *netinfo,
-				 struct acvp_buf *response_buf,
+				 struct acvp_curl_response *response,
 				 struct curl_slist **slist, CURL **curl_ret)
 {
 	const struct acvp_net_ctx *net = netinfo->net;
@@ -291,15 +917,38 @@ static int acvp_curl_common_init(const struct acvp_na_ex *netinfo,
 
 	CKINT(acvp_curl_add_auth_hdr(auth, slist));
 
-	curl = curl_easy_init();
+	curl = acvp_curl_handle_get();
 	CKNULL(curl, -ENOMEM);
+	/* The multiplexer holds its own connection cache */
+	if (acvp_curl_share && !acvp_curl_mux_enabled(net))
+		CURL_CKINT(curl_easy_setopt(curl, CURLOPT_SHARE,
+					    acvp_curl_share));
 	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_URL, url));
 	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L));
 	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_USERAGENT, useragent));
-	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
-				    CURL_HTTP_VERSION_1_1));
+#if LIBCURL_VERSION_NUM >= 0x072F00
+	if (net->http2) {
+		/*
+		 * HTTP/2 is negotiated with ALPN, servers not supporting it
+		 * are accessed with HTTP/1.1. A new transfer waits for a
+		 * pending connection setup to learn whether it can be
+		 * multiplexed over it.
+		 */
+		CURL_CKINT(curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+					    CURL_HTTP_VERSION_2TLS));
+		CURL_CKINT(curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L));
+	} else
+#endif
+	{
+		CURL_CKINT(curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+					    CURL_HTTP_VERSION_1_1));
+	}
 	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_HTTPHEADER, *slist));
 
+	/* Offer all encodings curl can decode, the body is decoded by curl */
+	if (net->accept_compression)
+		CURL_CKINT(curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, ""));
+
 	/* Required for multi-threaded applications */
 	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L));
 
@@ -367,7 +1016,8 @@ static int acvp_curl_common_init(const struct acvp_na_ex *netinfo,
 	 * If the caller wants the HTTP data from the server
 	 * set the callback function
 	 */
-	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_WRITEDATA, response_buf));
+	response->curl = curl;
+	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_WRITEDATA, response));
 	CURL_CKINT(curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
 				    acvp_curl_write_cb));
 
@@ -375,7 +1025,7 @@ static int acvp_curl_common_init(const struct acvp_na_ex *netinfo,
 
 out:
 	if (ret && curl)
-		curl_easy_cleanup(curl);
+		acvp_curl_handle_put(curl);
 	return ret;
 }
 
@@ -384,20 +1034,34 @@ static int acvp_curl_http_common(const struct acvp_na_ex *netinfo,
 				 struct acvp_buf *response_buf,
 				 enum acvp_http_type http_type)
 {
+	struct acvp_curl_response response = { .buf = response_buf,
+					       .sink = netinfo->sink };
 	struct curl_slist *slist = NULL;
 	CURL *curl = NULL;
 	CURLcode cret;
-	ACVP_BUFFER_INIT(submit_tmp);
+	struct acvp_curl_upload upload = { .buf = NULL };
 	const char *url = netinfo->url, *http_type_str;
 	int ret;
 	unsigned int retries = 0;
 	long http_response_code = 0;
+	bool compress = false;
 
 	if (submit_buf)
 		slist = curl_slist_append(slist,
 					  "Content-Type: application/json");
 
-	CKINT(acvp_curl_common_init(netinfo, response_buf, &slist, &curl));
+	/*
+	 * Compress the request body if the server supports it. As the size of
+	 * the compressed data is not known in advance, it is sent chunked.
+	 */
+	if (netinfo->net && netinfo->net->compress_request && submit_buf &&
+	    submit_buf->buf && submit_buf->len >= ACVP_CURL_COMPRESS_MIN &&
+	    (http_type == acvp_http_post || http_type == acvp_http_put)) {
+		compress = true;
+		slist = curl_slist_append(slist, "Content-Encoding: gzip");
+	}
+
+	CKINT(acvp_curl_common_init(netinfo, &response, &slist, &curl));
 
 	switch (http_type) {
 	case acvp_http_get:
@@ -414,13 +1078,25 @@ static int acvp_curl_http_common(const struct acvp_na_ex *netinfo,
 			goto out;
 		}
 		logger(LOGGER_DEBUG, LOGGER_C_CURL,
-		       "Performing an HTTP POST operation of following data:\n%s\n",
-		       submit_buf->buf);
+		       "Performing an HTTP POST operation of following data:\n%.*s\n",
+		       (int)submit_buf->len, submit_buf->buf);
 		CURL_CKINT(curl_easy_setopt(curl, CURLOPT_POST, 1L));
-		CURL_CKINT(curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
-					    (curl_off_t)submit_buf->len));
-		CURL_CKINT(curl_easy_setopt(curl, CURLOPT_POSTFIELDS,
-					    submit_buf->buf));
+		CURL_CKINT(curl_easy_setopt(
+			curl, CURLOPT_POSTFIELDSIZE_LARGE,
+			compress ? (curl_off_t)-1 :
+				   (curl_off_t)submit_buf->len));
+
+		/*
+		 * A file is streamed to release the sent pages again, a
+		 * compressed body is generated while sending it.
+		 */
+		if (submit_buf->mapped || compress) {
+			CKINT(acvp_curl_upload_init(curl, &upload, submit_buf,
+						    compress));
+		} else {
+			CURL_CKINT(curl_easy_setopt(curl, CURLOPT_POSTFIELDS,
+						    submit_buf->buf));
+		}
 		break;
 	case acvp_http_put:
 		http_type_str = "PUT";
@@ -430,25 +1106,16 @@ static int acvp_curl_http_common(const struct acvp_na_ex *netinfo,
 			goto out;
 		}
 		logger(LOGGER_DEBUG, LOGGER_C_CURL,
-		       "Performing an HTTP PUT operation of following data:\n%s\n",
-		       submit_buf->buf);
+		       "Performing an HTTP PUT operation of following data:\n%.*s\n",
+		       (int)submit_buf->len, submit_buf->buf);
 
-		/*
-		 * We need a temporary buffer as we need to read parts of the
-		 * buffer and thus adjust the pointer and length field.
-		 */
-		submit_tmp.buf = submit_buf->buf;
-		submit_tmp.len = submit_buf->len;
-		CURL_CKINT(curl_easy_setopt(curl, CURLOPT_READFUNCTION,
-					    acvp_curl_read_cb));
+		CKINT(acvp_curl_upload_init(curl, &upload, submit_buf,
+					    compress));
 		CURL_CKINT(curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L));
-		CURL_CKINT(curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE,
-					    (curl_off_t)submit_buf->len));
-		CURL_CKINT(
-			curl_easy_setopt(curl, CURLOPT_READDATA, &submit_tmp));
-		logger(LOGGER_DEBUG, LOGGER_C_CURL,
-		       "About to HTTP PUT the following data:\n%s\n",
-		       submit_buf->buf);
+		CURL_CKINT(curl_easy_setopt(
+			curl, CURLOPT_INFILESIZE_LARGE,
+			compress ? (curl_off_t)-1 :
+				   (curl_off_t)submit_buf->len));
 		break;
 	case acvp_http_delete:
 		http_type_str = "DELETE";
@@ -474,7 +1141,7 @@ static int acvp_curl_http_common(const struct acvp_na_ex *netinfo,
 
 	/* Perform the HTTP request */
 	while (retries < ACVP_CURL_MAX_RETRIES) {
-		cret = curl_easy_perform(curl);
+		cret = acvp_curl_perform(netinfo->net, curl);
 		if (cret == CURLE_OK)
 			break;
 
@@ -482,6 +1149,11 @@ static int acvp_curl_http_common(const struct acvp_na_ex *netinfo,
 		       "Curl HTTP operation failed with code %d (%s)\n", cret,
 		       curl_easy_strerror(cret));
 
+		if (cret == CURLE_WRITE_ERROR && response.sink_ret) {
+			ret = response.sink_ret;
+			goto out;
+		}
+
 		if (cret == CURLE_RECV_ERROR) {
 			ret = -ECONNREFUSED;
 			goto out;
@@ -496,7 +1168,23 @@ static int acvp_curl_http_common(const struct acvp_na_ex *netinfo,
 			 * untouched in case it contains the error from the
 			 * HTTP operation.
 			 */
-			ret2 = sleep_interruptible(10, &acvp_curl_interrupted);
+			ret2 = acvp_net_backoff(
+				ACVP_CURL_BACKOFF_START + retries - 1,
+				&acvp_curl_interrupted);
+			if (ret2 < 0) {
+				ret = ret2;
+				goto out;
+			}
+
+			/* Drop the partial data of the failed transfer */
+			ret2 = acvp_curl_response_reset(&response);
+			if (ret2 < 0) {
+				ret = ret2;
+				goto out;
+			}
+
+			/* Send the request body again from its start */
+			ret2 = acvp_curl_upload_rewind(&upload);
 			if (ret2 < 0) {
 				ret = ret2;
 				goto out;
@@ -505,6 +1193,13 @@ static int acvp_curl_http_common(const struct acvp_na_ex *netinfo,
 	}
 
 	acvp_curl_log_peer_cert(curl);
+	acvp_curl_stat_update(curl);
+
+	if (response_buf && response_buf->buf) {
+		logger(LOGGER_DEBUG2, LOGGER_C_CURL,
+		       "Complete retrieved data (len %u): %s\n",
+		       response_buf->len, response_buf->buf);
+	}
 
 	/* Get the HTTP response status code from the server */
 	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_response_code);
@@ -515,11 +1210,27 @@ static int acvp_curl_http_common(const struct acvp_na_ex *netinfo,
 		       "Unable to HTTP %s data for URL %s: %ld\n",
 		       http_type_str, url, http_response_code);
 		ret = -(int)http_response_code;
+
+#if LIBCURL_VERSION_NUM >= 0x074200
+		/* Seconds of a Retry-After header, curl parses both formats */
+		if (netinfo->retry_after) {
+			curl_off_t retry_after = 0;
+
+			if (curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER,
+					      &retry_after) == CURLE_OK &&
+			    retry_after > 0) {
+				*netinfo->retry_after =
+					(retry_after > UINT32_MAX) ?
+						UINT32_MAX :
+						(uint32_t)retry_after;
+			}
+		}
+#endif
 	}
 
 out:
-	if (curl)
-		curl_easy_cleanup(curl);
+	acvp_curl_upload_release(&upload);
+	acvp_curl_handle_put(curl);
 	if (slist)
 		curl_slist_free_all(slist);
 	return atomic_bool_read(&acvp_curl_interrupted) ? -EINTR : ret;
@@ -567,9 +1278,11 @@ static int acvp_curl_http_post_multi(const struct acvp_na_ex *netinfo,
 	CURLcode cret;
 	curl_mime *form = NULL;
 	curl_mimepart *field = NULL;
+	struct acvp_curl_response response = { .buf = response_buf,
+					       .sink = netinfo->sink };
 	int ret = 0, still_running = 0;
 
-	CKINT(acvp_curl_common_init(netinfo, response_buf, &slist, &curl));
+	CKINT(acvp_curl_common_init(netinfo, &response, &slist, &curl));
 
 	multi_handle = curl_multi_init();
 	CKNULL(multi_handle, -ENOMEM);
@@ -583,7 +1296,29 @@ static int acvp_curl_http_post_multi(const struct acvp_na_ex *netinfo,
 		CURL_CKINT(curl_mime_name(field, s_buf->data_type));
 		logger(LOGGER_DEBUG, LOGGER_C_CURL, "Set mime type %s\n",
 		       s_buf->data_type);
-		if (s_buf->buf) {
+		if (s_buf->buf && s_buf->mapped) {
+			struct acvp_curl_upload *upload;
+
+			/* Files are streamed instead of copied by curl */
+			upload = calloc(1, sizeof(*upload));
+			CKNULL(upload, -ENOMEM);
+			upload->buf = s_buf;
+			upload->compress = false;
+			cret = curl_mime_data_cb(field, (curl_off_t)s_buf->len,
+						 acvp_curl_read_cb,
+						 acvp_curl_seek_cb, free,
+						 upload);
+			if (cret != CURLE_OK) {
+				free(upload);
+				logger(LOGGER_WARN, LOGGER_C_CURL,
+				       "Curl mime data setup failed: %s\n",
+				       curl_easy_strerror(cret));
+				ret = -EFAULT;
+				goto out;
+			}
+			logger(LOGGER_DEBUG, LOGGER_C_CURL,
+			       "Add mime file data of length %u\n", s_buf->len);
+		} else if (s_buf->buf) {
 			CURL_CKINT(curl_mime_data(
 				field, (const char *)s_buf->buf, s_buf->len));
 			logger(LOGGER_DEBUG, LOGGER_C_CURL,
@@ -676,13 +1411,20 @@ static int acvp_curl_http_post_multi(const struct acvp_na_ex *netinfo,
 		}
 	}
 
+	if (!ret && response.sink_ret)
+		ret = response.sink_ret;
+
 out:
-	if (multi_handle)
+	if (multi_handle) {
+		if (curl)
+			curl_multi_remove_handle(multi_handle, curl);
 		curl_multi_cleanup(multi_handle);
-	if (curl)
-		curl_easy_cleanup(curl);
+	}
 	if (form)
 		curl_mime_free(form);
+	if (curl && !ret)
+		acvp_curl_stat_update(curl);
+	acvp_curl_handle_put(curl);
 	if (slist)
 		curl_slist_free_all(slist);
 	return ret;
@@ -694,11 +1436,21 @@ static int acvp_curl_library_init(void)
 	if (curl_global_init(CURL_GLOBAL_ALL))
 		return -EFAULT;
 
+	/* Operate without a connection cache if share object is unavailable */
+	acvp_curl_share_init();
+
+	/* Without the multiplexer, HTTP/2 transfers are not multiplexed */
+	acvp_curl_mux_init();
+
 	return acvp_openssl_thread_setup();
 }
 
 static void acvp_curl_library_exit(void)
 {
+	acvp_curl_stat_log();
+	acvp_curl_handle_release_all();
+	acvp_curl_mux_release();
+	acvp_curl_share_release();
 	curl_global_cleanup();
 }
 
@@ -17,11 +17,357 @@
  * DAMAGE.
  */
 
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
 #include "internal.h"
 
+/*****************************************************************************
+ * Request rate limiter
+ *
+ * All requests to the ACVP server, regardless of the thread issuing them,
+ * obtain a token from one token bucket before they are sent. The bucket is
+ * refilled with the current request rate which is adjusted with an AIMD
+ * scheme: every successful request round at the current rate increases the
+ * rate by one request per second, every throttling response of the server
+ * (HTTP 429, 502, 503, 504) halves the rate and pauses all requests for a
+ * jittered exponential backoff time which is at least as long as the
+ * Retry-After time of the response. Retry hints of the server hold the rate
+ * as the server signals that it is busy. The rates are configured with
+ * acvp_set_net_rate_limit. A disabled limiter only applies the backoff.
+ *****************************************************************************/
+
+/* Fixed point scaling of one token */
+#define ACVP_NET_TOKEN 1000
+
+/* Backoff in milliseconds */
+#define ACVP_NET_BACKOFF_BASE_MS 500
+#define ACVP_NET_BACKOFF_MAX_MS 60000
+
+/* Upper bound of a Retry-After time of the server in seconds */
+#define ACVP_NET_RETRY_AFTER_MAX 3600
+
+/* Number of resubmissions of a request that was throttled */
+#define ACVP_NET_THROTTLE_RETRIES 5
+
+/* Maximum slice of a wait before the interruption is checked */
+#define ACVP_NET_WAIT_SLICE_NS ((uint64_t)100 * 1000 * 1000)
+
+#define ACVP_NET_NS_PER_SEC ((uint64_t)1000 * 1000 * 1000)
+#define ACVP_NET_NS_PER_MS ((uint64_t)1000 * 1000)
+
+struct acvp_net_limiter {
+	mutex_w_t lock;
+	uint64_t last_ns; /* Time of last refill, 0 if not yet refilled */
+	uint64_t pause_until_ns; /* No request before this time */
+	uint64_t tokens; /* Available tokens scaled with ACVP_NET_TOKEN */
+	uint32_t rate; /* Current rate in requests per second */
+	uint32_t rate_min; /* Lower bound of the rate */
+	uint32_t rate_max; /* Upper bound of the rate */
+	uint32_t successes; /* Successful requests since last rate change */
+	uint32_t throttled; /* Consecutive throttling responses */
+	uint32_t prng; /* State of jitter generator */
+	bool disabled; /* Only apply the backoff */
+};
+
+static struct acvp_net_limiter acvp_net_limiter = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.tokens = ACVP_NET_RATE_START * ACVP_NET_TOKEN,
+	.rate = ACVP_NET_RATE_START,
+	.rate_min = ACVP_NET_RATE_MIN,
+	.rate_max = ACVP_NET_RATE_MAX,
+};
+
+static uint64_t acvp_net_now_ns(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now))
+		return 0;
+
+	return ((uint64_t)now.tv_sec * ACVP_NET_NS_PER_SEC +
+		(uint64_t)now.tv_nsec);
+}
+
+/* xorshift32 - caller must hold the limiter lock */
+static uint32_t acvp_net_jitter_rand(struct acvp_net_limiter *limiter)
+{
+	uint32_t x = limiter->prng;
+
+	if (!x)
+		x = (uint32_t)acvp_net_now_ns() | 1;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	limiter->prng = x;
+
+	return x;
+}
+
+/*
+ * Jittered exponential backoff: the backoff doubles with every attempt and
+ * a random value from the upper half of the backoff window is used to
+ * prevent that all threads resume at the same time.
+ */
+static uint64_t acvp_net_backoff_ns(struct acvp_net_limiter *limiter,
+				    unsigned int attempt)
+{
+	uint64_t backoff_ms = ACVP_NET_BACKOFF_BASE_MS;
+
+	while (attempt > 1 && backoff_ms < ACVP_NET_BACKOFF_MAX_MS) {
+		backoff_ms <<= 1;
+		attempt--;
+	}
+	if (backoff_ms > ACVP_NET_BACKOFF_MAX_MS)
+		backoff_ms = ACVP_NET_BACKOFF_MAX_MS;
+
+	backoff_ms = backoff_ms / 2 +
+		     acvp_net_jitter_rand(limiter) % (backoff_ms / 2 + 1);
+
+	return backoff_ms * ACVP_NET_NS_PER_MS;
+}
+
+/* Sleep the given time while checking for an interruption */
+static int acvp_net_wait(uint64_t wait_ns, atomic_bool_t *interrupted)
+{
+	while (wait_ns) {
+		uint64_t slice = (wait_ns < ACVP_NET_WAIT_SLICE_NS) ?
+					       wait_ns :
+					       ACVP_NET_WAIT_SLICE_NS;
+		struct timespec sleeptime = {
+			.tv_sec = (time_t)(slice / ACVP_NET_NS_PER_SEC),
+			.tv_nsec = (long)(slice % ACVP_NET_NS_PER_SEC)
+		};
+
+		if (interrupted && atomic_bool_read(interrupted))
+			return -EINTR;
+
+		nanosleep(&sleeptime, NULL);
+		wait_ns -= slice;
+	}
+
+	return 0;
+}
+
+int acvp_net_backoff(unsigned int attempt, atomic_bool_t *interrupted)
+{
+	struct acvp_net_limiter *limiter = &acvp_net_limiter;
+	uint64_t backoff;
+
+	mutex_w_lock(&limiter->lock);
+	backoff = acvp_net_backoff_ns(limiter, attempt);
+	mutex_w_unlock(&limiter->lock);
+
+	logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+	       "Backing off for %" PRIu64 " milliseconds (attempt %u)\n",
+	       backoff / ACVP_NET_NS_PER_MS, attempt);
+
+	return acvp_net_wait(backoff, interrupted);
+}
+
+/* Wait until a token is available and take it */
+static int acvp_net_rate_acquire(void)
+{
+	struct acvp_net_limiter *limiter = &acvp_net_limiter;
+	uint64_t now, wait;
+	int ret;
+
+	mutex_w_lock(&limiter->lock);
+
+	while (1) {
+		now = acvp_net_now_ns();
+
+		/*
+		 * Refill the bucket - the capacity allows a burst of 1 second,
+		 * thus a longer interval does not add more tokens.
+		 */
+		if (!limiter->last_ns) {
+			limiter->last_ns = now;
+		} else if (now > limiter->last_ns) {
+			uint64_t elapsed = now - limiter->last_ns;
+
+			if (elapsed > ACVP_NET_NS_PER_SEC)
+				elapsed = ACVP_NET_NS_PER_SEC;
+			limiter->tokens += elapsed * limiter->rate /
+					   (ACVP_NET_NS_PER_SEC / ACVP_NET_TOKEN);
+			if (limiter->tokens >
+			    (uint64_t)limiter->rate * ACVP_NET_TOKEN) {
+				limiter->tokens =
+					(uint64_t)limiter->rate * ACVP_NET_TOKEN;
+			}
+			limiter->last_ns = now;
+		}
+
+		if (now < limiter->pause_until_ns) {
+			wait = limiter->pause_until_ns - now;
+		} else if (limiter->disabled) {
+			break;
+		} else if (limiter->tokens >= ACVP_NET_TOKEN) {
+			limiter->tokens -= ACVP_NET_TOKEN;
+			break;
+		} else {
+			wait = (ACVP_NET_TOKEN - limiter->tokens) *
+			       (ACVP_NET_NS_PER_SEC / ACVP_NET_TOKEN) /
+			       limiter->rate;
+		}
+
+		mutex_w_unlock(&limiter->lock);
+
+		if (wait > ACVP_NET_WAIT_SLICE_NS)
+			wait = ACVP_NET_WAIT_SLICE_NS;
+		CKINT(acvp_net_wait(wait, &acvp_op_interrupted));
+
+		mutex_w_lock(&limiter->lock);
+	}
+
+	mutex_w_unlock(&limiter->lock);
+
+	ret = 0;
+
+out:
+	return ret;
+}
+
+/* Is the HTTP return code a sign that the server is overloaded? */
+static bool acvp_net_throttled(int ret)
+{
+	switch (-ret) {
+	case 429: /* Too Many Requests */
+	case 502: /* Bad Gateway */
+	case 503: /* Service Unavailable */
+	case 504: /* Gateway Timeout */
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * May the request be resubmitted after a throttling response? A server
+ * refusing the request with 429 or 503 did not process it. Gateway errors
+ * leave the state on the server unknown, thus only GET is resubmitted.
+ */
+static bool acvp_net_throttle_retry(int ret, enum acvp_http_type nettype)
+{
+	if (ret == -429 || ret == -503)
+		return true;
+
+	return (nettype == acvp_http_get);
+}
+
+/*
+ * Adjust the rate based on the result of the request - the Retry-After time
+ * of the server is the lower bound of the backoff.
+ */
+static void acvp_net_rate_feedback(int ret, uint32_t retry_after)
+{
+	struct acvp_net_limiter *limiter = &acvp_net_limiter;
+	uint64_t backoff = 0;
+	uint32_t rate;
+	bool disabled;
+
+	mutex_w_lock(&limiter->lock);
+
+	if (acvp_net_throttled(ret)) {
+		/* Multiplicative decrease */
+		limiter->rate /= 2;
+		if (limiter->rate < limiter->rate_min)
+			limiter->rate = limiter->rate_min;
+		limiter->successes = 0;
+		limiter->throttled++;
+		limiter->tokens = 0;
+
+		backoff = acvp_net_backoff_ns(limiter, limiter->throttled);
+		if (retry_after > ACVP_NET_RETRY_AFTER_MAX)
+			retry_after = ACVP_NET_RETRY_AFTER_MAX;
+		if (backoff < retry_after * ACVP_NET_NS_PER_SEC)
+			backoff = retry_after * ACVP_NET_NS_PER_SEC;
+		if (acvp_net_now_ns() + backoff > limiter->pause_until_ns)
+			limiter->pause_until_ns = acvp_net_now_ns() + backoff;
+	} else {
+		limiter->throttled = 0;
+
+		/* Additive increase after one round at the current rate */
+		if (++limiter->successes >= limiter->rate) {
+			limiter->successes = 0;
+			if (limiter->rate < limiter->rate_max)
+				limiter->rate++;
+		}
+	}
+
+	rate = limiter->rate;
+	disabled = limiter->disabled;
+
+	mutex_w_unlock(&limiter->lock);
+
+	if (backoff && disabled) {
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "ACVP server throttles requests (HTTP %d) - pausing for %" PRIu64
+		       " milliseconds\n",
+		       -ret, backoff / ACVP_NET_NS_PER_MS);
+	} else if (backoff) {
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "ACVP server throttles requests (HTTP %d) - reducing request rate to %u per second and pausing for %" PRIu64
+		       " milliseconds\n",
+		       -ret, rate, backoff / ACVP_NET_NS_PER_MS);
+	}
+}
+
+int acvp_net_rate_limit(bool enable, uint32_t rate_start, uint32_t rate_min,
+			uint32_t rate_max)
+{
+	struct acvp_net_limiter *limiter = &acvp_net_limiter;
+
+	if (!rate_min || rate_min > rate_start || rate_start > rate_max) {
+		logger(LOGGER_ERR, LOGGER_C_ANY,
+		       "Request rate limits must satisfy 0 < minimum (%u) <= start (%u) <= maximum (%u)\n",
+		       rate_min, rate_start, rate_max);
+		return -EINVAL;
+	}
+
+	mutex_w_lock(&limiter->lock);
+	limiter->disabled = !enable;
+	limiter->rate = rate_start;
+	limiter->rate_min = rate_min;
+	limiter->rate_max = rate_max;
+	limiter->tokens = (uint64_t)rate_start * ACVP_NET_TOKEN;
+	limiter->last_ns = acvp_net_now_ns();
+	limiter->successes = 0;
+	mutex_w_unlock(&limiter->lock);
+
+	if (enable) {
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+		       "Request rate limit: start %u, minimum %u, maximum %u requests per second\n",
+		       rate_start, rate_min, rate_max);
+	} else {
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+		       "Request rate limit disabled\n");
+	}
+
+	return 0;
+}
+
+void acvp_net_rate_retry_hint(uint32_t seconds)
+{
+	struct acvp_net_limiter *limiter = &acvp_net_limiter;
+
+	/* Server is busy - do not increase the rate any further for now */
+	mutex_w_lock(&limiter->lock);
+	limiter->successes = 0;
+	mutex_w_unlock(&limiter->lock);
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY,
+	       "ACVP server retry hint of %u seconds holds request rate\n",
+	       seconds);
+}
+
 static int _acvp_net_op(const struct acvp_testid_ctx *testid_ctx,
 			const char *url, const struct acvp_ext_buf *submit,
-			struct acvp_buf *response, enum acvp_http_type nettype)
+			struct acvp_buf *response,
+			const struct acvp_buf_sink *sink,
+			enum acvp_http_type nettype, uint32_t *retry_after)
 {
 	const struct acvp_net_ctx *net;
 	struct acvp_auth_ctx *auth = testid_ctx->server_auth;
@@ -31,10 +377,19 @@ static int _acvp_net_op(const struct acvp_testid_ctx *testid_ctx,
 	/* Refresh the ACVP JWT token by re-logging in. */
 	CKINT(acvp_login(testid_ctx));
 
+	/* Refresh the JWT in the background before it expires */
+	if (acvp_auth_refresh_track(testid_ctx)) {
+		logger(LOGGER_DEBUG, LOGGER_C_ANY,
+		       "JWT of test session %u is refreshed during next use\n",
+		       testid_ctx->testid);
+	}
+
 	CKINT(acvp_get_net(&net));
 	netinfo.net = net;
 	netinfo.url = url;
 	netinfo.server_auth = auth;
+	netinfo.sink = sink;
+	netinfo.retry_after = retry_after;
 
 	mutex_reader_lock(&auth->mutex);
 	switch (nettype) {
@@ -71,6 +426,17 @@ static int _acvp_net_op(const struct acvp_testid_ctx *testid_ctx,
 	}
 	mutex_reader_unlock(&auth->mutex);
 
+	/*
+	 * Backends that do not support streaming deliver the complete body in
+	 * the response buffer - forward it to the sink.
+	 */
+	if (!ret && sink && response && response->buf && response->len) {
+		ret = sink->write(sink->ctx, response->buf, response->len);
+		acvp_free_buf(response);
+		if (ret)
+			goto out;
+	}
+
 	if (!ret || ret < -200) {
 		logger(LOGGER_DEBUG, LOGGER_C_CURL, "HTTP return code: %d\n",
 		       ret ? -ret : 200);
@@ -89,18 +455,49 @@ out:
 	return ret;
 }
 
-int acvp_net_op(const struct acvp_testid_ctx *testid_ctx, const char *url,
-		const struct acvp_ext_buf *submit, struct acvp_buf *response,
-		enum acvp_http_type nettype)
+static int acvp_net_sink_reset(const struct acvp_buf_sink *sink)
+{
+	if (!sink || !sink->reset)
+		return 0;
+
+	return sink->reset(sink->ctx);
+}
+
+static int acvp_net_op_common(const struct acvp_testid_ctx *testid_ctx,
+			      const char *url,
+			      const struct acvp_ext_buf *submit,
+			      struct acvp_buf *response,
+			      const struct acvp_buf_sink *sink,
+			      enum acvp_http_type nettype)
 {
 	struct acvp_auth_ctx *auth = testid_ctx->server_auth;
 	enum acvp_error_code code = ACVP_ERR_NO_ERR;
+	unsigned int attempt = 0;
+	uint32_t retry_after;
 	int ret;
 
 	CKNULL_LOG(na, -EFAULT, "No network backend registered\n");
 	CKNULL_LOG(auth, -EINVAL, "Authentication context missing\n");
 
-	ret = _acvp_net_op(testid_ctx, url, submit, response, nettype);
+	while (1) {
+		CKINT(acvp_net_rate_acquire());
+		retry_after = 0;
+		ret = _acvp_net_op(testid_ctx, url, submit, response, sink,
+				   nettype, &retry_after);
+		acvp_net_rate_feedback(ret, retry_after);
+
+		if (!acvp_net_throttled(ret) ||
+		    !acvp_net_throttle_retry(ret, nettype) ||
+		    ++attempt > ACVP_NET_THROTTLE_RETRIES)
+			break;
+
+		logger(LOGGER_VERBOSE, LOGGER_C_ANY,
+		       "Resubmitting throttled request (attempt %u)\n",
+		       attempt);
+		if (response)
+			acvp_free_buf(response);
+		CKINT(acvp_net_sink_reset(sink));
+	}
 	CKINT(acvp_error_convert(response, ret, &code));
 
 	/*
@@ -112,7 +509,9 @@ int acvp_net_op(const struct acvp_testid_ctx *testid_ctx, const char *url,
 		logger(LOGGER_WARN, LOGGER_C_ANY,
 		       "Authentication error received - force refresh of auth token and retry network operation\n");
 		CKINT(acvp_jwt_invalidate(testid_ctx));
-		CKINT(_acvp_net_op(testid_ctx, url, submit, response, nettype));
+		CKINT(acvp_net_sink_reset(sink));
+		CKINT(_acvp_net_op(testid_ctx, url, submit, response, sink,
+				   nettype, NULL));
 		CKINT(acvp_error_convert(response, ret, &code));
 	}
 
@@ -127,3 +526,27 @@ int acvp_net_op(const struct acvp_testid_ctx *testid_ctx, const char *url,
 out:
 	return ret;
 }
+
+int acvp_net_op(const struct acvp_testid_ctx *testid_ctx, const char *url,
+		const struct acvp_ext_buf *submit, struct acvp_buf *response,
+		enum acvp_http_type nettype)
+{
+	return acvp_net_op_common(testid_ctx, url, submit, response, NULL,
+				  nettype);
+}
+
+int acvp_net_op_sink(const struct acvp_testid_ctx *testid_ctx, const char *url,
+		     const struct acvp_buf_sink *sink,
+		     struct acvp_buf *response)
+{
+	int ret;
+
+	CKNULL_LOG(sink, -EINVAL, "Sink missing\n");
+	CKNULL_LOG(sink->write, -EINVAL, "Sink write callback missing\n");
+
+	ret = acvp_net_op_common(testid_ctx, url, NULL, response, sink,
+				 acvp_http_get);
+
+out:
+	return ret;
+}
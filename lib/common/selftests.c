@@ -169,12 +169,155 @@ static int sha_tester(void)
 	return ret;
 }
 
+/*
+ * Multi-buffer update with messages spanning multiple blocks of all hashes:
+ * the message is the 112 bytes FIPS 180 message repeated four times.
+ */
+static int sha_mb_tester_one(const struct hash *hash, const uint8_t *exp,
+			     const char *info)
+{
+#define SHA_MB_TESTER_NUM 8
+	static const uint8_t msg_part[] =
+		"abcdefghbcdefghicdefghijdefghijkefghijklfghijklm"
+		"ghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrs"
+		"mnopqrstnopqrstu";
+	uint64_t ctx_buf[SHA_MB_TESTER_NUM][SHA_MAX_CTX_SIZE / sizeof(uint64_t)];
+	struct sha_ctx *ctx[SHA_MB_TESTER_NUM];
+	const uint8_t *in[SHA_MB_TESTER_NUM];
+	size_t inlen[SHA_MB_TESTER_NUM];
+	uint8_t msg[4 * (sizeof(msg_part) - 1)];
+	uint8_t act[SHA512_SIZE_DIGEST];
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < 4; i++) {
+		memcpy(msg + i * (sizeof(msg_part) - 1), msg_part,
+		       sizeof(msg_part) - 1);
+	}
+
+	for (i = 0; i < SHA_MB_TESTER_NUM; i++) {
+		ctx[i] = (struct sha_ctx *)ctx_buf[i];
+		hash->init(ctx[i]);
+
+		/* Leave a partial block in the context */
+		hash->update(ctx[i], msg, 3);
+		in[i] = msg + 3;
+		inlen[i] = 300;
+	}
+	hash->update_mb(ctx, in, inlen, SHA_MB_TESTER_NUM);
+
+	for (i = 0; i < SHA_MB_TESTER_NUM; i++) {
+		in[i] = msg + 303;
+		inlen[i] = sizeof(msg) - 303;
+	}
+	hash->update_mb(ctx, in, inlen, SHA_MB_TESTER_NUM);
+
+	for (i = 0; i < SHA_MB_TESTER_NUM; i++) {
+		hash->final(ctx[i], act);
+		ret += compare(act, exp, hash->digestsize, info);
+	}
+
+	return ret;
+#undef SHA_MB_TESTER_NUM
+}
+
+static int sha_mb_tester(void)
+{
+	static const uint8_t exp_256[] = {
+		0xf2, 0xc6, 0xe7, 0xc0, 0x5f, 0x92, 0xae, 0x9c, 0x14, 0x3e,
+		0x6d, 0x80, 0x34, 0x7a, 0x30, 0x45, 0xd1, 0x01, 0x77, 0x66,
+		0x3c, 0x11, 0xa1, 0xf1, 0xb4, 0xb7, 0x51, 0xb5, 0x9e, 0x5b,
+		0xe2, 0x0b
+	};
+	static const uint8_t exp_512[] = {
+		0x52, 0x63, 0xac, 0xf5, 0x86, 0xb2, 0xc1, 0x7a, 0xe3, 0xe5,
+		0x1f, 0x14, 0x7c, 0x26, 0x14, 0x96, 0xee, 0x84, 0x32, 0xbc,
+		0xfe, 0x69, 0xc1, 0x51, 0xe0, 0x7d, 0x79, 0x79, 0x1b, 0x35,
+		0x34, 0xc8, 0xe0, 0x74, 0x40, 0xa8, 0x4e, 0xac, 0xff, 0x25,
+		0x3e, 0xb5, 0x33, 0x4c, 0xaf, 0x51, 0x89, 0x0d, 0x66, 0x2a,
+		0x13, 0xe3, 0x06, 0x9e, 0xc6, 0xf1, 0xf1, 0xbf, 0xc9, 0xa6,
+		0x53, 0xf9, 0x8d, 0x68
+	};
+	static const uint8_t exp_sha3_256[] = {
+		0xa6, 0xcb, 0x76, 0x87, 0x9c, 0xdd, 0x5a, 0xa6, 0xdb, 0x2c,
+		0x75, 0x7b, 0x7d, 0x51, 0x9b, 0x7d, 0xda, 0x62, 0x24, 0xa8,
+		0x4a, 0xc1, 0x4e, 0xf3, 0xec, 0x17, 0x0f, 0x6c, 0x89, 0xb9,
+		0xb7, 0x4e
+	};
+	int ret;
+
+	ret = sha_mb_tester_one(sha256, exp_256, "SHA-256 multi-buffer");
+	ret += sha_mb_tester_one(sha512, exp_512, "SHA-512 multi-buffer");
+	ret += sha_mb_tester_one(sha3_256, exp_sha3_256,
+				 "SHA3-256 multi-buffer");
+
+	return ret;
+}
+
+static void hash_set_impl_c(void)
+{
+	sha256_set_impl(HASH_IMPL_C);
+	sha512_set_impl(HASH_IMPL_C);
+	sha3_set_impl(HASH_IMPL_C);
+}
+
+/*
+ * Test every SHA-2 and SHA-3 implementation supported by the CPU before the
+ * fastest one is selected for use.
+ */
+static int hash_impl_tester(void)
+{
+	static const enum hash_impl impls[] = { HASH_IMPL_C,
+						HASH_IMPL_SHANI,
+						HASH_IMPL_AVX2,
+						HASH_IMPL_ARMV8_CE,
+						HASH_IMPL_AVX512 };
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < sizeof(impls) / sizeof(*impls); i++) {
+		int ret256 = sha256_set_impl(impls[i]);
+		int ret512 = sha512_set_impl(impls[i]);
+		int ret_sha3 = sha3_set_impl(impls[i]);
+
+		if (ret256 && ret512 && ret_sha3)
+			continue;
+
+		/* Algorithm without this implementation uses C */
+		if (ret256)
+			sha256_set_impl(HASH_IMPL_C);
+		if (ret512)
+			sha512_set_impl(HASH_IMPL_C);
+		if (ret_sha3)
+			sha3_set_impl(HASH_IMPL_C);
+
+		ret += sha_tester();
+		ret += sha3_tester();
+		ret += sha_mb_tester();
+	}
+
+	if (ret) {
+		hash_set_impl_c();
+		return ret;
+	}
+
+	/* Verify the combination finally selected */
+	sha256_set_impl(HASH_IMPL_AUTO);
+	sha512_set_impl(HASH_IMPL_AUTO);
+	sha3_set_impl(HASH_IMPL_AUTO);
+	ret = sha_tester();
+	ret += sha3_tester();
+	if (ret)
+		hash_set_impl_c();
+
+	return ret;
+}
+
 static int crypto_selftest(void)
 {
-	int ret = sha3_tester();
+	int ret = hash_impl_tester();
 
 	ret += sha3_hmac_tester();
-	ret += sha_tester();
 
 	if (ret) {
 		logger_set_verbosity(LOGGER_ERR);
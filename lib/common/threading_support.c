@@ -43,32 +43,81 @@
  * Threading Support
  * =================
  *
- * Threading support is provided by maintaining a pool of threads which
- * are spawned when they are needed. Once the thread completes its first job
- * it remains idle but alive and waits for the next job. The code first
- * tries to reuse existing idle threads before spawning new threads.
+ * Threading support is provided by maintaining a pool of threads per thread
+ * group which are spawned when they are needed. Each thread group has a work
+ * queue. A job submitted with thread_start is placed into the queue of its
+ * thread group and one idle thread of that group is woken up with a condition
+ * variable. If no idle thread is available and the group has not yet spawned
+ * all of its threads, a new thread is spawned. Once a thread completes its
+ * job, it remains alive and waits for the next job.
+ *
+ * The number of jobs that are queued or executing in a thread group is
+ * limited by the concurrency limit of the group which is also the number of
+ * threads the group may spawn. If that limit is reached, thread_start blocks
+ * until a job of that group completes. The limits default to an even split of
+ * all threads and can be changed with thread_set_limits.
+ *
+ * Work stealing: An idle thread of a regular thread group executes queued jobs
+ * of regular thread groups with a higher number, taking them from the tail of
+ * the queue while the owning threads take jobs from the head. As the jobs of
+ * a group with a higher number are the "children" of the jobs of a group with
+ * a lower number, a "child" thread never executes a "mother" job. This retains
+ * the deadlock avoidance semantics of the thread groups while saving threads
+ * when a group has spare idle threads.
  *
  * It is permissible to spawn new threads from different mother threads. When
- * calling thread_wait, only the threads from the caller are waited for.
+ * calling thread_wait, only the jobs from the caller are waited for. The
+ * return codes of all jobs of one mother thread are collected and handed
+ * to thread_wait.
  */
 
+/*
+ * One job scheduled with thread_start
+ */
+struct thread_job {
+	struct thread_job *next, *prev;
+	int (*start_routine)(void *); /* Thread code to be executed */
+	void *data; /* Parameters used by the thread code */
+	struct thread_group *group; /* Thread group of the job */
+	struct thread_parent *parent; /* Mother thread or NULL */
+};
+
+/*
+ * Bookkeeping of the jobs of one mother thread
+ */
+struct thread_parent {
+	struct thread_parent *next;
+	pthread_t thread_id; /* Thread ID of mother thread */
+	unsigned int outstanding; /* Number of queued or executing jobs */
+	int ret; /* Return codes of completed jobs ORed together */
+	pthread_cond_t done; /* Signalled when all jobs completed */
+};
+
+/*
+ * Thread group with its work queue
+ */
+struct thread_group {
+	struct thread_job *head, *tail; /* Work queue */
+	pthread_cond_t work; /* Signalled on new job or shutdown */
+	pthread_cond_t slot_free; /* Signalled on completed job */
+	unsigned int first_slot; /* First slot in threads[] of the group */
+	unsigned int nr_slots; /* Concurrency limit of the group */
+	unsigned int spawned; /* Number of threads spawned */
+	unsigned int idle; /* Number of threads waiting for work */
+	unsigned int wakeups; /* Number of idle threads already woken up */
+	unsigned int busy; /* Number of queued or executing jobs */
+	unsigned int thread_group; /* Number of regular thread group */
+	bool shutdown; /* Shall the threads of the group terminate? */
+};
+
 /*
  * Structure for one thread
  */
 struct thread_ctx {
 	pthread_t thread_id; /* Thread ID from pthread_create */
-	pthread_t parent; /* Parent thread ID */
 	unsigned int thread_num; /* Current slot number */
-	int ret_ancestor; /* Return code of ancestor code */
-
-	int (*start_routine)(void *); /* Thread code to be executed */
-	void *data; /* Parameters used by the thread code */
-
-	atomic_bool_t thread_pending; /* Is thread associated with structure? */
-	mutex_w_t inuse; /* Is thread data structure used? */
-	atomic_bool_t shutdown; /* Shall the thread be shut down? */
-	bool scheduled; /* Is/was a job executed and return code
-					 * is ready for pickup? */
+	struct thread_group *group; /* Thread group the thread serves */
+	bool alive; /* Is thread associated with structure? */
 };
 
 /*
@@ -84,6 +133,22 @@ static struct thread_ctx threads[THREADING_REALLY_ALL_THREADS];
 static uint32_t threads_groups = 0;
 static uint32_t threads_per_threadgroup = 1;
 
+/*
+ * Thread groups - the regular groups are followed by the special groups.
+ */
+static struct thread_group *thread_groups = NULL;
+
+/*
+ * List of mother threads with pending or uncollected jobs.
+ */
+static struct thread_parent *thread_parents = NULL;
+
+/*
+ * Lock protecting the thread groups, the work queues and the mother thread
+ * bookkeeping.
+ */
+static DEFINE_MUTEX_W_UNLOCKED(threads_lock);
+
 static pthread_attr_t pthread_attr;
 
 /*
@@ -108,16 +173,23 @@ static inline unsigned int thread_get_special_slot(unsigned int thread_group)
 	return (THREADING_MAX_THREADS + (UINT_MAX - thread_group));
 }
 
-static inline bool thread_is_special(struct thread_ctx *tctx)
+static inline bool thread_group_is_special(struct thread_group *group)
 {
-	return (tctx->thread_num >= THREADING_MAX_THREADS) ? true : false;
+	return (group >= thread_groups + threads_groups) ? true : false;
+}
+
+/* Number of thread groups, including the special groups */
+static inline unsigned int thread_groups_all(bool system_threads)
+{
+	return system_threads ? threads_groups + ACVP_THREAD_MAX_SPECIAL_GROUPS :
+				      threads_groups;
 }
 
 int thread_init(uint32_t groups)
 {
 	static uint32_t thread_initialized = 0;
 	unsigned int i;
-	int ret;
+	int ret = 0;
 
 	if (groups > (THREADING_MAX_THREADS)) {
 		logger(LOGGER_ERR, LOGGER_C_THREADING,
@@ -131,19 +203,36 @@ int thread_init(uint32_t groups)
 
 	if (thread_initialized)
 		goto out;
-	thread_initialized = 1;
+
+	thread_groups = calloc(groups + ACVP_THREAD_MAX_SPECIAL_GROUPS,
+			       sizeof(*thread_groups));
+	CKNULL(thread_groups, -ENOMEM);
 
 	CKINT(pthread_attr_init(&pthread_attr));
 	memset(threads, 0, sizeof(threads));
 
-	for (i = 0; i < THREADING_REALLY_ALL_THREADS; i++) {
-		mutex_w_init(&threads[i].inuse, false);
-		atomic_bool_set_false(&threads[i].shutdown);
-	}
-
 	threads_groups = groups;
 	threads_per_threadgroup = THREADING_MAX_THREADS / threads_groups;
 
+	for (i = 0; i < groups + ACVP_THREAD_MAX_SPECIAL_GROUPS; i++) {
+		struct thread_group *group = &thread_groups[i];
+
+		pthread_cond_init(&group->work, NULL);
+		pthread_cond_init(&group->slot_free, NULL);
+
+		if (i < groups) {
+			group->first_slot = i * threads_per_threadgroup;
+			group->nr_slots = threads_per_threadgroup;
+			group->thread_group = i;
+		} else {
+			/* One reserved thread per special group */
+			group->first_slot = THREADING_MAX_THREADS + i - groups;
+			group->nr_slots = 1;
+		}
+	}
+
+	thread_initialized = 1;
+
 	logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
 	       "Initialized threading support for %u threads\n",
 	       THREADING_MAX_THREADS);
@@ -155,41 +244,317 @@ int thread_init(uint32_t groups)
 	}
 
 out:
+	return ret;
+}
+
+/*
+ * Terminate the idle threads of the regular thread groups - caller holds
+ * threads_cleanup.
+ */
+static int thread_reap_idle(void)
+{
+	unsigned int i;
+
+	mutex_w_lock(&threads_lock);
+
+	for (i = 0; i < threads_groups; i++) {
+		if (thread_groups[i].busy) {
+			mutex_w_unlock(&threads_lock);
+			logger(LOGGER_ERR, LOGGER_C_THREADING,
+			       "Thread limits cannot be changed while threads are active\n");
+			return -EBUSY;
+		}
+	}
+
+	for (i = 0; i < threads_groups; i++) {
+		thread_groups[i].shutdown = true;
+		pthread_cond_broadcast(&thread_groups[i].work);
+	}
+
+	mutex_w_unlock(&threads_lock);
+
+	for (i = 0; i < THREADING_MAX_THREADS; i++) {
+		if (threads[i].alive) {
+			pthread_join(threads[i].thread_id, NULL);
+			threads[i].alive = false;
+			logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
+			       "Thread %u terminated\n", i);
+		}
+	}
+
+	mutex_w_lock(&threads_lock);
+	for (i = 0; i < threads_groups; i++) {
+		thread_groups[i].spawned = 0;
+		thread_groups[i].shutdown = false;
+		pthread_cond_broadcast(&thread_groups[i].slot_free);
+	}
+	mutex_w_unlock(&threads_lock);
+
 	return 0;
 }
 
-static inline void thread_block(void)
+int thread_set_limits(const uint32_t *limits, uint32_t groups)
+{
+	unsigned int i, assigned = 0, unassigned = 0, first_slot = 0;
+	int ret = 0;
+
+	if (!thread_groups)
+		return -EOPNOTSUPP;
+
+	if (groups > threads_groups) {
+		logger(LOGGER_ERR, LOGGER_C_THREADING,
+		       "Thread limits for %u thread groups provided, but only %u thread groups are defined\n",
+		       groups, threads_groups);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < threads_groups; i++) {
+		if (i < groups && limits[i])
+			assigned += limits[i];
+		else
+			unassigned++;
+	}
+
+	if (assigned + unassigned > THREADING_MAX_THREADS) {
+		logger(LOGGER_ERR, LOGGER_C_THREADING,
+		       "Thread limits exceed the maximum number of threads (%u)\n",
+		       THREADING_MAX_THREADS);
+		return -EINVAL;
+	}
+
+	/* Threads that served earlier jobs wait idle for work */
+	mutex_w_lock(&threads_cleanup);
+	ret = thread_reap_idle();
+	if (ret) {
+		mutex_w_unlock(&threads_cleanup);
+		return ret;
+	}
+
+	mutex_w_lock(&threads_lock);
+
+	/* The thread slots can only be re-arranged without running threads */
+	for (i = 0; i < threads_groups; i++) {
+		if (thread_groups[i].spawned) {
+			logger(LOGGER_ERR, LOGGER_C_THREADING,
+			       "Thread limits cannot be changed while threads are active\n");
+			ret = -EBUSY;
+			goto out;
+		}
+	}
+
+	/* Groups without a limit share the remaining threads evenly */
+	for (i = 0; i < threads_groups; i++) {
+		struct thread_group *group = &thread_groups[i];
+
+		group->first_slot = first_slot;
+		if (i < groups && limits[i]) {
+			group->nr_slots = limits[i];
+		} else {
+			group->nr_slots =
+				(THREADING_MAX_THREADS - assigned) / unassigned;
+		}
+		first_slot += group->nr_slots;
+
+		/* Allow blocked callers to use the new limit */
+		pthread_cond_broadcast(&group->slot_free);
+	}
+
+out:
+	mutex_w_unlock(&threads_lock);
+	mutex_w_unlock(&threads_cleanup);
+
+	if (!ret) {
+		for (i = 0; i < threads_groups; i++) {
+			logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
+			       "Thread group %u limited to %u concurrent jobs\n",
+			       i, thread_groups[i].nr_slots);
+		}
+	}
+
+	return ret;
+}
+
+unsigned int thread_get_limit(uint32_t thread_group)
+{
+	unsigned int limit = 0;
+
+	mutex_w_lock(&threads_lock);
+	if (thread_groups && thread_group < threads_groups)
+		limit = thread_groups[thread_group].nr_slots;
+	mutex_w_unlock(&threads_lock);
+
+	return limit;
+}
+
+/* Cancellation cleanup handler when waiting on a condition variable */
+static void thread_unlock(void *arg)
+{
+	(void)arg;
+	mutex_w_unlock(&threads_lock);
+}
+
+/* Wait for the condition variable - caller must hold threads_lock */
+static inline void thread_cond_wait(pthread_cond_t *cond)
+{
+	pthread_cleanup_push(thread_unlock, NULL);
+	pthread_cond_wait(cond, &threads_lock);
+	pthread_cleanup_pop(0);
+}
+
+/* Find the bookkeeping of the calling thread - caller holds threads_lock */
+static struct thread_parent *thread_parent_find(pthread_t self)
+{
+	struct thread_parent *parent;
+
+	for (parent = thread_parents; parent; parent = parent->next) {
+		if (pthread_equal(parent->thread_id, self))
+			return parent;
+	}
+
+	return NULL;
+}
+
+/* Get the bookkeeping of the calling thread - caller holds threads_lock */
+static struct thread_parent *thread_parent_get(pthread_t self)
+{
+	struct thread_parent *parent = thread_parent_find(self);
+
+	if (parent)
+		return parent;
+
+	parent = calloc(1, sizeof(*parent));
+	if (!parent)
+		return NULL;
+
+	parent->thread_id = self;
+	pthread_cond_init(&parent->done, NULL);
+	parent->next = thread_parents;
+	thread_parents = parent;
+
+	return parent;
+}
+
+/* Remove the bookkeeping of a mother thread - caller holds threads_lock */
+static void thread_parent_put(struct thread_parent *parent)
 {
-	const struct timespec sleeptime = { .tv_sec = 0, .tv_nsec = 1 << 27 };
+	struct thread_parent **pos;
+
+	for (pos = &thread_parents; *pos; pos = &(*pos)->next) {
+		if (*pos == parent) {
+			*pos = parent->next;
+			break;
+		}
+	}
 
-	nanosleep(&sleeptime, NULL);
+	pthread_cond_destroy(&parent->done);
+	free(parent);
 }
 
-static inline bool thread_dirty(unsigned int slot)
+/* Append the job to the work queue - caller holds threads_lock */
+static void thread_queue_add(struct thread_group *group, struct thread_job *job)
 {
-	return (atomic_bool_read(&threads[slot].thread_pending));
+	job->next = NULL;
+	job->prev = group->tail;
+	if (group->tail)
+		group->tail->next = job;
+	else
+		group->head = job;
+	group->tail = job;
 }
 
-/* Thread structure cleanup after execution when thread is kept alive. */
-static inline void thread_cleanup(struct thread_ctx *tctx)
+/* Take the job from the work queue - caller holds threads_lock */
+static void thread_queue_del(struct thread_group *group, struct thread_job *job)
 {
-	tctx->data = NULL;
-	tctx->start_routine = NULL;
+	if (job->prev)
+		job->prev->next = job->next;
+	else
+		group->head = job->next;
+	if (job->next)
+		job->next->prev = job->prev;
+	else
+		group->tail = job->prev;
+	job->next = job->prev = NULL;
+}
+
+/*
+ * Find a job for the thread group: first the head of the own queue, then the
+ * tail of the queue of a regular "child" thread group - caller holds
+ * threads_lock.
+ */
+static struct thread_job *thread_queue_next(struct thread_group *group)
+{
+	unsigned int i;
+
+	if (group->head)
+		return group->head;
+
+	if (thread_group_is_special(group))
+		return NULL;
+
+	for (i = group->thread_group + 1; i < threads_groups; i++) {
+		if (thread_groups[i].tail)
+			return thread_groups[i].tail;
+	}
+
+	return NULL;
+}
+
+/*
+ * Wake up a thread for a new job of the group. Prefer an idle thread of the
+ * group itself, then an idle thread of a "mother" thread group that can steal
+ * the job - caller holds threads_lock.
+ *
+ * @return true if a thread was woken up, false if no thread is idle
+ */
+static bool thread_wake(struct thread_group *group)
+{
+	unsigned int i;
+
+	if (group->idle > group->wakeups) {
+		group->wakeups++;
+		pthread_cond_signal(&group->work);
+		return true;
+	}
+
+	if (thread_group_is_special(group))
+		return false;
+
+	for (i = 0; i < group->thread_group; i++) {
+		struct thread_group *mother = &thread_groups[i];
+
+		if (mother->idle > mother->wakeups) {
+			mother->wakeups++;
+			pthread_cond_signal(&mother->work);
+			return true;
+		}
+	}
 
-	/* Return values of special threads is irrelevant */
-	if (thread_is_special(tctx))
-		tctx->scheduled = false;
+	return false;
 }
 
-/* Thread structure cleanup when thread is terminated. */
-static inline void thread_cleanup_full(struct thread_ctx *tctx)
+static int thread_create(struct thread_group *group);
+
+/*
+ * A thread woken up for a job of a child thread group may take a job of its
+ * own group instead. Pass the wakeup on so that the remaining job is not
+ * stalled until a thread becomes idle - caller holds threads_lock.
+ */
+static void thread_wake_remaining(struct thread_group *group)
 {
-	thread_cleanup(tctx);
-	tctx->thread_num = 0;
-	atomic_bool_set_false(&tctx->thread_pending);
-	tctx->scheduled = false;
-	tctx->ret_ancestor = 0;
-	mutex_w_destroy(&tctx->inuse);
+	struct thread_job *job = thread_queue_next(group);
+
+	if (!job)
+		return;
+
+	group = job->group;
+	if (!thread_wake(group) && group->spawned < group->nr_slots) {
+		/* Without a new thread the job waits for a busy thread */
+		if (thread_create(group)) {
+			logger(LOGGER_DEBUG, LOGGER_C_THREADING,
+			       "Cannot spawn thread for thread group %u\n",
+			       group->thread_group);
+		}
+	}
 }
 
 /* Worker loop of a thread */
@@ -197,6 +562,8 @@ static void *thread_worker(void *arg)
 {
 	sigset_t block, old;
 	struct thread_ctx *tctx = (struct thread_ctx *)arg;
+	struct thread_group *group = tctx->group;
+	struct thread_job *job;
 	int ret;
 
 	/* Block all signals from being processed by thread */
@@ -205,146 +572,167 @@ static void *thread_worker(void *arg)
 	if (ret)
 		return NULL;
 
+	mutex_w_lock(&threads_lock);
+
 	while (1) {
-		mutex_w_lock(&tctx->inuse);
-
-		if (atomic_bool_read(&tctx->shutdown)) {
-			/* Request for termination */
-			mutex_w_unlock(&tctx->inuse);
-			/*
-			 * As the while loop terminates, the thread will
-			 * terminate as well - clean up our structure in case
-			 * the signal handler wants to cancel all threads.
-			 * In this case, it has to identify that this thread
-			 * does not exist any more.
-			 */
-			thread_cleanup_full(tctx);
-			pthread_exit(NULL);
+		while (!(job = thread_queue_next(group)) && !group->shutdown) {
+			group->idle++;
+			thread_cond_wait(&group->work);
+			group->idle--;
+			if (group->wakeups)
+				group->wakeups--;
+		}
+
+		/* Request for termination once the queue is drained */
+		if (!job)
 			break;
-		} else if (tctx->start_routine) {
-			/* Work to do, execute */
-			tctx->ret_ancestor = tctx->start_routine(tctx->data);
-			thread_cleanup(tctx);
-			logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
-			       "Thread %u completed\n", tctx->thread_num);
-			mutex_w_unlock(&tctx->inuse);
-		} else {
-			/* Idle */
-			mutex_w_unlock(&tctx->inuse);
-			thread_block();
+
+		thread_queue_del(job->group, job);
+		thread_wake_remaining(group);
+
+		mutex_w_unlock(&threads_lock);
+
+		if (job->group != group) {
+			logger(LOGGER_DEBUG, LOGGER_C_THREADING,
+			       "Thread %u executes job of thread group %u\n",
+			       tctx->thread_num, job->group->thread_group);
 		}
+
+		/* Work to do, execute */
+		ret = job->start_routine(job->data);
+		logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
+		       "Thread %u completed\n", tctx->thread_num);
+
+		mutex_w_lock(&threads_lock);
+
+		/* Return values of special threads is irrelevant */
+		if (job->parent) {
+			job->parent->ret |= ret;
+			job->parent->outstanding--;
+			if (!job->parent->outstanding)
+				pthread_cond_broadcast(&job->parent->done);
+		}
+		job->group->busy--;
+		pthread_cond_signal(&job->group->slot_free);
+		free(job);
 	}
 
+	mutex_w_unlock(&threads_lock);
+
 	return NULL;
 }
 
-/* Spawn a thread */
-static int thread_create(struct thread_ctx *tctx, unsigned int slot)
+/* Spawn a thread - caller holds threads_lock */
+static int thread_create(struct thread_group *group)
 {
+	struct thread_ctx *tctx;
+	unsigned int slot = group->first_slot + group->spawned;
 	int ret;
 
+	tctx = &threads[slot];
 	tctx->thread_num = slot;
-	tctx->data = NULL;
-	atomic_bool_set_true(&tctx->thread_pending);
+	tctx->group = group;
 
 	ret = -pthread_create(&tctx->thread_id, &pthread_attr, &thread_worker,
 			      tctx);
 	if (ret)
-		goto err;
+		return ret;
 
-	ret = -pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	if (ret)
-		goto err;
+	tctx->alive = true;
+	group->spawned++;
 
 	return 0;
-
-err:
-	thread_cleanup_full(tctx);
-	return ret;
 }
 
-/* Find free pthread slot and schedule the job */
+/* Queue the job in the work queue of the thread group */
 static int thread_schedule(int (*start_routine)(void *), void *tdata,
-			   uint32_t thread_group, int *ret_ancestor)
+			   uint32_t thread_group)
 {
-	pthread_t self = pthread_self();
-	unsigned int i, upper;
+	struct thread_group *group;
+	struct thread_parent *parent = NULL;
+	struct thread_job *job;
 	unsigned int special_slot = thread_get_special_slot(thread_group);
+	unsigned int slot = 0;
+	bool spawned = false;
+	int ret = 0;
 
-	if (threads_groups < thread_group && !special_slot) {
+	if (threads_groups <= thread_group && !special_slot) {
 		logger(LOGGER_ERR, LOGGER_C_THREADING,
 		       "undefined thread group requested (%u, max thread group is %u)\n",
 		       thread_group, threads_groups);
 		return -EINVAL;
 	}
 
-	/* Get the range of slots of the thread_group */
 	if (special_slot) {
-		i = special_slot;
-		upper = special_slot + 1;
+		group = &thread_groups[threads_groups + special_slot -
+				       THREADING_MAX_THREADS];
 	} else {
-		i = thread_group * threads_per_threadgroup;
-		upper = (thread_group + 1) * threads_per_threadgroup;
+		group = &thread_groups[thread_group];
 	}
 
-	for (; i < upper; i++) {
-		if (atomic_bool_read(&threads_in_cancel))
-			return -ESHUTDOWN;
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return -ENOMEM;
+	job->start_routine = start_routine;
+	job->data = tdata;
+
+	mutex_w_lock(&threads_lock);
+
+	/* Wait until the thread group has capacity for the job */
+	while (1) {
+		if (atomic_bool_read(&threads_in_cancel)) {
+			ret = -ESHUTDOWN;
+			goto out;
+		}
+
+		if (!group->shutdown && group->busy < group->nr_slots)
+			break;
+
+		thread_cond_wait(&group->slot_free);
+	}
 
-		if (mutex_w_trylock(&threads[i].inuse)) {
-			/* The thread is currently executing a body of code */
-			if (threads[i].start_routine ||
-			    atomic_bool_read(&threads[i].shutdown)) {
-				mutex_w_unlock(&threads[i].inuse);
-				continue;
-			}
-
-			/*
-			 * Thread is not being picked up by thread_wait of the
-			 * mother thread, skip.
-			 */
-			if (threads[i].scheduled &&
-			    !pthread_equal(threads[i].parent, self)) {
-				mutex_w_unlock(&threads[i].inuse);
-				continue;
-			}
-
-			/*
-			 * Create thread as we have a clean slot and all
-			 * existing threads are busy.
-			 */
-			if (!thread_dirty(i)) {
-				int ret = thread_create(&threads[i], i);
-
-				if (ret)
-					return ret;
-
-				logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
-				       "Thread %u for thread group %u allocated\n",
-				       i, thread_group);
-			}
-
-			/* Catch the return code of the ancestor thread */
-			if (ret_ancestor)
-				*ret_ancestor = threads[i].ret_ancestor;
-
-			/*
-			 * Use the thread from the thread pool and schedule
-			 * job.
-			 */
+	if (!thread_group_is_special(group)) {
+		parent = thread_parent_get(pthread_self());
+		if (!parent) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	/* Create thread as all existing threads are busy. */
+	if (!thread_wake(group) && group->spawned < group->nr_slots) {
+		slot = group->first_slot + group->spawned;
+		ret = thread_create(group);
+		if (ret)
+			goto out;
+		spawned = true;
+	}
+
+	job->group = group;
+	job->parent = parent;
+	if (parent)
+		parent->outstanding++;
+	thread_queue_add(group, job);
+	group->busy++;
+	job = NULL;
+
+out:
+	mutex_w_unlock(&threads_lock);
+
+	if (job)
+		free(job);
+
+	if (!ret) {
+		if (spawned) {
 			logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
-			       "Thread %u for thread group %u assigned\n", i,
+			       "Thread %u for thread group %u allocated\n", slot,
 			       thread_group);
-			threads[i].data = tdata;
-			threads[i].start_routine = start_routine;
-			threads[i].parent = pthread_self();
-			threads[i].scheduled = true;
-			mutex_w_unlock(&threads[i].inuse);
-			return 0;
 		}
+		logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
+		       "Job for thread group %u queued\n", thread_group);
 	}
 
-	return -EAGAIN;
+	return ret;
 }
 
 /*
@@ -352,58 +740,44 @@ static int thread_schedule(int (*start_routine)(void *), void *tdata,
  */
 int thread_wait(void)
 {
-	unsigned int i;
-	pthread_t self = pthread_self();
+	struct thread_parent *parent;
 	int ret = 0;
-	bool wait = true;
-
-	while (wait) {
-		wait = false;
-
-		/* Only wait for our children */
-		for (i = 0; i < THREADING_MAX_THREADS; i++) {
-			if (atomic_bool_read(&threads[i].shutdown))
-				return -ESHUTDOWN;
-
-			/* Thread is not initialized, skip */
-			if (!thread_dirty(i))
-				continue;
-
-			/* Thread is not one of our children, skip */
-			if (!pthread_equal(threads[i].parent, self))
-				continue;
-
-			/* If the thread executes a job, skip but wait wait. */
-			if (!mutex_w_trylock(&threads[i].inuse)) {
-				wait = true;
-				continue;
-			}
-
-			/*
-			 * If there is a start routine, a job is pending and we
-			 * wait for it to finish.
-			 */
-			if (threads[i].start_routine) {
-				wait = true;
-			} else {
-				/* Collect return code of our threads */
-				ret |= threads[i].ret_ancestor;
-				threads[i].scheduled = false;
-			}
-
-			mutex_w_unlock(&threads[i].inuse);
+
+	mutex_w_lock(&threads_lock);
+
+	/* Only wait for our children */
+	parent = thread_parent_find(pthread_self());
+	if (!parent)
+		goto out;
+
+	while (parent->outstanding) {
+		if (atomic_bool_read(&threads_in_cancel)) {
+			ret = -ESHUTDOWN;
+			goto out;
 		}
 
-		if (wait)
-			thread_block();
+		thread_cond_wait(&parent->done);
 	}
 
+	/* Collect return code of our threads */
+	ret = parent->ret;
+	thread_parent_put(parent);
+
+out:
+	mutex_w_unlock(&threads_lock);
 	return ret;
 }
 
+/*
+ * The name of the current thread is cached as it is queried for every log
+ * message and pthread_getname_np implies a system call.
+ */
+static __thread char thread_name_cache[ACVP_THREAD_MAX_NAMELEN];
+
 int thread_set_name(enum acvp_request_type type, uint32_t id)
 {
 	char name[ACVP_THREAD_MAX_NAMELEN];
+	int ret;
 
 	switch (type) {
 	case acvp_testid:
@@ -418,26 +792,53 @@ int thread_set_name(enum acvp_request_type type, uint32_t id)
 	case acvp_totp:
 		snprintf(name, sizeof(name), "totp%u", id);
 		break;
+	case acvp_dssync:
+		snprintf(name, sizeof(name), "dssync%u", id);
+		break;
+	case acvp_jwtrefresh:
+		snprintf(name, sizeof(name), "jwtrefresh%u", id);
+		break;
 	default:
 		snprintf(name, sizeof(name), "%u", id);
 		break;
 	}
 
 #ifdef __APPLE__
-	return -pthread_setname_np(name);
+	ret = -pthread_setname_np(name);
 #else
-	return -pthread_setname_np(pthread_self(), name);
+	ret = -pthread_setname_np(pthread_self(), name);
 #endif
+	if (!ret)
+		memcpy(thread_name_cache, name, sizeof(thread_name_cache));
+
+	return ret;
 }
 
 int thread_get_name(char *name, size_t len)
 {
-	return -pthread_getname_np(pthread_self(), name, len);
+	int ret;
+
+	if (!len)
+		return -EINVAL;
+
+	if (!thread_name_cache[0]) {
+		ret = -pthread_getname_np(pthread_self(), thread_name_cache,
+					  sizeof(thread_name_cache));
+		if (ret) {
+			thread_name_cache[0] = '\0';
+			return ret;
+		}
+	}
+
+	snprintf(name, len, "%s", thread_name_cache);
+
+	return 0;
 }
 
 /* Wait for all threads */
 static int thread_wait_all(bool system_threads)
 {
+	struct thread_parent *parent, *tmp;
 	unsigned int i, upper = system_threads ? THREADING_REALLY_ALL_THREADS :
 						       THREADING_MAX_THREADS;
 	int ret = 0;
@@ -445,25 +846,45 @@ static int thread_wait_all(bool system_threads)
 	mutex_w_lock(&threads_cleanup);
 
 	/* Ensure that no new thread is spawned. */
-	for (i = 0; i < upper; i++)
-		atomic_bool_set_true(&threads[i].shutdown);
+	mutex_w_lock(&threads_lock);
+	for (i = 0; i < thread_groups_all(system_threads); i++) {
+		thread_groups[i].shutdown = true;
+		pthread_cond_broadcast(&thread_groups[i].work);
+	}
+	mutex_w_unlock(&threads_lock);
 
 	/* Wait for all worker threads. */
 	for (i = 0; i < upper; i++) {
-		if (atomic_bool_read(&threads_in_cancel))
+		if (atomic_bool_read(&threads_in_cancel)) {
+			mutex_w_unlock(&threads_cleanup);
 			return -ESHUTDOWN;
-		if (thread_dirty(i)) {
+		}
+		if (threads[i].alive) {
 			pthread_join(threads[i].thread_id, NULL);
-			ret |= threads[i].ret_ancestor;
-			thread_cleanup_full(&threads[i]);
+			threads[i].alive = false;
 			logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
 			       "Thread %u terminated\n", i);
 		}
 	}
 
+	mutex_w_lock(&threads_lock);
+
+	/* Collect the return codes nobody waited for */
+	for (parent = thread_parents; parent; parent = tmp) {
+		tmp = parent->next;
+		ret |= parent->ret;
+		parent->ret = 0;
+		if (!parent->outstanding)
+			thread_parent_put(parent);
+	}
+
 	/* Allow new threads being spawned */
-	for (i = 0; i < upper; i++)
-		atomic_bool_set_false(&threads[i].shutdown);
+	for (i = 0; i < thread_groups_all(system_threads); i++) {
+		thread_groups[i].spawned = 0;
+		thread_groups[i].shutdown = false;
+		pthread_cond_broadcast(&thread_groups[i].slot_free);
+	}
+	mutex_w_unlock(&threads_lock);
 
 	mutex_w_unlock(&threads_cleanup);
 
@@ -473,30 +894,49 @@ static int thread_wait_all(bool system_threads)
 /* Kill all threads */
 static void thread_cancel(bool system_threads)
 {
+	struct thread_parent *parent;
 	unsigned int i, upper = system_threads ? THREADING_REALLY_ALL_THREADS :
 						       THREADING_MAX_THREADS;
 
 	atomic_bool_set_true(&threads_in_cancel);
 	mutex_w_lock(&threads_cleanup);
-	/* Ensure that no new thread is spawned. */
-	for (i = 0; i < upper; i++) {
-		atomic_bool_set_true(&threads[i].shutdown);
-		threads[i].start_routine = NULL;
+
+	/* Ensure that no new thread is spawned and drop all queued jobs. */
+	mutex_w_lock(&threads_lock);
+	for (i = 0; i < thread_groups_all(system_threads); i++) {
+		struct thread_group *group = &thread_groups[i];
+
+		group->shutdown = true;
+		while (group->head) {
+			struct thread_job *job = group->head;
+
+			group->head = job->next;
+			free(job);
+		}
+		group->tail = NULL;
+		pthread_cond_broadcast(&group->work);
+		pthread_cond_broadcast(&group->slot_free);
 	}
 
+	/* Wake up all mother threads */
+	for (parent = thread_parents; parent; parent = parent->next)
+		pthread_cond_broadcast(&parent->done);
+	mutex_w_unlock(&threads_lock);
+
 	/* Kill all worker threads. */
 	for (i = 0; i < upper; i++) {
-		if (thread_dirty(i)) {
+		if (threads[i].alive &&
+		    !pthread_equal(threads[i].thread_id, pthread_self())) {
 			pthread_cancel(threads[i].thread_id);
 			pthread_join(threads[i].thread_id, NULL);
-			thread_cleanup_full(&threads[i]);
+			threads[i].alive = false;
 			logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
 			       "Thread %u killed\n", i);
 		}
 	}
 
 	/*
-	 * Do not set threads[i].shutdown to false any more as no new
+	 * Do not set the shutdown flag to false any more as no new
 	 * thread shall be spawned. We are in the process of dying.
 	 */
 
@@ -506,18 +946,14 @@ static void thread_cancel(bool system_threads)
 int thread_start(int (*start_routine)(void *), void *tdata,
 		 uint32_t thread_group, int *ret_ancestor)
 {
-	int ret;
-
-	while (1) {
-		ret = thread_schedule(start_routine, tdata, thread_group,
-				      ret_ancestor);
-		if (ret == -EAGAIN)
-			thread_block();
-		else
-			return ret;
-	}
+	/*
+	 * The return codes of all jobs are collected with thread_wait, thus
+	 * there is no ancestor whose return code would be lost.
+	 */
+	if (ret_ancestor)
+		*ret_ancestor = 0;
 
-	return 0;
+	return thread_schedule(start_routine, tdata, thread_group);
 }
 
 void thread_stop_spawning(void)
@@ -529,6 +965,9 @@ int thread_release(bool force, bool system_threads)
 {
 	int ret = 0;
 
+	if (!thread_groups)
+		return 0;
+
 	/*
 	 * In case someone intends to wait and we are in cancel mode, force
 	 * cancellation.
@@ -553,6 +992,17 @@ int thread_init(uint32_t groups)
 	(void)groups;
 	return 0;
 }
+int thread_set_limits(const uint32_t *limits, uint32_t groups)
+{
+	(void)limits;
+	(void)groups;
+	return 0;
+}
+unsigned int thread_get_limit(uint32_t thread_group)
+{
+	(void)thread_group;
+	return 1;
+}
 int thread_release(bool force, bool system_threads)
 {
 	(void)force;
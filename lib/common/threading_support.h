@@ -63,13 +63,17 @@ extern "C" {
 #define ACVP_THREAD_TOTP_SERVER_GROUP ((uint32_t)-1)
 #define ACVP_THREAD_TOTP_PINGSERVER_GROUP ((uint32_t)-2)
 #define ACVP_THREAD_SIGHANDLER_GROUP ((uint32_t)-3)
-#define ACVP_THREAD_MAX_SPECIAL_GROUPS 3
+#define ACVP_THREAD_DS_SYNC_GROUP ((uint32_t)-4)
+#define ACVP_THREAD_AUTH_REFRESH_GROUP ((uint32_t)-5)
+#define ACVP_THREAD_MAX_SPECIAL_GROUPS 5
 
 enum acvp_request_type {
 	acvp_testid,
 	acvp_vsid,
 	acvp_signal,
 	acvp_totp,
+	acvp_dssync,
+	acvp_jwtrefresh,
 };
 
 /**
@@ -82,6 +86,24 @@ enum acvp_request_type {
  */
 int thread_init(uint32_t groups);
 
+/**
+ * @brief - Set the concurrency limits of the regular thread groups
+ *
+ * The limit of a thread group defines how many jobs of that group may be
+ * executed concurrently. The sum of all limits must not exceed
+ * THREADING_MAX_THREADS. The limits can only be changed as long as no job of
+ * a regular thread group is queued or executing. Idle threads of the regular
+ * thread groups are terminated before the thread slots are re-arranged.
+ *
+ * @param limits [in] Array with one limit per thread group starting with
+ *		      thread group 0. A limit of zero marks a thread group
+ *		      that obtains an even share of the remaining threads.
+ * @param groups [in] Number of entries in limits.
+ *
+ * @return: 0 on success, < 0 on error
+ */
+int thread_set_limits(const uint32_t *limits, uint32_t groups);
+
 /**
  * @brief - Wait for currently executing threads and release threading support
  *
@@ -117,6 +139,16 @@ int thread_wait(void);
 int thread_start(int (*start_routine)(void *), void *tdata,
 		 uint32_t thread_group, int *ret_ancestor);
 
+/**
+ * @brief - Obtain the concurrency limit of a regular thread group
+ *
+ * @param thread_group [in] Thread group
+ *
+ * @return Maximum number of concurrent jobs of the thread group, 0 if the
+ *	   thread group is not defined
+ */
+unsigned int thread_get_limit(uint32_t thread_group);
+
 #define ACVP_THREAD_MAX_NAMELEN 16
 /**
  * @brief - Give a name to a thread that is used for logging
@@ -132,7 +132,7 @@ static int esvp_read_cc_def_one(const char *cc_dir_name, struct esvp_es_def *es)
 	struct json_object *cc_conf = NULL;
 	struct stat statbuf;
 	struct esvp_cc_def *cc = NULL;
-	char cc_file_name[FILENAME_MAX], cc_data_name[FILENAME_MAX];
+	char cc_file_name[FILENAME_MAX];
 	const char *str;
 	int ret;
 
@@ -171,17 +171,12 @@ static int esvp_read_cc_def_one(const char *cc_dir_name, struct esvp_es_def *es)
 	/*
 	 * According to the spec, the bijective claim and the required to
 	 * provide a conditioning output is only applicable if we have a
-	 * non-vetted component.
+	 * non-vetted component. The conditioning output is hashed together
+	 * with the raw noise data in esvp_hash_es_files.
 	 */
-	if (!cc->vetted) {
+	if (!cc->vetted)
 		CKINT(json_get_bool(cc_conf, "bijective", &cc->bijective));
 
-		snprintf(cc_data_name, sizeof(cc_data_name), "%s/%s%s",
-			 cc->config_dir, ESVP_ES_FILE_CC_DATA,
-			 ESVP_ES_BINARY_FILE_EXTENSION);
-		CKINT(acvp_hash_file(cc_data_name, sha256, &cc->data_hash));
-	}
-
 	/*
 	 * If we have a vetted component, we require the certificate ID
 	 */
@@ -249,13 +244,83 @@ out:
 	return ret;
 }
 
+/*
+ * Hash the raw noise data, the restart data and the output of all non-vetted
+ * conditioning components in one go. The message digests are cached in the
+ * entropy source directory so that unchanged files are not hashed again.
+ */
+static int esvp_hash_es_files(struct esvp_es_def *es)
+{
+	struct esvp_cc_def *cc;
+	struct acvp_buf **md = NULL;
+	char **pathnames = NULL;
+	char cache_file[FILENAME_MAX];
+	unsigned int i, num = 2;
+	int ret = 0;
+
+	for (cc = es->cc; cc; cc = cc->next) {
+		if (!cc->vetted)
+			num++;
+	}
+
+	pathnames = calloc(num, sizeof(*pathnames));
+	CKNULL(pathnames, -ENOMEM);
+	md = calloc(num, sizeof(*md));
+	CKNULL(md, -ENOMEM);
+
+	for (i = 0; i < num; i++) {
+		pathnames[i] = malloc(FILENAME_MAX);
+		CKNULL(pathnames[i], -ENOMEM);
+	}
+
+	snprintf(pathnames[0], FILENAME_MAX, "%s/%s/%s%s", es->config_dir,
+		 ESVP_ES_DIR_ENTROPY_SOURCE, ESVP_ES_FILE_RAW_NOISE,
+		 ESVP_ES_BINARY_FILE_EXTENSION);
+	md[0] = &es->raw_noise_data_hash;
+
+	snprintf(pathnames[1], FILENAME_MAX, "%s/%s/%s%s", es->config_dir,
+		 ESVP_ES_DIR_ENTROPY_SOURCE, ESVP_ES_FILE_RESTART_DATA,
+		 ESVP_ES_BINARY_FILE_EXTENSION);
+	md[1] = &es->raw_noise_restart_hash;
+
+	for (cc = es->cc, i = 2; cc; cc = cc->next) {
+		if (cc->vetted)
+			continue;
+
+		snprintf(pathnames[i], FILENAME_MAX, "%s/%s%s",
+			 cc->config_dir, ESVP_ES_FILE_CC_DATA,
+			 ESVP_ES_BINARY_FILE_EXTENSION);
+		md[i] = &cc->data_hash;
+		i++;
+	}
+
+	snprintf(cache_file, sizeof(cache_file), "%s/%s/%s%s", es->config_dir,
+		 ESVP_ES_DIR_ENTROPY_SOURCE, ESVP_ES_FILE_HASH_CACHE,
+		 ESVP_ES_CONFIG_FILE_EXTENSION);
+
+	CKINT(acvp_hash_files((const char *const *)pathnames, sha256, md, num,
+			      cache_file));
+
+out:
+	if (pathnames) {
+		for (i = 0; i < num; i++) {
+			if (pathnames[i])
+				free(pathnames[i]);
+		}
+		free(pathnames);
+	}
+	if (md)
+		free(md);
+	return ret;
+}
+
 static int esvp_read_es_def(const char *directory, struct esvp_es_def **es_out)
 {
 	struct json_object *es_conf = NULL;
 	struct esvp_es_def *es = NULL;
 	struct stat statbuf;
 	const char *str;
-	char pathname[FILENAME_MAX], es_data_file[FILENAME_MAX];
+	char pathname[FILENAME_MAX];
 	int ret = 0;
 
 	CKNULL(es_out, -EINVAL);
@@ -292,17 +357,6 @@ static int esvp_read_es_def(const char *directory, struct esvp_es_def **es_out)
 	CKINT(json_get_string(es_conf, "primaryNoiseSource", &str));
 	CKINT(acvp_duplicate(&es->primary_noise_source_desc, str));
 
-	snprintf(es_data_file, sizeof(es_data_file), "%s/%s/%s%s",
-		 es->config_dir, ESVP_ES_DIR_ENTROPY_SOURCE,
-		 ESVP_ES_FILE_RAW_NOISE, ESVP_ES_BINARY_FILE_EXTENSION);
-	CKINT(acvp_hash_file(es_data_file, sha256, &es->raw_noise_data_hash));
-
-	snprintf(es_data_file, sizeof(es_data_file), "%s/%s/%s%s",
-		 es->config_dir, ESVP_ES_DIR_ENTROPY_SOURCE,
-		 ESVP_ES_FILE_RESTART_DATA, ESVP_ES_BINARY_FILE_EXTENSION);
-	CKINT(acvp_hash_file(es_data_file, sha256,
-			     &es->raw_noise_restart_hash));
-
 	CKINT(json_get_uint(es_conf, "bitsPerSample", &es->bits_per_sample));
 	CKINT(json_get_uint(es_conf, "alphabetSize", &es->alphabet_size));
 	CKINT(json_get_uint(es_conf, "numberOfRestarts",
@@ -318,6 +372,7 @@ static int esvp_read_es_def(const char *directory, struct esvp_es_def **es_out)
 			    &es->additional_noise_sources));
 
 	CKINT(esvp_read_cc_def(directory, es));
+	CKINT(esvp_hash_es_files(es));
 
 	*es_out = es;
 
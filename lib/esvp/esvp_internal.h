@@ -62,6 +62,8 @@ int esvp_certify(struct acvp_testid_ctx *testid_ctx);
 #define ESVP_ES_FILE_RESTART_DATA "restart_bits"
 /* File with the conditioning data */
 #define ESVP_ES_FILE_CC_DATA "conditioned_bits"
+/* File caching the message digests of the data files */
+#define ESVP_ES_FILE_HASH_CACHE "hash_cache"
 
 /* Directory containing one sub-directory per conditioning component */
 #define ESVP_ES_DIR_CONDCOMP "conditioning_component"
@@ -109,6 +109,7 @@ int esvp_read_status(const struct acvp_testid_ctx *testid_ctx,
 		 * Append the new conditioning component entry at the end of the list
 		 * because the order matters.
 		 */
+		acvp_auth_refresh_sd_lock();
 		if (es->sd) {
 			struct esvp_sd_def *iter_sd = es->sd;
 
@@ -122,6 +123,7 @@ int esvp_read_status(const struct acvp_testid_ctx *testid_ctx,
 		} else {
 			es->sd = sd;
 		}
+		acvp_auth_refresh_sd_unlock();
 	}
 
 out:
@@ -301,6 +301,7 @@ esvp_process_post_one_sd_response(const struct acvp_testid_ctx *testid_ctx,
 	 * Append the new conditioning component entry at the end of the list
 	 * because the order matters.
 	 */
+	acvp_auth_refresh_sd_lock();
 	if (es->sd) {
 		struct esvp_sd_def *iter_sd = es->sd;
 
@@ -314,6 +315,7 @@ esvp_process_post_one_sd_response(const struct acvp_testid_ctx *testid_ctx,
 	} else {
 		es->sd = sd;
 	}
+	acvp_auth_refresh_sd_unlock();
 
 out:
 	ACVP_JSON_PUT_NULL(req);
@@ -343,7 +345,7 @@ static int esvp_process_datafiles_post_one(
 	struct stat statbuf;
 	ACVP_EXT_BUFFER_INIT(data);
 	ACVP_BUFFER_INIT(response);
-	int ret, ret2, fd;
+	int ret, ret2;
 
 	if (submitted && *submitted) {
 		logger(LOGGER_DEBUG, LOGGER_C_ANY,
@@ -378,26 +380,9 @@ static int esvp_process_datafiles_post_one(
 		return -EINVAL;
 	}
 
-	fd = open(pathname, O_RDONLY | O_CLOEXEC);
-	if (fd < 0) {
-		ret = -errno;
-
-		logger(LOGGER_WARN, LOGGER_C_DS_FILE,
-		       "Cannot open file %s (%d)\n", pathname, ret);
-		goto out;
-	}
-
-	data.buf = mmap(NULL, (size_t)statbuf.st_size, PROT_READ, MAP_SHARED,
-			fd, 0);
-	if (data.buf == MAP_FAILED) {
-		logger(LOGGER_WARN, LOGGER_C_DS_FILE, "Cannot mmap file %s\n",
-		       pathname);
-		ret = -ENOMEM;
-		goto out;
-	}
+	CKINT(acvp_ext_buf_map(pathname, &data));
 
 	logger(LOGGER_DEBUG, LOGGER_C_ANY, "Posting file %s\n", pathname);
-	data.len = (uint32_t)statbuf.st_size;
 	data.data_type = data_type;
 	data.filename = basename(pathname);
 	data.next = additional_keys;
@@ -410,8 +395,7 @@ static int esvp_process_datafiles_post_one(
 
 	ret = acvp_request_error_handler(ret2);
 
-	munmap(data.buf, (size_t)statbuf.st_size);
-	close(fd);
+	acvp_ext_buf_unmap(&data);
 
 	if (ret)
 		goto out;
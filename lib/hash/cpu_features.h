@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#define HASH_X86_64
+#endif
+
+#if defined(__aarch64__) &&                                                    \
+	(defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#define HASH_ARMV8_CE
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* CPU features used by the hash implementations */
+#define HASH_CPU_SHANI		(1 << 0)
+#define HASH_CPU_AVX2		(1 << 1)
+#define HASH_CPU_ARMV8_SHA2	(1 << 2)
+#define HASH_CPU_BMI2		(1 << 3)
+#define HASH_CPU_AVX512		(1 << 4)
+
+/*
+ * Detect the CPU features. The x86 vector extensions are only reported if
+ * the operating system saves the respective register state.
+ */
+static inline unsigned int hash_cpu_features(void)
+{
+	unsigned int features = 0;
+
+#ifdef HASH_X86_64
+	unsigned int eax, ebx, ecx, edx, xcr0_lo, xcr0_hi;
+	int ymm = 0, zmm = 0;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+
+	/* OSXSAVE: check that the OS saves the XMM and YMM registers */
+	if (ecx & bit_OSXSAVE) {
+		__asm__ volatile("xgetbv"
+				 : "=a"(xcr0_lo), "=d"(xcr0_hi)
+				 : "c"(0));
+		(void)xcr0_hi;
+		ymm = (xcr0_lo & 0x6) == 0x6;
+		/* Additionally the opmask and ZMM registers */
+		zmm = (xcr0_lo & 0xe6) == 0xe6;
+	}
+
+	/* SHA-NI requires SSSE3 and SSE4.1 for the message handling */
+	if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+		return 0;
+
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return 0;
+
+	if (ebx & bit_SHA)
+		features |= HASH_CPU_SHANI;
+	if (ymm && (ebx & bit_AVX2))
+		features |= HASH_CPU_AVX2;
+	if ((ebx & bit_BMI) && (ebx & bit_BMI2))
+		features |= HASH_CPU_BMI2;
+	/* The 256-bit forms of the AVX-512 instructions are used */
+	if (zmm && (ebx & bit_AVX512F) && (ebx & bit_AVX512VL))
+		features |= HASH_CPU_AVX512;
+#endif
+
+#ifdef HASH_ARMV8_CE
+#if defined(__linux__)
+	if (getauxval(AT_HWCAP) & HWCAP_SHA2)
+		features |= HASH_CPU_ARMV8_SHA2;
+#elif defined(__APPLE__)
+	/* All 64-bit Apple CPUs provide the cryptographic extensions */
+	features |= HASH_CPU_ARMV8_SHA2;
+#endif
+#endif
+
+	return features;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPU_FEATURES_H */
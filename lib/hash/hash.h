@@ -32,11 +32,32 @@ struct hash {
 	void (*init)(struct sha_ctx *ctx);
 	void (*update)(struct sha_ctx *ctx, const uint8_t *in, size_t inlen);
 	void (*final)(struct sha_ctx *ctx, uint8_t *digest);
+	/*
+	 * Multi-buffer update: ctx[i] absorbs inlen[i] bytes from in[i] for
+	 * all num independent contexts. The contexts are initialized and
+	 * finalized with init and final. Where the CPU allows it, the
+	 * messages are processed in parallel.
+	 */
+	void (*update_mb)(struct sha_ctx *ctx[], const uint8_t *const in[],
+			  const size_t inlen[], unsigned int num);
 	unsigned int blocksize;
 	unsigned int digestsize;
 	unsigned int ctxsize;
 };
 
+/*
+ * Implementations of the compression functions - the hash descriptors
+ * always use the implementation selected for the respective algorithm.
+ */
+enum hash_impl {
+	HASH_IMPL_AUTO,		/* Fastest implementation supported by CPU */
+	HASH_IMPL_C,		/* Portable C implementation */
+	HASH_IMPL_SHANI,	/* Intel SHA extensions */
+	HASH_IMPL_AVX2,		/* AVX2 (multi-buffer update) */
+	HASH_IMPL_ARMV8_CE,	/* ARMv8 cryptographic extensions */
+	HASH_IMPL_AVX512,	/* AVX-512 (multi-buffer update) */
+};
+
 #define SHA_MAX_CTX_SIZE	368
 #define HASH_CTX_ON_STACK(name)						\
 	uint8_t name ## _ctx_buf[SHA_MAX_CTX_SIZE];			\
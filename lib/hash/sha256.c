@@ -18,12 +18,18 @@
  * DAMAGE.
  */
 
+#include <errno.h>
 #include <string.h>
 
 #include "bitshift_be.h"
+#include "cpu_features.h"
 #include "memset_secure.h"
 #include "sha256.h"
 
+#ifdef HASH_X86_64
+#include <immintrin.h>
+#endif
+
 struct sha_ctx {
 	uint32_t H[8];
 	size_t msg_len;
@@ -70,13 +76,13 @@ static inline uint32_t ror(uint32_t x, int n)
 #define s0(x)		(ror(x, 7) ^ ror(x, 18) ^ (x >> 3))
 #define s1(x)		(ror(x, 17) ^ ror(x, 19) ^ (x >> 10))
 
-static inline void sha256_transform(struct sha_ctx *ctx, const uint8_t *in)
+static inline void sha256_transform(uint32_t *H, const uint8_t *in)
 {
 	uint32_t W[64], a, b, c, d, e, f, g, h, T1, T2;
 	unsigned int i;
 
-	a = ctx->H[0]; b = ctx->H[1]; c = ctx->H[2]; d = ctx->H[3];
-	e = ctx->H[4]; f = ctx->H[5]; g = ctx->H[6]; h = ctx->H[7];
+	a = H[0]; b = H[1]; c = H[2]; d = H[3];
+	e = H[4]; f = H[5]; g = H[6]; h = H[7];
 
 	for (i = 0; i < 64; i++) {
 		if (i < 16) {
@@ -94,17 +100,352 @@ static inline void sha256_transform(struct sha_ctx *ctx, const uint8_t *in)
  		d = c; c = b; b = a; a = T1 + T2;
 	}
 
-	ctx->H[0] += a; ctx->H[1] += b; ctx->H[2] += c; ctx->H[3] += d;
-	ctx->H[4] += e; ctx->H[5] += f; ctx->H[6] += g; ctx->H[7] += h;
+	H[0] += a; H[1] += b; H[2] += c; H[3] += d;
+	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
 
 	/* Zeroize intermediate values - register are not zeroized */
 	for (i = 48; i < 64; i++)
 		W[i] = 0;
 }
 
+static void sha256_blocks_c(uint32_t *H, const uint8_t *in, size_t blocks)
+{
+	for (; blocks; blocks--, in += SHA256_SIZE_BLOCK)
+		sha256_transform(H, in);
+}
+
+#ifdef HASH_X86_64
+
+/*
+ * SHA-256 using the Intel SHA extensions. The state is held as ABEF and CDGH
+ * as required by the SHA256RNDS2 instruction.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t *H, const uint8_t *in, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					    0x0405060700010203ULL);
+	__m128i state0, state1, abef, cdgh, msg, tmp, m[4];
+	unsigned int i;
+
+	tmp = _mm_loadu_si128((const __m128i *)&H[0]);
+	state1 = _mm_loadu_si128((const __m128i *)&H[4]);
+
+	tmp = _mm_shuffle_epi32(tmp, 0xB1);		/* CDAB */
+	state1 = _mm_shuffle_epi32(state1, 0x1B);	/* EFGH */
+	state0 = _mm_alignr_epi8(tmp, state1, 8);	/* ABEF */
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);	/* CDGH */
+
+	for (; blocks; blocks--, in += SHA256_SIZE_BLOCK) {
+		abef = state0;
+		cdgh = state1;
+
+		/* Four rounds per iteration */
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				m[i] = _mm_loadu_si128(
+					(const __m128i *)(in + 16 * i));
+				m[i] = _mm_shuffle_epi8(m[i], mask);
+			}
+
+			msg = _mm_add_epi32(m[i % 4], _mm_loadu_si128(
+				(const __m128i *)&sha256_K[4 * i]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+
+			/* Message schedule W[4 * (i + 1) ... ] */
+			if (i >= 3 && i <= 14) {
+				tmp = _mm_alignr_epi8(m[i % 4],
+						      m[(i + 3) % 4], 4);
+				m[(i + 1) % 4] =
+					_mm_add_epi32(m[(i + 1) % 4], tmp);
+				m[(i + 1) % 4] = _mm_sha256msg2_epu32(
+					m[(i + 1) % 4], m[i % 4]);
+			}
+
+			msg = _mm_shuffle_epi32(msg, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+			if (i >= 1 && i <= 12) {
+				m[(i + 3) % 4] = _mm_sha256msg1_epu32(
+					m[(i + 3) % 4], m[i % 4]);
+			}
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);		/* FEBA */
+	state1 = _mm_shuffle_epi32(state1, 0xB1);	/* DCHG */
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);	/* DCBA */
+	state1 = _mm_alignr_epi8(state1, tmp, 8);	/* HGFE */
+
+	_mm_storeu_si128((__m128i *)&H[0], state0);
+	_mm_storeu_si128((__m128i *)&H[4], state1);
+}
+
+/*
+ * Eight independent SHA-256 computations in the 32-bit lanes of the AVX2
+ * registers. Each lane processes the same number of blocks.
+ */
+#define SHA256_MB_LANES 8
+
+#define ROR8(x, n)							\
+	_mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define CH8(x, y, z)							\
+	_mm256_xor_si256(_mm256_and_si256(x, y), _mm256_andnot_si256(x, z))
+#define MAJ8(x, y, z)							\
+	_mm256_or_si256(_mm256_and_si256(x, y),				\
+			_mm256_and_si256(z, _mm256_or_si256(x, y)))
+#define S0_8(x)								\
+	_mm256_xor_si256(_mm256_xor_si256(ROR8(x, 2), ROR8(x, 13)),	\
+			 ROR8(x, 22))
+#define S1_8(x)								\
+	_mm256_xor_si256(_mm256_xor_si256(ROR8(x, 6), ROR8(x, 11)),	\
+			 ROR8(x, 25))
+#define s0_8(x)								\
+	_mm256_xor_si256(_mm256_xor_si256(ROR8(x, 7), ROR8(x, 18)),	\
+			 _mm256_srli_epi32(x, 3))
+#define s1_8(x)								\
+	_mm256_xor_si256(_mm256_xor_si256(ROR8(x, 17), ROR8(x, 19)),	\
+			 _mm256_srli_epi32(x, 10))
+
+/* Load eight big-endian words of each lane and transpose them */
+__attribute__((target("avx2")))
+static inline void sha256_load8_avx2(__m256i *W, const uint8_t *const in[],
+				     size_t offset)
+{
+	const __m256i bswap = _mm256_set_epi8(
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m256i r[8], t[8], u[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++)
+		r[i] = _mm256_loadu_si256((const __m256i *)(in[i] + offset));
+
+	for (i = 0; i < 8; i += 2) {
+		t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+	}
+	for (i = 0; i < 8; i += 4) {
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	for (i = 0; i < 4; i++) {
+		W[i] = _mm256_shuffle_epi8(
+			_mm256_permute2x128_si256(u[i], u[i + 4], 0x20), bswap);
+		W[i + 4] = _mm256_shuffle_epi8(
+			_mm256_permute2x128_si256(u[i], u[i + 4], 0x31), bswap);
+	}
+}
+
+__attribute__((target("avx2")))
+static void sha256_blocks_mb_avx2(uint32_t *const H[], const uint8_t *in[],
+				  size_t blocks)
+{
+	uint32_t out[8][SHA256_MB_LANES] __attribute__((aligned(32)));
+	__m256i state[8], v[8], W[16], T1, T2;
+	size_t offset;
+	unsigned int i;
+
+	for (i = 0; i < 8; i++) {
+		state[i] = _mm256_setr_epi32((int)H[0][i], (int)H[1][i],
+					     (int)H[2][i], (int)H[3][i],
+					     (int)H[4][i], (int)H[5][i],
+					     (int)H[6][i], (int)H[7][i]);
+	}
+
+	for (offset = 0; blocks; blocks--, offset += SHA256_SIZE_BLOCK) {
+		for (i = 0; i < 8; i++)
+			v[i] = state[i];
+
+		sha256_load8_avx2(W, in, offset);
+		sha256_load8_avx2(W + 8, in, offset + 32);
+
+		for (i = 0; i < 64; i++) {
+			if (i >= 16) {
+				W[i & 15] = _mm256_add_epi32(
+					_mm256_add_epi32(
+						s1_8(W[(i - 2) & 15]),
+						W[(i - 7) & 15]),
+					_mm256_add_epi32(
+						s0_8(W[(i - 15) & 15]),
+						W[i & 15]));
+			}
+
+			T1 = _mm256_add_epi32(
+				_mm256_add_epi32(v[7], S1_8(v[4])),
+				_mm256_add_epi32(
+					CH8(v[4], v[5], v[6]),
+					_mm256_add_epi32(
+						_mm256_set1_epi32(
+							(int)sha256_K[i]),
+						W[i & 15])));
+			T2 = _mm256_add_epi32(S0_8(v[0]),
+					      MAJ8(v[0], v[1], v[2]));
+			v[7] = v[6];
+			v[6] = v[5];
+			v[5] = v[4];
+			v[4] = _mm256_add_epi32(v[3], T1);
+			v[3] = v[2];
+			v[2] = v[1];
+			v[1] = v[0];
+			v[0] = _mm256_add_epi32(T1, T2);
+		}
+
+		for (i = 0; i < 8; i++)
+			state[i] = _mm256_add_epi32(state[i], v[i]);
+	}
+
+	for (i = 0; i < 8; i++)
+		_mm256_store_si256((__m256i *)out[i], state[i]);
+
+	for (i = 0; i < SHA256_MB_LANES; i++) {
+		unsigned int j;
+
+		for (j = 0; j < 8; j++)
+			H[i][j] = out[j][i];
+	}
+
+	/* Zeroize intermediate values - register are not zeroized */
+	memset_secure(W, 0, sizeof(W));
+	memset_secure(v, 0, sizeof(v));
+}
+
+#else /* HASH_X86_64 */
+
+#define SHA256_MB_LANES 1
+
+#endif /* HASH_X86_64 */
+
+#ifdef HASH_ARMV8_CE
+
+/* SHA-256 using the ARMv8 cryptographic extensions */
+static void sha256_blocks_ce(uint32_t *H, const uint8_t *in, size_t blocks)
+{
+	uint32x4_t state0, state1, abcd, efgh, msg, tmp, m[4];
+	unsigned int i;
+
+	state0 = vld1q_u32(&H[0]);
+	state1 = vld1q_u32(&H[4]);
+
+	for (; blocks; blocks--, in += SHA256_SIZE_BLOCK) {
+		abcd = state0;
+		efgh = state1;
+
+		for (i = 0; i < 4; i++) {
+			m[i] = vreinterpretq_u32_u8(
+				vrev32q_u8(vld1q_u8(in + 16 * i)));
+		}
+
+		/* Four rounds per iteration */
+		for (i = 0; i < 16; i++) {
+			msg = vaddq_u32(m[i % 4], vld1q_u32(&sha256_K[4 * i]));
+
+			/* Message schedule W[4 * i + 16 ... ] */
+			if (i < 12) {
+				m[i % 4] = vsha256su1q_u32(
+					vsha256su0q_u32(m[i % 4],
+							m[(i + 1) % 4]),
+					m[(i + 2) % 4], m[(i + 3) % 4]);
+			}
+
+			tmp = state0;
+			state0 = vsha256hq_u32(state0, state1, msg);
+			state1 = vsha256h2q_u32(state1, tmp, msg);
+		}
+
+		state0 = vaddq_u32(state0, abcd);
+		state1 = vaddq_u32(state1, efgh);
+	}
+
+	vst1q_u32(&H[0], state0);
+	vst1q_u32(&H[4], state1);
+}
+
+#endif /* HASH_ARMV8_CE */
+
+/* Selected compression functions */
+static void (*sha256_blocks)(uint32_t *H, const uint8_t *in,
+			     size_t blocks) = sha256_blocks_c;
+static void (*sha256_blocks_mb)(uint32_t *const H[], const uint8_t *in[],
+				size_t blocks) = NULL;
+static const char *sha256_impl_name = "C";
+
+int sha256_set_impl(enum hash_impl impl)
+{
+	unsigned int features = hash_cpu_features();
+
+	switch (impl) {
+	case HASH_IMPL_AUTO:
+		if (features & HASH_CPU_SHANI)
+			return sha256_set_impl(HASH_IMPL_SHANI);
+		if (features & HASH_CPU_ARMV8_SHA2)
+			return sha256_set_impl(HASH_IMPL_ARMV8_CE);
+		if (features & HASH_CPU_AVX2)
+			return sha256_set_impl(HASH_IMPL_AVX2);
+		return sha256_set_impl(HASH_IMPL_C);
+
+	case HASH_IMPL_C:
+		sha256_blocks = sha256_blocks_c;
+		sha256_blocks_mb = NULL;
+		sha256_impl_name = "C";
+		return 0;
+
+	case HASH_IMPL_SHANI:
+#ifdef HASH_X86_64
+		if (!(features & HASH_CPU_SHANI))
+			return -EOPNOTSUPP;
+		sha256_blocks = sha256_blocks_shani;
+		sha256_blocks_mb = NULL;
+		sha256_impl_name = "SHA-NI";
+		return 0;
+#else
+		return -EOPNOTSUPP;
+#endif
+
+	case HASH_IMPL_AVX2:
+#ifdef HASH_X86_64
+		if (!(features & HASH_CPU_AVX2))
+			return -EOPNOTSUPP;
+		sha256_blocks = sha256_blocks_c;
+		sha256_blocks_mb = sha256_blocks_mb_avx2;
+		sha256_impl_name = "AVX2 (multi-buffer)";
+		return 0;
+#else
+		return -EOPNOTSUPP;
+#endif
+
+	case HASH_IMPL_ARMV8_CE:
+#ifdef HASH_ARMV8_CE
+		if (!(features & HASH_CPU_ARMV8_SHA2))
+			return -EOPNOTSUPP;
+		sha256_blocks = sha256_blocks_ce;
+		sha256_blocks_mb = NULL;
+		sha256_impl_name = "ARMv8 CE";
+		return 0;
+#else
+		return -EOPNOTSUPP;
+#endif
+
+	case HASH_IMPL_AVX512:
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+const char *sha256_get_impl(void)
+{
+	return sha256_impl_name;
+}
+
 static void sha256_update(struct sha_ctx *ctx, const uint8_t *in, size_t inlen)
 {
 	unsigned int partial = ctx->msg_len % SHA256_SIZE_BLOCK;
+	size_t blocks;
 
 	ctx->msg_len += inlen;
 
@@ -129,18 +470,108 @@ static void sha256_update(struct sha_ctx *ctx, const uint8_t *in, size_t inlen)
 		inlen -= todo;
 		in += todo;
 
-		sha256_transform(ctx, ctx->partial);
+		sha256_blocks(ctx->H, ctx->partial, 1);
 	}
 
 	/* Perform a transformation of full block-size messages */
-	for (; inlen >= SHA256_SIZE_BLOCK;
-	     inlen -= SHA256_SIZE_BLOCK, in += SHA256_SIZE_BLOCK)
-		sha256_transform(ctx, in);
+	blocks = inlen / SHA256_SIZE_BLOCK;
+	if (blocks) {
+		sha256_blocks(ctx->H, in, blocks);
+		inlen -= blocks * SHA256_SIZE_BLOCK;
+		in += blocks * SHA256_SIZE_BLOCK;
+	}
 
 	/* If we have data left, copy it into the partial block buffer */
 	memcpy(ctx->partial, in, inlen);
 }
 
+static void sha256_update_mb(struct sha_ctx *ctx[], const uint8_t *const in[],
+			     const size_t inlen[], unsigned int num)
+{
+	const uint8_t *ptr[SHA256_MB_LANES > 1 ? 64 : 1];
+	size_t len[SHA256_MB_LANES > 1 ? 64 : 1];
+	unsigned int i, done = 0;
+
+	/*
+	 * Without a multi-buffer implementation or with too many contexts,
+	 * the messages are processed one after the other.
+	 */
+	if (!sha256_blocks_mb || num < 2 || num > sizeof(len) / sizeof(*len)) {
+		for (i = 0; i < num; i++)
+			sha256_update(ctx[i], in[i], inlen[i]);
+		return;
+	}
+
+	/* Fill the partial block buffers first */
+	for (i = 0; i < num; i++) {
+		unsigned int partial = ctx[i]->msg_len % SHA256_SIZE_BLOCK;
+		size_t todo = partial ? SHA256_SIZE_BLOCK - partial : 0;
+
+		if (todo > inlen[i])
+			todo = inlen[i];
+		if (todo)
+			sha256_update(ctx[i], in[i], todo);
+
+		ptr[i] = in[i] + todo;
+		len[i] = inlen[i] - todo;
+	}
+
+	/*
+	 * Process the common number of full blocks of up to SHA256_MB_LANES
+	 * messages in parallel as long as at least two messages have a full
+	 * block left.
+	 */
+	while (1) {
+		uint32_t dummy[SHA256_MB_LANES][8];
+		uint32_t *H[SHA256_MB_LANES];
+		const uint8_t *lane_in[SHA256_MB_LANES];
+		unsigned int lane[SHA256_MB_LANES], lanes = 0;
+		size_t blocks = 0;
+
+		for (i = done; i < num && lanes < SHA256_MB_LANES; i++) {
+			if (len[i] < SHA256_SIZE_BLOCK) {
+				if (i == done)
+					done++;
+				continue;
+			}
+
+			if (!blocks || len[i] / SHA256_SIZE_BLOCK < blocks)
+				blocks = len[i] / SHA256_SIZE_BLOCK;
+			lane[lanes++] = i;
+		}
+
+		if (lanes < 2)
+			break;
+
+		for (i = 0; i < SHA256_MB_LANES; i++) {
+			if (i < lanes) {
+				H[i] = ctx[lane[i]]->H;
+				lane_in[i] = ptr[lane[i]];
+			} else {
+				/* Unused lanes hash the first message */
+				memcpy(dummy[i], ctx[lane[0]]->H,
+				       sizeof(dummy[i]));
+				H[i] = dummy[i];
+				lane_in[i] = ptr[lane[0]];
+			}
+		}
+
+		sha256_blocks_mb(H, lane_in, blocks);
+
+		for (i = 0; i < lanes; i++) {
+			ptr[lane[i]] += blocks * SHA256_SIZE_BLOCK;
+			len[lane[i]] -= blocks * SHA256_SIZE_BLOCK;
+			ctx[lane[i]]->msg_len += blocks * SHA256_SIZE_BLOCK;
+		}
+
+		memset_secure(dummy, 0, sizeof(dummy));
+	}
+
+	/* The remaining data of each message */
+	for (i = 0; i < num; i++)
+		sha256_update(ctx[i], ptr[i], len[i]);
+}
+
 static void sha256_final(struct sha_ctx *ctx, uint8_t *digest)
 {
 	unsigned int i, partial = ctx->msg_len % SHA256_SIZE_BLOCK;
@@ -160,7 +591,7 @@ static void sha256_final(struct sha_ctx *ctx, uint8_t *digest)
 	if (partial > (SHA256_SIZE_BLOCK - (2 * sizeof(uint32_t)))) {
 		memset(ctx->partial + partial, 0, SHA256_SIZE_BLOCK - partial);
 		partial = 0;
-		sha256_transform(ctx, ctx->partial);
+		sha256_blocks(ctx->H, ctx->partial, 1);
 	}
 
 	/* Fill the unused part of the partial buffer with zeros */
@@ -171,7 +602,7 @@ static void sha256_final(struct sha_ctx *ctx, uint8_t *digest)
 	be64_to_ptr(ctx->partial + (SHA256_SIZE_BLOCK - 8), ctx->msg_len);
 
 	/* Final transformation */
-	sha256_transform(ctx, ctx->partial);
+	sha256_blocks(ctx->H, ctx->partial, 1);
 
 	memset_secure(ctx->partial, 0, SHA256_SIZE_BLOCK);
 
@@ -188,6 +619,7 @@ static const struct hash _sha256 = {
 	.init		= sha256_init,
 	.update		= sha256_update,
 	.final		= sha256_final,
+	.update_mb	= sha256_update_mb,
 	.blocksize	= SHA256_SIZE_BLOCK,
 	.digestsize	= SHA256_SIZE_DIGEST,
 	.ctxsize	= sizeof(struct sha_ctx),
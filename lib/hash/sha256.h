@@ -32,6 +32,17 @@ extern "C"
 
 extern const struct hash *sha256;
 
+/*
+ * Select the implementation of the SHA-256 compression function.
+ *
+ * Returns 0 on success, -EOPNOTSUPP if the CPU does not support the
+ * implementation.
+ */
+int sha256_set_impl(enum hash_impl impl);
+
+/* Name of the selected SHA-256 implementation */
+const char *sha256_get_impl(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,12 +17,18 @@
  * DAMAGE.
  */
 
+#include <errno.h>
 #include <string.h>
 
 #include "bitshift_le.h"
+#include "cpu_features.h"
 #include "memset_secure.h"
 #include "sha3.h"
 
+#ifdef HASH_X86_64
+#include <immintrin.h>
+#endif
+
 struct sha_ctx {
 	uint64_t state[25];
 	size_t msg_len;
@@ -38,170 +44,6 @@ static inline uint64_t rol(uint64_t x, int n)
 }
 
 /*********************************** Keccak ***********************************/
-/* state[x + y*5] */
-#define A(x, y) (x + 5 * y)
-
-static inline void keccakp_theta(uint64_t s[25])
-{
-	uint64_t C[5], D[5];
-
-	/* Step 1 */
-	C[0] = s[A(0, 0)] ^ s[A(0, 1)] ^ s[A(0, 2)] ^ s[A(0, 3)] ^ s[A(0, 4)];
-	C[1] = s[A(1, 0)] ^ s[A(1, 1)] ^ s[A(1, 2)] ^ s[A(1, 3)] ^ s[A(1, 4)];
-	C[2] = s[A(2, 0)] ^ s[A(2, 1)] ^ s[A(2, 2)] ^ s[A(2, 3)] ^ s[A(2, 4)];
-	C[3] = s[A(3, 0)] ^ s[A(3, 1)] ^ s[A(3, 2)] ^ s[A(3, 3)] ^ s[A(3, 4)];
-	C[4] = s[A(4, 0)] ^ s[A(4, 1)] ^ s[A(4, 2)] ^ s[A(4, 3)] ^ s[A(4, 4)];
-
-	/* Step 2 */
-	D[0] = C[4] ^ rol(C[1], 1);
-	D[1] = C[0] ^ rol(C[2], 1);
-	D[2] = C[1] ^ rol(C[3], 1);
-	D[3] = C[2] ^ rol(C[4], 1);
-	D[4] = C[3] ^ rol(C[0], 1);
-
-	/* Step 3 */
-	s[A(0, 0)] ^= D[0];
-	s[A(1, 0)] ^= D[1];
-	s[A(2, 0)] ^= D[2];
-	s[A(3, 0)] ^= D[3];
-	s[A(4, 0)] ^= D[4];
-
-	s[A(0, 1)] ^= D[0];
-	s[A(1, 1)] ^= D[1];
-	s[A(2, 1)] ^= D[2];
-	s[A(3, 1)] ^= D[3];
-	s[A(4, 1)] ^= D[4];
-
-	s[A(0, 2)] ^= D[0];
-	s[A(1, 2)] ^= D[1];
-	s[A(2, 2)] ^= D[2];
-	s[A(3, 2)] ^= D[3];
-	s[A(4, 2)] ^= D[4];
-
-	s[A(0, 3)] ^= D[0];
-	s[A(1, 3)] ^= D[1];
-	s[A(2, 3)] ^= D[2];
-	s[A(3, 3)] ^= D[3];
-	s[A(4, 3)] ^= D[4];
-
-	s[A(0, 4)] ^= D[0];
-	s[A(1, 4)] ^= D[1];
-	s[A(2, 4)] ^= D[2];
-	s[A(3, 4)] ^= D[3];
-	s[A(4, 4)] ^= D[4];
-}
-
-static inline void keccakp_rho(uint64_t s[25])
-{
-	/* Step 1 */
-	/* s[A(0, 0)] = s[A(0, 0)]; */
-
-#define RHO_ROL(t)	(((t + 1) * (t + 2) / 2) % 64)
-	/* Step 3 */
-	s[A(1, 0)] = rol(s[A(1, 0)], RHO_ROL(0));
-	s[A(0, 2)] = rol(s[A(0, 2)], RHO_ROL(1));
-	s[A(2, 1)] = rol(s[A(2, 1)], RHO_ROL(2));
-	s[A(1, 2)] = rol(s[A(1, 2)], RHO_ROL(3));
-	s[A(2, 3)] = rol(s[A(2, 3)], RHO_ROL(4));
-	s[A(3, 3)] = rol(s[A(3, 3)], RHO_ROL(5));
-	s[A(3, 0)] = rol(s[A(3, 0)], RHO_ROL(6));
-	s[A(0, 1)] = rol(s[A(0, 1)], RHO_ROL(7));
-	s[A(1, 3)] = rol(s[A(1, 3)], RHO_ROL(8));
-	s[A(3, 1)] = rol(s[A(3, 1)], RHO_ROL(9));
-	s[A(1, 4)] = rol(s[A(1, 4)], RHO_ROL(10));
-	s[A(4, 4)] = rol(s[A(4, 4)], RHO_ROL(11));
-	s[A(4, 0)] = rol(s[A(4, 0)], RHO_ROL(12));
-	s[A(0, 3)] = rol(s[A(0, 3)], RHO_ROL(13));
-	s[A(3, 4)] = rol(s[A(3, 4)], RHO_ROL(14));
-	s[A(4, 3)] = rol(s[A(4, 3)], RHO_ROL(15));
-	s[A(3, 2)] = rol(s[A(3, 2)], RHO_ROL(16));
-	s[A(2, 2)] = rol(s[A(2, 2)], RHO_ROL(17));
-	s[A(2, 0)] = rol(s[A(2, 0)], RHO_ROL(18));
-	s[A(0, 4)] = rol(s[A(0, 4)], RHO_ROL(19));
-	s[A(4, 2)] = rol(s[A(4, 2)], RHO_ROL(20));
-	s[A(2, 4)] = rol(s[A(2, 4)], RHO_ROL(21));
-	s[A(4, 1)] = rol(s[A(4, 1)], RHO_ROL(22));
-	s[A(1, 1)] = rol(s[A(1, 1)], RHO_ROL(23));
-}
-
-static inline void keccakp_pi(uint64_t s[25])
-{
-	uint64_t t = s[A(4, 4)];
-
-	/* Step 1 */
-	/* s[A(0, 0)] = s[A(0, 0)]; */
-	s[A(4, 4)] = s[A(1, 4)];
-	s[A(1, 4)] = s[A(3, 1)];
-	s[A(3, 1)] = s[A(1, 3)];
-	s[A(1, 3)] = s[A(0, 1)];
-	s[A(0, 1)] = s[A(3, 0)];
-	s[A(3, 0)] = s[A(3, 3)];
-	s[A(3, 3)] = s[A(2, 3)];
-	s[A(2, 3)] = s[A(1, 2)];
-	s[A(1, 2)] = s[A(2, 1)];
-	s[A(2, 1)] = s[A(0, 2)];
-	s[A(0, 2)] = s[A(1, 0)];
-	s[A(1, 0)] = s[A(1, 1)];
-	s[A(1, 1)] = s[A(4, 1)];
-	s[A(4, 1)] = s[A(2, 4)];
-	s[A(2, 4)] = s[A(4, 2)];
-	s[A(4, 2)] = s[A(0, 4)];
-	s[A(0, 4)] = s[A(2, 0)];
-	s[A(2, 0)] = s[A(2, 2)];
-	s[A(2, 2)] = s[A(3, 2)];
-	s[A(3, 2)] = s[A(4, 3)];
-	s[A(4, 3)] = s[A(3, 4)];
-	s[A(3, 4)] = s[A(0, 3)];
-	s[A(0, 3)] = s[A(4, 0)];
-	s[A(4, 0)] = t;
-}
-
-static inline void keccakp_chi(uint64_t s[25])
-{
-	uint64_t t0[5], t1[5];
-
-	t0[0] = s[A(0, 0)];
-	t0[1] = s[A(0, 1)];
-	t0[2] = s[A(0, 2)];
-	t0[3] = s[A(0, 3)];
-	t0[4] = s[A(0, 4)];
-
-	t1[0] = s[A(1, 0)];
-	t1[1] = s[A(1, 1)];
-	t1[2] = s[A(1, 2)];
-	t1[3] = s[A(1, 3)];
-	t1[4] = s[A(1, 4)];
-
-	s[A(0, 0)] ^= ~s[A(1, 0)] & s[A(2, 0)];
-	s[A(0, 1)] ^= ~s[A(1, 1)] & s[A(2, 1)];
-	s[A(0, 2)] ^= ~s[A(1, 2)] & s[A(2, 2)];
-	s[A(0, 3)] ^= ~s[A(1, 3)] & s[A(2, 3)];
-	s[A(0, 4)] ^= ~s[A(1, 4)] & s[A(2, 4)];
-
-	s[A(1, 0)] ^= ~s[A(2, 0)] & s[A(3, 0)];
-	s[A(1, 1)] ^= ~s[A(2, 1)] & s[A(3, 1)];
-	s[A(1, 2)] ^= ~s[A(2, 2)] & s[A(3, 2)];
-	s[A(1, 3)] ^= ~s[A(2, 3)] & s[A(3, 3)];
-	s[A(1, 4)] ^= ~s[A(2, 4)] & s[A(3, 4)];
-
-	s[A(2, 0)] ^= ~s[A(3, 0)] & s[A(4, 0)];
-	s[A(2, 1)] ^= ~s[A(3, 1)] & s[A(4, 1)];
-	s[A(2, 2)] ^= ~s[A(3, 2)] & s[A(4, 2)];
-	s[A(2, 3)] ^= ~s[A(3, 3)] & s[A(4, 3)];
-	s[A(2, 4)] ^= ~s[A(3, 4)] & s[A(4, 4)];
-
-	s[A(3, 0)] ^= ~s[A(4, 0)] & t0[0];
-	s[A(3, 1)] ^= ~s[A(4, 1)] & t0[1];
-	s[A(3, 2)] ^= ~s[A(4, 2)] & t0[2];
-	s[A(3, 3)] ^= ~s[A(4, 3)] & t0[3];
-	s[A(3, 4)] ^= ~s[A(4, 4)] & t0[4];
-
-	s[A(4, 0)] ^= ~t0[0] & t1[0];
-	s[A(4, 1)] ^= ~t0[1] & t1[1];
-	s[A(4, 2)] ^= ~t0[2] & t1[2];
-	s[A(4, 3)] ^= ~t0[3] & t1[3];
-	s[A(4, 4)] ^= ~t0[4] & t1[4];
-}
 
 static const uint64_t keccakp_iota_vals[] = {
 	0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL,
@@ -214,24 +56,341 @@ static const uint64_t keccakp_iota_vals[] = {
 	0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL
 };
 
-static inline void keccakp_iota(uint64_t s[25], unsigned int round)
+/*
+ * Keccak-p[1600] with the steps of one round merged and unrolled on local
+ * variables holding the lanes A[x + 5 * y]. The lane type T and the lane
+ * operations XOR, XOR5, ROL (rotate left by a constant) and CHI
+ * (a ^ (~b & c)) are defined by the user of the macros. This allows to
+ * instantiate the permutation for 64-bit scalars as well as for vector
+ * registers holding the same lane of several states.
+ */
+#define KECCAKP_VARS(T)							\
+	T A0, A1, A2, A3, A4, A5, A6, A7, A8, A9, A10, A11, A12;	\
+	T A13, A14, A15, A16, A17, A18, A19, A20, A21, A22, A23, A24;	\
+	T B0, B1, B2, B3, B4, B5, B6, B7, B8, B9, B10, B11, B12;	\
+	T B13, B14, B15, B16, B17, B18, B19, B20, B21, B22, B23, B24;	\
+	T C0, C1, C2, C3, C4, D0, D1, D2, D3, D4
+
+#define KECCAKP_LOAD							\
+	A0 = LOAD(0);							\
+	A1 = LOAD(1);							\
+	A2 = LOAD(2);							\
+	A3 = LOAD(3);							\
+	A4 = LOAD(4);							\
+	A5 = LOAD(5);							\
+	A6 = LOAD(6);							\
+	A7 = LOAD(7);							\
+	A8 = LOAD(8);							\
+	A9 = LOAD(9);							\
+	A10 = LOAD(10);							\
+	A11 = LOAD(11);							\
+	A12 = LOAD(12);							\
+	A13 = LOAD(13);							\
+	A14 = LOAD(14);							\
+	A15 = LOAD(15);							\
+	A16 = LOAD(16);							\
+	A17 = LOAD(17);							\
+	A18 = LOAD(18);							\
+	A19 = LOAD(19);							\
+	A20 = LOAD(20);							\
+	A21 = LOAD(21);							\
+	A22 = LOAD(22);							\
+	A23 = LOAD(23);							\
+	A24 = LOAD(24);
+
+#define KECCAKP_STORE							\
+	STORE(0, A0);							\
+	STORE(1, A1);							\
+	STORE(2, A2);							\
+	STORE(3, A3);							\
+	STORE(4, A4);							\
+	STORE(5, A5);							\
+	STORE(6, A6);							\
+	STORE(7, A7);							\
+	STORE(8, A8);							\
+	STORE(9, A9);							\
+	STORE(10, A10);							\
+	STORE(11, A11);							\
+	STORE(12, A12);							\
+	STORE(13, A13);							\
+	STORE(14, A14);							\
+	STORE(15, A15);							\
+	STORE(16, A16);							\
+	STORE(17, A17);							\
+	STORE(18, A18);							\
+	STORE(19, A19);							\
+	STORE(20, A20);							\
+	STORE(21, A21);							\
+	STORE(22, A22);							\
+	STORE(23, A23);							\
+	STORE(24, A24);
+
+#define KECCAKP_ROUND							\
+	C0 = XOR5(A0, A5, A10, A15, A20);				\
+	C1 = XOR5(A1, A6, A11, A16, A21);				\
+	C2 = XOR5(A2, A7, A12, A17, A22);				\
+	C3 = XOR5(A3, A8, A13, A18, A23);				\
+	C4 = XOR5(A4, A9, A14, A19, A24);				\
+	D0 = XOR(C4, ROL(C1, 1));					\
+	D1 = XOR(C0, ROL(C2, 1));					\
+	D2 = XOR(C1, ROL(C3, 1));					\
+	D3 = XOR(C2, ROL(C4, 1));					\
+	D4 = XOR(C3, ROL(C0, 1));					\
+	B0 = XOR(A0, D0);						\
+	B10 = ROL(XOR(A1, D1), 1);					\
+	B20 = ROL(XOR(A2, D2), 62);					\
+	B5 = ROL(XOR(A3, D3), 28);					\
+	B15 = ROL(XOR(A4, D4), 27);					\
+	B16 = ROL(XOR(A5, D0), 36);					\
+	B1 = ROL(XOR(A6, D1), 44);					\
+	B11 = ROL(XOR(A7, D2), 6);					\
+	B21 = ROL(XOR(A8, D3), 55);					\
+	B6 = ROL(XOR(A9, D4), 20);					\
+	B7 = ROL(XOR(A10, D0), 3);					\
+	B17 = ROL(XOR(A11, D1), 10);					\
+	B2 = ROL(XOR(A12, D2), 43);					\
+	B12 = ROL(XOR(A13, D3), 25);					\
+	B22 = ROL(XOR(A14, D4), 39);					\
+	B23 = ROL(XOR(A15, D0), 41);					\
+	B8 = ROL(XOR(A16, D1), 45);					\
+	B18 = ROL(XOR(A17, D2), 15);					\
+	B3 = ROL(XOR(A18, D3), 21);					\
+	B13 = ROL(XOR(A19, D4), 8);					\
+	B14 = ROL(XOR(A20, D0), 18);					\
+	B24 = ROL(XOR(A21, D1), 2);					\
+	B9 = ROL(XOR(A22, D2), 61);					\
+	B19 = ROL(XOR(A23, D3), 56);					\
+	B4 = ROL(XOR(A24, D4), 14);					\
+	A0 = CHI(B0, B1, B2);						\
+	A1 = CHI(B1, B2, B3);						\
+	A2 = CHI(B2, B3, B4);						\
+	A3 = CHI(B3, B4, B0);						\
+	A4 = CHI(B4, B0, B1);						\
+	A5 = CHI(B5, B6, B7);						\
+	A6 = CHI(B6, B7, B8);						\
+	A7 = CHI(B7, B8, B9);						\
+	A8 = CHI(B8, B9, B5);						\
+	A9 = CHI(B9, B5, B6);						\
+	A10 = CHI(B10, B11, B12);					\
+	A11 = CHI(B11, B12, B13);					\
+	A12 = CHI(B12, B13, B14);					\
+	A13 = CHI(B13, B14, B10);					\
+	A14 = CHI(B14, B10, B11);					\
+	A15 = CHI(B15, B16, B17);					\
+	A16 = CHI(B16, B17, B18);					\
+	A17 = CHI(B17, B18, B19);					\
+	A18 = CHI(B18, B19, B15);					\
+	A19 = CHI(B19, B15, B16);					\
+	A20 = CHI(B20, B21, B22);					\
+	A21 = CHI(B21, B22, B23);					\
+	A22 = CHI(B22, B23, B24);					\
+	A23 = CHI(B23, B24, B20);					\
+	A24 = CHI(B24, B20, B21);
+
+/* Portable 64-bit implementation - also compiled with BMI for ANDN/RORX */
+#define KECCAKP_1600_SCALAR(name)					\
+static void name(uint64_t s[25])					\
+{									\
+	KECCAKP_VARS(uint64_t);						\
+	unsigned int round;						\
+									\
+	KECCAKP_LOAD;							\
+	for (round = 0; round < 24; round++) {				\
+		KECCAKP_ROUND;						\
+		A0 ^= keccakp_iota_vals[round];				\
+	}								\
+	KECCAKP_STORE;							\
+}
+
+#define LOAD(i)			s[i]
+#define STORE(i, v)		s[i] = v
+#define XOR(a, b)		((a) ^ (b))
+#define XOR5(a, b, c, d, e)	((a) ^ (b) ^ (c) ^ (d) ^ (e))
+#define ROL(a, n)		rol(a, n)
+#define CHI(a, b, c)		((a) ^ (~(b) & (c)))
+
+KECCAKP_1600_SCALAR(keccakp_1600_c)
+
+#ifdef HASH_X86_64
+__attribute__((target("bmi,bmi2")))
+KECCAKP_1600_SCALAR(keccakp_1600_bmi2)
+#endif
+
+#undef LOAD
+#undef STORE
+#undef XOR
+#undef XOR5
+#undef ROL
+#undef CHI
+
+#ifdef HASH_X86_64
+
+/*
+ * Four Keccak-p[1600] states in the 64-bit lanes of 256-bit registers. The
+ * function absorbs the given number of blocks of rword words of each input
+ * into the respective state.
+ */
+#define KECCAKP_1600_X4(name)						\
+static void name(uint64_t *const s[4], const uint8_t *const in[4],	\
+		 size_t blocks, unsigned int rword)			\
+{									\
+	__m256i S[25];							\
+	uint64_t out[4] __attribute__((aligned(32)));			\
+	KECCAKP_VARS(__m256i);						\
+	size_t offset;							\
+	unsigned int i, round;						\
+									\
+	for (i = 0; i < 25; i++) {					\
+		S[i] = _mm256_setr_epi64x((long long)s[0][i],		\
+					  (long long)s[1][i],		\
+					  (long long)s[2][i],		\
+					  (long long)s[3][i]);		\
+	}								\
+									\
+	for (offset = 0; blocks; blocks--, offset += rword * 8) {	\
+		for (i = 0; i < rword; i++) {				\
+			S[i] = _mm256_xor_si256(S[i],			\
+				_mm256_setr_epi64x(			\
+				(long long)ptr_to_le64(in[0] + offset + i * 8), \
+				(long long)ptr_to_le64(in[1] + offset + i * 8), \
+				(long long)ptr_to_le64(in[2] + offset + i * 8), \
+				(long long)ptr_to_le64(in[3] + offset + i * 8))); \
+		}							\
+									\
+		KECCAKP_LOAD;						\
+		for (round = 0; round < 24; round++) {			\
+			KECCAKP_ROUND;					\
+			A0 = _mm256_xor_si256(A0, _mm256_set1_epi64x(	\
+				(long long)keccakp_iota_vals[round]));	\
+		}							\
+		KECCAKP_STORE;						\
+	}								\
+									\
+	for (i = 0; i < 25; i++) {					\
+		_mm256_store_si256((__m256i *)out, S[i]);		\
+		s[0][i] = out[0];					\
+		s[1][i] = out[1];					\
+		s[2][i] = out[2];					\
+		s[3][i] = out[3];					\
+	}								\
+}
+
+#define LOAD(i)			S[i]
+#define STORE(i, v)		S[i] = v
+
+/* AVX2 */
+#define XOR(a, b)		_mm256_xor_si256(a, b)
+#define XOR5(a, b, c, d, e)						\
+	XOR(XOR(XOR(a, b), XOR(c, d)), e)
+#define ROL(a, n)							\
+	_mm256_or_si256(_mm256_slli_epi64(a, n), _mm256_srli_epi64(a, 64 - (n)))
+#define CHI(a, b, c)		XOR(a, _mm256_andnot_si256(b, c))
+
+__attribute__((target("avx2")))
+KECCAKP_1600_X4(keccakp_1600_x4_avx2)
+
+#undef XOR5
+#undef ROL
+#undef CHI
+
+/* AVX-512: three-way XOR and chi in one instruction, native rotation */
+#define XOR5(a, b, c, d, e)						\
+	_mm256_ternarylogic_epi64(_mm256_ternarylogic_epi64(a, b, c, 0x96), \
+				  d, e, 0x96)
+#define ROL(a, n)		_mm256_rol_epi64(a, n)
+#define CHI(a, b, c)		_mm256_ternarylogic_epi64(a, b, c, 0xd2)
+
+__attribute__((target("avx2,avx512f,avx512vl")))
+KECCAKP_1600_X4(keccakp_1600_x4_avx512)
+
+#undef LOAD
+#undef STORE
+#undef XOR
+#undef XOR5
+#undef ROL
+#undef CHI
+
+#endif /* HASH_X86_64 */
+
+/* Selected permutations */
+static void (*keccakp_1600)(uint64_t s[25]) = keccakp_1600_c;
+static void (*keccakp_1600_x4)(uint64_t *const s[4],
+			       const uint8_t *const in[4], size_t blocks,
+			       unsigned int rword) = NULL;
+static const char *sha3_impl_name = "C";
+
+/* Fastest scalar permutation for the CPU */
+static void sha3_set_scalar(unsigned int features)
 {
-	s[0] ^= keccakp_iota_vals[round];
+#ifdef HASH_X86_64
+	if (features & HASH_CPU_BMI2) {
+		keccakp_1600 = keccakp_1600_bmi2;
+		return;
+	}
+#else
+	(void)features;
+#endif
+	keccakp_1600 = keccakp_1600_c;
 }
 
-static inline void keccakp_1600(uint64_t s[25])
+int sha3_set_impl(enum hash_impl impl)
 {
-	unsigned int round;
-
-	for (round = 0; round < 24; round++) {
-		keccakp_theta(s);
-		keccakp_rho(s);
-		keccakp_pi(s);
-		keccakp_chi(s);
-		keccakp_iota(s, round);
+	unsigned int features = hash_cpu_features();
+
+	switch (impl) {
+	case HASH_IMPL_AUTO:
+		if (features & HASH_CPU_AVX512)
+			return sha3_set_impl(HASH_IMPL_AVX512);
+		if (features & HASH_CPU_AVX2)
+			return sha3_set_impl(HASH_IMPL_AVX2);
+		sha3_set_scalar(features);
+		keccakp_1600_x4 = NULL;
+		sha3_impl_name = (keccakp_1600 == keccakp_1600_c) ? "C" :
+								   "C (BMI2)";
+		return 0;
+
+	case HASH_IMPL_C:
+		keccakp_1600 = keccakp_1600_c;
+		keccakp_1600_x4 = NULL;
+		sha3_impl_name = "C";
+		return 0;
+
+	case HASH_IMPL_AVX2:
+#ifdef HASH_X86_64
+		if (!(features & HASH_CPU_AVX2))
+			return -EOPNOTSUPP;
+		sha3_set_scalar(features);
+		keccakp_1600_x4 = keccakp_1600_x4_avx2;
+		sha3_impl_name = "AVX2 (4-way)";
+		return 0;
+#else
+		return -EOPNOTSUPP;
+#endif
+
+	case HASH_IMPL_AVX512:
+#ifdef HASH_X86_64
+		if (!(features & HASH_CPU_AVX512))
+			return -EOPNOTSUPP;
+		sha3_set_scalar(features);
+		keccakp_1600_x4 = keccakp_1600_x4_avx512;
+		sha3_impl_name = "AVX-512 (4-way)";
+		return 0;
+#else
+		return -EOPNOTSUPP;
+#endif
+
+	case HASH_IMPL_SHANI:
+	case HASH_IMPL_ARMV8_CE:
+	default:
+		return -EOPNOTSUPP;
 	}
 }
 
+const char *sha3_get_impl(void)
+{
+	return sha3_impl_name;
+}
+
 /*********************************** SHA-3 ************************************/
 
 static inline void sha3_init(struct sha_ctx *ctx)
@@ -325,6 +484,102 @@ static void sha3_update(struct sha_ctx *ctx, const uint8_t *in, size_t inlen)
 	memcpy(ctx->partial, in, inlen);
 }
 
+static void sha3_update_mb(struct sha_ctx *ctx[], const uint8_t *const in[],
+			   const size_t inlen[], unsigned int num)
+{
+	const uint8_t *ptr[64];
+	size_t len[64];
+	unsigned int i, done = 0, r;
+
+	/*
+	 * Without a 4-way implementation, with too many contexts or with
+	 * contexts of different SHA-3 variants, the messages are processed
+	 * one after the other.
+	 */
+	if (!keccakp_1600_x4 || num < 2 || num > sizeof(len) / sizeof(*len)) {
+		for (i = 0; i < num; i++)
+			sha3_update(ctx[i], in[i], inlen[i]);
+		return;
+	}
+
+	r = ctx[0]->r;
+	for (i = 1; i < num; i++) {
+		if (ctx[i]->r != r) {
+			for (i = 0; i < num; i++)
+				sha3_update(ctx[i], in[i], inlen[i]);
+			return;
+		}
+	}
+
+	/* Fill the partial block buffers first */
+	for (i = 0; i < num; i++) {
+		size_t partial = ctx[i]->msg_len % r;
+		size_t todo = partial ? r - partial : 0;
+
+		if (todo > inlen[i])
+			todo = inlen[i];
+		if (todo)
+			sha3_update(ctx[i], in[i], todo);
+
+		ptr[i] = in[i] + todo;
+		len[i] = inlen[i] - todo;
+	}
+
+	/*
+	 * Absorb the common number of full blocks of up to four messages in
+	 * parallel as long as at least two messages have a full block left.
+	 */
+	while (1) {
+		uint64_t dummy[4][25];
+		uint64_t *state[4];
+		const uint8_t *lane_in[4];
+		unsigned int lane[4], lanes = 0;
+		size_t blocks = 0;
+
+		for (i = done; i < num && lanes < 4; i++) {
+			if (len[i] < r) {
+				if (i == done)
+					done++;
+				continue;
+			}
+
+			if (!blocks || len[i] / r < blocks)
+				blocks = len[i] / r;
+			lane[lanes++] = i;
+		}
+
+		if (lanes < 2)
+			break;
+
+		for (i = 0; i < 4; i++) {
+			if (i < lanes) {
+				state[i] = ctx[lane[i]]->state;
+				lane_in[i] = ptr[lane[i]];
+			} else {
+				/* Unused lanes absorb the first message */
+				memcpy(dummy[i], ctx[lane[0]]->state,
+				       sizeof(dummy[i]));
+				state[i] = dummy[i];
+				lane_in[i] = ptr[lane[0]];
+			}
+		}
+
+		keccakp_1600_x4(state, lane_in, blocks, r / 8);
+
+		for (i = 0; i < lanes; i++) {
+			ptr[lane[i]] += blocks * r;
+			len[lane[i]] -= blocks * r;
+			ctx[lane[i]]->msg_len += blocks * r;
+		}
+
+		memset_secure(dummy, 0, sizeof(dummy));
+	}
+
+	/* The remaining data of each message */
+	for (i = 0; i < num; i++)
+		sha3_update(ctx[i], ptr[i], len[i]);
+}
+
 static void sha3_final(struct sha_ctx *ctx, uint8_t *digest)
 {
 	size_t partial = ctx->msg_len % ctx->r;
@@ -364,6 +619,7 @@ static const struct hash _sha3_224 = {
 	.init		= sha3_224_init,
 	.update		= sha3_update,
 	.final		= sha3_final,
+	.update_mb	= sha3_update_mb,
 	.blocksize	= SHA3_224_SIZE_BLOCK,
 	.digestsize	= SHA3_224_SIZE_DIGEST,
 	.ctxsize	= sizeof(struct sha_ctx),
@@ -374,6 +630,7 @@ static const struct hash _sha3_256 = {
 	.init		= sha3_256_init,
 	.update		= sha3_update,
 	.final		= sha3_final,
+	.update_mb	= sha3_update_mb,
 	.blocksize	= SHA3_256_SIZE_BLOCK,
 	.digestsize	= SHA3_256_SIZE_DIGEST,
 	.ctxsize	= sizeof(struct sha_ctx),
@@ -384,6 +641,7 @@ static const struct hash _sha3_384 = {
 	.init		= sha3_384_init,
 	.update		= sha3_update,
 	.final		= sha3_final,
+	.update_mb	= sha3_update_mb,
 	.blocksize	= SHA3_384_SIZE_BLOCK,
 	.digestsize	= SHA3_384_SIZE_DIGEST,
 	.ctxsize	= sizeof(struct sha_ctx),
@@ -394,6 +652,7 @@ static const struct hash _sha3_512 = {
 	.init		= sha3_512_init,
 	.update		= sha3_update,
 	.final		= sha3_final,
+	.update_mb	= sha3_update_mb,
 	.blocksize	= SHA3_512_SIZE_BLOCK,
 	.digestsize	= SHA3_512_SIZE_DIGEST,
 	.ctxsize	= sizeof(struct sha_ctx),
@@ -56,6 +56,18 @@ extern const struct hash *sha3_512;
 /* Largest block size we support */
 #define SHA3_MAX_SIZE_BLOCK		SHA3_224_SIZE_BLOCK
 
+/*
+ * Select the implementation of the Keccak permutation used by all SHA-3
+ * variants.
+ *
+ * Returns 0 on success, -EOPNOTSUPP if the CPU does not support the
+ * implementation.
+ */
+int sha3_set_impl(enum hash_impl impl);
+
+/* Name of the selected Keccak implementation */
+const char *sha3_get_impl(void);
+
 #ifdef __cplusplus
 }
 #endif
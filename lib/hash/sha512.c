@@ -18,12 +18,18 @@
  * DAMAGE.
  */
 
+#include <errno.h>
 #include <string.h>
 
 #include "bitshift_be.h"
+#include "cpu_features.h"
 #include "memset_secure.h"
 #include "sha512.h"
 
+#ifdef HASH_X86_64
+#include <immintrin.h>
+#endif
+
 struct sha_ctx {
 	uint64_t H[8];
 	size_t msg_len;
@@ -86,13 +92,13 @@ static inline uint64_t ror(uint64_t x, int n)
 #define s0(x)		(ror(x, 1) ^ ror(x, 8) ^ (x >> 7))
 #define s1(x)		(ror(x, 19) ^ ror(x, 61) ^ (x >> 6))
 
-static inline void sha512_transform(struct sha_ctx *ctx, const uint8_t *in)
+static inline void sha512_transform(uint64_t *H, const uint8_t *in)
 {
 	uint64_t W[80], a, b, c, d, e, f, g, h, T1, T2;
 	unsigned int i;
 
-	a = ctx->H[0]; b = ctx->H[1]; c = ctx->H[2]; d = ctx->H[3];
-	e = ctx->H[4]; f = ctx->H[5]; g = ctx->H[6]; h = ctx->H[7];
+	a = H[0]; b = H[1]; c = H[2]; d = H[3];
+	e = H[4]; f = H[5]; g = H[6]; h = H[7];
 
 	for (i = 0; i < 80; i++) {
 		if (i < 16) {
@@ -110,17 +116,208 @@ static inline void sha512_transform(struct sha_ctx *ctx, const uint8_t *in)
 		d = c; c = b; b = a; a = T1 + T2;
 	}
 
-	ctx->H[0] += a; ctx->H[1] += b; ctx->H[2] += c; ctx->H[3] += d;
-	ctx->H[4] += e; ctx->H[5] += f; ctx->H[6] += g; ctx->H[7] += h;
+	H[0] += a; H[1] += b; H[2] += c; H[3] += d;
+	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
 
 	/* Zeroize intermediate values - register are not zeroized */
 	for (i = 64; i < 80; i++)
 		W[i] = 0;
 }
 
+static void sha512_blocks_c(uint64_t *H, const uint8_t *in, size_t blocks)
+{
+	for (; blocks; blocks--, in += SHA512_SIZE_BLOCK)
+		sha512_transform(H, in);
+}
+
+#ifdef HASH_X86_64
+
+/*
+ * Four independent SHA-512 computations in the 64-bit lanes of the AVX2
+ * registers. Each lane processes the same number of blocks.
+ */
+#define SHA512_MB_LANES 4
+
+#define ROR4(x, n)							\
+	_mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - (n)))
+#define CH4(x, y, z)							\
+	_mm256_xor_si256(_mm256_and_si256(x, y), _mm256_andnot_si256(x, z))
+#define MAJ4(x, y, z)							\
+	_mm256_or_si256(_mm256_and_si256(x, y),				\
+			_mm256_and_si256(z, _mm256_or_si256(x, y)))
+#define S0_4(x)								\
+	_mm256_xor_si256(_mm256_xor_si256(ROR4(x, 28), ROR4(x, 34)),	\
+			 ROR4(x, 39))
+#define S1_4(x)								\
+	_mm256_xor_si256(_mm256_xor_si256(ROR4(x, 14), ROR4(x, 18)),	\
+			 ROR4(x, 41))
+#define s0_4(x)								\
+	_mm256_xor_si256(_mm256_xor_si256(ROR4(x, 1), ROR4(x, 8)),	\
+			 _mm256_srli_epi64(x, 7))
+#define s1_4(x)								\
+	_mm256_xor_si256(_mm256_xor_si256(ROR4(x, 19), ROR4(x, 61)),	\
+			 _mm256_srli_epi64(x, 6))
+
+/* Load four big-endian words of each lane and transpose them */
+__attribute__((target("avx2")))
+static inline void sha512_load4_avx2(__m256i *W, const uint8_t *const in[],
+				     size_t offset)
+{
+	const __m256i bswap = _mm256_set_epi8(
+		8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+		8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i r[4], t[4];
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		r[i] = _mm256_loadu_si256((const __m256i *)(in[i] + offset));
+
+	t[0] = _mm256_unpacklo_epi64(r[0], r[1]);
+	t[1] = _mm256_unpackhi_epi64(r[0], r[1]);
+	t[2] = _mm256_unpacklo_epi64(r[2], r[3]);
+	t[3] = _mm256_unpackhi_epi64(r[2], r[3]);
+
+	W[0] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(t[0], t[2], 0x20),
+				   bswap);
+	W[1] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(t[1], t[3], 0x20),
+				   bswap);
+	W[2] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(t[0], t[2], 0x31),
+				   bswap);
+	W[3] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(t[1], t[3], 0x31),
+				   bswap);
+}
+
+__attribute__((target("avx2")))
+static void sha512_blocks_mb_avx2(uint64_t *const H[], const uint8_t *in[],
+				  size_t blocks)
+{
+	uint64_t out[8][SHA512_MB_LANES] __attribute__((aligned(32)));
+	__m256i state[8], v[8], W[16], T1, T2;
+	size_t offset;
+	unsigned int i;
+
+	for (i = 0; i < 8; i++) {
+		state[i] = _mm256_setr_epi64x((long long)H[0][i],
+					      (long long)H[1][i],
+					      (long long)H[2][i],
+					      (long long)H[3][i]);
+	}
+
+	for (offset = 0; blocks; blocks--, offset += SHA512_SIZE_BLOCK) {
+		for (i = 0; i < 8; i++)
+			v[i] = state[i];
+
+		for (i = 0; i < 4; i++)
+			sha512_load4_avx2(W + 4 * i, in, offset + 32 * i);
+
+		for (i = 0; i < 80; i++) {
+			if (i >= 16) {
+				W[i & 15] = _mm256_add_epi64(
+					_mm256_add_epi64(
+						s1_4(W[(i - 2) & 15]),
+						W[(i - 7) & 15]),
+					_mm256_add_epi64(
+						s0_4(W[(i - 15) & 15]),
+						W[i & 15]));
+			}
+
+			T1 = _mm256_add_epi64(
+				_mm256_add_epi64(v[7], S1_4(v[4])),
+				_mm256_add_epi64(
+					CH4(v[4], v[5], v[6]),
+					_mm256_add_epi64(
+						_mm256_set1_epi64x(
+							(long long)sha512_K[i]),
+						W[i & 15])));
+			T2 = _mm256_add_epi64(S0_4(v[0]),
+					      MAJ4(v[0], v[1], v[2]));
+			v[7] = v[6];
+			v[6] = v[5];
+			v[5] = v[4];
+			v[4] = _mm256_add_epi64(v[3], T1);
+			v[3] = v[2];
+			v[2] = v[1];
+			v[1] = v[0];
+			v[0] = _mm256_add_epi64(T1, T2);
+		}
+
+		for (i = 0; i < 8; i++)
+			state[i] = _mm256_add_epi64(state[i], v[i]);
+	}
+
+	for (i = 0; i < 8; i++)
+		_mm256_store_si256((__m256i *)out[i], state[i]);
+
+	for (i = 0; i < SHA512_MB_LANES; i++) {
+		unsigned int j;
+
+		for (j = 0; j < 8; j++)
+			H[i][j] = out[j][i];
+	}
+
+	/* Zeroize intermediate values - register are not zeroized */
+	memset_secure(W, 0, sizeof(W));
+	memset_secure(v, 0, sizeof(v));
+}
+
+#else /* HASH_X86_64 */
+
+#define SHA512_MB_LANES 1
+
+#endif /* HASH_X86_64 */
+
+/* Selected compression functions */
+static void (*sha512_blocks)(uint64_t *H, const uint8_t *in,
+			     size_t blocks) = sha512_blocks_c;
+static void (*sha512_blocks_mb)(uint64_t *const H[], const uint8_t *in[],
+				size_t blocks) = NULL;
+static const char *sha512_impl_name = "C";
+
+int sha512_set_impl(enum hash_impl impl)
+{
+	unsigned int features = hash_cpu_features();
+
+	switch (impl) {
+	case HASH_IMPL_AUTO:
+		if (features & HASH_CPU_AVX2)
+			return sha512_set_impl(HASH_IMPL_AVX2);
+		return sha512_set_impl(HASH_IMPL_C);
+
+	case HASH_IMPL_C:
+		sha512_blocks = sha512_blocks_c;
+		sha512_blocks_mb = NULL;
+		sha512_impl_name = "C";
+		return 0;
+
+	case HASH_IMPL_AVX2:
+#ifdef HASH_X86_64
+		if (!(features & HASH_CPU_AVX2))
+			return -EOPNOTSUPP;
+		sha512_blocks = sha512_blocks_c;
+		sha512_blocks_mb = sha512_blocks_mb_avx2;
+		sha512_impl_name = "AVX2 (multi-buffer)";
+		return 0;
+#else
+		return -EOPNOTSUPP;
+#endif
+
+	case HASH_IMPL_SHANI:
+	case HASH_IMPL_ARMV8_CE:
+	case HASH_IMPL_AVX512:
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+const char *sha512_get_impl(void)
+{
+	return sha512_impl_name;
+}
+
 static void sha512_update(struct sha_ctx *ctx, const uint8_t *in, size_t inlen)
 {
 	unsigned int partial = ctx->msg_len % SHA512_SIZE_BLOCK;
+	size_t blocks;
 
 	ctx->msg_len += inlen;
 
@@ -145,18 +342,108 @@ static void sha512_update(struct sha_ctx *ctx, const uint8_t *in, size_t inlen)
 		inlen -= todo;
 		in += todo;
 
-		sha512_transform(ctx, ctx->partial);
+		sha512_blocks(ctx->H, ctx->partial, 1);
 	}
 
 	/* Perform a transformation of full block-size messages */
-	for (; inlen >= SHA512_SIZE_BLOCK;
-	     inlen -= SHA512_SIZE_BLOCK, in += SHA512_SIZE_BLOCK)
-		sha512_transform(ctx, in);
+	blocks = inlen / SHA512_SIZE_BLOCK;
+	if (blocks) {
+		sha512_blocks(ctx->H, in, blocks);
+		inlen -= blocks * SHA512_SIZE_BLOCK;
+		in += blocks * SHA512_SIZE_BLOCK;
+	}
 
 	/* If we have data left, copy it into the partial block buffer */
 	memcpy(ctx->partial, in, inlen);
 }
 
+static void sha512_update_mb(struct sha_ctx *ctx[], const uint8_t *const in[],
+			     const size_t inlen[], unsigned int num)
+{
+	const uint8_t *ptr[SHA512_MB_LANES > 1 ? 64 : 1];
+	size_t len[SHA512_MB_LANES > 1 ? 64 : 1];
+	unsigned int i, done = 0;
+
+	/*
+	 * Without a multi-buffer implementation or with too many contexts,
+	 * the messages are processed one after the other.
+	 */
+	if (!sha512_blocks_mb || num < 2 || num > sizeof(len) / sizeof(*len)) {
+		for (i = 0; i < num; i++)
+			sha512_update(ctx[i], in[i], inlen[i]);
+		return;
+	}
+
+	/* Fill the partial block buffers first */
+	for (i = 0; i < num; i++) {
+		unsigned int partial = ctx[i]->msg_len % SHA512_SIZE_BLOCK;
+		size_t todo = partial ? SHA512_SIZE_BLOCK - partial : 0;
+
+		if (todo > inlen[i])
+			todo = inlen[i];
+		if (todo)
+			sha512_update(ctx[i], in[i], todo);
+
+		ptr[i] = in[i] + todo;
+		len[i] = inlen[i] - todo;
+	}
+
+	/*
+	 * Process the common number of full blocks of up to SHA512_MB_LANES
+	 * messages in parallel as long as at least two messages have a full
+	 * block left.
+	 */
+	while (1) {
+		uint64_t dummy[SHA512_MB_LANES][8];
+		uint64_t *H[SHA512_MB_LANES];
+		const uint8_t *lane_in[SHA512_MB_LANES];
+		unsigned int lane[SHA512_MB_LANES], lanes = 0;
+		size_t blocks = 0;
+
+		for (i = done; i < num && lanes < SHA512_MB_LANES; i++) {
+			if (len[i] < SHA512_SIZE_BLOCK) {
+				if (i == done)
+					done++;
+				continue;
+			}
+
+			if (!blocks || len[i] / SHA512_SIZE_BLOCK < blocks)
+				blocks = len[i] / SHA512_SIZE_BLOCK;
+			lane[lanes++] = i;
+		}
+
+		if (lanes < 2)
+			break;
+
+		for (i = 0; i < SHA512_MB_LANES; i++) {
+			if (i < lanes) {
+				H[i] = ctx[lane[i]]->H;
+				lane_in[i] = ptr[lane[i]];
+			} else {
+				/* Unused lanes hash the first message */
+				memcpy(dummy[i], ctx[lane[0]]->H,
+				       sizeof(dummy[i]));
+				H[i] = dummy[i];
+				lane_in[i] = ptr[lane[0]];
+			}
+		}
+
+		sha512_blocks_mb(H, lane_in, blocks);
+
+		for (i = 0; i < lanes; i++) {
+			ptr[lane[i]] += blocks * SHA512_SIZE_BLOCK;
+			len[lane[i]] -= blocks * SHA512_SIZE_BLOCK;
+			ctx[lane[i]]->msg_len += blocks * SHA512_SIZE_BLOCK;
+		}
+
+		memset_secure(dummy, 0, sizeof(dummy));
+	}
+
+	/* The remaining data of each message */
+	for (i = 0; i < num; i++)
+		sha512_update(ctx[i], ptr[i], len[i]);
+}
+
 static void sha512_final(struct sha_ctx *ctx, uint8_t *digest)
 {
 	unsigned int i, partial = ctx->msg_len % SHA512_SIZE_BLOCK;
@@ -176,7 +463,7 @@ static void sha512_final(struct sha_ctx *ctx, uint8_t *digest)
 	if (partial > (SHA512_SIZE_BLOCK - (2 * sizeof(uint64_t)))) {
 		memset(ctx->partial + partial, 0, SHA512_SIZE_BLOCK - partial);
 		partial = 0;
-		sha512_transform(ctx, ctx->partial);
+		sha512_blocks(ctx->H, ctx->partial, 1);
 	}
 
 	/* Fill the unused part of the partial buffer with zeros */
@@ -187,7 +474,7 @@ static void sha512_final(struct sha_ctx *ctx, uint8_t *digest)
 	be64_to_ptr(ctx->partial + (SHA512_SIZE_BLOCK - 8), ctx->msg_len);
 
 	/* Final transformation */
-	sha512_transform(ctx, ctx->partial);
+	sha512_blocks(ctx->H, ctx->partial, 1);
 
 	memset_secure(ctx->partial, 0, SHA512_SIZE_BLOCK);
 
@@ -204,6 +491,7 @@ static const struct hash _sha512 = {
 	.init		= sha512_init,
 	.update		= sha512_update,
 	.final		= sha512_final,
+	.update_mb	= sha512_update_mb,
 	.blocksize	= SHA512_SIZE_BLOCK,
 	.digestsize	= SHA512_SIZE_DIGEST,
 	.ctxsize	= sizeof(struct sha_ctx),
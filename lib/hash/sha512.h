@@ -32,6 +32,17 @@ extern "C"
 
 extern const struct hash *sha512;
 
+/*
+ * Select the implementation of the SHA-512 compression function.
+ *
+ * Returns 0 on success, -EOPNOTSUPP if the CPU does not support the
+ * implementation.
+ */
+int sha512_set_impl(enum hash_impl impl);
+
+/* Name of the selected SHA-512 implementation */
+const char *sha512_get_impl(void);
+
 #ifdef __cplusplus
 }
 #endif
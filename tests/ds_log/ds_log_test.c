@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "datastore_log_file.h"
+#include "logger.h"
+
+/* The log code only requires the logger */
+void _logger(const enum logger_verbosity severity,
+	     const enum logger_class class, const char *file, const char *func,
+	     const uint32_t line, const char *fmt, ...)
+{
+	(void)severity;
+	(void)class;
+	(void)file;
+	(void)func;
+	(void)line;
+	(void)fmt;
+}
+
+static char log_path[FILENAME_MAX];
+
+static int test_append(const char *test, uint32_t vsid, const char *name,
+		       const char *data)
+{
+	struct acvp_ds_log *log;
+	int ret;
+
+	ret = acvp_ds_log_get(log_path, true, 0600, &log);
+	if (ret) {
+		printf("%s: opening log failed (%d)\n", test, ret);
+		return 1;
+	}
+
+	ret = acvp_ds_log_append(log, vsid, name, (const uint8_t *)data,
+				 (uint32_t)strlen(data), 0);
+	acvp_ds_log_put(log);
+	if (ret) {
+		printf("%s: appending %s failed (%d)\n", test, name, ret);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Read the record and compare it with the expected data or error */
+static int test_read(const char *test, uint32_t vsid, const char *name,
+		     const char *exp, int exp_ret)
+{
+	struct acvp_ds_log *log;
+	uint8_t *data = NULL;
+	uint32_t len;
+	int ret;
+
+	ret = acvp_ds_log_get(log_path, false, 0, &log);
+	if (ret) {
+		printf("%s: opening log failed (%d)\n", test, ret);
+		return 1;
+	}
+
+	ret = acvp_ds_log_read(log, vsid, name, &data, &len, NULL);
+	acvp_ds_log_put(log);
+
+	if (ret != exp_ret) {
+		printf("%s: reading %s returned %d, expected %d\n", test, name,
+		       ret, exp_ret);
+		return 1;
+	}
+	if (ret)
+		return 0;
+
+	ret = 0;
+	if (len != strlen(exp) || memcmp(data, exp, len) ||
+	    data[len] != '\0') {
+		printf("%s: unexpected data of %s\n", test, name);
+		ret = 1;
+	}
+
+	free(data);
+	return ret;
+}
+
+static off_t test_size(void)
+{
+	struct stat statbuf;
+
+	if (stat(log_path, &statbuf))
+		return -1;
+	return statbuf.st_size;
+}
+
+static int test_vsids(const char *test, const uint32_t *exp, uint32_t nr_exp)
+{
+	struct acvp_ds_log *log;
+	uint32_t *vsids = NULL, nr_vsids = 0;
+	int ret;
+
+	ret = acvp_ds_log_get(log_path, false, 0, &log);
+	if (ret) {
+		printf("%s: opening log failed (%d)\n", test, ret);
+		return 1;
+	}
+
+	ret = acvp_ds_log_vsids(log, &vsids, &nr_vsids);
+	acvp_ds_log_put(log);
+	if (ret) {
+		printf("%s: listing vsIDs failed (%d)\n", test, ret);
+		return 1;
+	}
+
+	if (nr_vsids != nr_exp ||
+	    (nr_exp && memcmp(vsids, exp, nr_exp * sizeof(*exp)))) {
+		printf("%s: unexpected vsIDs\n", test);
+		ret = 1;
+	}
+
+	free(vsids);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t vsids[] = { 1, 2 };
+	struct acvp_ds_log *log;
+	char path[FILENAME_MAX];
+	off_t size;
+	int fd, return_ret = 0;
+
+	if (argc != 2) {
+		printf("Usage: %s <test directory>\n", argv[0]);
+		return 1;
+	}
+
+	snprintf(log_path, sizeof(log_path), "%s/1%s", argv[1],
+		 ACVP_DS_LOG_SUFFIX);
+
+	/* A missing log is only created on request */
+	if (acvp_ds_log_get(log_path, false, 0, &log) != -ENOENT) {
+		printf("missing: log unexpectedly present\n");
+		return 1;
+	}
+
+	/* The latest record of an artifact is returned */
+	return_ret += test_append("append", ACVP_DS_LOG_TESTID, "meta", "m1");
+	return_ret += test_append("append", 1, "vector", "v1");
+	return_ret += test_append("append", 2, "vector", "v2");
+	return_ret += test_append("append", 1, "vector", "v1-new");
+	return_ret += test_append("append", 1, "empty", "");
+	return_ret += test_read("append", 1, "vector", "v1-new", 0);
+	return_ret += test_read("append", 2, "vector", "v2", 0);
+	return_ret += test_read("append", ACVP_DS_LOG_TESTID, "meta", "m1", 0);
+	return_ret += test_read("append", 1, "empty", "", 0);
+	return_ret += test_read("append", 3, "vector", NULL, -ENOENT);
+	return_ret += test_vsids("append", vsids, 2);
+
+	/* The index is rebuilt from the file after a rename */
+	snprintf(path, sizeof(path), "%s/2%s", argv[1], ACVP_DS_LOG_SUFFIX);
+	if (acvp_ds_log_rename(log_path, path)) {
+		printf("rename: renaming log failed\n");
+		return 1;
+	}
+	snprintf(log_path, sizeof(log_path), "%s", path);
+	return_ret += test_read("rename", 1, "vector", "v1-new", 0);
+	return_ret += test_read("rename", 2, "vector", "v2", 0);
+
+	/* A torn record at the end of the log is discarded */
+	size = test_size();
+	fd = open(log_path, O_WRONLY | O_APPEND);
+	if (fd < 0 || write(fd, "ACVPtorn", 8) != 8) {
+		printf("torn: cannot write torn record\n");
+		return 1;
+	}
+	close(fd);
+	return_ret += test_read("torn", 2, "vector", "v2", 0);
+	return_ret += test_append("torn", 3, "vector", "v3");
+	return_ret += test_read("torn", 3, "vector", "v3", 0);
+	if (test_size() <= size || test_size() >= size + 8 + 40 + 6 + 2) {
+		printf("torn: torn record not truncated\n");
+		return_ret++;
+	}
+
+	/* A corrupted record is detected */
+	return_ret += test_append("corrupt", 4, "vector", "v4");
+	size = test_size();
+	fd = open(log_path, O_WRONLY);
+	if (fd < 0 || pwrite(fd, "X", 1, size - 1) != 1) {
+		printf("corrupt: cannot corrupt record\n");
+		return 1;
+	}
+	close(fd);
+	return_ret += test_read("corrupt", 4, "vector", NULL, -EIO);
+	return_ret += test_read("corrupt", 3, "vector", "v3", 0);
+
+	/* Compaction drops the superseded records */
+	return_ret += test_append("compact", 4, "vector", "v4-new");
+	size = test_size();
+	if (acvp_ds_log_get(log_path, false, 0, &log) ||
+	    acvp_ds_log_compact(log)) {
+		printf("compact: compacting log failed\n");
+		return 1;
+	}
+	acvp_ds_log_put(log);
+	if (test_size() >= size) {
+		printf("compact: log not compacted\n");
+		return_ret++;
+	}
+	return_ret += test_read("compact", 1, "vector", "v1-new", 0);
+	return_ret += test_read("compact", 4, "vector", "v4-new", 0);
+	return_ret += test_read("compact", ACVP_DS_LOG_TESTID, "meta", "m1",
+				0);
+
+	return return_ret;
+}
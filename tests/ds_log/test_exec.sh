@@ -0,0 +1,35 @@
+#!/bin/bash
+
+. ../libtest.sh
+
+EXEC="./ds_log"
+NAME="$(basename $EXEC)"
+
+# Test 1
+#
+# Purpose: Append, read, recover, verify and compact the test session log
+# Expected result: The latest record of each artifact is returned, torn
+#		   records are discarded and corrupted records are detected
+test1()
+{
+	local tmpdir="$(mktemp -d)"
+	local result=$($EXEC $tmpdir)
+	local ret=$?
+
+	rm -rf $tmpdir
+
+	if [ $ret -ne 0 ]
+	then
+		echo_fail "Test $NAME 1: $result"
+	else
+		echo_pass "Test $NAME 1"
+	fi
+
+	gcov_analyze "../../lib/common/datastore_log_file.c" "test1"
+}
+
+init_common
+
+test1
+
+exit_test
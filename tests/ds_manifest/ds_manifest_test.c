@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "datastore_manifest.h"
+#include "logger.h"
+
+/* The manifest code only requires the logger */
+void _logger(const enum logger_verbosity severity,
+	     const enum logger_class class, const char *file, const char *func,
+	     const uint32_t line, const char *fmt, ...)
+{
+	(void)severity;
+	(void)class;
+	(void)file;
+	(void)func;
+	(void)line;
+	(void)fmt;
+}
+
+/* Scan callback reporting the vsID as flags */
+static unsigned int scanned;
+
+static int test_scan(void *ctx, uint32_t vsid,
+		     struct acvp_ds_manifest_entry *entry)
+{
+	uint32_t *flags = ctx;
+
+	scanned++;
+	entry->flags = *flags;
+	entry->verdict = vsid;
+
+	return 0;
+}
+
+static char vector_dir[FILENAME_MAX], manifest_dir[FILENAME_MAX];
+
+static int test_mkdir(uint32_t vsid)
+{
+	char path[FILENAME_MAX + 16];
+
+	snprintf(path, sizeof(path), "%s/%u", vector_dir, vsid);
+	return mkdir(path, 0700);
+}
+
+static int test_rmdir(uint32_t vsid)
+{
+	char path[FILENAME_MAX + 16];
+
+	snprintf(path, sizeof(path), "%s/%u", vector_dir, vsid);
+	return rmdir(path);
+}
+
+/* Load the manifest and compare it with the expected vsIDs */
+static int test_load(const char *test, const uint32_t *vsids,
+		     uint32_t nr_vsids, unsigned int exp_scanned,
+		     uint32_t flags)
+{
+	struct acvp_ds_manifest manifest;
+	uint32_t i, scan_flags = flags;
+	int ret;
+
+	scanned = 0;
+	ret = acvp_ds_manifest_load(manifest_dir, vector_dir, &manifest,
+				    test_scan, &scan_flags);
+	if (ret) {
+		printf("%s: loading manifest failed (%d)\n", test, ret);
+		return 1;
+	}
+
+	if (scanned != exp_scanned) {
+		printf("%s: %u vsIDs scanned, expected %u\n", test, scanned,
+		       exp_scanned);
+		ret = 1;
+	}
+
+	if (manifest.nr_entries != nr_vsids) {
+		printf("%s: %u entries, expected %u\n", test,
+		       manifest.nr_entries, nr_vsids);
+		ret = 1;
+		goto out;
+	}
+
+	for (i = 0; i < nr_vsids; i++) {
+		struct acvp_ds_manifest_entry *entry =
+			acvp_ds_manifest_find(&manifest, vsids[i]);
+
+		if (!entry || entry->verdict != vsids[i]) {
+			printf("%s: vsID %u missing\n", test, vsids[i]);
+			ret = 1;
+		}
+	}
+
+out:
+	acvp_ds_manifest_release(&manifest);
+	return ret;
+}
+
+static int test_flags(const char *test, uint32_t vsid, uint32_t flags)
+{
+	struct acvp_ds_manifest manifest;
+	struct acvp_ds_manifest_entry *entry;
+	uint32_t scan_flags = 0;
+	int ret;
+
+	ret = acvp_ds_manifest_load(manifest_dir, vector_dir, &manifest,
+				    test_scan, &scan_flags);
+	if (ret) {
+		printf("%s: loading manifest failed (%d)\n", test, ret);
+		return 1;
+	}
+
+	entry = acvp_ds_manifest_find(&manifest, vsid);
+	if (!entry || entry->flags != flags) {
+		printf("%s: unexpected flags of vsID %u\n", test, vsid);
+		ret = 1;
+	}
+
+	acvp_ds_manifest_release(&manifest);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t set1[] = { 1, 2, 3 };
+	static const uint32_t set2[] = { 1, 3, 4 };
+	char path[FILENAME_MAX + 32];
+	uint32_t flags = ACVP_DS_MANIFEST_VECTOR;
+	FILE *file;
+	int return_ret = 0;
+
+	if (argc != 2) {
+		printf("Usage: %s <test directory>\n", argv[0]);
+		return 1;
+	}
+
+	snprintf(vector_dir, sizeof(vector_dir), "%s/vectors", argv[1]);
+	snprintf(manifest_dir, sizeof(manifest_dir), "%s/secure", argv[1]);
+	if (mkdir(vector_dir, 0700) || mkdir(manifest_dir, 0700) ||
+	    test_mkdir(1) || test_mkdir(2) || test_mkdir(3)) {
+		printf("Cannot create test directories\n");
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/%s", vector_dir, "nonumber");
+	mkdir(path, 0700);
+
+	/* The manifest is built from the vsID directories */
+	return_ret += test_load("build", set1, 3, 3, flags);
+
+	/* The stored manifest is used without scanning the vsIDs */
+	return_ret += test_load("reuse", set1, 3, 0, flags);
+
+	/* Added and removed vsID directories are detected */
+	if (test_mkdir(4) || test_rmdir(2)) {
+		printf("Cannot modify test directories\n");
+		return 1;
+	}
+	return_ret += test_load("reconcile", set2, 3, 1, flags);
+
+	/* The update of a vsID is recorded */
+	flags = ACVP_DS_MANIFEST_VECTOR | ACVP_DS_MANIFEST_PROCESSED;
+	if (acvp_ds_manifest_update(manifest_dir, vector_dir, 3, test_scan,
+				    &flags)) {
+		printf("update: updating manifest failed\n");
+		return_ret++;
+	}
+	return_ret += test_flags("update", 3, flags);
+	return_ret += test_flags("update", 4, ACVP_DS_MANIFEST_VECTOR);
+
+	/* An invalid manifest is rebuilt */
+	snprintf(path, sizeof(path), "%s/%s", manifest_dir, ACVP_DS_MANIFEST);
+	file = fopen(path, "r+");
+	if (!file) {
+		printf("Cannot open manifest\n");
+		return 1;
+	}
+	fwrite("garbage", 1, 7, file);
+	fclose(file);
+	return_ret += test_load("rebuild", set2, 3, 3, 0);
+	return_ret += test_flags("rebuild", 3, 0);
+
+	return return_ret;
+}
@@ -0,0 +1,35 @@
+#!/bin/bash
+
+. ../libtest.sh
+
+EXEC="./ds_manifest"
+NAME="$(basename $EXEC)"
+
+# Test 1
+#
+# Purpose: Build, reuse, reconcile, update and rebuild the vsID manifest
+# Expected result: The manifest matches the vsID directories and only new
+#		   vsIDs are scanned
+test1()
+{
+	local tmpdir="$(mktemp -d)"
+	local result=$($EXEC $tmpdir)
+	local ret=$?
+
+	rm -rf $tmpdir
+
+	if [ $ret -ne 0 ]
+	then
+		echo_fail "Test $NAME 1: $result"
+	else
+		echo_pass "Test $NAME 1"
+	fi
+
+	gcov_analyze "../../lib/common/datastore_manifest.c" "test1"
+}
+
+init_common
+
+test1
+
+exit_test
@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Cross-check all SHA-2 and SHA-3 implementations supported by the CPU
+ * against the C implementation and, with option -b, measure their throughput.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash/sha256.h"
+#include "hash/sha3.h"
+#include "hash/sha512.h"
+
+#define MAX_MSGS	16
+#define MAX_MSG_LEN	4096
+#define TRIALS		500
+
+#define BENCH_MSG_LEN	(8 * 1024 * 1024)
+#define BENCH_MSGS	8
+#define BENCH_ROUNDS	4
+
+struct algo {
+	const char *name;
+	const struct hash **hash;
+	int (*set_impl)(enum hash_impl impl);
+	const char *(*get_impl)(void);
+	bool bench;
+};
+
+static const struct algo algos[] = {
+	{ "SHA-256", &sha256, sha256_set_impl, sha256_get_impl, true },
+	{ "SHA-512", &sha512, sha512_set_impl, sha512_get_impl, true },
+	{ "SHA3-224", &sha3_224, sha3_set_impl, sha3_get_impl, false },
+	{ "SHA3-256", &sha3_256, sha3_set_impl, sha3_get_impl, true },
+	{ "SHA3-384", &sha3_384, sha3_set_impl, sha3_get_impl, false },
+	{ "SHA3-512", &sha3_512, sha3_set_impl, sha3_get_impl, true },
+};
+
+static const enum hash_impl impls[] = {
+	HASH_IMPL_C,
+	HASH_IMPL_SHANI,
+	HASH_IMPL_AVX2,
+	HASH_IMPL_ARMV8_CE,
+	HASH_IMPL_AVX512,
+};
+
+static uint64_t ctx_buf[MAX_MSGS][SHA_MAX_CTX_SIZE / sizeof(uint64_t)];
+
+static uint64_t rnd_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return rnd_state;
+}
+
+static void rnd_fill(uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (uint8_t)rnd();
+}
+
+static void hash_one(const struct hash *hash, const uint8_t *in, size_t inlen,
+		     uint8_t *digest)
+{
+	struct sha_ctx *ctx = (struct sha_ctx *)ctx_buf[0];
+
+	hash->init(ctx);
+	hash->update(ctx, in, inlen);
+	hash->final(ctx, digest);
+}
+
+/*
+ * Hash random messages with random partial prefixes using the single-buffer
+ * and the multi-buffer update and compare the result with the reference
+ * digests.
+ */
+static int check_hash(const struct hash *hash,
+		      uint8_t msg[MAX_MSGS][MAX_MSG_LEN],
+		      const size_t len[], const size_t prefix[],
+		      uint8_t ref[MAX_MSGS][64], unsigned int num,
+		      const char *info)
+{
+	struct sha_ctx *ctx[MAX_MSGS];
+	const uint8_t *in[MAX_MSGS];
+	size_t inlen[MAX_MSGS];
+	uint8_t act[64];
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < num; i++) {
+		struct sha_ctx *one = (struct sha_ctx *)ctx_buf[0];
+
+		hash->init(one);
+		hash->update(one, msg[i], prefix[i]);
+		hash->update(one, msg[i] + prefix[i], len[i] - prefix[i]);
+		hash->final(one, act);
+		if (memcmp(act, ref[i], hash->digestsize)) {
+			printf("%s single-buffer mismatch (len %zu, prefix %zu)\n",
+			       info, len[i], prefix[i]);
+			ret++;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		ctx[i] = (struct sha_ctx *)ctx_buf[i];
+		hash->init(ctx[i]);
+		hash->update(ctx[i], msg[i], prefix[i]);
+		in[i] = msg[i] + prefix[i];
+		inlen[i] = len[i] - prefix[i];
+	}
+	hash->update_mb(ctx, in, inlen, num);
+
+	for (i = 0; i < num; i++) {
+		hash->final(ctx[i], act);
+		if (memcmp(act, ref[i], hash->digestsize)) {
+			printf("%s multi-buffer mismatch (msg %u of %u, len %zu, prefix %zu)\n",
+			       info, i, num, len[i], prefix[i]);
+			ret++;
+		}
+	}
+
+	return ret;
+}
+
+static int check_algo(const struct algo *algo)
+{
+	static uint8_t msg[MAX_MSGS][MAX_MSG_LEN];
+	uint8_t ref[MAX_MSGS][64];
+	size_t len[MAX_MSGS], prefix[MAX_MSGS];
+	unsigned int trial, i, j, num;
+	int ret = 0;
+
+	for (trial = 0; trial < TRIALS; trial++) {
+		num = 1 + (unsigned int)(rnd() % MAX_MSGS);
+
+		for (i = 0; i < num; i++) {
+			/* Mostly equally-sized messages as for file hashing */
+			if (i && rnd() % 2)
+				len[i] = len[0];
+			else
+				len[i] = (size_t)(rnd() % MAX_MSG_LEN);
+			prefix[i] = len[i] ? (size_t)(rnd() % (len[i] + 1)) : 0;
+			rnd_fill(msg[i], len[i]);
+		}
+
+		algo->set_impl(HASH_IMPL_C);
+		for (i = 0; i < num; i++)
+			hash_one(*algo->hash, msg[i], len[i], ref[i]);
+
+		for (j = 0; j < sizeof(impls) / sizeof(*impls); j++) {
+			char info[64];
+
+			if (algo->set_impl(impls[j]))
+				continue;
+
+			snprintf(info, sizeof(info), "%s %s", algo->name,
+				 algo->get_impl());
+			ret += check_hash(*algo->hash, msg, len, prefix, ref,
+					  num, info);
+		}
+	}
+
+	algo->set_impl(HASH_IMPL_AUTO);
+
+	return ret;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void bench_algo(const struct algo *algo, uint8_t *buf)
+{
+	const struct hash *hash = *algo->hash;
+	struct sha_ctx *ctx[BENCH_MSGS];
+	const uint8_t *in[BENCH_MSGS];
+	size_t inlen[BENCH_MSGS];
+	uint8_t digest[64];
+	unsigned int i, j, round;
+
+	for (i = 0; i < BENCH_MSGS; i++) {
+		ctx[i] = (struct sha_ctx *)ctx_buf[i];
+		in[i] = buf + (size_t)i * BENCH_MSG_LEN;
+		inlen[i] = BENCH_MSG_LEN;
+	}
+
+	for (j = 0; j < sizeof(impls) / sizeof(*impls); j++) {
+		double start, single, multi;
+
+		if (algo->set_impl(impls[j]))
+			continue;
+
+		start = now();
+		for (round = 0; round < BENCH_ROUNDS; round++) {
+			for (i = 0; i < BENCH_MSGS; i++)
+				hash_one(hash, in[i], inlen[i], digest);
+		}
+		single = now() - start;
+
+		start = now();
+		for (round = 0; round < BENCH_ROUNDS; round++) {
+			for (i = 0; i < BENCH_MSGS; i++)
+				hash->init(ctx[i]);
+			hash->update_mb(ctx, in, inlen, BENCH_MSGS);
+			for (i = 0; i < BENCH_MSGS; i++)
+				hash->final(ctx[i], digest);
+		}
+		multi = now() - start;
+
+		printf("%s %-20s single-buffer %6.3f GB/s, multi-buffer (%u messages) %6.3f GB/s\n",
+		       algo->name, algo->get_impl(),
+		       (double)BENCH_ROUNDS * BENCH_MSGS * BENCH_MSG_LEN /
+			       single / 1e9,
+		       BENCH_MSGS,
+		       (double)BENCH_ROUNDS * BENCH_MSGS * BENCH_MSG_LEN /
+			       multi / 1e9);
+	}
+
+	algo->set_impl(HASH_IMPL_AUTO);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < sizeof(algos) / sizeof(*algos); i++)
+		ret += check_algo(&algos[i]);
+
+	if (ret) {
+		printf("Hash implementation cross-check failed with %d errors\n",
+		       ret);
+		return 1;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		uint8_t *buf = malloc((size_t)BENCH_MSGS * BENCH_MSG_LEN);
+
+		if (!buf)
+			return 1;
+		rnd_fill(buf, (size_t)BENCH_MSGS * BENCH_MSG_LEN);
+
+		for (i = 0; i < sizeof(algos) / sizeof(*algos); i++) {
+			if (algos[i].bench)
+				bench_algo(&algos[i], buf);
+		}
+
+		free(buf);
+	}
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+. ../libtest.sh
+
+EXEC="./hash_bench"
+NAME="$(basename $EXEC)"
+
+# Test 1
+#
+# Purpose: Cross-check all SHA-2 and SHA-3 implementations supported by the
+#	   CPU
+# Expected result: All implementations and the multi-buffer update match
+#		   the C implementation
+test1()
+{
+	local result=$($EXEC)
+
+	if [ $? -ne 0 ]
+	then
+		echo_fail "Test $NAME 1: $result"
+	else
+		echo_pass "Test $NAME 1"
+	fi
+
+	gcov_analyze "../../lib/hash/sha256.c" "test1"
+	gcov_analyze "../../lib/hash/sha512.c" "test1"
+	gcov_analyze "../../lib/hash/sha3.c" "test1"
+}
+
+init_common
+
+test1
+
+exit_test
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Benchmark of the network backend: concurrent threads issue HTTP GET
+ * requests to one server, either with HTTP/1.1 or with HTTP/2 multiplexing.
+ * With verbose logging, the connection statistics of the backend are logged
+ * when the application terminates. As the verbose logging slows down the
+ * transfers, it should not be used when measuring the performance.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "acvpproxy.h"
+#include "internal.h"
+#include "logger.h"
+#include "ret_checkers.h"
+
+#define HTTP2_BENCH_MAX_THREADS 256
+
+struct http2_bench_thread {
+	pthread_t thread;
+	const struct acvp_na_ex *netinfo;
+	unsigned int requests;
+	uint64_t latency_ns;
+	int ret;
+};
+
+static uint64_t http2_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void *http2_bench_worker(void *arg)
+{
+	struct http2_bench_thread *t = arg;
+	unsigned int i;
+
+	for (i = 0; i < t->requests; i++) {
+		ACVP_BUFFER_INIT(response);
+		uint64_t start = http2_bench_now();
+		int ret = na->acvp_http_get(t->netinfo, &response);
+
+		t->latency_ns += http2_bench_now() - start;
+		acvp_free_buf(&response);
+		if (ret) {
+			t->ret = ret;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: http2_bench -s <server> -p <port> -a <CA file> -c <client cert>\n"
+		"\t\t   -k <client key> -u <path> [-t <threads>] [-n <requests>]\n"
+		"\t\t   [-v] [-2]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct http2_bench_thread threads[HTTP2_BENCH_MAX_THREADS];
+	struct acvp_na_ex netinfo;
+	const struct acvp_net_ctx *net;
+	const char *server = NULL, *ca = NULL, *cert = NULL, *key = NULL,
+		   *path = NULL;
+	char url[ACVP_NET_URL_MAXLEN];
+	unsigned int port = 443, nthreads = 16, requests = 64, i;
+	uint64_t start, duration, latency = 0;
+	bool http2 = false, verbose = false;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "s:p:a:c:k:u:t:n:v2")) != -1) {
+		switch (c) {
+		case 's':
+			server = optarg;
+			break;
+		case 'p':
+			port = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+		case 'a':
+			ca = optarg;
+			break;
+		case 'c':
+			cert = optarg;
+			break;
+		case 'k':
+			key = optarg;
+			break;
+		case 'u':
+			path = optarg;
+			break;
+		case 't':
+			nthreads = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			requests = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case '2':
+			http2 = true;
+			break;
+		default:
+			usage();
+			return EINVAL;
+		}
+	}
+
+	if (!server || !cert || !path || !nthreads ||
+	    nthreads > HTTP2_BENCH_MAX_THREADS) {
+		usage();
+		return EINVAL;
+	}
+
+	/* The connection statistics are logged with verbose level */
+	if (verbose)
+		logger_set_verbosity(LOGGER_VERBOSE);
+
+	CKINT(acvp_init(NULL, 0, 0, false, NULL));
+	CKINT(acvp_set_net(server, port, ca, NULL, cert, NULL, key, NULL));
+	CKINT(acvp_set_net_http2(http2));
+	CKINT(acvp_get_net(&net));
+
+	snprintf(url, sizeof(url), "https://%s:%u/%s", server, port, path);
+	netinfo.net = net;
+	netinfo.url = url;
+	netinfo.server_auth = NULL;
+	netinfo.sink = NULL;
+	netinfo.retry_after = NULL;
+
+	memset(threads, 0, sizeof(threads));
+	start = http2_bench_now();
+	for (i = 0; i < nthreads; i++) {
+		threads[i].netinfo = &netinfo;
+		threads[i].requests = requests / nthreads +
+				      ((i < requests % nthreads) ? 1 : 0);
+		if (pthread_create(&threads[i].thread, NULL,
+				   http2_bench_worker, &threads[i])) {
+			ret = -EFAULT;
+			nthreads = i;
+			break;
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		latency += threads[i].latency_ns;
+		if (threads[i].ret && !ret)
+			ret = threads[i].ret;
+	}
+	duration = http2_bench_now() - start;
+
+	if (ret)
+		goto out;
+
+	printf("%s: %u requests with %u threads in %llu ms (%llu requests/s), average latency %llu us\n",
+	       http2 ? "HTTP/2" : "HTTP/1.1", requests, nthreads,
+	       (unsigned long long)(duration / 1000000),
+	       (unsigned long long)(duration ?
+			(uint64_t)requests * 1000000000ULL / duration : 0),
+	       (unsigned long long)(requests ?
+			latency / requests / 1000 : 0));
+
+out:
+	acvp_release();
+	return -ret;
+}
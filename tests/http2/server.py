@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+#
+# License: see LICENSE file in root directory
+#
+# HTTP/1.1 stand-in for the ACVP server serving the files of the current
+# directory. Each request is answered after the given delay to model the
+# server processing time.
+#
+# Usage: server.py <port> <delay in ms> [<TLS certificate> <TLS key>]
+#
+
+import http.server
+import socketserver
+import ssl
+import sys
+import time
+
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        time.sleep(float(sys.argv[2]) / 1000)
+        return super().do_GET()
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+    request_queue_size = 256
+
+
+server = Server(("127.0.0.1", int(sys.argv[1])), Handler)
+if len(sys.argv) > 4:
+    # No ALPN - the client must fall back to HTTP/1.1
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(sys.argv[3], sys.argv[4])
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+server.serve_forever()
@@ -0,0 +1,206 @@
+#!/bin/bash
+#
+# Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+#
+# License: see LICENSE file in root directory
+#
+# THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+# WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+# OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+# WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+# OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+# BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+# USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#
+# The network backend is exercised against local stand-in servers:
+#
+#	* nghttpx terminating TLS and offering HTTP/2 and HTTP/1.1 with ALPN
+#	  in front of server.py
+#
+#	* server.py terminating TLS itself and only offering HTTP/1.1
+#
+
+. ../libtest.sh
+
+EXEC="./http2_bench"
+NAME="$(basename $EXEC)"
+
+TMPDIR="$(mktemp -d)"
+BACKEND_PORT=18080
+H2_PORT=18443
+H1_PORT=18444
+THREADS=32
+REQUESTS=2000
+
+# Delay of the server response in milliseconds
+DELAY=5
+
+PIDS=""
+
+cleanup()
+{
+	local pid
+
+	for pid in $PIDS
+	do
+		kill $pid 2>/dev/null
+	done
+	rm -rf $TMPDIR
+	make -s clean
+}
+
+init()
+{
+	trap "cleanup; exit" 0 1 2 3 15
+
+	make clean
+	make -s
+
+	openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+		-addext "subjectAltName=DNS:localhost" \
+		-keyout $TMPDIR/key.pem -out $TMPDIR/cert.pem 2>/dev/null
+	mkdir $TMPDIR/htdocs
+	head -c 4096 /dev/urandom | base64 > $TMPDIR/htdocs/testvectors.json
+
+	local server="$(pwd)/server.py"
+
+	(cd $TMPDIR/htdocs && exec python3 $server $BACKEND_PORT $DELAY) &
+	PIDS="$PIDS $!"
+	(cd $TMPDIR/htdocs && exec python3 $server $H1_PORT $DELAY \
+		$TMPDIR/cert.pem $TMPDIR/key.pem) &
+	PIDS="$PIDS $!"
+	nghttpx -f"127.0.0.1,$H2_PORT" -b"127.0.0.1,$BACKEND_PORT" \
+		$TMPDIR/key.pem $TMPDIR/cert.pem >/dev/null 2>&1 &
+	PIDS="$PIDS $!"
+
+	sleep 2
+}
+
+bench()
+{
+	local port=$1
+
+	shift
+	$EXEC -s localhost -p $port -a $TMPDIR/cert.pem -c $TMPDIR/cert.pem \
+		-k $TMPDIR/key.pem -u testvectors.json -t $THREADS $@
+}
+
+# Check the connection statistics logged by the backend
+stats()
+{
+	local log=$1
+	local http2=$2
+	local connections=$3
+
+	local line=$(grep -a "HTTP transfers:" $log)
+	local h2=$(echo "$line" | sed 's/.*(HTTP\/2: \([0-9]*\)).*/\1/')
+	local conns=$(echo "$line" | sed 's/.*new connections: \([0-9]*\).*/\1/')
+
+	if [ -z "$line" ]
+	then
+		echo "no statistics"
+		return 1
+	fi
+
+	if [ "$h2" -ne "$http2" ]
+	then
+		echo "$h2 HTTP/2 transfers, expected $http2"
+		return 1
+	fi
+
+	if [ "$conns" -gt "$connections" ]
+	then
+		echo "$conns connections, expected at most $connections"
+		return 1
+	fi
+
+	return 0
+}
+
+# Test 1
+#
+# Purpose: HTTP/2 is negotiated and the requests of all threads are
+#	   multiplexed over few connections
+# Expected result: All transfers use HTTP/2 with at most 4 connections
+test1()
+{
+	local result=$(bench $H2_PORT -n 256 -2 -v 2>$TMPDIR/test1.log)
+
+	if [ $? -ne 0 ]
+	then
+		echo_fail "Test $NAME 1: transfers failed"
+		return
+	fi
+
+	result=$(stats $TMPDIR/test1.log 256 4)
+	if [ $? -ne 0 ]
+	then
+		echo_fail "Test $NAME 1: $result"
+	else
+		echo_pass "Test $NAME 1"
+	fi
+}
+
+# Test 2
+#
+# Purpose: Server does not support HTTP/2
+# Expected result: All transfers fall back to HTTP/1.1
+test2()
+{
+	local result=$(bench $H1_PORT -n 256 -2 -v 2>$TMPDIR/test2.log)
+
+	if [ $? -ne 0 ]
+	then
+		echo_fail "Test $NAME 2: transfers failed"
+		return
+	fi
+
+	result=$(stats $TMPDIR/test2.log 0 256)
+	if [ $? -ne 0 ]
+	then
+		echo_fail "Test $NAME 2: $result"
+	else
+		echo_pass "Test $NAME 2"
+	fi
+}
+
+# Benchmark: HTTP/1.1 compared to HTTP/2 with the same server
+benchmark()
+{
+	local result
+
+	result=$(bench $H2_PORT -n $REQUESTS 2>/dev/null)
+	if [ $? -ne 0 ]
+	then
+		echo_fail "Benchmark HTTP/1.1 failed"
+		return
+	fi
+	echo_info "$result"
+
+	result=$(bench $H2_PORT -n $REQUESTS -2 2>/dev/null)
+	if [ $? -ne 0 ]
+	then
+		echo_fail "Benchmark HTTP/2 failed"
+		return
+	fi
+	echo_info "$result"
+}
+
+if [ ! -x "$(type -p nghttpx)" ] || [ ! -x "$(type -p python3)" ]
+then
+	echo_deact "Test $NAME: nghttpx and python3 required"
+	exit_test
+fi
+
+init
+
+test1
+test2
+benchmark
+
+exit_test
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "json_stream.h"
+
+struct test_vector {
+	const char *in;
+	bool strip_version;
+	const char *inject;
+	const char *capture_key;
+	int ret;
+	const char *out;
+	const char *capture;
+};
+
+static const struct test_vector vectors[] = {
+	/* Pass-through */
+	{ "[{\"acvVersion\": \"1.0\"}, {\"vsId\": 1}]", false, NULL, NULL, 0,
+	  "[{\"acvVersion\": \"1.0\"}, {\"vsId\": 1}]", NULL },
+	/* Strip the version */
+	{ "[ {\"acvVersion\": \"1.0\"},\n {\"vsId\": 1, \"a\": [1, {\"b\": \"}\"}]} ]",
+	  true, NULL, NULL, 0,
+	  "{\"vsId\": 1, \"a\": [1, {\"b\": \"}\"}]}", NULL },
+	/* Strip the version located after the data */
+	{ "[{\"vsId\": 2}, {\"acvVersion\": \"1.0\"}]", true, NULL, NULL, 0,
+	  "{\"vsId\": 2}", NULL },
+	/* Inject a key */
+	{ "[{\"acvVersion\": \"1.0\"}, {\"vsId\": 1}]", false,
+	  "\"showExpected\": true", NULL, 0,
+	  "[{\"acvVersion\": \"1.0\"}, {\"vsId\": 1, \"showExpected\": true}]",
+	  NULL },
+	/* Replace the value of a key that is already present */
+	{ "[{\"acvVersion\": \"1.0\"}, {\"vsId\": 1, \"showExpected\": false}]",
+	  true, "\"showExpected\": true", NULL, 0,
+	  "{\"vsId\": 1, \"showExpected\": true}", NULL },
+	/* Replace a present value followed by other members */
+	{ "[{\"acvVersion\": \"1.0\"}, {\"showExpected\" : {\"a\": [1]} ,\"vsId\": 1}]",
+	  false, "\"showExpected\": true", NULL, 0,
+	  "[{\"acvVersion\": \"1.0\"}, {\"showExpected\" : true,\"vsId\": 1}]",
+	  NULL },
+	/* Keys of nested objects do not prevent the injection */
+	{ "[{\"acvVersion\": \"1.0\"}, {\"a\": {\"showExpected\": 1}}]",
+	  true, "\"showExpected\": true", NULL, 0,
+	  "{\"a\": {\"showExpected\": 1}, \"showExpected\": true}", NULL },
+	/* Inject a key into an empty object */
+	{ "[{\"acvVersion\": \"1.0\"}, {}]", true, "\"showExpected\": true",
+	  NULL, 0, "{\"showExpected\": true}", NULL },
+	/* Capture a retry statement */
+	{ "[{\"acvVersion\": \"1.0\"}, {\"retry\" : 30 }]", false, NULL,
+	  "retry", 0, "[{\"acvVersion\": \"1.0\"}, {\"retry\" : 30 }]", "30" },
+	/* Keys of nested objects are not captured */
+	{ "[{\"acvVersion\": \"1.0\"}, {\"x\": {\"retry\": 5}, \"y\": \"a\\\"b\"}]",
+	  true, NULL, "retry", 0,
+	  "{\"x\": {\"retry\": 5}, \"y\": \"a\\\"b\"}", NULL },
+	/* Capture a string value with escaped quote */
+	{ "[{\"acvVersion\": \"1.0\"}, {\"y\": \"a\\\"b\", \"z\": 1}]", true,
+	  NULL, "y", 0, "{\"y\": \"a\\\"b\", \"z\": 1}", "\"a\\\"b\"" },
+	/* Malformed nesting */
+	{ "[{\"acvVersion\": \"1.0\"}, {\"vsId\": 1]]", false, NULL, NULL,
+	  -EINVAL, NULL, NULL },
+	/* Truncated message */
+	{ "[{\"acvVersion\": \"1.0\"}, {\"vsId\": 1}", false, NULL, NULL,
+	  -EINVAL, NULL, NULL },
+	/* No data object */
+	{ "[{\"acvVersion\": \"1.0\"}]", true, NULL, NULL, -EINVAL, NULL,
+	  NULL },
+	/* Not an ACVP array */
+	{ "{\"vsId\": 1}", false, NULL, NULL, -EINVAL, NULL, NULL },
+};
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+struct test_out {
+	char buf[1024];
+	uint32_t len;
+};
+
+static int test_out_write(void *ctx, const uint8_t *data, uint32_t len)
+{
+	struct test_out *out = ctx;
+
+	if (out->len + len >= sizeof(out->buf))
+		return -EOVERFLOW;
+
+	memcpy(out->buf + out->len, data, len);
+	out->len += len;
+	out->buf[out->len] = '\0';
+
+	return 0;
+}
+
+/* Process the message in chunks of the given size */
+static int test_one(const struct test_vector *vector, unsigned int chunk)
+{
+	struct test_out out = { .len = 0 };
+	struct acvp_buf_sink sink = { .write = test_out_write, .ctx = &out };
+	struct json_stream js;
+	const uint8_t *in = (const uint8_t *)vector->in;
+	uint32_t len = (uint32_t)strlen(vector->in), todo;
+	int ret = 0;
+
+	json_stream_init(&js);
+	js.version_keyword = "acvVersion";
+	js.strip_version = vector->strip_version;
+	js.inject = vector->inject;
+	js.capture_key = vector->capture_key;
+	js.out = &sink;
+
+	while (len && !ret) {
+		todo = (len < chunk) ? len : chunk;
+		ret = json_stream_update(&js, in, todo);
+		in += todo;
+		len -= todo;
+	}
+	if (!ret)
+		ret = json_stream_final(&js);
+
+	if (ret != vector->ret) {
+		printf("chunk %u: unexpected return code %d for %s\n", chunk,
+		       ret, vector->in);
+		return 1;
+	}
+	if (ret)
+		return 0;
+
+	if (strcmp(out.buf, vector->out)) {
+		printf("chunk %u: unexpected output %s for %s\n", chunk,
+		       out.buf, vector->in);
+		return 1;
+	}
+
+	if (vector->capture) {
+		if (!js.captured || strcmp(js.capture, vector->capture)) {
+			printf("chunk %u: capture mismatch for %s\n", chunk,
+			       vector->in);
+			return 1;
+		}
+	} else if (js.captured) {
+		printf("chunk %u: unexpected capture %s for %s\n", chunk,
+		       js.capture, vector->in);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i, chunk;
+	int return_ret = 0;
+
+	(void)argc;
+	(void)argv;
+
+	for (i = 0; i < ARRAY_SIZE(vectors); i++) {
+		for (chunk = 1; chunk <= strlen(vectors[i].in); chunk++)
+			return_ret += test_one(&vectors[i], chunk);
+	}
+
+	return return_ret;
+}
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+. ../libtest.sh
+
+EXEC="./json_stream"
+NAME="$(basename $EXEC)"
+
+# Test 1
+#
+# Purpose: Process ACVP messages in chunks of all sizes
+# Expected result: Output and captured values match the expected data
+test1()
+{
+	local result=$($EXEC)
+
+	if [ $? -ne 0 ]
+	then
+		echo_fail "Test $NAME 1: $result"
+	else
+		echo_pass "Test $NAME 1"
+	fi
+
+	gcov_analyze "../../lib/common/json_stream.c" "test1"
+}
+
+init_common
+
+test1
+
+exit_test